@@ -10,6 +10,7 @@
 
 #include "agios_config.h"
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "common_functions.h"
 #include "MLF.h"
 #include "mylist.h"
@@ -17,83 +18,86 @@
 #include "req_hashtable.h"
 #include "waiting_common.h"
 
-static int MLF_current_hash=0;  /**< position of the hashtable we are accessing. Used so we do a round robin on the hashtable even across different calls to MLF(). */
-static int *MLF_lock_tries=NULL; /**< counter of how many times we tried without success to acquire the lock of a hashtable line. */
-
 /**
  * initalizes the scheduler.
+ * @param ctx the AGIOS instance.
  * @return true or false for success.
  */
-bool MLF_init(void)
+bool MLF_init(struct agios_ctx_t *ctx)
 {
-	MLF_lock_tries = malloc(sizeof(int)*(AGIOS_HASH_ENTRIES+1));
-	if (!MLF_lock_tries) {
+	ctx->MLF_lock_tries = malloc(sizeof(int32_t)*ctx->hashtable_size);
+	if (!ctx->MLF_lock_tries) {
 		agios_print("AGIOS: cannot allocate memory for MLF structures\n");
 		return false;
 	}
-	for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) MLF_lock_tries[i]=0;
+	for (int32_t i=0; i< ctx->hashtable_size; i++) ctx->MLF_lock_tries[i]=0;
 	return true;
 }
 /**
  * called to stop MLF.
+ * @param ctx the AGIOS instance.
  */
-void MLF_exit()
+void MLF_exit(struct agios_ctx_t *ctx)
 {
-	if (MLF_lock_tries) free(MLF_lock_tries);
+	if (ctx->MLF_lock_tries) free(ctx->MLF_lock_tries);
+	ctx->MLF_lock_tries = NULL;
 }
 /**
  * Selects a request to be processed from a queue (and updates the schedule factor for all requests in this queue.
+ * @param ctx the AGIOS instance.
  * @param reqlist the queue of requests.
  * @return a pointer to the request to be processed.
  */
-struct request_t *applyMLFonlist(struct queue_t *reqlist)
+struct request_t *applyMLFonlist(struct agios_ctx_t *ctx, struct queue_t *reqlist)
 {
-	bool found=false;
-	struct request_t *req; /**< used to iterate over all requests in the queue. */
+	struct request_t *req; /**< used to iterate over the requests in the queue. */
 	struct request_t *selectedreq=NULL; /**< will receive the selected request. */
 
-	agios_list_for_each_entry (req, &(reqlist->list), related) { //go through all requests in this queue
-		/*first, increment the sched_factor. This must be done to ALL requests, every time*/
-		increment_sched_factor(req);
-		if (!found) { //we select the first request that can be selected
-			/*see if the request's quantum is large enough to allow its execution*/
-			if ((req->sched_factor*config_mlf_quantum) >= req->len) {
-				selectedreq = req;
-				found = true; /*we select the first possible request because we want to process them by offset order, and the list is ordered by offset. However, we do not stop the for loop here because we still have to increment the sched_factor of all requests (which is equivalent to increase their quanta)*/
-			}
-		} //end if not found
+	/*first, increment the sched_factor. This must be done to ALL requests, every time, but it is only counted in the queue (@see get_sched_factor)*/
+	increment_sched_factors(reqlist);
+	agios_list_for_each_entry (req, &(reqlist->list), related) { //go through the requests in this queue
+		/*see if the request's quantum is large enough to allow its execution*/
+		if ((((int64_t) get_sched_factor(reqlist, req))*ctx->config.mlf_quantum) >= req->len) {
+			selectedreq = req;
+			break; /*we select the first possible request because we want to process them by offset order, and the list is ordered by offset*/
+		}
 	}
 	return selectedreq;
 }
 /**
  * selects a request to be processed for a file.
+ * @param ctx the AGIOS instance.
  * @param req_file the file to be accessed.
  * @return a pointer to the selected request.
  */
-struct request_t *MLF_select_request(struct file_t *req_file)
+struct request_t *MLF_select_request(struct agios_ctx_t *ctx, struct file_t *req_file)
 {
 	struct request_t *req=NULL; /**< will receive the request to be processed. */
 
 	if (!agios_list_empty(&req_file->read_queue.list)) { //if we have read requests
-		req = applyMLFonlist(&(req_file->read_queue));
+		req = applyMLFonlist(ctx, &(req_file->read_queue));
 	}
 	if ((!req) && (!agios_list_empty(&req_file->write_queue.list))) { //if we have not selected a read request already, and we have write requests
-		req = applyMLFonlist(&(req_file->write_queue));
+		req = applyMLFonlist(ctx, &(req_file->write_queue));
 	}
-	if (req && (!check_selection(req, req_file))) return NULL; //before proceeding with this request, check if we should wait
+	if (req && (!check_selection(ctx, req, req_file))) return NULL; //before proceeding with this request, check if we should wait
 	return req;
 }
 /**
  * main function for the MLF scheduler. Selects requests, processes and then cleans up them.
+ * @param ctx the AGIOS instance.
  * @return a waiting time for the agios_thead to sleep in case we decide to sleep, 0 otherwise.
  */
-int64_t MLF(void)
+int64_t MLF(struct agios_ctx_t *ctx)
 {
 	struct request_t *req; /**< this will receive the request selected to be processed. */
 	struct agios_list_head *reqfile_l; /**< a line of the hashtable */
-	struct file_t *req_file; /**< used to iterate over all files in a line of the hashtable */
+	struct file_t *req_file; /**< used to iterate over the active files in a line of the hashtable */
+	struct file_t *next_req_file; /**< the one after req_file (which can leave the list of active files if we take all its requests) */
+	int32_t next_hash; /**< the next line of the hashtable with requests. */
+	bool wrapped = false; /**< did we go back to the beginning of the hashtable after starting_hash? */
 	int32_t shortest_waiting_time=INT_MAX; /**< will be adapted to the shortest waiting time among all files that are currently waiting. In case we cannot process requests because all of the files are waiting, we will use this to wait the shortest amount of time possible. */
-	int32_t starting_hash = MLF_current_hash; /**< from what hash position we are starting to round robin in the hashtable. */
+	int32_t starting_hash = ctx->MLF_current_hash; /**< from what hash position we are starting to round robin in the hashtable. */
 	bool processed_requests = false; /**< could we process any requests while going through the whole hashtable? */
 	bool mlf_stop=false; /**< flag that will be set by the process_request_step2 function, to let us know we should stop and give control back to the agios_thread */
 	int32_t waiting_time = 0; /**< the waiting time we will return if we leave for not having requests to process (or if all files are waiting, in that case this will receive shortest_waiting_time). */
@@ -101,31 +105,31 @@ int64_t MLF(void)
 	AGIOS_LIST_HEAD(info_list); /**< we will select multiple requests from a queue if the quantum allows, so we'll make a list of the struct processing_info_t structs returned by the multiple calls to process_requests_step1 to call process_requests_step2 later, when we are done with the queue and can unlock the mutex. */
 
 	/*search through all the files for requests to process*/
-	while ((current_reqnb > 0) && (!mlf_stop)) {
+	while ((ctx->current_reqnb > 0) && (!mlf_stop)) {
 		/*try to lock the line of the hashtable. If we can't get it, we will move on to the next line.
          * If a line has been tried without success MAX_MLF_LOCK_TRIES times, we will perform a regular lock to wait until it is available.
          * The idea is to decrease the cost of waiting for locks but without starving queues. */
-		reqfile_l = hashtable_trylock(MLF_current_hash);
+		reqfile_l = hashtable_trylock(ctx, ctx->MLF_current_hash);
 		if (!reqfile_l) { /*could not get the lock*/
-			if (MLF_lock_tries[MLF_current_hash] >= MAX_MLF_LOCK_TRIES) {
+			if (ctx->MLF_lock_tries[ctx->MLF_current_hash] >= MAX_MLF_LOCK_TRIES) {
 				/*we already tried the max number of times, now we will wait until the lock is free*/
-				reqfile_l = hashtable_lock(MLF_current_hash);
-			} else MLF_lock_tries[MLF_current_hash]++;
+				reqfile_l = hashtable_lock(ctx, ctx->MLF_current_hash);
+			} else ctx->MLF_lock_tries[ctx->MLF_current_hash]++;
 		}
 		if (reqfile_l) { //if we got the lock. This is NOT an else because we may have modified reqfile_l inside the previous if.
-			MLF_lock_tries[MLF_current_hash]=0;
-			if (hashlist_reqcounter[MLF_current_hash] > 0) { //see if we have requests for this line of the hashtable
-		            agios_list_for_each_entry (req_file, reqfile_l, hashlist) { //go through all files in this line of the hashtable
+			ctx->MLF_lock_tries[ctx->MLF_current_hash]=0;
+			if (ctx->hashlist_reqcounter[ctx->MLF_current_hash] > 0) { //see if we have requests for this line of the hashtable
+		            agios_list_for_each_entry_safe (req_file, next_req_file, &ctx->hashlist_active[ctx->MLF_current_hash], activelist) { //go through all active files in this line of the hashtable
 					    /*do a MLF step to this file, potentially selecting a request to be processed,
                          * but before we need to see if we are waiting new requests to this file*/
     					if (req_file->waiting_time > 0) update_waiting_time_counters(req_file, &shortest_waiting_time);
-	    				req = MLF_select_request(req_file);
+	    				req = MLF_select_request(ctx, req_file);
 		    			if ((req) && (req_file->waiting_time <= 0)) { //if we could select a request to this file and we are not waiting on it
 			    			/*removes the request from the hastable*/
-				    		hashtable_del_req(req);
+				    		hashtable_del_req(ctx, req);
 					    	/*sends it back to the file system*/
 						    /* \todo do not hold the lock when calling step2! */
-    						info = process_requests_step1(req, MLF_current_hash);
+    						info = process_requests_step1(ctx, req, ctx->MLF_current_hash);
 	    					agios_list_add_tail(&info->list, &info_list);
 		    				processed_requests=true;
 			    			/*cleanup step*/
@@ -133,21 +137,26 @@ int64_t MLF(void)
 				    	} //end if we could select a request and it is ready to be processed
 				    } //end for all files in the hashtable line
 			}
-			hashtable_unlock(MLF_current_hash);
-			mlf_stop = call_step2_for_info_list(&info_list);
+			hashtable_unlock(ctx, ctx->MLF_current_hash);
+			mlf_stop = call_step2_for_info_list(ctx, &info_list);
 			assert(agios_list_empty(&info_list));
 		} //end if we got the lock
-		//now we'll move on to the next line of the hashtable
+		//now we'll move on to the next line of the hashtable that has requests
 		if (!mlf_stop) { //if mlf_stop is true, we've left the loop without going through all reqfiles, we should not increase the current hash yet
-			MLF_current_hash++;
-			if (MLF_current_hash >= AGIOS_HASH_ENTRIES) MLF_current_hash = 0;
-			if (MLF_current_hash == starting_hash) { /*it means we already went through all the file structures*/
+			next_hash = hashtable_next_active_line(ctx, ctx->MLF_current_hash + 1);
+			if (next_hash < 0) { //we got to the end of the hashtable, go back to the beginning
+				next_hash = hashtable_next_active_line(ctx, 0);
+				wrapped = true;
+			}
+			if ((next_hash < 0) || ((wrapped) && (next_hash >= starting_hash))) { /*it means we already went through all the file structures*/
 				if (!processed_requests) { //and we could not process anything even after going through ALL files
 					waiting_time = shortest_waiting_time;
 					break; //get out of the while
 				}
 				processed_requests=false; /*restart the counting*/
+				wrapped = false;
 			}
+			if (next_hash >= 0) ctx->MLF_current_hash = next_hash;
 		} //end if we were not notified to stop
 	}//end while
 	return waiting_time;
@@ -5,6 +5,10 @@
 
 #define MAX_MLF_LOCK_TRIES	2 /**< How many times we will try to acquire a lock without waiting for it. @see MLF() */
 
-bool MLF_init();
-void MLF_exit();
-int64_t MLF(void);
+struct agios_ctx_t;
+struct queue_t;
+
+struct request_t *applyMLFonlist(struct agios_ctx_t *ctx, struct queue_t *reqlist);
+bool MLF_init(struct agios_ctx_t *ctx);
+void MLF_exit(struct agios_ctx_t *ctx);
+int64_t MLF(struct agios_ctx_t *ctx);
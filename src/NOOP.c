@@ -8,6 +8,7 @@
 #include <limits.h>
 #include <string.h>
 
+#include "agios_ctx.h"
 #include "agios_request.h"
 #include "common_functions.h"
 #include "mylist.h"
@@ -18,29 +19,31 @@
 
 /** 
  * NOOP schedule function. Usually NOOP means not having a schedule function. However, when we dynamically change from another algorithm to NOOP, we may still have requests on queue. So we just process all of them. 
+ * @param ctx the AGIOS instance.
  * @return 0, because we will never decide to sleep 
  */
-int64_t NOOP(void)
+int64_t NOOP(struct agios_ctx_t *ctx)
 {
-	struct agios_list_head *list; 
 	struct request_t *req;
 	bool stop_processing=false;
 	int32_t hash;
+	int32_t shard; /**< the shard of the timeline with the oldest request */
 	struct processing_info_t *info; /**< the struct with information about requests to be processed, filled by process_requests_step1 and given as parameter to process_requests_step2 */
 
 	while(!stop_processing) 
 	{
-		list = timeline_lock(); //we give a change to new requests by locking and unlocking to every rquest. Otherwise agios_add_request would never get the lock.
-		stop_processing = agios_list_empty(list);
-		if (!stop_processing) { //if the list is not empty
+		shard = timeline_oldest_shard(ctx);
+		if (shard < 0) break; //all shards are empty
+		timeline_lock_shard(ctx, shard); //we give a change to new requests by locking and unlocking to every rquest. Otherwise agios_add_request would never get the lock.
+		req = timeline_oldest_req(ctx, shard, &hash);
+		if (req) { //if the shard was not emptied before we got the lock
 			//just take one request and process it
-			req = timeline_oldest_req(&hash);
 			debug("NOOP is processing leftover requests %s %ld %ld", req->file_id, req->offset, req->len);
-			info = process_requests_step1(req, hash);
+			info = process_requests_step1(ctx, req, hash);
 			generic_post_process(req);
-			timeline_unlock();	
-			stop_processing = process_requests_step2(info);
-		} else timeline_unlock();	
+			timeline_unlock_shard(ctx, shard);	
+			stop_processing = process_requests_step2(ctx, info);
+		} else timeline_unlock_shard(ctx, shard);	
 	}
 	return 0;
 }
@@ -3,4 +3,6 @@
  */
 #pragma once
 
-int64_t NOOP(void);
+struct agios_ctx_t;
+
+int64_t NOOP(struct agios_ctx_t *ctx);
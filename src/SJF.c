@@ -1,8 +1,11 @@
 /*! \file SJF.c
-    \brief Implementation of the SJF scheduling algorithm.
+    \brief Implementation of the SJF and SJF-heap scheduling algorithms.
+
+    Both always take requests from a shortest queue (one with the smallest sum of request sizes). When several queues have the same size, SJF takes the first one it finds and SJF-heap the one at the top of the heap, so they do not always select the same queue. SJF finds it by going over all active files every time it selects a request, SJF-heap keeps the queues that have requests in a min-heap (ctx->sjf_heap) that is updated every time the size of a queue changes (when requests are added, processed or cancelled), so finding the shortest queue costs O(1) and each update costs O(log n).
  */
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,11 +13,14 @@
 #include <time.h>
 
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "agios_request.h"
+#include "common_functions.h"
 #include "mylist.h"
 #include "process_request.h"
 #include "req_hashtable.h"
 #include "scheduling_algorithms.h"
+#include "SJF.h"
 
 /**
  * answers if a queue could be selected to process requests, given a current minimum queue size. The queue may only be selected if it has requests in it and its size is smaller than the provided min size.
@@ -31,40 +37,37 @@ bool SJF_check_queue(struct queue_t *queue, int64_t min_size)
 	}
 }
 /**
- * goes over the whole hashtable to find the shortest queue. The caller must NOT hold the mutex for any line of the hashtable.
+ * goes over the active files of the hashtable to find the shortest queue. The caller must NOT hold the mutex for any line of the hashtable.
+ * @param ctx the AGIOS instance.
  * @param current_hash the line of the hashtable where the returned request is (it will be modified by this function). 
  * @return the shortest queue that contains requests, NULL if we can't find one.
  */
-struct queue_t *SJF_get_shortest_job(int32_t *current_hash)
+struct queue_t *SJF_get_shortest_job(struct agios_ctx_t *ctx, int32_t *current_hash)
 {
-	struct agios_list_head *reqfile_l; /**< used to access the line of the hashtable. */
 	int64_t min_size = LONG_MAX; /**< used to keep track of the shortest queue. */
 	struct queue_t *chosen_queue=NULL; /**< used to keep track of the shortest queue (and returned at the end). */
 	int32_t chosen_hash=0; /**< used to keep track of the shortest queue. */
 	struct file_t *req_file; /**< used to go over all files in a line of the hashtable. */
 	int32_t evaluated_reqfiles=0; /**< counter of how many files were checked. */
 	
-	for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) { //go over all lines of the hashtable
-		reqfile_l = hashtable_lock(i);
-		agios_list_for_each_entry (req_file, reqfile_l, hashlist) { //go over all files in this line
-			if ((!agios_list_empty(&req_file->write_queue.list)) || 
-				(!agios_list_empty(&req_file->read_queue.list))) { //if at least one of the queues has requests in it	 
-				assert((req_file->read_queue.current_size > 0) || (req_file->write_queue.current_size > 0));  //sanity check
-				evaluated_reqfiles++; //we count only files that have requests 
-				if (SJF_check_queue(&req_file->read_queue, min_size)) {
-					min_size = req_file->read_queue.current_size;
-					chosen_queue = &req_file->read_queue;
-					chosen_hash = i;
-				}
-				if (SJF_check_queue(&req_file->write_queue, min_size)) { //this is NOT an else because the write queue could be smaller
-					min_size = req_file->write_queue.current_size;
-					chosen_queue = &req_file->write_queue;
-					chosen_hash = i;
-				}
-			} //end if at least one of the queues is not empty
+	for (int32_t i = hashtable_next_active_line(ctx, 0); i >= 0; i = hashtable_next_active_line(ctx, i+1)) { //go over the lines of the hashtable that have requests
+		hashtable_lock(ctx, i);
+		agios_list_for_each_entry (req_file, &ctx->hashlist_active[i], activelist) { //go over all active files in this line (at least one of their queues has requests in it)
+			assert((req_file->read_queue.current_size > 0) || (req_file->write_queue.current_size > 0));  //sanity check
+			evaluated_reqfiles++;
+			if (SJF_check_queue(&req_file->read_queue, min_size)) {
+				min_size = req_file->read_queue.current_size;
+				chosen_queue = &req_file->read_queue;
+				chosen_hash = i;
+			}
+			if (SJF_check_queue(&req_file->write_queue, min_size)) { //this is NOT an else because the write queue could be smaller
+				min_size = req_file->write_queue.current_size;
+				chosen_queue = &req_file->write_queue;
+				chosen_hash = i;
+			}
 		} //end of for all files
-		hashtable_unlock(i);
-		if (evaluated_reqfiles >= current_filenb) break; //shortcut out in case we know the rest of the hashtable is empty
+		hashtable_unlock(ctx, i);
+		if (evaluated_reqfiles >= ctx->current_filenb) break; //shortcut out in case we know the rest of the hashtable is empty
 	} //end go over all the hashtable
 	if (!chosen_queue) return NULL;
 	else {
@@ -74,9 +77,10 @@ struct queue_t *SJF_get_shortest_job(int32_t *current_hash)
 }
 /**
  * main function for the SJF scheduler. Selects requests, processes and then cleans up them. Returns only after consuming all requests, or earlier if notified by the process_requests_step2 function. 
+ * @param ctx the AGIOS instance.
  * @return 0 (because we will never decide to sleep)
  */
-int64_t SJF(void)
+int64_t SJF(struct agios_ctx_t *ctx)
 {	
 	int32_t SJF_current_hash=0; /**< the line of the hashtable we are going to take requests from. */
 	struct queue_t *SJF_current_queue; /**< the queue from which we will take requests. */
@@ -84,25 +88,194 @@ int64_t SJF(void)
 	bool SJF_stop=false; /**< the return of the process_requests_step2 function may notify us it is time to stop because of a periodic event. */
 	struct processing_info_t *info; /**< the struct with information about requests to be processed, filled by process_requests_step1 and given as parameter to process_requests_step2 */
 
-	while ((current_reqnb > 0) && (SJF_stop == false)) {
+	while ((ctx->current_reqnb > 0) && (SJF_stop == false)) {
 		/*1. find the shortest queue*/
-		SJF_current_queue = SJF_get_shortest_job(&SJF_current_hash);
+		SJF_current_queue = SJF_get_shortest_job(ctx, &SJF_current_hash);
 		if (SJF_current_queue) {
-			hashtable_lock(SJF_current_hash); //it is possible that between unlocking in the get_shortest_job function and locking here new requests were added and this is no longer the shortest queue, but we don't care that much.
+			hashtable_lock(ctx, SJF_current_hash); //it is possible that between unlocking in the get_shortest_job function and locking here new requests were added and this is no longer the shortest queue, but we don't care that much.
 			/*2. select its first request and process it*/	
 			assert(!agios_list_empty(&SJF_current_queue->list)); //sanity check
 			req = agios_list_entry(SJF_current_queue->list.next, struct request_t, related);
 			if (req) {
 				/*removes the request from the hastable*/
-				hashtable_del_req(req);
+				hashtable_del_req(ctx, req);
 				/*sends it back to the file system*/
-				info = process_requests_step1(req, SJF_current_hash);
+				info = process_requests_step1(ctx, req, SJF_current_hash);
 				generic_post_process(req);
-				hashtable_unlock(SJF_current_hash);
-				SJF_stop = process_requests_step2(info);
-			} else hashtable_unlock(SJF_current_hash);
-		}
+				hashtable_unlock(ctx, SJF_current_hash);
+				SJF_stop = process_requests_step2(ctx, info);
+			} else hashtable_unlock(ctx, SJF_current_hash);
+		} else break; //the requests being counted are not in the hashtable yet (they were just counted, or are still in the timeline after a change of scheduling algorithm), the agios thread will call us again
 	}
 	return 0;
 }
 
+
+/**
+ * puts a queue in a position of the heap of SJF-heap. The caller must hold sjf_heap_mutex.
+ * @param ctx the AGIOS instance.
+ * @param pos the position.
+ * @param queue the queue.
+ */
+static void SJF_heap_set(struct agios_ctx_t *ctx, int32_t pos, struct queue_t *queue)
+{
+	ctx->sjf_heap[pos] = queue;
+	queue->heap_index = pos;
+}
+/**
+ * moves a queue towards the top of the heap while it is shorter than its parent. The caller must hold sjf_heap_mutex.
+ * @param ctx the AGIOS instance.
+ * @param pos the current position of the queue.
+ * @return the new position of the queue.
+ */
+static int32_t SJF_heap_sift_up(struct agios_ctx_t *ctx, int32_t pos)
+{
+	struct queue_t *queue = ctx->sjf_heap[pos]; /**< the queue being moved. */
+	int32_t parent; /**< the position of the parent of pos. */
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (ctx->sjf_heap[parent]->current_size <= queue->current_size) break;
+		SJF_heap_set(ctx, pos, ctx->sjf_heap[parent]);
+		pos = parent;
+	}
+	SJF_heap_set(ctx, pos, queue);
+	return pos;
+}
+/**
+ * moves a queue towards the bottom of the heap while it is longer than one of its children. The caller must hold sjf_heap_mutex.
+ * @param ctx the AGIOS instance.
+ * @param pos the current position of the queue.
+ */
+static void SJF_heap_sift_down(struct agios_ctx_t *ctx, int32_t pos)
+{
+	struct queue_t *queue = ctx->sjf_heap[pos]; /**< the queue being moved. */
+	int32_t child; /**< the position of the shortest child of pos. */
+
+	while ((child = 2*pos + 1) < ctx->sjf_heap_len) {
+		if ((child + 1 < ctx->sjf_heap_len) && (ctx->sjf_heap[child+1]->current_size < ctx->sjf_heap[child]->current_size)) child++;
+		if (queue->current_size <= ctx->sjf_heap[child]->current_size) break;
+		SJF_heap_set(ctx, pos, ctx->sjf_heap[child]);
+		pos = child;
+	}
+	SJF_heap_set(ctx, pos, queue);
+}
+/**
+ * puts a queue in the heap of SJF-heap if it has requests, takes it out if it does not, and moves it to the right position for its current_size. It must be called every time requests are added to or removed from a queue (or its current_size changes), holding the lock of the line of the hashtable of its file. It does nothing if SJF-heap is not the current scheduler.
+ * @param ctx the AGIOS instance.
+ * @param queue the queue.
+ */
+void SJF_heap_update(struct agios_ctx_t *ctx, struct queue_t *queue)
+{
+	struct queue_t **new_heap; /**< used to grow the heap. */
+	int32_t pos; /**< the position of the queue in the heap. */
+
+	if (!ctx->sjf_heap) return; //only allocated while SJF-heap is being used, that changes during a switch of scheduling algorithm, when no other thread is using the data structures (@see begin_scheduler_switch)
+	pthread_mutex_lock(&ctx->sjf_heap_mutex);
+	pos = queue->heap_index;
+	if (!agios_list_empty(&queue->list)) {
+		if (pos < 0) { //a new queue, put it at the end and let it go up
+			if (ctx->sjf_heap_len >= ctx->sjf_heap_size) {
+				new_heap = realloc(ctx->sjf_heap, sizeof(struct queue_t *)*ctx->sjf_heap_size*2);
+				if (!new_heap) {
+					agios_print("PANIC! Cannot allocate memory for the SJF-heap structures.");
+					pthread_mutex_unlock(&ctx->sjf_heap_mutex);
+					return;
+				}
+				ctx->sjf_heap = new_heap;
+				ctx->sjf_heap_size *= 2;
+			}
+			pos = ctx->sjf_heap_len++;
+			SJF_heap_set(ctx, pos, queue);
+		}
+		SJF_heap_sift_down(ctx, SJF_heap_sift_up(ctx, pos)); //current_size may have increased or decreased
+	} else if (pos >= 0) { //the queue is empty now, put the last queue of the heap in its place
+		queue->heap_index = -1;
+		ctx->sjf_heap_len--;
+		if (pos < ctx->sjf_heap_len) {
+			SJF_heap_set(ctx, pos, ctx->sjf_heap[ctx->sjf_heap_len]);
+			SJF_heap_sift_down(ctx, SJF_heap_sift_up(ctx, pos));
+		}
+	}
+	pthread_mutex_unlock(&ctx->sjf_heap_mutex);
+}
+/**
+ * initializes SJF-heap, building the heap from the files that already have requests. It is called by the AGIOS thread at the start, or while changing the scheduling algorithm, after the grace period of begin_scheduler_switch (before end_scheduler_switch lets other threads use the data structures again), so we go over the active files without locking. If requests are being migrated from the timeline, they are added to the heap as they are put in the hashtable.
+ * @param ctx the AGIOS instance.
+ * @return true or false for success.
+ */
+bool SJF_heap_init(struct agios_ctx_t *ctx)
+{
+	struct file_t *req_file; /**< used to go over the active files in a line of the hashtable. */
+	int32_t size = 2*ctx->current_filenb; /**< each file has two queues. */
+
+	if (ctx->sjf_heap) SJF_heap_exit(ctx);
+	if (size < SJF_HEAP_INITIAL_SIZE) size = SJF_HEAP_INITIAL_SIZE;
+	ctx->sjf_heap = malloc(sizeof(struct queue_t *)*size);
+	if (!ctx->sjf_heap) {
+		agios_print("AGIOS: cannot allocate memory for SJF-heap structures\n");
+		return false;
+	}
+	ctx->sjf_heap_size = size;
+	ctx->sjf_heap_len = 0;
+	for (int32_t i = hashtable_next_active_line(ctx, 0); i >= 0; i = hashtable_next_active_line(ctx, i+1)) {
+		agios_list_for_each_entry (req_file, &ctx->hashlist_active[i], activelist) {
+			SJF_heap_update(ctx, &req_file->read_queue);
+			SJF_heap_update(ctx, &req_file->write_queue);
+		}
+	}
+	return true;
+}
+/**
+ * called to stop SJF-heap. The queues are kept, only the heap is freed.
+ * @param ctx the AGIOS instance.
+ */
+void SJF_heap_exit(struct agios_ctx_t *ctx)
+{
+	if (!ctx->sjf_heap) return;
+	for (int32_t i = 0; i < ctx->sjf_heap_len; i++) ctx->sjf_heap[i]->heap_index = -1;
+	free(ctx->sjf_heap);
+	ctx->sjf_heap = NULL;
+	ctx->sjf_heap_len = 0;
+	ctx->sjf_heap_size = 0;
+}
+/**
+ * main function for the SJF-heap scheduler. Like SJF, it selects a shortest queue, but takes it from the top of the heap instead of looking for it. Returns only after consuming all requests, or earlier if notified by the process_requests_step2 function.
+ * @param ctx the AGIOS instance.
+ * @return 0 (because we will never decide to sleep)
+ */
+int64_t SJF_heap(struct agios_ctx_t *ctx)
+{
+	struct queue_t *queue; /**< the queue from which we will take requests. */
+	int32_t hash; /**< the line of the hashtable of its file. */
+	struct request_t *req; /**< the request we will process. */
+	bool SJF_stop=false; /**< the return of the process_requests_step2 function may notify us it is time to stop because of a periodic event. */
+	struct processing_info_t *info; /**< the struct with information about requests to be processed, filled by process_requests_step1 and given as parameter to process_requests_step2 */
+
+	while ((ctx->current_reqnb > 0) && (SJF_stop == false)) {
+		/*1. find the shortest queue*/
+		pthread_mutex_lock(&ctx->sjf_heap_mutex);
+		if (ctx->sjf_heap_len == 0) { //the requests being counted were not added to a queue yet
+			pthread_mutex_unlock(&ctx->sjf_heap_mutex);
+			break;
+		}
+		queue = ctx->sjf_heap[0];
+		pthread_mutex_unlock(&ctx->sjf_heap_mutex);
+		hash = queue->req_file->hash;
+		hashtable_lock(ctx, hash); //as in SJF, the queue may not be the shortest one anymore by now, but we don't care that much.
+		if (agios_list_empty(&queue->list)) { //its requests were cancelled before we got the lock
+			hashtable_unlock(ctx, hash);
+			continue;
+		}
+		/*2. select its first request and process it*/
+		req = agios_list_entry(queue->list.next, struct request_t, related);
+		/*removes the request from the hastable*/
+		hashtable_del_req(ctx, req);
+		/*sends it back to the file system (this also updates the heap)*/
+		info = process_requests_step1(ctx, req, hash);
+		generic_post_process(req);
+		hashtable_unlock(ctx, hash);
+		SJF_stop = process_requests_step2(ctx, info);
+	}
+	return 0;
+}
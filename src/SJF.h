@@ -1,6 +1,17 @@
 /*! \file SJF.c
-    \brief Implementation of the SJF scheduling algorithm.
+    \brief Implementation of the SJF and SJF-heap scheduling algorithms.
  */
 #pragma once
 
-int64_t SJF(void);
+#include <stdbool.h>
+
+#define SJF_HEAP_INITIAL_SIZE 64 /**< minimum number of positions allocated for the heap of SJF-heap. @see SJF_heap_init */
+
+struct agios_ctx_t;
+struct queue_t;
+
+int64_t SJF(struct agios_ctx_t *ctx);
+bool SJF_heap_init(struct agios_ctx_t *ctx);
+void SJF_heap_exit(struct agios_ctx_t *ctx);
+int64_t SJF_heap(struct agios_ctx_t *ctx);
+void SJF_heap_update(struct agios_ctx_t *ctx, struct queue_t *queue);
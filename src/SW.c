@@ -1,16 +1,163 @@
 /*! \file SW.c
     \brief Implementation of the SW scheduling algorithm
 
+    SW processes requests in the order of their time windows (arrival_time / sw_size), and inside a window in the order of their queue_id (then in arrival order). Requests are kept in the timeline in that order, so they are processed as with TO. To find where a new request goes without going through the timeline, the timeline is indexed by a calendar: a list of windows, each with its queue_ids (@see SW_window_t and SW_queue_t). Since requests usually arrive in order, their window is usually the last one, and the place of their queue_id is found with the index of the window.
  */
 #include <stdint.h>
+#include <stdlib.h>
 
+#include "agios_config.h"
+#include "agios_ctx.h"
+#include "common_functions.h"
+#include "mylist.h"
+#include "myrbtree.h"
+#include "SW.h"
 #include "TO.h"
 
+/**
+ * finds the window of a request in the calendar, creating it if needed.
+ * @param ctx the AGIOS instance.
+ * @param window the number of the window.
+ * @return the window, NULL if we could not allocate memory for it.
+ */
+static struct SW_window_t *get_window(struct agios_ctx_t *ctx, int64_t window)
+{
+	struct agios_list_head *pos; /**< used to go through the windows, starting from the last one */
+	struct SW_window_t *tmp; /**< the window at pos */
+	struct SW_window_t *new; /**< the window we may create */
+
+	for (pos = ctx->SW_windows.prev; pos != &ctx->SW_windows; pos = pos->prev) {
+		tmp = agios_list_entry(pos, struct SW_window_t, list);
+		if (tmp->window == window) return tmp;
+		if (tmp->window < window) break; //the new one goes after this one
+	}
+	new = malloc(sizeof(struct SW_window_t));
+	if (!new) return NULL;
+	new->window = window;
+	init_agios_list_head(&new->queues);
+	agios_rb_init_root(&new->index);
+	agios_list_add(&new->list, pos);
+	return new;
+}
+/**
+ * finds the queue of a request in a window of the calendar, creating it if needed.
+ * @param window the window.
+ * @param queue_id the queue_id of the request.
+ * @return the queue, NULL if we could not allocate memory for it.
+ */
+static struct SW_queue_t *get_queue(struct SW_window_t *window, int32_t queue_id)
+{
+	struct agios_list_head *insertion_place = window->queues.prev; /**< the queue after which a new one would go */
+	struct agios_rb_node *node = window->index.node; /**< used to walk down the index of the window */
+	struct SW_queue_t *tmp; /**< the queue at node */
+	struct SW_queue_t *new; /**< the queue we may create */
+
+	while (node) {
+		tmp = agios_rb_entry(node, struct SW_queue_t, index_node);
+		if (tmp->queue_id == queue_id) return tmp;
+		if (tmp->queue_id > queue_id) {
+			insertion_place = tmp->list.prev;
+			node = node->left;
+		} else node = node->right;
+	}
+	new = malloc(sizeof(struct SW_queue_t));
+	if (!new) return NULL;
+	new->queue_id = queue_id;
+	new->reqnb = 0;
+	new->first = NULL;
+	new->last = NULL;
+	new->window = window;
+	agios_list_add(&new->list, insertion_place);
+	agios_rb_init_node(&new->index_node);
+	if (insertion_place == &window->queues) agios_rb_insert_after(&window->index, &new->index_node, NULL);
+	else agios_rb_insert_after(&window->index, &new->index_node, &agios_list_entry(insertion_place, struct SW_queue_t, list)->index_node);
+	return new;
+}
+/**
+ * gives the request that comes right before the requests of a queue in the timeline (the last request of the previous queue_id of the same window, or of the previous window).
+ * @param ctx the AGIOS instance.
+ * @param queue the queue, which has no requests yet.
+ * @param this_timeline the timeline.
+ * @return the link of that request in the timeline, or the timeline itself if there is no such request.
+ */
+static struct agios_list_head *get_place_of_new_queue(struct agios_ctx_t *ctx, struct SW_queue_t *queue, struct agios_list_head *this_timeline)
+{
+	struct SW_window_t *window; /**< the previous window */
+
+	if (queue->list.prev != &queue->window->queues) return &agios_list_entry(queue->list.prev, struct SW_queue_t, list)->last->related;
+	if (queue->window->list.prev == &ctx->SW_windows) return this_timeline;
+	window = agios_list_entry(queue->window->list.prev, struct SW_window_t, list);
+	return &agios_list_entry(window->queues.prev, struct SW_queue_t, list)->last->related;
+}
+/**
+ * adds a request to the timeline in the order of SW (by time window, then queue_id, then arrival). The caller must hold the timeline lock.
+ * @param ctx the AGIOS instance.
+ * @param req the request.
+ * @param this_timeline the timeline (@see __timeline_add_req).
+ * @param older if true, the request is being moved to the timeline (@see __timeline_add_req) and it is older than the others of its queue, so it goes before them instead of after.
+ */
+void SW_add_req(struct agios_ctx_t *ctx, struct request_t *req, struct agios_list_head *this_timeline, bool older)
+{
+	struct SW_window_t *window; /**< the time window of the request */
+	struct SW_queue_t *queue = NULL; /**< the queue of the request in its window */
+
+	window = get_window(ctx, req->arrival_time / ctx->config.sw_size);
+	if (window) {
+		queue = get_queue(window, req->queue_id);
+		if ((!queue) && (agios_list_empty(&window->queues))) {
+			agios_list_del(&window->list);
+			free(window);
+		}
+	}
+	if (!queue) { //we could not allocate memory, so we cannot respect the order of SW for this request
+		agios_print("PANIC! Could not allocate memory for SW, adding a request to the end of the timeline");
+		agios_list_add_tail(&req->related, this_timeline);
+		return;
+	}
+	if (queue->reqnb == 0) {
+		agios_list_add(&req->related, get_place_of_new_queue(ctx, queue, this_timeline));
+		queue->first = req;
+		queue->last = req;
+	} else if (older) {
+		agios_list_add_tail(&req->related, &queue->first->related);
+		queue->first = req;
+	} else {
+		agios_list_add(&req->related, &queue->last->related);
+		queue->last = req;
+	}
+	queue->reqnb++;
+	req->sw_queue = queue;
+}
+/**
+ * removes a request from the calendar of SW (it must be called before it is removed from the timeline, @see request_del). The caller must hold the timeline lock.
+ * @param req the request.
+ */
+void SW_del_req(struct request_t *req)
+{
+	struct SW_queue_t *queue = req->sw_queue; /**< the queue of the request */
+	struct SW_window_t *window = queue->window; /**< and its window */
+
+	req->sw_queue = NULL;
+	queue->reqnb--;
+	if (queue->reqnb > 0) { //the requests of the queue are contiguous in the timeline
+		if (queue->first == req) queue->first = agios_list_entry(req->related.next, struct request_t, related);
+		if (queue->last == req) queue->last = agios_list_entry(req->related.prev, struct request_t, related);
+		return;
+	}
+	agios_list_del(&queue->list);
+	agios_rb_erase(&window->index, &queue->index_node);
+	free(queue);
+	if (agios_list_empty(&window->queues)) {
+		agios_list_del(&window->list);
+		free(window);
+	}
+}
 /**
  * main function for the scheduling algorithm, it simply uses the TO implementation because the only difference between them is in the inclusion of requests.
+ * @param ctx the AGIOS instance.
  * @return 0 (because we will never decide to sleep)
  */
-int64_t SW(void)
+int64_t SW(struct agios_ctx_t *ctx)
 {
-	return timeorder(); // The difference between them in in the inclusion of requests, the processing is the same
+	return timeorder(ctx); // The difference between them in in the inclusion of requests, the processing is the same
 }
@@ -4,4 +4,41 @@
  */
 #pragma once
 
-int64_t SW(void);
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "agios_request.h"
+#include "mylist.h"
+#include "myrbtree.h"
+
+struct agios_ctx_t;
+
+/*! \struct SW_window_t
+    \brief A time window of SW with queued requests.
+
+    Windows are kept in the list ctx->SW_windows, ordered by window. Each one has a list of SW_queue_t (one per queue_id with requests in this window), ordered by queue_id, and a tree that mirrors that list (to find the place of a queue_id without going through the list, @see myrbtree.c).
+ */
+struct SW_window_t {
+	int64_t window; /**< the number of the window (arrival_time / sw_size) */
+	struct agios_list_head list; /**< to insert this window in ctx->SW_windows */
+	struct agios_list_head queues; /**< the SW_queue_t of this window, ordered by queue_id */
+	struct agios_rb_root index; /**< the same SW_queue_t, in the same order */
+};
+/*! \struct SW_queue_t
+    \brief The requests with the same queue_id in a time window of SW.
+
+    They are contiguous in the timeline (in arrival order), so we only keep the first and the last ones.
+ */
+struct SW_queue_t {
+	int32_t queue_id; /**< the queue_id of the requests */
+	int32_t reqnb; /**< how many requests are in the timeline */
+	struct request_t *first; /**< the first request in the timeline */
+	struct request_t *last; /**< the last request in the timeline */
+	struct SW_window_t *window; /**< the window where this queue is */
+	struct agios_list_head list; /**< to insert this queue in the list of its window */
+	struct agios_rb_node index_node; /**< to insert this queue in the index of its window */
+};
+
+void SW_add_req(struct agios_ctx_t *ctx, struct request_t *req, struct agios_list_head *this_timeline, bool older);
+void SW_del_req(struct request_t *req);
+int64_t SW(struct agios_ctx_t *ctx);
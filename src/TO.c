@@ -9,29 +9,37 @@
 #include <time.h>
 
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "process_request.h"
 #include "req_timeline.h"
 #include "scheduling_algorithms.h"
 
 /**
- * repeatedly process the first request of the timeline, until process_requests notify us to stop.
+ * repeatedly process the oldest request of the timeline, until process_requests notify us to stop. That is the first request of the shard whose first request is the oldest one (@see timeline_oldest_shard).
+ * @param ctx the AGIOS instance.
  * @return 0 (because we will never decide to sleep) 
  */
-int64_t timeorder(void)
+int64_t timeorder(struct agios_ctx_t *ctx)
 {
 	struct request_t *req;	/**< the request we will process. */
 	bool TO_stop = false; /**< is it time to stop and go back to the agios thread to do a periodic event? */
 	int32_t hash; /**< the hashtable line which contains information about the request we will process. */
+	int32_t shard; /**< the shard of the timeline where that request is. */
 	struct processing_info_t *info; /**< the struct with information about requests to be processed, filled by process_requests_step1 and given as parameter to process_requests_step2 */
 
-	while ((current_reqnb > 0) && (TO_stop == false)) {
-		timeline_lock();
-		req = timeline_oldest_req(&hash);
-		assert(req); //sanity check
-		info = process_requests_step1(req, hash); 
+	while ((ctx->current_reqnb > 0) && (TO_stop == false)) {
+		shard = timeline_oldest_shard(ctx);
+		if (shard < 0) break; //the requests were counted but the locks of their shards were not released yet, the agios thread will call us again
+		timeline_lock_shard(ctx, shard);
+		req = timeline_oldest_req(ctx, shard, &hash);
+		if (!req) { //it was cancelled before we got the lock
+			timeline_unlock_shard(ctx, shard);
+			continue;
+		}
+		info = process_requests_step1(ctx, req, hash); 
 		generic_post_process(req);
-		timeline_unlock();
-		TO_stop = process_requests_step2(info);
+		timeline_unlock_shard(ctx, shard);
+		TO_stop = process_requests_step2(ctx, info);
 	}
 	return 0;
 }
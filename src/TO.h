@@ -3,4 +3,6 @@
  */
 #pragma once
 
-int64_t timeorder(void);
+struct agios_ctx_t;
+
+int64_t timeorder(struct agios_ctx_t *ctx);
@@ -4,6 +4,8 @@
  */
 #pragma once
 
-bool TWINS_init();
-int64_t TWINS(void);
-void TWINS_exit();
+struct agios_ctx_t;
+
+bool TWINS_init(struct agios_ctx_t *ctx);
+int64_t TWINS(struct agios_ctx_t *ctx);
+void TWINS_exit(struct agios_ctx_t *ctx);
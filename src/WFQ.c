@@ -12,6 +12,7 @@
 
 #include "agios_config.h"
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "common_functions.h"
 #include "hash.h"
 #include "mylist.h"
@@ -19,45 +20,55 @@
 #include "req_hashtable.h"
 #include "req_timeline.h"
 #include "scheduling_algorithms.h"
+#include "WFQ.h"
 
 
-static int g_current_queue; /**< the current queue from where we are taking requests */
-struct wfq_weights_t * wfq_weights; /**< An array that keeps the weight and the credit of each queue */
-
-struct wfq_weights_t
-{
-    int64_t weight;
-    int64_t credit;
-
-};
-
 /**
- * function called to initialize WFQ by setting some variables.
+ * function called to initialize WFQ by setting some variables. The weights are only read the first time, when WFQ is selected again (by a dynamic scheduling algorithm) the queues keep the credits they had (@see WFQ_exit).
+ * @param ctx the AGIOS instance.
  * @return true or false for success
  */
-bool WFQ_init()
+bool WFQ_init(struct agios_ctx_t *ctx)
 {
     //The WFQ
+    if (ctx->wfq_weights) return true; //we were already used, the weights and credits were kept
+
+    if (ctx->multi_timeline_size < 2)
+    {
+        agios_print("WFQ Error: WFQ needs multiple queues, agios_init must receive a max_queue_id.\n");
+        return false;
+    }
+    if (!ctx->config.wfq_conf_file)
+    {
+        agios_print("WFQ Error: the path of the WFQ config file was not provided.\n");
+        return false;
+    }
 
     // Firstly, we set the queues weight and credit
     // the weights of each queue is read from the wfq.conf
-    FILE *setup_file = fopen(config_wfq_conf_file, "r");
+    FILE *setup_file = fopen(ctx->config.wfq_conf_file, "r");
 
-    agios_print("WFQ conf file: %s\n", config_wfq_conf_file);
+    agios_print("WFQ conf file: %s\n", ctx->config.wfq_conf_file);
     if(!setup_file)
     {
-        agios_print("WFQ Error: Error opening WFQ config file %s.\n", config_wfq_conf_file);
+        agios_print("WFQ Error: Error opening WFQ config file %s.\n", ctx->config.wfq_conf_file);
         return false;
     }
 
-    wfq_weights  = (struct wfq_weights_t *) malloc(multi_timeline_size  * sizeof(struct wfq_weights_t));
+    ctx->wfq_weights  = (struct wfq_weights_t *) malloc(ctx->multi_timeline_size  * sizeof(struct wfq_weights_t));
+    if (!ctx->wfq_weights)
+    {
+        agios_print("WFQ Error: could not allocate memory for the weights.\n");
+        fclose(setup_file);
+        return false;
+    }
 
-    for (int i = 0; i < multi_timeline_size - 1; i++)
+    for (int i = 0; i < ctx->multi_timeline_size - 1; i++)
     { //fscanf to get the weights from the setup file
-        fscanf(setup_file, "%ld", &(wfq_weights[i].weight));
-        wfq_weights[i].credit = 0;
+        fscanf(setup_file, "%ld", &(ctx->wfq_weights[i].weight));
+        ctx->wfq_weights[i].credit = 0;
         // check if the weight is greater than zero
-        assert(wfq_weights[i].weight > 0);
+        assert(ctx->wfq_weights[i].weight > 0);
     }
 
 
@@ -67,18 +78,29 @@ bool WFQ_init()
 }
 
 /**
- * function called when stopping the use of TWINS, for now we don't have anything to clean up.
+ * function called when stopping the use of WFQ. The weights and the credits of the queues are kept for when it is selected again, since its requests stay in the same queues when changing to TWINS (and are moved in order to the other data structures, @see reorder_timeline and migrate_slice). They are freed by WFQ_cleanup.
+ * @param ctx the AGIOS instance.
+ */
+void WFQ_exit(struct agios_ctx_t *ctx)
+{
+}
+
+/**
+ * function called at the end of the execution to free the weights of the queues.
+ * @param ctx the AGIOS instance.
  */
-void WFQ_exit()
+void WFQ_cleanup(struct agios_ctx_t *ctx)
 {
-    free(wfq_weights);
+    free(ctx->wfq_weights);
+    ctx->wfq_weights = NULL;
 }
 
 /**
  * main function for the TWINS scheduler. It is called by the AGIOS thread to schedule some requests. It will continue to consume requests until there are no more requests or if notified by the process_requests_step2 function.
+ * @param ctx the AGIOS instance.
  * @return if we are returning because we were asked to stop, 0, otherwise we return the time until the end of the current window
  */
-int64_t WFQ(void)
+int64_t WFQ(struct agios_ctx_t *ctx)
 {
     bool WFQ_STOP = false; /**< the return of the process_requests_step2 function may notify us it is time to stop because of a periodic event */
     struct request_t * req; /**< used to access requests from the queues */
@@ -86,22 +108,25 @@ int64_t WFQ(void)
     struct processing_info_t *info; /**< the struct with information about requests to be processed, filled by process_requests_step1 and given as parameter to process_requests_step2 */
 
     int64_t amount;
+    int32_t idle_queues = 0; /**< how many queues in a row we went through without processing requests */
 
     PRINT_FUNCTION_NAME;
 
 
-    while(current_reqnb > 0 && ! WFQ_STOP)
+    while(ctx->current_reqnb > 0 && ! WFQ_STOP)
     {
+        //after a change of scheduling algorithm, the requests may still be in the hashtable (@see migrate_slice), so we return to the AGIOS thread instead of going around the empty queues
+        if (idle_queues >= ctx->multi_timeline_size - 1) break;
+        idle_queues++;
 
-        amount = wfq_weights[g_current_queue].weight + wfq_weights[g_current_queue].credit;
+        amount = ctx->wfq_weights[ctx->wfq_current_queue].weight + ctx->wfq_weights[ctx->wfq_current_queue].credit;
 
 
-        timeline_lock();
+        timeline_lock_shard(ctx, 0); //WFQ does not shard the timeline, so the lock of the first shard protects all queues (@see timeline_shard)
 
 
-        //we are not locking the current_reqnb_mutex, so we could be using outdated information. We have chosen to do this for performance reasons
-        while (!agios_list_empty(&(multi_timeline[g_current_queue])) && !WFQ_STOP) {
-            req = agios_list_entry(multi_timeline[g_current_queue].next, struct request_t, related);
+        while (!agios_list_empty(&(ctx->multi_timeline[ctx->wfq_current_queue])) && !WFQ_STOP) {
+            req = agios_list_entry(ctx->multi_timeline[ctx->wfq_current_queue].next, struct request_t, related);
             if (amount - req->len >= 0) {
                 //we can only process requests from the current app_id
                 //take request from the right queue
@@ -110,30 +135,31 @@ int64_t WFQ(void)
 
                 /*send it back to the file system*/
                 //we need the hash for this request's file id so we can update its stats
-                hash = get_hashtable_position(req->file_id);
-                info = process_requests_step1(req, hash);
+                hash = req->globalinfo->req_file->hash;
+                info = process_requests_step1(ctx, req, hash);
 
                 amount -= req->len; //request size
+                idle_queues = 0;
 
                 generic_post_process(req);
 
-                timeline_unlock();
+                timeline_unlock_shard(ctx, 0);
 
-                WFQ_STOP = process_requests_step2(info);
+                WFQ_STOP = process_requests_step2(ctx, info);
 
-                timeline_lock();
+                timeline_lock_shard(ctx, 0);
 
             } else break;
 
         }
 
         // update the queue credit
-        if (!agios_list_empty(&(multi_timeline[g_current_queue]))) wfq_weights[g_current_queue].credit = amount;
-        else wfq_weights[g_current_queue].credit = 0;
+        if (!agios_list_empty(&(ctx->multi_timeline[ctx->wfq_current_queue]))) ctx->wfq_weights[ctx->wfq_current_queue].credit = amount;
+        else ctx->wfq_weights[ctx->wfq_current_queue].credit = 0;
 
-        g_current_queue = (g_current_queue + 1) % (multi_timeline_size - 1);
+        ctx->wfq_current_queue = (ctx->wfq_current_queue + 1) % (ctx->multi_timeline_size - 1);
 
-        timeline_unlock();
+        timeline_unlock_shard(ctx, 0);
 
     }
 
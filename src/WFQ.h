@@ -4,9 +4,22 @@
  */
 #pragma once
 
-struct wfq_weights_t;
+#include <stdbool.h>
+#include <stdint.h>
 
-bool WFQ_init();
-int64_t WFQ(void);
-void WFQ_exit();
+/**
+ * the weight and the credit of a queue of the multi_timeline, used by WFQ (@see WFQ_init).
+ */
+struct wfq_weights_t
+{
+    int64_t weight; /**< how many bytes it may process each time it is visited */
+    int64_t credit; /**< how many it did not use the last time, because the next request was larger */
+};
+
+struct agios_ctx_t;
+
+bool WFQ_init(struct agios_ctx_t *ctx);
+int64_t WFQ(struct agios_ctx_t *ctx);
+void WFQ_exit(struct agios_ctx_t *ctx);
+void WFQ_cleanup(struct agios_ctx_t *ctx);
 
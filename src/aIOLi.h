@@ -3,5 +3,14 @@
  */
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 
-int64_t aIOLi(void);
+struct agios_ctx_t;
+struct queue_t;
+
+bool aIOLi_select_from_list(struct agios_ctx_t *ctx,
+				struct queue_t *queue, 
+				struct queue_t **selected_queue, 
+				int64_t *selected_timestamp);
+int64_t aIOLi(struct agios_ctx_t *ctx);
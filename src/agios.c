@@ -2,64 +2,117 @@
     \brief Implementation of the agios_init and agios_exit functions, used to start and end the library.
 
     Users start using the library by calling agios_init providing the callbacks to be used to process requests and the path to a configuration file. Then new requests are added to the library with agios_add_request. When the scheduling policy being applied decides it is time to process a request, AGIOS will call the callback functions provided by the user to agios_init. Later the user has to be sure to call agios_release_request to let AGIOS know the request has been processed, or call agios_cancel_request earlier to cancel that request. Before ending, the user must call agios_exit to cleanup all allocated memory.
+
+    Each call to agios_init_ctx (or agios_init_pull_mode_ctx) creates a new AGIOS instance, described by a struct agios_ctx_t, that must later be given to agios_exit_ctx. agios_init and agios_init_pull_mode do the same for the default instance (default_ctx), which is the one used by the functions that do not receive a context.
 */
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include "agios.h"
+#include "agios_add_request.h"
 #include "agios_config.h"
+#include "agios_ctx.h"
+#include "agios_release_request.h"
 #include "agios_thread.h"
 #include "common_functions.h"
 #include "data_structures.h"
+#include "file_registry.h"
+#include "mem_pool.h"
 #include "performance.h"
 #include "process_request.h"
+#include "pull_mode.h"
 #include "scheduling_algorithms.h"
 #include "trace.h"
+#include "WFQ.h"
 
-static pthread_t g_agios_thread; /**< AGIOS thread that will run the AGIOS_thread function.  */
+struct agios_ctx_t *default_ctx = NULL; /**< the instance used by agios_init, agios_exit and all other functions that do not receive a context. */
 
 /**
- * function used by agios_exit and agios_init (in case of errors) to clean up all allocated memory.
+ * allocates a new context and initializes its locks, lists and default configuration parameters. Nothing else is allocated here, that is done by start_agios.
+ * @return the new context, or NULL if we could not allocate memory.
  */
-void cleanup_agios(void)
+static struct agios_ctx_t *create_ctx(void)
 {
-	cleanup_config_parameters();
-	cleanup_performance_module();
-	cleanup_data_structures();
-	if (config_trace_agios) {
-		close_agios_trace();
-		cleanup_agios_trace();
+	struct agios_ctx_t *ctx = calloc(1, sizeof(struct agios_ctx_t)); /**< the new context. */
+
+	if (!ctx) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		return NULL;
 	}
+	set_default_config_parameters(&ctx->config);
+	pthread_cond_init(&ctx->request_added_cond, NULL);
+	pthread_mutex_init(&ctx->request_added_mutex, NULL);
+	pthread_mutex_init(&ctx->performance_mutex, NULL);
+	pthread_mutex_init(&ctx->trace_mutex, NULL);
+	pthread_mutex_init(&ctx->registry_mutex, NULL);
+	pthread_mutex_init(&ctx->pull_mutex, NULL);
+	pthread_cond_init(&ctx->pull_not_empty_cond, NULL);
+	pthread_cond_init(&ctx->pull_not_full_cond, NULL);
+	pthread_mutex_init(&ctx->pull_partial_mutex, NULL);
+	pthread_mutex_init(&ctx->sjf_heap_mutex, NULL);
+	pthread_mutex_init(&ctx->scheduler_switch_mutex, NULL);
+	pthread_cond_init(&ctx->scheduler_switch_cond, NULL);
+	init_agios_list_head(&ctx->performance_info);
+	init_agios_list_head(&ctx->pull_partial_list);
+	init_agios_list_head(&ctx->failed_adds);
+	init_scheduling_algorithms(ctx);
+	atomic_init(&ctx->add_queue, NULL);
+	atomic_init(&ctx->completion_queue, NULL);
+	return ctx;
 }
-
 /**
- * function called by the user to initialize AGIOS. It will read parameters, allocate memory and start the AGIOS thread.
- * @param process_request the callback function from the user code used by AGIOS to process a single request. (required)
- * @param process_requests the callback function from the user code used by AGIOS to process a list of requests. (optional)
- * @param config_file the path to a configuration file. If NULL, the DEFAULT_CONFIGFILE will be read instead. If the default configuration file does not exist, it will use default values.
- * @param max_queue_id for schedulers that use multiple queues, one per server/application (TWINS and SW), define the number of queues to be used. If it is not relevant to the used scheduler, it is better to provide 0. With each request being added, a value between 0 and max_queue_id-1 is to be provided.
- * @see agios_config.c
- * @return true of false for success.
+ * function used by agios_exit_ctx and agios_init_ctx (in case of errors) to clean up all allocated memory.
+ * @param ctx the AGIOS instance, which is freed by this function.
  */
-bool agios_init(void * process_request_user(int64_t req_id), 
-		void * process_requests_user(int64_t *reqs, int32_t reqnb), 
-		char *config_file, 
-		int32_t max_queue_id)
+static void cleanup_agios(struct agios_ctx_t *ctx)
 {
-	//check if a callback was provided 
-	if (!process_request_user) {
-		agios_print("Incorrect parameters to agios_init\n");
-		return false; //we don't use the goto cleanup_on_error because we have nothing to clean up
+	cleanup_performance_module(ctx);
+	cleanup_data_structures(ctx);
+	WFQ_cleanup(ctx); //WFQ keeps its weights when it stops being used, in case it is selected again
+	cleanup_file_registry(ctx);
+	cleanup_pull_mode(ctx);
+	if (ctx->using_mem_pools) cleanup_mem_pools();
+	if (ctx->config.trace) {
+		close_agios_trace(ctx);
+		cleanup_agios_trace(ctx);
 	}
-	user_callbacks.process_request_cb = process_request_user;
-	user_callbacks.process_requests_cb = process_requests_user;
-	if (!read_configuration_file(config_file)) goto cleanup_on_error; 
-	if (!allocate_data_structures(max_queue_id)) goto cleanup_on_error;
+	cleanup_config_parameters(&ctx->config);
+	pthread_cond_destroy(&ctx->request_added_cond);
+	pthread_mutex_destroy(&ctx->request_added_mutex);
+	pthread_mutex_destroy(&ctx->performance_mutex);
+	pthread_mutex_destroy(&ctx->trace_mutex);
+	pthread_mutex_destroy(&ctx->registry_mutex);
+	pthread_mutex_destroy(&ctx->pull_mutex);
+	pthread_cond_destroy(&ctx->pull_not_empty_cond);
+	pthread_cond_destroy(&ctx->pull_not_full_cond);
+	pthread_mutex_destroy(&ctx->pull_partial_mutex);
+	pthread_mutex_destroy(&ctx->sjf_heap_mutex);
+	pthread_mutex_destroy(&ctx->scheduler_switch_mutex);
+	pthread_cond_destroy(&ctx->scheduler_switch_cond);
+	free(ctx);
+}
+/**
+ * reads parameters, allocates memory and starts the AGIOS thread. Used by agios_init_ctx and agios_init_pull_mode_ctx, after they set the callbacks.
+ * @param ctx the AGIOS instance, created by create_ctx. In case of errors, it is freed.
+ * @param config_file @see agios_init_ctx
+ * @param max_queue_id @see agios_init_ctx
+ * @param use_pull_mode true if requests will be taken by workers with agios_next_requests_ctx instead of given to the callbacks.
+ * @return true of false for success.
+ */
+static bool start_agios(struct agios_ctx_t *ctx, char *config_file, int32_t max_queue_id, bool use_pull_mode)
+{
+	if (!read_configuration_file(ctx, config_file)) goto cleanup_on_error;
+	if (!init_mem_pools(ctx->config.preallocated_requests)) goto cleanup_on_error;
+	ctx->using_mem_pools = true;
+	if ((use_pull_mode) && (!init_pull_mode(ctx, ctx->config.pull_ring_size))) goto cleanup_on_error;
+	if (!allocate_data_structures(ctx, max_queue_id)) goto cleanup_on_error;
+	disable_unavailable_schedulers(ctx); //the ones that need the multi_timeline, if it was not allocated
 	//if we are going to generate traces, init the tracing module
-	if (config_trace_agios) {
-		if (!init_trace_module()) goto cleanup_on_error;
+	if (ctx->config.trace) {
+		if (!init_trace_module(ctx)) goto cleanup_on_error;
 	}
 	//init the AGIOS thread
-	int32_t ret = pthread_create(&g_agios_thread, NULL, agios_thread, NULL);
+	int32_t ret = pthread_create(&ctx->agios_thread, NULL, agios_thread, ctx);
 	if (ret != 0) {
                 agios_print("Unable to start a thread to agios!\n");
 		goto cleanup_on_error;
@@ -67,20 +120,107 @@ bool agios_init(void * process_request_user(int64_t req_id),
 	//success, finish the function call
 	return true;
 cleanup_on_error:  //used to abort the initialization if anything goes wrong
-	cleanup_agios();
+	cleanup_agios(ctx);
 	return false;
 }
+/**
+ * function called by the user to start a new AGIOS instance. It will read parameters, allocate memory and start an AGIOS thread for this instance. Many instances can be used at the same time, each one with its own configuration and scheduling algorithm.
+ * @param process_request the callback function from the user code used by AGIOS to process a single request. (required)
+ * @param process_requests the callback function from the user code used by AGIOS to process a list of requests. (optional)
+ * @param config_file the path to a configuration file. If NULL, the DEFAULT_CONFIGFILE will be read instead. If the default configuration file does not exist, it will use default values.
+ * @param max_queue_id for schedulers that use multiple queues, one per server/application (TWINS and SW), define the number of queues to be used. If it is not relevant to the used scheduler, it is better to provide 0. With each request being added, a value between 0 and max_queue_id-1 is to be provided.
+ * @see agios_config.c
+ * @return the new instance, to be given to the other functions and finally to agios_exit_ctx, or NULL in case of errors.
+ */
+agios_ctx_t *agios_init_ctx(void * process_request_user(int64_t req_id),
+		void * process_requests_user(int64_t *reqs, int32_t reqnb),
+		char *config_file,
+		int32_t max_queue_id)
+{
+	struct agios_ctx_t *ctx; /**< the new instance. */
+
+	//check if a callback was provided
+	if (!process_request_user) {
+		agios_print("Incorrect parameters to agios_init\n");
+		return NULL; //we don't use the goto cleanup_on_error because we have nothing to clean up
+	}
+	ctx = create_ctx();
+	if (!ctx) return NULL;
+	ctx->user_callbacks.process_request_cb = process_request_user;
+	ctx->user_callbacks.process_requests_cb = process_requests_user;
+	if (!start_agios(ctx, config_file, max_queue_id, false)) return NULL;
+	return ctx;
+}
+/**
+ * function called by the user to start a new AGIOS instance in pull mode. It does the same as agios_init_ctx, but instead of calling callbacks from the AGIOS thread, requests are kept (in a ring of library_options.pull_ring_size positions) until worker threads take them by calling agios_next_requests_ctx. If the ring is full, scheduling waits for the workers.
+ * @param config_file @see agios_init_ctx
+ * @param max_queue_id @see agios_init_ctx
+ * @return the new instance, or NULL in case of errors.
+ */
+agios_ctx_t *agios_init_pull_mode_ctx(char *config_file, int32_t max_queue_id)
+{
+	struct agios_ctx_t *ctx = create_ctx(); /**< the new instance. */
 
+	if (!ctx) return NULL;
+	if (!start_agios(ctx, config_file, max_queue_id, true)) return NULL;
+	return ctx;
+}
 /**
- * function called by the user to stop AGIOS. It will stop the AGIOS thread and free all allocated memory.
+ * function called by the user to stop an AGIOS instance. It will stop its AGIOS thread and free all memory allocated for it. The context cannot be used after this call.
+ * @param ctx the AGIOS instance, given by agios_init_ctx or agios_init_pull_mode_ctx.
  */
-void agios_exit(void)
+void agios_exit_ctx(agios_ctx_t *ctx)
 {
-	//stop the agios thread
-	stop_the_agios_thread();
-	pthread_join(g_agios_thread, NULL);
-	if (current_scheduler->exit) current_scheduler->exit(); //the exit function is not mandatory for schedulers
+	//stop the agios thread (in pull mode, it could be waiting for the workers)
+	stop_pull_mode(ctx);
+	stop_the_agios_thread(ctx);
+	pthread_join(ctx->agios_thread, NULL);
+	//release what the user released after the last time the agios thread did it
+	process_deferred_releases(ctx);
+	//requests that were not added yet are discarded, as the ones that were not processed
+	discard_deferred_adds(ctx);
+	if (ctx->current_scheduler->exit) ctx->current_scheduler->exit(ctx); //the exit function is not mandatory for schedulers
 	//cleanup memory
-	cleanup_agios();
+	cleanup_agios(ctx);
+}
+/**
+ * function called by the user to initialize AGIOS (the default instance). It will read parameters, allocate memory and start the AGIOS thread.
+ * @see agios_init_ctx
+ * @return true of false for success. It fails if the default instance is already running.
+ */
+bool agios_init(void * process_request_user(int64_t req_id),
+		void * process_requests_user(int64_t *reqs, int32_t reqnb),
+		char *config_file,
+		int32_t max_queue_id)
+{
+	if (default_ctx) {
+		agios_print("agios_init called, but AGIOS is already running. Call agios_exit first\n");
+		return false;
+	}
+	default_ctx = agios_init_ctx(process_request_user, process_requests_user, config_file, max_queue_id);
+	return default_ctx != NULL;
+}
+/**
+ * function called by the user to initialize AGIOS (the default instance) in pull mode.
+ * @see agios_init_pull_mode_ctx
+ * @return true of false for success. It fails if the default instance is already running.
+ */
+bool agios_init_pull_mode(char *config_file, int32_t max_queue_id)
+{
+	if (default_ctx) {
+		agios_print("agios_init_pull_mode called, but AGIOS is already running. Call agios_exit first\n");
+		return false;
+	}
+	default_ctx = agios_init_pull_mode_ctx(config_file, max_queue_id);
+	return default_ctx != NULL;
+}
+/**
+ * function called by the user to stop AGIOS (the default instance). It will stop the AGIOS thread and free all allocated memory.
+ */
+void agios_exit(void)
+{
+	if (!default_ctx) return;
+	agios_exit_ctx(default_ctx);
+	default_ctx = NULL;
 	agios_print("stopped for this client. AGIOS can be used again by calling agios_init\n");
 }
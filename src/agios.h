@@ -2,6 +2,16 @@
     \brief Interface from users to the AGIOS library. 
 
     Users start using the library by calling agios_init providing the callbacks to be used to process requests and the path to a configuration file. Then new requests are added to the library with agios_add_request. When the scheduling policy being applied decides it is time to process a request, AGIOS will call the callback functions provided by the user to agios_init. Later the user has to be sure to call agios_release_request to let AGIOS know the request has been processed, or call agios_cancel_request earlier to cancel that request. Before ending, the user must call agios_exit to cleanup all allocated memory.
+
+    Alternatively, requests can be added with agios_add_request_with_handle, which gives back a handle to the request. That handle can then be given to agios_release_request_by_handle or agios_cancel_request_by_handle, which do not have to look for the request in the internal data structures.
+
+    When many requests arrive at the same time, they can be given together to agios_add_requests, which is cheaper than calling agios_add_request for each one of them. Similarly, many requests added with handles can be released together with agios_release_requests, and all requests given together to the callback can be released with agios_release_request_batch. If library_options.deferred_release is set in the configuration file, the release functions do not take any lock, they only record the release so it is done later by the AGIOS thread. In the same way, if library_options.deferred_add is set, the add functions only push the new requests to a lock-free queue, and they are added to the scheduling queues by the AGIOS thread.
+
+    Instead of having requests given to callbacks called by the AGIOS thread, the user may start AGIOS with agios_init_pull_mode. In that case, worker threads take the requests to be processed by calling agios_next_requests (and then release them as usual).
+
+    Files that are accessed many times can be registered with agios_register_file, which gives back an integer key. Requests to that file can then be added, released and cancelled with agios_add_request_by_key, agios_release_request_by_key and agios_cancel_request_by_key, which do not have to hash or compare file handles.
+
+    All the functions above act on a single, default, AGIOS instance. Many independent instances (each one with its own configuration, scheduling algorithm and AGIOS thread) can be used in the same process by calling agios_init_ctx or agios_init_pull_mode_ctx instead, which give back an agios_ctx_t to be passed to the _ctx version of every function, and finally to agios_exit_ctx.
 */
 #pragma once 
 
@@ -19,10 +29,34 @@ enum {
 	RT_READ = 0,
 	RT_WRITE = 1,
 };
+/** \typedef agios_request_handle_t
+ *  \brief An opaque handle to a request, obtained from agios_add_request_with_handle. It is valid until the request is released or cancelled.
+ */
+struct request_t;
+typedef struct request_t *agios_request_handle_t;
+/** \typedef agios_ctx_t
+ *  \brief An opaque AGIOS instance, obtained from agios_init_ctx or agios_init_pull_mode_ctx. It is valid until given to agios_exit_ctx.
+ */
+struct agios_ctx_t;
+typedef struct agios_ctx_t agios_ctx_t;
+/** \struct agios_request_info_t
+ *  \brief Describes one request in a batch given to agios_add_requests. The fields have the same meaning as the arguments of agios_add_request.
+ */
+struct agios_request_info_t {
+	char *file_id; /**< the file handle, or NULL if the file is identified by file_key. */
+	int32_t file_key; /**< the key given by agios_register_file, only used if file_id is NULL. */
+	int32_t type; /**< RT_READ or RT_WRITE. */
+	int64_t offset; /**< position of the file to be accessed (in bytes). */
+	int64_t len; /**< size of the request (in bytes). */
+	int64_t identifier; /**< value given to the callback to identify this request. */
+	int32_t queue_id; /**< server or application identifier, only relevant for TWINS, WFQ and SW. */
+};
 bool agios_init(void * process_request_user(int64_t req_id), 
 		void * process_requests_user(int64_t *reqs, int32_t reqnb), 
 		char *config_file, 
 		int32_t max_queue_id);
+bool agios_init_pull_mode(char *config_file, int32_t max_queue_id);
+int32_t agios_next_requests(int64_t *reqs, int32_t max_reqnb, int64_t timeout_ns);
 void agios_exit(void);
 bool agios_add_request(char *file_id, 
 			int32_t type, 
@@ -30,6 +64,23 @@ bool agios_add_request(char *file_id,
 			int64_t len, 
 			int64_t identifier, 
 			int32_t queue_id);
+bool agios_add_request_with_handle(char *file_id, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle);
+bool agios_add_request_by_key(int32_t key, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle);
+bool agios_add_requests(struct agios_request_info_t *reqs, 
+			int32_t reqnb, 
+			agios_request_handle_t *handles);
 bool agios_release_request(char *file_id, 
 				int32_t type, 
 				int64_t len, 
@@ -38,6 +89,78 @@ bool agios_cancel_request(char *file_id,
 				int32_t type, 
 				int64_t len, 
 				int64_t offset);
+int32_t agios_register_file(char *file_id);
+bool agios_release_request_by_key(int32_t key, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset); 
+bool agios_cancel_request_by_key(int32_t key, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset);
+bool agios_release_request_by_handle(agios_request_handle_t handle);
+bool agios_cancel_request_by_handle(agios_request_handle_t handle);
+bool agios_release_requests(agios_request_handle_t *handles, int32_t reqnb);
+bool agios_release_request_batch(agios_request_handle_t handle);
+agios_ctx_t *agios_init_ctx(void * process_request_user(int64_t req_id), 
+			void * process_requests_user(int64_t *reqs, int32_t reqnb), 
+			char *config_file, 
+			int32_t max_queue_id);
+agios_ctx_t *agios_init_pull_mode_ctx(char *config_file, int32_t max_queue_id);
+int32_t agios_next_requests_ctx(agios_ctx_t *ctx, int64_t *reqs, int32_t max_reqnb, int64_t timeout_ns);
+void agios_exit_ctx(agios_ctx_t *ctx);
+bool agios_add_request_ctx(agios_ctx_t *ctx, 
+			char *file_id, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id);
+bool agios_add_request_with_handle_ctx(agios_ctx_t *ctx, 
+			char *file_id, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle);
+bool agios_add_request_by_key_ctx(agios_ctx_t *ctx, 
+			int32_t key, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle);
+bool agios_add_requests_ctx(agios_ctx_t *ctx, 
+			struct agios_request_info_t *reqs, 
+			int32_t reqnb, 
+			agios_request_handle_t *handles);
+bool agios_release_request_ctx(agios_ctx_t *ctx, 
+				char *file_id, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset); 
+bool agios_cancel_request_ctx(agios_ctx_t *ctx, 
+				char *file_id, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset);
+int32_t agios_register_file_ctx(agios_ctx_t *ctx, char *file_id);
+bool agios_release_request_by_key_ctx(agios_ctx_t *ctx, 
+				int32_t key, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset); 
+bool agios_cancel_request_by_key_ctx(agios_ctx_t *ctx, 
+				int32_t key, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset);
+bool agios_release_request_by_handle_ctx(agios_ctx_t *ctx, agios_request_handle_t handle);
+bool agios_cancel_request_by_handle_ctx(agios_ctx_t *ctx, agios_request_handle_t handle);
+bool agios_release_requests_ctx(agios_ctx_t *ctx, agios_request_handle_t *handles, int32_t reqnb);
+bool agios_release_request_batch_ctx(agios_ctx_t *ctx, agios_request_handle_t handle);
 #ifdef __cplusplus
 }
 #endif
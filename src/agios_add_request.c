@@ -1,34 +1,41 @@
 /*! \file agios_add_request.c
-    \brief Implementation of the agios_add_request function, used by the user to add requests to AGIOS.
+    \brief Implementation of the agios_add_request and agios_add_requests functions, used by the user to add requests to AGIOS.
 
     The request will be added to queues and statistics will be kept. The data structure used to keep the requests is either a timeline or the hashtable, depending on the currently used scheduling algorithm. 
     @see req_hashtable.c
     @see req_timeline.c
 */  
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "agios.h"
 #include "agios_add_request.h"
 #include "agios_config.h"
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "agios_request.h"
 #include "agios_thread.h"
 #include "common_functions.h"
 #include "data_structures.h"
+#include "file_registry.h"
 #include "hash.h"
+#include "mem_pool.h"
 #include "mylist.h"
 //#include "pattern_tracker.h"
 #include "process_request.h"
 #include "req_hashtable.h"
 #include "req_timeline.h"
 #include "scheduling_algorithms.h"
+#include "SJF.h"
 #include "statistics.h"
 #include "trace.h"
+#include "waiting_common.h"
 
 
-static int32_t g_last_timestamp=0; /**< We increase this number at every new request, just so each one of them has an unique identifier. */
+static _Atomic int64_t g_last_timestamp=0; /**< We increase this number at every new request, just so each one of them has an unique identifier. It is the global sequence number used to merge the shards of the timeline (@see req_timeline.c), so it is incremented atomically instead of under a lock. */
 
 /**
  * initializes the queue_statistics_t structure from a queue.
@@ -45,6 +52,7 @@ void init_queue_statistics(struct queue_statistics_t *stats)
 	stats->avg_time_between_requests = -1;
 	stats->avg_distance = -1;
 	stats->aggs_no = 0;
+	stats->avg_agg_size = -1;
 }
 /** 
  * initializes a queue (struct queue_t).
@@ -55,28 +63,37 @@ void init_queue(struct queue_t *queue,
 					struct file_t *req_file)
 {
 	init_agios_list_head(&queue->list);
+	agios_rb_init_root(&queue->index);
+	queue->index_max_len = 0;
 	init_agios_list_head(&queue->dispatch);
 	queue->req_file = req_file;
 	queue->laststartoff = 0;
 	queue->lastfinaloff = 0;
 	queue->predictedoff = 0;
 	queue->nextquantum = 0;
+	queue->sched_epoch = 0;
 	queue->current_size = 0;
+	queue->heap_index = -1;
 	queue->lastaggregation = 0;
 	queue->best_agg = 0;
 	queue->last_received_finaloffset = 0;
 	queue->shift_phenomena = 0;
 	queue->better_aggregation = 0;
+	queue->dispatch_batchnb = 0;
 	init_queue_statistics(&queue->stats);
 }
 /** 
  * Initializes a file_t structure about a file.
  * @param req_file the structure to be initialized.
  * @param file_id the file handle.
+ * @param hash the line of the hashtable where this file is.
+ * @param file_hash the hash of file_id, given by get_file_hash.
  * @return true or false for success
  */
 bool file_init(struct file_t *req_file, 
-			char *file_id)
+			char *file_id,
+			int32_t hash,
+			uint64_t file_hash)
 {
 	req_file->file_id = malloc(sizeof(char)*(strlen(file_id)+2));
 	if (!req_file->file_id) return false;
@@ -84,13 +101,18 @@ bool file_init(struct file_t *req_file,
 	req_file->first_request_time=0;
 	req_file->waiting_time = 0;
 	req_file->timeline_reqnb=0;
+	req_file->hash = hash;
+	req_file->file_hash = file_hash;
+	req_file->bucket_next = NULL;
+	init_agios_list_head(&req_file->activelist);
+	init_agios_list_head(&req_file->idlelist);
+	req_file->key = -1;
 	init_queue(&req_file->read_queue, req_file);
 	init_queue(&req_file->write_queue, req_file);
 	return true;
 }
 /**
- * Function to allocate and fill a new request struct, used by agios_add_request.
- * @param file_id the handle of the file.
+ * Function to allocate and fill a new request struct, used by agios_add_request. The request does not point to its file yet, that is done when it is added (@see request_attach_file).
  * @param type is RT_READ or RT_WRITE.
  * @param offset the position of the file being accessed.
  * @param len the size of the request.
@@ -100,8 +122,7 @@ bool file_init(struct file_t *req_file,
  * @see agios_request.h
  * @return the newly allocated and filled request structure, NULL if it failed.
  */
-struct request_t * request_constructor(char *file_id, 
-					int32_t type, 
+struct request_t * request_constructor(int32_t type, 
 					int64_t offset, 
 					int64_t len, 
 					int64_t identifier,  
@@ -111,29 +132,29 @@ struct request_t * request_constructor(char *file_id,
 	struct request_t *new; /**< The new request structure that will be returned */
 
 	//allocate memory
-	new = malloc(sizeof(struct request_t));
+	new = mem_pool_alloc(REQUEST_POOL);
 	if (!new) return NULL;
-	new->file_id = malloc(sizeof(char)*(strlen(file_id)+1));
-	if (!new->file_id) {
-		free(new);
-		return NULL;
-	}
-	//copy the file handle
-	strcpy(new->file_id, file_id);
 	//fill the structure
+	new->file_id = NULL;
 	new->queue_id = queue_id;
 	new->type = type;
 	new->user_id = identifier;
 	new->offset = offset;
 	new->len = len;
 	new->sched_factor = 0;
+	new->sched_epoch = 0;
+	new->sw_queue = NULL;
 	new->arrival_time = arrival_time;
+	new->dispatch_timestamp = 0;
+	new->dispatch_batch = 0;
+	atomic_init(&new->add_state, REQ_ADD_PENDING);
+	new->release_claimed = false;
 	new->reqnb = 1;
 	init_agios_list_head(&new->reqs_list);
 	new->agg_head=NULL;
-	g_last_timestamp++;
-	new->timestamp = g_last_timestamp;
+	new->timestamp = atomic_fetch_add_explicit(&g_last_timestamp, 1, memory_order_relaxed) + 1;
 	init_agios_list_head(&new->related);
+	agios_rb_init_node(&new->index_node);
 	return new;
 }
 /**
@@ -149,14 +170,15 @@ struct request_t *make_virtual_request(struct request_t *aggregation_head,
 	struct request_t *newreq; /**< the aggregated request we will create and fill and add to the hashtable. */
 
 	/*creates a new request to be the aggregation head by copying all its information*/
-	newreq = request_constructor(aggregation_head->file_id, 
-					aggregation_head->type, 
+	newreq = request_constructor(aggregation_head->type, 
 					aggregation_head->offset, 
 					aggregation_head->len, 
 					0, 
 					aggregation_head->arrival_time, 
 					aggregation_head->queue_id);
+	newreq->file_id = aggregation_head->file_id;
 	newreq->sched_factor = aggregation_head->sched_factor;
+	newreq->sched_epoch = aggregation_head->sched_epoch;
 	newreq->timestamp = aggregation_head->timestamp;
 	/*replaces the request on the hashtable*/
 	__agios_list_add(&newreq->related, prev, next);
@@ -175,12 +197,16 @@ void include_in_aggregation(struct request_t *req, struct request_t **agg_req)
 {
 	struct agios_list_head *prev; /**< prev and next define the position of the virtual request in the queue. */
 	struct agios_list_head *next;
+	struct request_t *single_req; /**< the request that is replaced by the virtual request. */
 
 	if ((*agg_req)->reqnb == 1) { /*agg_req is not a virtual request yet, we have to prepare it*/
-		prev = (*agg_req)->related.prev;
-		next = (*agg_req)->related.next;
-		agios_list_del(&((*agg_req)->related));
-		(*agg_req) = make_virtual_request((*agg_req), prev, next);
+		single_req = *agg_req;
+		prev = single_req->related.prev;
+		next = single_req->related.next;
+		agios_list_del(&single_req->related);
+		(*agg_req) = make_virtual_request(single_req, prev, next);
+		//the virtual request also takes its place in the index of the queue (if it is in the hashtable)
+		if (!agios_rb_empty_node(&single_req->index_node)) agios_rb_replace(&single_req->globalinfo->index, &single_req->index_node, &(*agg_req)->index_node);
 	}
 	if (req->offset <= (*agg_req)->offset) { /*it has to be inserted in the beginning*/
 		agios_list_add(&req->related, &((*agg_req)->reqs_list));
@@ -209,7 +235,7 @@ void join_aggregations(struct request_t **head, struct request_t **tail)
 	struct request_t *aux_req=NULL; /**< used to avoid moving a request before moving the iterator to the next one, otherwise the loop breaks. */
 
 	/*removes the tail from the queue*/
-	agios_list_del(&((*tail)->related));
+	request_del(*tail);
 	if ((*tail)->reqnb == 1) include_in_aggregation(*tail, head); /*the tail is not actually a virtual request*/
 	else { /*the tail is a virtual request*/
 		/*transfers all requests from this virtual request to the first one*/
@@ -224,18 +250,20 @@ void join_aggregations(struct request_t **head, struct request_t **tail)
 			agios_list_del(&aux_req->related);
 			include_in_aggregation(aux_req, head);
 		}
-		free(*tail);	/*we dont need this empty virtual request anymore*/
+		mem_pool_free(REQUEST_POOL, *tail);	/*we dont need this empty virtual request anymore*/
 		*tail = NULL;
 	} //end tail is a virtual request 
 }
 /**
  * upon the insertion of a new request, checks if it is possible to include it into an existing virtual request (if yes, perform the aggregations already).
+ * @param ctx the AGIOS instance.
  * @param req the new request.
  * @param insertion_place the position of the queue where it is going to be inserted
  * @param the head of the queue where it is going to be inserted.
  * @return true or false to tell if the request was added into an aggregation or not. If it wasn't, it still has to be inserted in the queue after this call.
  */
-int32_t insert_aggregations(struct request_t *req, 
+int32_t insert_aggregations(struct agios_ctx_t *ctx,
+				struct request_t *req, 
 				struct agios_list_head *insertion_place, 
 				struct agios_list_head *list_head)
 {
@@ -247,7 +275,8 @@ int32_t insert_aggregations(struct request_t *req,
 	if (insertion_place != list_head) {
 		/*if it is not the first request of the queue, we could aggregate it with the previous one*/
 		prev_req = agios_list_entry(insertion_place, struct request_t, related);
-		if (CHECK_AGGREGATE(prev_req, req) && ((prev_req->reqnb + req->reqnb) <= current_scheduler->max_aggreg_size)) { //if we should aggregate these requests
+		update_sched_factor(prev_req->globalinfo, prev_req); //it could receive sched_factors of other requests
+		if (CHECK_AGGREGATE(prev_req, req) && ((prev_req->reqnb + req->reqnb) <= ctx->current_scheduler->max_aggreg_size)) { //if we should aggregate these requests
 			if (req->reqnb > 1) join_aggregations(&prev_req, &req);
 			else include_in_aggregation(req,&prev_req);
 			insertion_place = &(prev_req->related);
@@ -255,14 +284,16 @@ int32_t insert_aggregations(struct request_t *req,
 			/*maybe this request is also contiguous to the next one, so we will join everything*/
 			if (insertion_place->next != list_head) { /*if the request was not to be the last of the queue*/
 				next_req = agios_list_entry(insertion_place->next, struct request_t, related);
-				if (CHECK_AGGREGATE(prev_req, next_req) && ((next_req->reqnb + prev_req->reqnb) <= current_scheduler->max_aggreg_size)) join_aggregations(&prev_req, &next_req); //if we should aggregate
+				update_sched_factor(next_req->globalinfo, next_req);
+				if (CHECK_AGGREGATE(prev_req, next_req) && ((next_req->reqnb + prev_req->reqnb) <= ctx->current_scheduler->max_aggreg_size)) join_aggregations(&prev_req, &next_req); //if we should aggregate
 			}
 		} //end if we should aggregate
 	} //end check aggregation with the previous one
 	if ((!aggregated) && (insertion_place->next != list_head)) {
 		/*if we could not aggregated with the previous one, or there is no previous one, and this request is not to be the last of the queue, lets try with the next one*/
 		next_req = agios_list_entry(insertion_place->next, struct request_t, related);
-		if (CHECK_AGGREGATE(req, next_req) && ((next_req->reqnb + req->reqnb) <= current_scheduler->max_aggreg_size)) { //if we should aggregate
+		update_sched_factor(next_req->globalinfo, next_req);
+		if (CHECK_AGGREGATE(req, next_req) && ((next_req->reqnb + req->reqnb) <= ctx->current_scheduler->max_aggreg_size)) { //if we should aggregate
 			if (req->reqnb > 1) join_aggregations(&req, &next_req); //we could be adding a virtual request (because we are migrating between data structures), and then if we get here we will not add this new request anywhere, we'll actually remove the next one and copy its requests to the new one's list. So we cannot return aggregated = 1, because we still need to add this request
 			else {
 				include_in_aggregation(req, &next_req);
@@ -275,112 +306,607 @@ int32_t insert_aggregations(struct request_t *req,
 /**
  * Allocates and initializes a new file_t structure about a file.
  * @param file_id the file handle.
+ * @param hash the line of the hashtable where this file is.
+ * @param file_hash the hash of file_id, given by get_file_hash.
  * @return the newly allocated and initialized structure, or NULL in case of error.
  */
-struct file_t * file_constructor(char *file_id)
+struct file_t * file_constructor(char *file_id, int32_t hash, uint64_t file_hash)
 {
 	struct file_t *req_file;
 
-	req_file = malloc(sizeof(struct file_t));
+	req_file = mem_pool_alloc(FILE_POOL);
 	if (!req_file) return NULL;
-	if (!file_init(req_file, file_id)) { //we enter the if if we had problems filling the structure, in that case cleanup
-		free(req_file);
+	if (!file_init(req_file, file_id, hash, file_hash)) { //we enter the if if we had problems filling the structure, in that case cleanup
+		mem_pool_free(FILE_POOL, req_file);
 		return NULL;
 	}
 	return req_file;
 }
 /** 
- * goes through a list of file_t structures searching for the given file_id. If such structure does not exist in the list, creates a new one and includes it. The caller MUST hold relevant lock (timeline or hashtable entry).
- * @param hash_list the list of file_t structures where we will look.
+ * looks in a line of the hashtable for the file_t structure of the given file_id. If such structure does not exist, creates a new one and includes it. The caller MUST hold relevant lock (timeline or hashtable entry).
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable where we will look.
+ * @param file_hash the hash of file_id, given by get_file_hash.
  * @param file_id the file handle.
  * @return a pointer to the found or newly allocated struct file_t of file_id. NULL in case of error.
  */
-struct file_t *find_req_file(struct agios_list_head *hash_list, 
+struct file_t *find_req_file(struct agios_ctx_t *ctx,
+					int32_t hash, 
+					uint64_t file_hash,
 					char *file_id)
 {
 	struct file_t *req_file; /**< pointer that will be returned with the relevant file information. */
-	bool found_file= false; /**< as the name suggests. */
-	bool found_higher_handle = false; /**< in case we stop iterating over the list because files have higher handles (since the list is ordered by file handle) */
 
-	agios_list_for_each_entry (req_file, hash_list, hashlist) { //look for it in the list
-		if (strcmp(req_file->file_id, file_id) >= 0) {
-			if (strcmp(req_file->file_id, file_id) == 0) found_file=true;
-			else found_higher_handle = true;
-			break; //since the list is ordered by file handle, we don't need to go through all files
-		}
-	} //end for all files in the list
-	if (!found_file) { //if we did not find it, make a new one
-		struct agios_list_head *insertion_place; /**< used to know where to insert the newly allocated file_t. */
-		if (found_higher_handle) insertion_place = &(req_file->hashlist);
-		else insertion_place = hash_list;
-		req_file = file_constructor(file_id);
+	req_file = hashtable_find_file(ctx, hash, file_hash, file_id);
+	if (!req_file) { //if we did not find it, make a new one
+		req_file = file_constructor(file_id, hash, file_hash);
 		if (!req_file) {
 			agios_print("PANIC! AGIOS could not allocate memory!\n");
 			return NULL;
 		}
-		agios_list_add_tail(&req_file->hashlist, insertion_place);
+		hashtable_add_file(ctx, req_file);
 	} //end if we did not find the structure
-	//update the file counter (that keeps track of how many files are being accessed right now
-	if (req_file->timeline_reqnb == 0) inc_current_filenb();
 	return req_file;
 }
+/**
+ * makes a new request point to the structure of the file it accesses, and updates information about the file. The caller MUST hold relevant lock (timeline or hashtable entry).
+ * @param ctx the AGIOS instance.
+ * @param req the new request.
+ * @param req_file the structure of the file accessed by req.
+ */
+static void request_attach_file(struct agios_ctx_t *ctx, struct request_t *req, struct file_t *req_file)
+{
+	req->file_id = req_file->file_id; //we don't need a copy of the file handle, the file structure will exist as long as the request
+	if (req->type == RT_READ) req->globalinfo = &req_file->read_queue;
+	else req->globalinfo = &req_file->write_queue;
+	/*if it is the first request to this file, we have to store its arrival time. */ 
+	if (req_file->first_request_time == 0) req_file->first_request_time = req->arrival_time;
+	//update the file counter (that keeps track of how many files are being accessed right now
+	if (req_file->timeline_reqnb == 0) inc_current_filenb(ctx);
+}
+/**
+ * adds a new request to the data structure being used by the current scheduling algorithm, and updates the file and queue counters. Statistics and the global request counter are NOT updated here. The caller must hold the adequate lock (@see acquire_adequate_lock).
+ * @param ctx the AGIOS instance.
+ * @param req the new request, filled by request_constructor.
+ * @param hash the line of the hashtable where information about its file is.
+ * @param req_file the structure of the file accessed by req.
+ */
+static void add_request_to_data_structure(struct agios_ctx_t *ctx, struct request_t *req, int32_t hash, struct file_t *req_file)
+{
+	request_attach_file(ctx, req, req_file);
+	migrate_file(ctx, req_file, false); //if requests are being migrated after a change of scheduling algorithm, the ones of this file are moved before adding a new one
+	if (ctx->current_scheduler->needs_hashtable) hashtable_add_req(ctx, req,hash,NULL);
+	else timeline_add_req(ctx, req, hash, NULL);
+	ctx->hashlist_reqcounter[hash]++;
+	req->globalinfo->current_size += req->len;
+	SJF_heap_update(ctx, req->globalinfo);
+	req->globalinfo->req_file->timeline_reqnb++;
+	hashtable_update_idle(ctx, req_file);
+	atomic_store_explicit(&req->add_state, REQ_ADDED, memory_order_release);
+}
+/**
+ * used by the functions that receive a handle to check if its request is in the data structures. When library_options.deferred_add is set, it may still be waiting to be added by the AGIOS thread (or it could not be added), and then these functions must not touch it.
+ * @param req the request.
+ * @return true if the request was added.
+ */
+bool request_is_added(struct request_t *req)
+{
+	return (atomic_load_explicit(&req->add_state, memory_order_acquire) == REQ_ADDED);
+}
+/**
+ * adds a new request to AGIOS (used by agios_add_request_with_handle_ctx and agios_add_request_by_key_ctx). 
+ * @param ctx the AGIOS instance.
+ * @param req the new request, filled by request_constructor. It is freed if this function fails.
+ * @param hash the line of the hashtable where information about its file is.
+ * @param file_hash the hash of file_id (only used when req_file is not given).
+ * @param file_id the file handle, used to find the file structure when req_file is not given.
+ * @param req_file the structure of the file accessed by req if it is already known (because the file was registered), NULL otherwise.
+ * @return true or false for success.
+ */
+static bool add_new_request(struct agios_ctx_t *ctx, struct request_t *req, int32_t hash, uint64_t file_hash, char *file_id, struct file_t *req_file)
+{
+	bool using_hashtable; /**< Used to control the used data structure in the case it is being changed while this function is running */
+
+	//acquire the lock for the right data structure (it depends on the current scheduling algorithm being used)
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	//find the file being accessed
+	if (!req_file) req_file = find_req_file(ctx, hash, file_hash, file_id);
+	if (!req_file) {
+		release_adequate_lock(ctx, hash, using_hashtable);
+		request_cleanup(req);
+		return false;
+	}
+	//add the request to the right data structure
+	add_request_to_data_structure(ctx, req, hash, req_file);
+	//update statistics
+	statistics_newreq(ctx, req);  
+	debug("current status: there are %d requests in the scheduler to %d files",ctx->current_reqnb, ctx->current_filenb);
+	//trace this request arrival
+	if (ctx->config.trace) agios_trace_add_request(ctx, req);  
+	//increase the number of current requests on the scheduler
+	inc_current_reqnb(ctx); 
+	// Signalize to the consumer thread that a new request was added. In the case of NOOP scheduler, the agios thread does nothing, we will return the request right away
+	if (ctx->current_alg != NOOP_SCHEDULER) {
+		signal_new_req_to_agios_thread(ctx); 
+		release_adequate_lock(ctx, hash, using_hashtable);
+	} else {
+		//if we are running the NOOP scheduler, we just give it back already
+		debug("NOOP is directly processing this request");
+		struct processing_info_t *info = process_requests_step1(ctx, req, hash);
+		generic_post_process(req);
+		release_adequate_lock(ctx, hash, using_hashtable);
+		process_requests_step2(ctx, info);
+	}
+	return true;
+}
+/**
+ * adds a chain of records to the queue of deferred additions. Any thread can do that at any time, it takes no lock. If the queue was empty, the AGIOS thread is woken up, otherwise it was already signaled and will take these records with the others.
+ * @param ctx the AGIOS instance.
+ * @param first the most recent record of the chain (the next ones are older).
+ * @param last the oldest record of the chain, its next is overwritten.
+ */
+static void defer_add(struct agios_ctx_t *ctx, struct deferred_add_t *first, struct deferred_add_t *last)
+{
+	struct deferred_add_t *head = atomic_load_explicit(&ctx->add_queue, memory_order_relaxed); /**< the last record that was added to the queue */
+
+	do {
+		last->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&ctx->add_queue, &head, first, memory_order_release, memory_order_relaxed));
+	if (!head) signal_new_req_to_agios_thread(ctx);
+}
+/**
+ * makes a record of a new request to be added later by the AGIOS thread. Used by the add functions when library_options.deferred_add is set.
+ * @param req the new request, filled by request_constructor.
+ * @param hash the line of the hashtable where information about its file is.
+ * @param file_hash the hash of file_id (only used when req_file is not given).
+ * @param file_id the file handle, copied if req_file is not given.
+ * @param req_file the structure of the file accessed by req if it was registered, NULL otherwise.
+ * @return the record, or NULL in case of error.
+ */
+static struct deferred_add_t *make_deferred_add(struct request_t *req, int32_t hash, uint64_t file_hash, char *file_id, struct file_t *req_file)
+{
+	struct deferred_add_t *record = mem_pool_alloc(DEFERRED_ADD_POOL); /**< the new record */
+
+	if (!record) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		return NULL;
+	}
+	record->req = req;
+	record->req_file = req_file;
+	record->file_id = NULL;
+	if ((!req_file) && (file_id)) { //file_id is only NULL when req_file is given, but the compiler cannot tell (and warns about strdup(NULL) when optimizing)
+		//the user may reuse the memory of the handle after we return, so we keep a copy for the AGIOS thread to find the file
+		record->file_id = strdup(file_id);
+		if (!record->file_id) {
+			agios_print("PANIC! AGIOS could not allocate memory!\n");
+			mem_pool_free(DEFERRED_ADD_POOL, record);
+			return NULL;
+		}
+	}
+	record->hash = hash;
+	record->file_hash = file_hash;
+	record->next = NULL;
+	return record;
+}
+/**
+ * frees a record of a deferred addition (but not its request).
+ * @param record the record.
+ */
+static void free_deferred_add(struct deferred_add_t *record)
+{
+	if (record->file_id) free(record->file_id);
+	mem_pool_free(DEFERRED_ADD_POOL, record);
+}
+/**
+ * records a new request to be added later by the AGIOS thread (used by agios_add_request_with_handle_ctx and agios_add_request_by_key_ctx when library_options.deferred_add is set).
+ * @see add_new_request for the parameters.
+ * @return true or false for success.
+ */
+static bool defer_new_request(struct agios_ctx_t *ctx, struct request_t *req, int32_t hash, uint64_t file_hash, char *file_id, struct file_t *req_file)
+{
+	struct deferred_add_t *record = make_deferred_add(req, hash, file_hash, file_id, req_file); /**< the new record */
+
+	if (!record) {
+		request_cleanup(req);
+		return false;
+	}
+	defer_add(ctx, record, record);
+	return true;
+}
 /** 
- * function called by the user to add a request to AGIOS.
+ * function called by the user to add a request to an AGIOS instance, obtaining a handle to it that can be later given to agios_release_request_by_handle_ctx or agios_cancel_request_by_handle_ctx.
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
  * @param file_id the file handle associated with the request.
  * @param type is RT_READ or RT_WRITE.
  * @param offset is the position of the file to be accessed (in bytes).
  * @param len is the size of the request (in bytes).
  * @param identifier is a 64-bit value that makes sense for the user to identify this request. It is the argument provided to the callback (so it must uniquely identify this request to the user).
  * @param queue_id is used for the TWINS and SW algorithms to be the identifier of the server or application, respectively. If not relevant, provide 0.
+ * @param handle will receive the handle to the request (NULL may be given if it is not needed). It is filled before the request is visible to the scheduler, so it is already valid when the callback is called for this request. It stops being valid after the request is released or cancelled.
  * @return true of false for success.
  */
-bool agios_add_request(char *file_id, 
+bool agios_add_request_with_handle_ctx(agios_ctx_t *ctx,
+			char *file_id, 
 			int32_t type, 
 			int64_t offset, 
 			int64_t len, 
 			int64_t identifier, 
-			int32_t queue_id)
+			int32_t queue_id,
+			agios_request_handle_t *handle)
 {
 	struct request_t *req;  /**< The request structure we will fill with the new request.*/
 	struct timespec arrival_time; /**< Filled with the time of arrival for this request */
 	int64_t timestamp; /**< It will receive a representation of arrival_time. */
-	int32_t hash = get_hashtable_position(file_id); /**< The position of the hashtable where information about this file is, calculated from the file handle. */ 
-	bool using_hashtable; /**< Used to control the used data structure in the case it is being changed while this function is running */
+	uint64_t file_hash; /**< the hash of file_id, computed only once for this request. */
 
 	//build the request_t structure and fill it for the new request, also add it to the current pattern in case we are using the pattern matching mechanism
 	agios_gettime(&(arrival_time));
 	timestamp = get_timespec2long(arrival_time);
 //	add_request_to_pattern(timestamp, offset, len, type, file_id); 
-	req = request_constructor(file_id, type, offset, len, identifier, timestamp, queue_id);
+	req = request_constructor(type, offset, len, identifier, timestamp, queue_id);
 	if (!req) return false;
-	//acquire the lock for the right data structure (it depends on the current scheduling algorithm being used)
-	using_hashtable = acquire_adequate_lock(hash);
-	//add the request to the right data structure
-	if (current_scheduler->needs_hashtable) hashtable_add_req(req,hash,NULL);
-	else timeline_add_req(req, hash, NULL);
-	//update counters and statistics
-	hashlist_reqcounter[hash]++;
-	req->globalinfo->current_size += req->len;
-	req->globalinfo->req_file->timeline_reqnb++;
-	statistics_newreq(req);  
-	debug("current status: there are %d requests in the scheduler to %d files",current_reqnb, current_filenb);
-	//trace this request arrival
-	if (config_trace_agios) agios_trace_add_request(req);  
-	//increase the number of current requests on the scheduler
-	inc_current_reqnb(); 
-	// Signalize to the consumer thread that a new request was added. In the case of NOOP scheduler, the agios thread does nothing, we will return the request right away
-	if (current_alg != NOOP_SCHEDULER) {
-		signal_new_req_to_agios_thread(); 
-		if (using_hashtable) hashtable_unlock(hash);
-		else timeline_unlock();
-	} else {
-		//if we are running the NOOP scheduler, we just give it back already
-		debug("NOOP is directly processing this request");
-		struct processing_info_t *info = process_requests_step1(req, hash);
-		generic_post_process(req);
-		if (using_hashtable) hashtable_unlock(hash);
-		else timeline_unlock();
-		process_requests_step2(info);
+	if (handle) *handle = req; //we give the handle before adding the request, because after that the agios thread may already process it
+	file_hash = get_file_hash(file_id);
+	if (ctx->config.deferred_add) return defer_new_request(ctx, req, get_hashtable_position(ctx, file_hash), file_hash, file_id, NULL);
+	return add_new_request(ctx, req, get_hashtable_position(ctx, file_hash), file_hash, file_id, NULL);
+}
+/** 
+ * function called by the user to add a request to the default AGIOS instance (the one started by agios_init), obtaining a handle to it.
+ * @see agios_add_request_with_handle_ctx
+ * @return true of false for success.
+ */
+bool agios_add_request_with_handle(char *file_id, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle)
+{
+	return agios_add_request_with_handle_ctx(default_ctx, file_id, type, offset, len, identifier, queue_id, handle);
+}
+/** 
+ * function called by the user to add a request to an AGIOS instance.
+ * @see agios_add_request_with_handle_ctx
+ * @return true of false for success.
+ */
+bool agios_add_request_ctx(agios_ctx_t *ctx,
+			char *file_id, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id)
+{
+	return agios_add_request_with_handle_ctx(ctx, file_id, type, offset, len, identifier, queue_id, NULL);
+}
+/** 
+ * function called by the user to add a request to the default AGIOS instance.
+ * @see agios_add_request_with_handle_ctx
+ * @return true of false for success.
+ */
+bool agios_add_request(char *file_id, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id)
+{
+	return agios_add_request_with_handle_ctx(default_ctx, file_id, type, offset, len, identifier, queue_id, NULL);
+}
+/** 
+ * function called by the user to add a request to a file that was registered with agios_register_file_ctx. It does the same as agios_add_request_with_handle_ctx, but the file is identified by its key, so its handle does not have to be hashed or compared to others.
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param key the key given by agios_register_file_ctx for the file accessed by the request.
+ * @see agios_add_request_with_handle_ctx for the other parameters.
+ * @return true of false for success.
+ */
+bool agios_add_request_by_key_ctx(agios_ctx_t *ctx,
+			int32_t key, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle)
+{
+	struct request_t *req;  /**< The request structure we will fill with the new request.*/
+	struct timespec arrival_time; /**< Filled with the time of arrival for this request */
+	struct file_t *req_file = get_registered_file(ctx, key); /**< the file accessed by the request */
+
+	if (!req_file) {
+		debug("PANIC! There is no file registered with the key %d", key);
+		return false;
 	}
-	return true;
+	agios_gettime(&(arrival_time));
+	req = request_constructor(type, offset, len, identifier, get_timespec2long(arrival_time), queue_id);
+	if (!req) return false;
+	if (handle) *handle = req; //we give the handle before adding the request, because after that the agios thread may already process it
+	if (ctx->config.deferred_add) return defer_new_request(ctx, req, req_file->hash, req_file->file_hash, NULL, req_file);
+	return add_new_request(ctx, req, req_file->hash, req_file->file_hash, NULL, req_file);
+}
+/** 
+ * function called by the user to add a request to a file registered with agios_register_file, in the default AGIOS instance.
+ * @see agios_add_request_by_key_ctx
+ * @return true of false for success.
+ */
+bool agios_add_request_by_key(int32_t key, 
+			int32_t type, 
+			int64_t offset, 
+			int64_t len, 
+			int64_t identifier, 
+			int32_t queue_id,
+			agios_request_handle_t *handle)
+{
+	return agios_add_request_by_key_ctx(default_ctx, key, type, offset, len, identifier, queue_id, handle);
+}
+/**
+ * compares two entries of a batch by line of the hashtable (and by position in the batch for the same line, so requests to the same line keep their order), used with qsort.
+ */
+int compare_batch_entries_by_hash(const void *a, const void *b)
+{
+	const struct batch_entry_t *first = a;
+	const struct batch_entry_t *second = b;
+
+	if (first->hash != second->hash) return (first->hash < second->hash) ? -1 : 1;
+	return (first->index < second->index) ? -1 : (first->index > second->index);
+}
+/**
+ * compares two entries of a batch by their position in the batch, used with qsort.
+ */
+static int compare_batch_entries_by_index(const void *a, const void *b)
+{
+	const struct batch_entry_t *first = a;
+	const struct batch_entry_t *second = b;
+
+	return (first->index < second->index) ? -1 : (first->index > second->index);
+}
+/**
+ * adds a batch of new requests to the data structures, taking each lock only once for all requests to files in the same line of the hashtable (or in the same shard when a timeline is being used). Used by agios_add_requests_ctx and by process_deferred_adds.
+ * @param ctx the AGIOS instance.
+ * @param entries the new requests, filled by request_constructor, in the order they were given. They are reordered by this function.
+ * @param reqnb the number of requests in entries.
+ * @param handles if not NULL, the handles given to the user (indexed by the index field of the entries), set to NULL for requests that could not be added.
+ * @return true or false for success. If the structure of a file could not be created, requests to that file were not added but the others were. These requests are freed, unless they were deferred additions: then the user already has their handles, so they are marked as REQ_ADD_FAILED and kept in ctx->failed_adds until agios_exit_ctx.
+ */
+static bool add_batch_entries(struct agios_ctx_t *ctx,
+			struct batch_entry_t *entries, 
+			int32_t reqnb, 
+			agios_request_handle_t *handles)
+{
+	struct request_t **group; /**< the requests being added to the same line, given together to statistics_newreqs. */
+	int32_t groupnb; /**< the number of requests in group. */
+	struct processing_info_t **infos; /**< when using the NOOP scheduler, the requests to be given back to the user. */
+	int32_t first = 0; /**< the first entry of the group being added. */
+	int32_t last; /**< one after the last entry of the group being added. */
+	bool using_hashtable; /**< Used to control the used data structure in the case it is being changed while this function is running */
+	bool sorted_by_hash; /**< are the entries (from first on) sorted by line of the hashtable or by their position in the batch? */
+	bool signal_agios_thread = false; /**< we only signal the agios thread once, after adding all requests. */
+	bool ret = true; /**< return of the function */
+
+	group = malloc(sizeof(struct request_t *)*reqnb);
+	infos = malloc(sizeof(struct processing_info_t *)*reqnb);
+	if ((!group) || (!infos)) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		free(group);
+		free(infos);
+		return false;
+	}
+	//when the hashtable is being used, we sort the requests by line so we can add each group holding its lock only once. With the timeline we keep the order given by the user. This is checked without a lock, so we may have to sort again later
+	sorted_by_hash = (ctx->current_scheduler) && (ctx->current_scheduler->needs_hashtable);
+	if (sorted_by_hash) qsort(entries, reqnb, sizeof(struct batch_entry_t), compare_batch_entries_by_hash);
+	//add the requests, one group for each line of the hashtable
+	while (first < reqnb) {
+		using_hashtable = acquire_adequate_lock(ctx, entries[first].hash);
+		if (using_hashtable != sorted_by_hash) { //the data structure is not the one we expected, so the remaining requests are in the wrong order 
+			if (using_hashtable) { //we are holding the lock to the wrong line, so we sort and try again
+				release_adequate_lock(ctx, entries[first].hash, true);
+				qsort(&entries[first], reqnb - first, sizeof(struct batch_entry_t), compare_batch_entries_by_hash);
+				sorted_by_hash = true;
+				continue;
+			} 
+			qsort(&entries[first], reqnb - first, sizeof(struct batch_entry_t), compare_batch_entries_by_index);
+			sorted_by_hash = false;
+		}
+		if (using_hashtable) {
+			for (last = first+1; (last < reqnb) && (entries[last].hash == entries[first].hash); last++);
+		} else { //the lock of a shard of the timeline protects all its lines of the hashtable (@see timeline_shard), so we add all the following requests to files in that shard in a single group (that is all remaining requests if the timeline is not sharded)
+			for (last = first+1; (last < reqnb) && (timeline_shard(ctx, entries[last].hash) == timeline_shard(ctx, entries[first].hash)); last++);
+		}
+		groupnb = 0;
+		for (int32_t i = first; i < last; i++) {
+			if (!entries[i].req_file) entries[i].req_file = find_req_file(ctx, entries[i].hash, entries[i].file_hash, entries[i].file_id);
+			if (!entries[i].req_file) { //we could not allocate the file structure, so this request will not be added
+				if (handles) handles[entries[i].index] = NULL;
+				if (ctx->config.deferred_add) { //the user may be holding a handle to it, so the functions that receive handles have to see it failed
+					atomic_store_explicit(&entries[i].req->add_state, REQ_ADD_FAILED, memory_order_release);
+					agios_list_add_tail(&entries[i].req->related, &ctx->failed_adds);
+				} else {
+					request_cleanup(entries[i].req);
+				}
+				entries[i].req = NULL;
+				ret = false;
+				continue;
+			}
+			add_request_to_data_structure(ctx, entries[i].req, entries[i].hash, entries[i].req_file);
+			group[groupnb++] = entries[i].req;
+			if (ctx->config.trace) agios_trace_add_request(ctx, entries[i].req);  
+		}
+		statistics_newreqs(ctx, group, groupnb);
+		inc_many_current_reqnb(ctx, groupnb);
+		debug("current status: there are %d requests in the scheduler to %d files",ctx->current_reqnb, ctx->current_filenb);
+		if (ctx->current_alg != NOOP_SCHEDULER) {
+			signal_agios_thread = true;
+			release_adequate_lock(ctx, entries[first].hash, using_hashtable);
+		} else {
+			//if we are running the NOOP scheduler, we just give them back already
+			debug("NOOP is directly processing %d requests", last - first);
+			for (int32_t i = 0; i < groupnb; i++) {
+				infos[i] = process_requests_step1(ctx, group[i], group[i]->globalinfo->req_file->hash);
+				generic_post_process(group[i]);
+			}
+			release_adequate_lock(ctx, entries[first].hash, using_hashtable);
+			for (int32_t i = 0; i < groupnb; i++) process_requests_step2(ctx, infos[i]);
+		}
+		first = last;
+	}
+	// Signalize to the consumer thread that new requests were added (unless we are the consumer thread, adding deferred requests)
+	if ((signal_agios_thread) && (!running_on_agios_thread(ctx))) signal_new_req_to_agios_thread(ctx); 
+	free(group);
+	free(infos);
+	return ret;
+}
+/**
+ * used to check, without taking them, if there are records in the queue of deferred additions.
+ * @param ctx the AGIOS instance.
+ * @return true if there are deferred additions to be processed.
+ */
+bool has_deferred_adds(struct agios_ctx_t *ctx)
+{
+	return (atomic_load_explicit(&ctx->add_queue, memory_order_relaxed) != NULL);
+}
+/**
+ * adds to the data structures all requests that were added to the queue of deferred additions until now. It is called by the AGIOS thread, so the threads that call the add functions do not compete for the locks of the data structures with the scheduling algorithm. Requests are added together as a batch (@see add_batch_entries), in the order they arrived. The caller must not hold any data structure lock.
+ * @param ctx the AGIOS instance.
+ */
+void process_deferred_adds(struct agios_ctx_t *ctx)
+{
+	struct deferred_add_t *record; /**< used to go over the records */
+	struct batch_entry_t *entries; /**< the new requests */
+	int32_t reqnb = 0; /**< the number of records */
+	int32_t i; /**< the position of a record in entries */
+
+	//take all records at once, new ones will be added to an empty queue
+	record = atomic_exchange_explicit(&ctx->add_queue, NULL, memory_order_acquire);
+	if (!record) return;
+	for (struct deferred_add_t *tmp = record; tmp; tmp = tmp->next) reqnb++;
+	entries = malloc(sizeof(struct batch_entry_t)*reqnb);
+	if (!entries) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		//give them back so we can try again later
+		struct deferred_add_t *last = record; /**< the oldest record */
+		while (last->next) last = last->next;
+		defer_add(ctx, record, last);
+		return;
+	}
+	//the queue gives them from the most recent one, but we want to add them in the order they arrived
+	i = reqnb-1;
+	for (struct deferred_add_t *tmp = record; tmp; tmp = tmp->next) {
+		entries[i].req = tmp->req;
+		entries[i].req_file = tmp->req_file;
+		entries[i].hash = tmp->hash;
+		entries[i].file_hash = tmp->file_hash;
+		entries[i].file_id = tmp->file_id;
+		entries[i].index = i;
+		i--;
+	}
+	if (!add_batch_entries(ctx, entries, reqnb, NULL)) agios_print("PANIC! AGIOS could not add some of the deferred requests\n");
+	free(entries);
+	while (record) {
+		struct deferred_add_t *next = record->next; /**< the next record */
+		free_deferred_add(record);
+		record = next;
+	}
+}
+/**
+ * frees all requests that are in the queue of deferred additions, without adding them, and the ones the AGIOS thread could not add. Called by agios_exit_ctx after the AGIOS thread has ended.
+ * @param ctx the AGIOS instance.
+ */
+void discard_deferred_adds(struct agios_ctx_t *ctx)
+{
+	struct deferred_add_t *record = atomic_exchange_explicit(&ctx->add_queue, NULL, memory_order_acquire); /**< used to go over the records */
+
+	while (record) {
+		struct deferred_add_t *next = record->next; /**< the next record */
+		request_cleanup(record->req);
+		free_deferred_add(record);
+		record = next;
+	}
+	list_of_requests_cleanup(&ctx->failed_adds);
+}
+/** 
+ * function called by the user to add many requests to an AGIOS instance at once. It has the same effect of calling agios_add_request_with_handle_ctx for each one of them, but it is cheaper: all requests receive the same arrival time, each lock is acquired only once for all requests to files in the same line of the hashtable (or once for all requests to files in the same shard when a timeline is being used), counters and statistics are updated once per line, and the agios thread is signaled only once. If library_options.deferred_add is set, the requests are only pushed together to the queue of deferred additions.
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param reqs the requests.
+ * @param reqnb the number of requests in reqs.
+ * @param handles if not NULL, a vector of reqnb positions that will receive the handles to the requests (in the same order as reqs). @see agios_add_request_with_handle_ctx
+ * @return true or false for success. If it fails because a request could not be created or a key was not registered, none of the requests were added. If it fails because the structure of a file could not be created, requests to that file were not added (their handles are NULL) but the others were.
+ */
+bool agios_add_requests_ctx(agios_ctx_t *ctx,
+			struct agios_request_info_t *reqs, 
+			int32_t reqnb, 
+			agios_request_handle_t *handles)
+{
+	struct batch_entry_t *entries; /**< the new requests, sorted by line of the hashtable. */
+	struct deferred_add_t *first_record = NULL; /**< with deferred additions, the chain of records of these requests (the last one first) */
+	struct deferred_add_t *last_record = NULL; /**< the first request of the chain */
+	struct timespec arrival_time; /**< Filled with the time of arrival for these requests */
+	int64_t timestamp; /**< It will receive a representation of arrival_time. */
+	bool ret; /**< return of the function */
+	
+	if (reqnb <= 0) return (reqnb == 0);
+	entries = malloc(sizeof(struct batch_entry_t)*reqnb);
+	if (!entries) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		return false;
+	}
+	//build all requests before acquiring any lock, they all arrived at the same time
+	agios_gettime(&(arrival_time));
+	timestamp = get_timespec2long(arrival_time);
+	for (int32_t i = 0; i < reqnb; i++) {
+		if (reqs[i].file_id) {
+			entries[i].req_file = NULL; //we will find it later, when holding the lock
+			entries[i].file_hash = get_file_hash(reqs[i].file_id);
+			entries[i].hash = get_hashtable_position(ctx, entries[i].file_hash);
+		} else { //a registered file
+			entries[i].req_file = get_registered_file(ctx, reqs[i].file_key);
+			if (entries[i].req_file) {
+				entries[i].hash = entries[i].req_file->hash;
+				entries[i].file_hash = entries[i].req_file->file_hash;
+			}
+		}
+		entries[i].file_id = reqs[i].file_id;
+		entries[i].req = request_constructor(reqs[i].type, reqs[i].offset, reqs[i].len, reqs[i].identifier, timestamp, reqs[i].queue_id);
+		if ((entries[i].req) && (entries[i].req_file || reqs[i].file_id) && (ctx->config.deferred_add)) { 
+			struct deferred_add_t *record = make_deferred_add(entries[i].req, entries[i].hash, entries[i].file_hash, entries[i].file_id, entries[i].req_file); /**< the record of this request */
+			if (record) { //the chain has the most recent one first, as the queue
+				record->next = first_record;
+				first_record = record;
+				if (!last_record) last_record = record;
+			} else {
+				request_cleanup(entries[i].req);
+				entries[i].req = NULL;
+			}
+		}
+		if ((!entries[i].req) || ((!reqs[i].file_id) && (!entries[i].req_file))) { //give up on the whole batch
+			debug("PANIC! Could not create request %d of the batch", i);
+			for (int32_t j = 0; j <= i; j++) if (entries[j].req) request_cleanup(entries[j].req);
+			while (first_record) {
+				struct deferred_add_t *next = first_record->next; /**< the next record */
+				free_deferred_add(first_record);
+				first_record = next;
+			}
+			free(entries);
+			return false;
+		}
+		entries[i].index = i;
+		if (handles) handles[i] = entries[i].req; //we give the handles before adding the requests, because after that the agios thread may already process them
+	}
+	if (ctx->config.deferred_add) { //the agios thread will add them
+		defer_add(ctx, first_record, last_record);
+		ret = true;
+	} else ret = add_batch_entries(ctx, entries, reqnb, handles);
+	free(entries);
+	return ret;
+}
+/** 
+ * function called by the user to add many requests to the default AGIOS instance at once.
+ * @see agios_add_requests_ctx
+ * @return true or false for success.
+ */
+bool agios_add_requests(struct agios_request_info_t *reqs, 
+			int32_t reqnb, 
+			agios_request_handle_t *handles)
+{
+	return agios_add_requests_ctx(default_ctx, reqs, reqnb, handles);
 }
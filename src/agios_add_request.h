@@ -3,9 +3,14 @@
 */  
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "agios_request.h"
 #include "mylist.h"
 
+struct agios_ctx_t;
+
 /**
  * says if two requests to the same file are contiguous or not.
  */
@@ -13,9 +18,53 @@
      ( (req->offset <= nextreq->offset)&& \
          ((req->offset+req->len)>=nextreq->offset))
 
-struct file_t *find_req_file(struct agios_list_head *hash_list, 
+/**
+ * an entry of a batch of requests given to agios_add_requests or agios_release_requests, used to sort them by line of the hashtable.
+ */
+struct batch_entry_t {
+	struct request_t *req; /**< the request. */
+	struct file_t *req_file; /**< the file accessed by the request (when known). */
+	int32_t hash; /**< the line of the hashtable where information about its file is. */
+	uint64_t file_hash; /**< the hash of the file handle, if the file structure is not known. */
+	char *file_id; /**< the file handle, if the file structure is not known. */
+	int32_t index; /**< the position of the request in the batch given by the user. */
+};
+
+/** \struct deferred_add_t
+ *  \brief A new request whose addition was deferred to the AGIOS thread (when library_options.deferred_add is set).
+ */
+struct deferred_add_t {
+	struct deferred_add_t *next; /**< the next record in the queue of deferred additions */
+	struct request_t *req; /**< the new request, filled by request_constructor */
+	struct file_t *req_file; /**< the file accessed by the request, if it was registered */
+	char *file_id; /**< a copy of the file handle, if the file was not registered */
+	int32_t hash; /**< the line of the hashtable where information about the file is */
+	uint64_t file_hash; /**< the hash of file_id, if it is used */
+};
+
+int compare_batch_entries_by_hash(const void *a, const void *b);
+void init_queue_statistics(struct queue_statistics_t *stats);
+bool file_init(struct file_t *req_file, 
+			char *file_id,
+			int32_t hash,
+			uint64_t file_hash);
+struct request_t * request_constructor(int32_t type, 
+					int64_t offset, 
+					int64_t len, 
+					int64_t identifier,  
+					int64_t arrival_time, 
+					int32_t queue_id);
+struct file_t *find_req_file(struct agios_ctx_t *ctx,
+					int32_t hash, 
+					uint64_t file_hash,
 					char *file_id);
-int32_t insert_aggregations(struct request_t *req, 
+int32_t insert_aggregations(struct agios_ctx_t *ctx,
+				struct request_t *req, 
 				struct agios_list_head *insertion_place, 
 				struct agios_list_head *list_head);
 void include_in_aggregation(struct request_t *req, struct request_t **agg_req);
+void join_aggregations(struct request_t **head, struct request_t **tail);
+bool request_is_added(struct request_t *req);
+bool has_deferred_adds(struct agios_ctx_t *ctx);
+void process_deferred_adds(struct agios_ctx_t *ctx);
+void discard_deferred_adds(struct agios_ctx_t *ctx);
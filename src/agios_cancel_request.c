@@ -8,140 +8,299 @@
 #include <string.h>
 
 #include "agios.h"
+#include "agios_add_request.h"
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "common_functions.h"
 #include "data_structures.h"
+#include "file_registry.h"
 #include "hash.h"
 #include "mylist.h"
 #include "req_hashtable.h"
 #include "req_timeline.h"
+#include "SJF.h"
 
-/** 
- * function used to remove a request from the scheduling queues
- * @param file_id the file handle associated with the request.
- * @param type is RT_READ or RT_WRITE.
+/**
+ * updates information about the file and request counters for a request that is no longer in the scheduling queues, and frees it. The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param req the request being cancelled (request_cleanup will remove it from its queue).
+ * @param hash the position of the hashtable where information about the file is.
+ */
+static void cancel_this_request(struct agios_ctx_t *ctx, struct request_t *req, int32_t hash)
+{
+	struct queue_t *queue = req->globalinfo; /**< the queue of the request. */
+	struct file_t *req_file = req->globalinfo->req_file; /**< the file accessed by the request. */
+
+	req->globalinfo->current_size -= req->len;
+	req->globalinfo->req_file->timeline_reqnb--;
+	if (req->globalinfo->req_file->timeline_reqnb == 0) dec_current_filenb(ctx);
+	dec_current_reqnb(ctx, hash);
+	//finally, free the structure
+	request_cleanup(req);
+	hashtable_update_active(ctx, req_file); //in case it was the last request in the queues of the file (it does nothing if requests are in the timeline)
+	SJF_heap_update(ctx, queue);
+	hashtable_update_idle(ctx, req_file);
+}
+/**
+ * removes a request from inside a virtual request, updating the virtual request information (and transforming it back into a single request if it was left with only one sub-request), and then frees it. The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param req the virtual request.
+ * @param aux_req the request being cancelled, which is part of req.
+ * @param hash the position of the hashtable where information about the file is.
+ */
+static void cancel_from_virtual_request(struct agios_ctx_t *ctx, struct request_t *req, struct request_t *aux_req, int32_t hash)
+{
+	bool first; /**< used to mark the first subrequest we visit */
+	struct request_t *tmp; /**< used to iterate over all sub-requests of this virtual request to update its information */
+	int64_t timestamp = req->timestamp; /**< the timestamp of the virtual request before the cancel */
+
+	//remove it from the virtual request
+	agios_list_del(&aux_req->related);
+	//we need to update offset and len for the aggregated request without this one (and also timestamp)
+	first = true; 
+	//we will recalculate offset and len of the aggregation by going over all sub-requests
+	agios_list_for_each_entry (tmp, &req->reqs_list, related) {
+		if (first) {
+			first = false;
+			req->offset = tmp->offset;
+			req->len = tmp->len;
+			req->arrival_time = tmp->arrival_time;
+			req->timestamp = tmp->timestamp;
+		} else {
+			if (tmp->offset < req->offset) {
+				req->len += req->offset - tmp->offset;
+				req->offset = tmp->offset;
+			}
+			if ((tmp->offset + tmp->len) > (req->offset + req->len)) {
+				req->len += (tmp->offset + tmp->len) - (req->offset + req->len);
+			}
+			if (tmp->arrival_time < req->arrival_time) req->arrival_time = tmp->arrival_time;
+			if (tmp->timestamp < req->timestamp) req->timestamp = tmp->timestamp;
+		}	
+	} //end for all requests inside this virtual request
+	//in the timeline, the timestamp of a request tells its place (the shards are merged by timestamp, and TO-agg aggregates to the oldest request it can), and the virtual request does not move, so it keeps its timestamp (@see req_timeline.c)
+	if (!ctx->current_scheduler->needs_hashtable) req->timestamp = timestamp;
+	//now let's update aggregated request information
+	req->reqnb--;
+	if (!ctx->current_scheduler->needs_hashtable) timeline_update_index(req); //its offset and len changed, so its place in the index of its queue may have changed (@see req_timeline.c)
+	if (req->reqnb == 1) { //it was a virtual request, now it's not anymore
+		struct agios_list_head *prev, *next; /**< used to place the sub-request in the place of the virtual request in the queue */
+		//remove the virtual request from the queue and add its only request in its place
+		prev = req->related.prev;
+		next = req->related.next;
+		agios_list_del(&req->related);
+		tmp = agios_list_entry(req->reqs_list.next, struct request_t, related);
+		__agios_list_add(&tmp->related, prev, next);
+		if (!agios_rb_empty_node(&req->index_node)) agios_rb_replace(&req->globalinfo->index, &req->index_node, &tmp->index_node); //also in the index of the queue
+		tmp->agg_head = NULL; //it is a single request again
+		tmp->timestamp = req->timestamp; //it takes the place of the virtual request
+		req->reqnb = 1; //otherwise the request_cleanup function will try to free the sub requests, that is not what we want here
+		request_cleanup(req);
+	}
+	//the request is out of the queue, so now we update information about the file and request counters
+	cancel_this_request(ctx, aux_req, hash);
+}
+/**
+ * looks for a request in a list of requests and removes it. The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param list the list, a queue of the hashtable or a list of the timeline (that has requests to all files).
+ * @param related the queue of the file for the type of the request.
  * @param len is the size of the request (in bytes).
  * @param offset is the position of the file to be accessed (in bytes).
- * @return true or false for success 
+ * @param hash the position of the hashtable where information about the file is.
+ * @return true if the request was found.
  */
-//removes a request from the scheduling queues
-//returns 1 if success
-bool agios_cancel_request(char *file_id, 
-			int32_t type, 
-			int64_t len, 
-			int64_t offset)  
+static bool cancel_request_from_list(struct agios_ctx_t *ctx,
+					struct agios_list_head *list,
+					struct queue_t *related,
+					int64_t len,
+					int64_t offset,
+					int32_t hash)
 {
-	struct file_t *req_file; /**< used to look for information about the file accessed by the request */
-	int32_t hash = get_hashtable_position(file_id); /**< the position of the hashtable where information about the file is */ 
-	struct agios_list_head *list; /**< used to iterate over the line of the hashtable, and then over the queue */
-	struct request_t *req; /**< used to iterate over the queue */
+	struct request_t *req; /**< used to iterate over the list */
 	struct request_t *aux_req; /**< used to iterate over the requests inside a virtual request */
-	bool found=false;
-	bool using_hashtable;
 
-	PRINT_FUNCTION_NAME;
-	//first acquire lock, we need to be careful because the data structure might me migrated while we are trying to do that
-	using_hashtable = acquire_adequate_lock(hash);
-	//now we have the appropriated lock
-	list = &hashlist[hash];
-	//find the structure for this file 
-	agios_list_for_each_entry (req_file, list, hashlist) {
-		if (strcmp(req_file->file_id, file_id) == 0) {
-			found = true;
-			break;
-		}
-	}
-	if (!found) { //that makes no sense, we are trying to cancel a request which was never added!!!
-		debug("PANIC! We cannot find the file structure for this request %s", file_id);
-		if (using_hashtable) hashtable_unlock(hash);
-		else timeline_unlock();
-		return false;
-	}
-	debug("REMOVING a request from file %s:", req_file->file_id );
-	//get the relevant queue
-	if (using_hashtable) {
-		if (type == RT_WRITE) list = &req_file->write_queue.list;
-		else list = &req_file->read_queue.list;
-	} else list = &timeline;
 	//find the request in the queue and remove it
-	found = false;
 	agios_list_for_each_entry (req, list, related) { //linearly search for this request in the queue. To each request in the queue, there are two possibilities: either it is a simple request, than we can just compare, or it is a virtual request, than we might have to look into the sub-requests of the virtual one
+		if (req->globalinfo != related) continue; //in the timeline we have requests to all files
 		if (req->reqnb == 1) { //simple request
 			if ((req->len == len) && (req->offset == offset)) {
 				//we found it
-				found = true;
-				//update information about the file and request counters
-				req->globalinfo->current_size -= req->len;
-				req->globalinfo->req_file->timeline_reqnb--;
-				if (req->globalinfo->req_file->timeline_reqnb == 0) dec_current_filenb();
-				dec_current_reqnb(hash);
-	 			//finally, free the structure
-				request_cleanup(req);
-				break;
+				cancel_this_request(ctx, req, hash);
+				return true;
 			}
 		} else { //aggregated request, the one we're looking for could be inside it
 			if ((req->offset <= offset) && (req->offset + req->len >= offset+len)) { //no need to look if the request we're looking for is not inside this one
 				agios_list_for_each_entry (aux_req, &req->reqs_list, related) {
 					if ((aux_req->len == len) && (aux_req->offset == offset)) {
-						bool first; /**< used to mark the first subrequest we visit */
-						struct request_t *tmp; /**< used to iterate over all sub-requests of this virtual request to update its information */
 						//we found it
-						found = true;
-						//remove it from the virtual request
-						agios_list_del(&aux_req->related);
-						//we need to update offset and len for the aggregated request without this one (and also timestamp)
-						first = true; 
-						//we will recalculate offset and len of the aggregation by going over all sub-requests
-						agios_list_for_each_entry (tmp, &req->reqs_list, related) {
-							if (first) {
-								first = false;
-								req->offset = tmp->offset;
-								req->len = tmp->len;
-								req->arrival_time = tmp->arrival_time;
-								req->timestamp = tmp->timestamp;
-							} else {
-								if (tmp->offset < req->offset) {
-									req->len += req->offset - tmp->offset;
-									req->offset = tmp->offset;
-								}
-								if ((tmp->offset + tmp->len) > (req->offset + req->len)) {
-									req->len += (tmp->offset + tmp->len) - (req->offset + req->len);
-								}
-								if (tmp->arrival_time < req->arrival_time) req->arrival_time = tmp->arrival_time;
-								if (tmp->timestamp < req->timestamp) req->timestamp = tmp->timestamp;
-							}	
-						} //end for all requests inside this virtual request
-						//now let's update aggregated request information
-						req->reqnb--;
-						if (req->reqnb == 1) { //it was a virtual request, now it's not anymore
-							struct agios_list_head *prev, *next; /**< used to place the sub-request in the place of the virtual request in the queue */
-							//remove the virtual request from the queue and add its only request in its place
-							prev = req->related.prev;
-							next = req->related.next;
-							agios_list_del(&req->related);
-							tmp = agios_list_entry(req->reqs_list.next, struct request_t, related);
-							__agios_list_add(&tmp->related, prev, next);
-							req->reqnb = 1; //otherwise the request_cleanup function will try to free the sub requests, that is not what we want here
-							request_cleanup(req);
-						}
-						//the request is out of the queue, so now we update information about the file and request counters
-						aux_req->globalinfo->current_size -= aux_req->len;
-						aux_req->globalinfo->req_file->timeline_reqnb--;
-						if(aux_req->globalinfo->req_file->timeline_reqnb == 0)
-							dec_current_filenb();
-						dec_current_reqnb(hash);
-				 		//finally, free the structure
-						request_cleanup(aux_req);
-						break;
+						cancel_from_virtual_request(ctx, req, aux_req, hash);
+						return true;
 					}
 				} //end for all requests inside the virtual request
-				if (found) break; 
 			} //end if request is inside a virtual request
 		} //end comparing to a virtual request
 	} //end going over all requests in the queue
-	if (!found) debug("PANIC! Could not find the request %ld %ld to file %s\n", offset, len, file_id);
+	return false;
+}
+/**
+ * looks for a request in the scheduling queues and removes it. The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param req_file the file accessed by the request.
+ * @param using_hashtable true if requests are in the hashtable, false if they are in the timeline.
+ * @param type is RT_READ or RT_WRITE.
+ * @param len is the size of the request (in bytes).
+ * @param offset is the position of the file to be accessed (in bytes).
+ */
+static void cancel_request_from_file(struct agios_ctx_t *ctx,
+					struct file_t *req_file, 
+					bool using_hashtable, 
+					int32_t type, 
+					int64_t len, 
+					int64_t offset)
+{
+	struct queue_t *related; /**< the queue of the file for this type of request */
+	int32_t hash = req_file->hash; /**< the position of the hashtable where information about the file is */ 
+	bool found = false;
+
+	debug("REMOVING a request from file %s:", req_file->file_id );
+	migrate_file(ctx, req_file, true); //if requests are being migrated after a change of scheduling algorithm, the ones of this file are moved so we look in a single place
+	//get the relevant queue
+	if (type == RT_WRITE) related = &req_file->write_queue;
+	else related = &req_file->read_queue;
+	if (using_hashtable) found = cancel_request_from_list(ctx, &related->list, related, len, offset, hash);
+	else if (ctx->current_scheduler->multi_timeline) { //TWINS and WFQ keep a queue for each queue_id, and we do not know the one of this request
+		for (int32_t i = 0; (i < ctx->multi_timeline_size) && (!found); i++) found = cancel_request_from_list(ctx, &ctx->multi_timeline[i], related, len, offset, hash);
+	} else found = cancel_request_from_list(ctx, &ctx->timeline_shards[timeline_shard(ctx, hash)].list, related, len, offset, hash);
+	if (!found) debug("PANIC! Could not find the request %ld %ld to file %s\n", offset, len, req_file->file_id);
+}
+/** 
+ * function used to remove a request from the scheduling queues
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param file_id the file handle associated with the request.
+ * @param type is RT_READ or RT_WRITE.
+ * @param len is the size of the request (in bytes).
+ * @param offset is the position of the file to be accessed (in bytes).
+ * @return false if AGIOS has no structure for the file (no request to it was added, or it was evicted), true otherwise, even if no queued request matched (that is only reported in debug mode).
+ */
+bool agios_cancel_request_ctx(agios_ctx_t *ctx,
+			char *file_id, 
+			int32_t type, 
+			int64_t len, 
+			int64_t offset)  
+{
+	struct file_t *req_file; /**< used to look for information about the file accessed by the request */
+	uint64_t file_hash = get_file_hash(file_id); /**< the hash of the file handle */
+	int32_t hash = get_hashtable_position(ctx, file_hash); /**< the position of the hashtable where information about the file is */ 
+	bool using_hashtable;
+
+	PRINT_FUNCTION_NAME;
+	//first acquire the lock of the data structure being used (it cannot be migrated while we hold it)
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	//now we have the appropriated lock
+	//find the structure for this file 
+	req_file = hashtable_find_file(ctx, hash, file_hash, file_id);
+	if (!req_file) { //that makes no sense, we are trying to cancel a request which was never added!!!
+		debug("PANIC! We cannot find the file structure for this request %s", file_id);
+		release_adequate_lock(ctx, hash, using_hashtable);
+		return false;
+	}
+	cancel_request_from_file(ctx, req_file, using_hashtable, type, len, offset);
+	//release data structure lock
+	release_adequate_lock(ctx, hash, using_hashtable);
+	return true;
+}
+/** 
+ * function used to remove a request from the scheduling queues of the default AGIOS instance (the one started by agios_init).
+ * @see agios_cancel_request_ctx
+ * @return true or false for success 
+ */
+bool agios_cancel_request(char *file_id, 
+			int32_t type, 
+			int64_t len, 
+			int64_t offset)  
+{
+	return agios_cancel_request_ctx(default_ctx, file_id, type, len, offset);
+}
+/** 
+ * function used to remove from the scheduling queues a request to a file registered with agios_register_file. It does the same as agios_cancel_request, but the file structure is found directly from the key.
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param key is the key given by agios_register_file.
+ * @param type is RT_READ or RT_WRITE.
+ * @param len is the size of the request (in bytes).
+ * @param offset is the position of the file to be accessed (in bytes).
+ * @return false if no file is registered with the key, true otherwise, even if no queued request matched (that is only reported in debug mode).
+ */
+bool agios_cancel_request_by_key_ctx(agios_ctx_t *ctx,
+			int32_t key, 
+			int32_t type, 
+			int64_t len, 
+			int64_t offset)  
+{
+	struct file_t *req_file = get_registered_file(ctx, key); /**< the file accessed by the request */
+	bool using_hashtable;
+
+	PRINT_FUNCTION_NAME;
+	if (!req_file) {
+		debug("PANIC! There is no file registered with the key %d", key);
+		return false;
+	}
+	//first acquire the lock of the data structure being used (it cannot be migrated while we hold it)
+	using_hashtable = acquire_adequate_lock(ctx, req_file->hash);
+	cancel_request_from_file(ctx, req_file, using_hashtable, type, len, offset);
 	//release data structure lock
-	if (using_hashtable) hashtable_unlock(hash);
-	else timeline_unlock();
+	release_adequate_lock(ctx, req_file->hash, using_hashtable);
 	return true;
 }
+/** 
+ * function used to remove from the scheduling queues of the default AGIOS instance a request to a file registered with agios_register_file.
+ * @see agios_cancel_request_by_key_ctx
+ * @return true or false for success 
+ */
+bool agios_cancel_request_by_key(int32_t key, 
+			int32_t type, 
+			int64_t len, 
+			int64_t offset)  
+{
+	return agios_cancel_request_by_key_ctx(default_ctx, key, type, len, offset);
+}
+/** 
+ * function used to remove from the scheduling queues a request that was added with agios_add_request_with_handle. Since we have a pointer to the request, we don't have to look for it.
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param handle the handle obtained when adding the request. It is no longer valid after this call (if it succeeds).
+ * @return true or false for success. It fails if the request was already sent back to the user for processing (in that case it must be released with agios_release_request_by_handle), and, if library_options.deferred_add is set, while the request is still waiting to be added by the AGIOS thread (or if it could not be added), because then it is not in the queues.
+ */
+bool agios_cancel_request_by_handle_ctx(agios_ctx_t *ctx, agios_request_handle_t handle)
+{
+	struct request_t *req = handle; /**< the request being cancelled. */
+	int32_t hash; /**< the position of the hashtable where information about the file is */ 
+	bool ret = true; /**< return of the function */
+	bool using_hashtable;
+
+	PRINT_FUNCTION_NAME;
+	if ((!req) || (!request_is_added(req))) return false;
+	hash = req->globalinfo->req_file->hash;
+	//first acquire the lock of the data structure being used (it cannot be migrated while we hold it)
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	if (req->dispatch_timestamp == 0) migrate_file(ctx, req->globalinfo->req_file, true); //the request may still be in the data structure of the previous scheduling algorithm
+	if (req->dispatch_timestamp != 0) { //it is too late, the request was already given back to the user
+		debug("PANIC! Could not cancel the request %ld %ld to file %s because it was already processed\n", req->offset, req->len, req->file_id);
+		ret = false;
+	} else if (req->agg_head) { //it is part of a virtual request
+		cancel_from_virtual_request(ctx, req->agg_head, req, hash);
+	} else { //it is a single request in the queue
+		cancel_this_request(ctx, req, hash);
+	}
+	//release data structure lock
+	release_adequate_lock(ctx, hash, using_hashtable);
+	return ret;
+}
+/** 
+ * function used to remove from the scheduling queues of the default AGIOS instance a request that was added with agios_add_request_with_handle.
+ * @see agios_cancel_request_by_handle_ctx
+ * @return true or false for success. It fails if the request was already sent back to the user for processing (in that case it must be released with agios_release_request_by_handle).
+ */
+bool agios_cancel_request_by_handle(agios_request_handle_t handle)
+{
+	return agios_cancel_request_by_handle_ctx(default_ctx, handle);
+}
@@ -8,36 +8,53 @@
 #include <string.h>
 
 #include "agios_config.h"
+#include "agios_ctx.h"
 #include "common_functions.h"
 #include "scheduling_algorithms.h"
 
-int32_t config_agios_default_algorithm = SJF_SCHEDULER;	/**< scheduling algorithm to be used (the identifier of the scheduling algorithm) */
-int32_t config_agios_max_trace_buffer_size = 1*1024*1024; /**< in bytes. A buffer is used to keep trace messages before going to the file, to avoid small writes to the disk and decrease tracing overhead. This parameter gives the size allocated for the buffer. */
-int32_t config_agios_performance_values = 5; /**< for how many of the last scheduling algorithm selections should we keepperformance metrics. */
-int64_t config_agios_select_algorithm_period=-1;	/**< if the scheduling algorithm is dynamic (meaning it will actually select other scheduling algorithms during the execution, this parameter defines the periodicity to change the scheduling algorithm during the execution. */
-int32_t config_agios_select_algorithm_min_reqnumber=1;	/**< if the scheduling algorithm is dynamic (meaning it will actually select other scheduling algorithms during the execution, this parameter defines how many requests have to be treated during a period before a new scheduling algorithm can be selected. */
-int32_t config_agios_starting_algorithm = SJF_SCHEDULER; /**< if the scheduling algorithm is dynamic (meaning it will actually select other scheduling algorithms during the execution, this is the scheduling algorithm that will be used whenever a decision cannot be made (possibly because there is not enough information */
-int32_t config_aioli_quantum = 8192;			/**< in bytes, how much of a queue can be processed before going to the next one (used by aIOLi) */
-int32_t config_mlf_quantum = 8192;			/**< similar to config_aioli_quantum */ 
-int64_t config_sw_size = 1000000000L;			/**< the window size used for the SW scheduling algorithm */
-bool config_trace_agios=false;				/**< will agios create a trace file will all requests arrivals? */
-char *config_trace_agios_file_prefix=NULL; 		/**< if creating trace files, they will be named config_trace_agios_file_prefix.*.config_trace_agios_file_sufix. The value in the middle of prefix and sufix is a counter, the library will check for existing files so they are not overwritten. */
-char *config_trace_agios_file_sufix=NULL;		/**< @see config_trace_agios_file_prefix */
-int64_t config_twins_window=1000000L; 		/**< The amount of time TWINS will stay in one queue before moving on to the next one (in nanoseconds). The default is 1ms */
-int32_t config_waiting_time = 900000;			/**< when there are no requests, the scheduler sleep using this as a timeout. It is also used by aIOLi to wait if it thinks better aggregations are possible */
-char *config_wfq_conf_file=NULL; /**< full path to the wfq conf file*/
-
+/**
+ * fills a configuration with the default values of all parameters, which are used when they are not given in the configuration file.
+ * @param config the configuration of an AGIOS instance.
+ */
+void set_default_config_parameters(struct agios_config_t *config)
+{
+	config->default_algorithm = SJF_SCHEDULER;
+	config->max_trace_buffer_size = 1*1024*1024;
+	config->preallocated_requests = 0;
+	config->expected_files = 0;
+	config->timeline_shards = 16;
+	config->max_idle_files = -1;
+	config->idle_file_timeout = -1;
+	config->keep_evicted_file_stats = true;
+	config->pull_ring_size = 1024;
+	config->deferred_add = false;
+	config->deferred_release = false;
+	config->performance_values = 5;
+	config->select_algorithm_period = -1;
+	config->select_algorithm_min_reqnumber = 1;
+	config->starting_algorithm = SJF_SCHEDULER;
+	config->aioli_quantum = 8192;
+	config->mlf_quantum = 8192;
+	config->sw_size = 1000000000L;
+	config->trace = false;
+	config->trace_file_prefix = NULL;
+	config->trace_file_sufix = NULL;
+	config->twins_window = 1000000L;
+	config->waiting_time = 900000;
+	config->wfq_conf_file = NULL;
+}
  /**
  * used to clean all memory allocated for the configuration parameters (at the end of the execution).
+ * @param config the configuration of an AGIOS instance.
  */
-void cleanup_config_parameters(void)
+void cleanup_config_parameters(struct agios_config_t *config)
 {
-	if(config_trace_agios_file_prefix)
-		free(config_trace_agios_file_prefix);
-	if(config_trace_agios_file_sufix)
-		free(config_trace_agios_file_sufix);
-	if(config_wfq_conf_file)
-		free(config_wfq_conf_file);
+	if(config->trace_file_prefix)
+		free(config->trace_file_prefix);
+	if(config->trace_file_sufix)
+		free(config->trace_file_sufix);
+	if(config->wfq_conf_file)
+		free(config->wfq_conf_file);
 }
 /**
  * simple function that receives an int and returns a bool version of it. Used while reading the parameters (because libconfig does not have a bool type).
@@ -61,27 +78,39 @@ void config_print_flag(bool flag, const char *message)
 }
 /**
  * function called during the initialization to print configuration parameters that will be used by AGIOS.
+ * @param config the configuration of an AGIOS instance.
  */
-void config_print(void)
+void config_print(struct agios_config_t *config)
 {
-	agios_just_print("Scheduling algorithm: %s\n", get_algorithm_name_from_index(config_agios_default_algorithm)); 
-	agios_just_print("If the scheduling algorithm is dynamic, we will start with %s and keep statistics about the last %d used algorithms.\n", get_algorithm_name_from_index(config_agios_starting_algorithm), config_agios_performance_values);
-	agios_just_print("Also, if the scheduling algorithm is dynamic, we will change the used scheduler every %ld ns, as long as %d requests were processed.\n",config_agios_select_algorithm_period, config_agios_select_algorithm_min_reqnumber);
-	agios_just_print("If aIOLi is used, its quantum is %d.\n If MLF is used, its quanutm is %d.\n If SW is used, its window size is %ld.\n If TWINS is used, its window duration is %ld.\n", config_aioli_quantum, config_mlf_quantum, config_sw_size, config_twins_window);
-	agios_just_print("The default waiting time for the AGIOS thread is %d\n", config_waiting_time);
-	config_print_flag(config_trace_agios, "Will AGIOS generate trace files? ");
-	if (config_trace_agios) {
-		agios_just_print("\tTrace files are named %s.*.%s\n", config_trace_agios_file_prefix, config_trace_agios_file_sufix);
-		agios_just_print("\tTrace file buffer has size %d bytes\n", config_agios_max_trace_buffer_size);
+	agios_just_print("Scheduling algorithm: %s\n", get_algorithm_name_from_index(config->default_algorithm)); 
+	agios_just_print("If the scheduling algorithm is dynamic, we will start with %s and keep statistics about the last %d used algorithms.\n", get_algorithm_name_from_index(config->starting_algorithm), config->performance_values);
+	agios_just_print("Also, if the scheduling algorithm is dynamic, we will change the used scheduler every %ld ns, as long as %d requests were processed.\n",config->select_algorithm_period, config->select_algorithm_min_reqnumber);
+	agios_just_print("If aIOLi is used, its quantum is %d.\n If MLF is used, its quanutm is %d.\n If SW is used, its window size is %ld.\n If TWINS is used, its window duration is %ld.\n", config->aioli_quantum, config->mlf_quantum, config->sw_size, config->twins_window);
+	agios_just_print("The default waiting time for the AGIOS thread is %d\n", config->waiting_time);
+	agios_just_print("Memory for %d requests will be allocated at initialization\n", config->preallocated_requests);
+	agios_just_print("The hashtable will be sized for %d files\n", config->expected_files);
+	agios_just_print("The timeline will be split in %d shards for TO, TO-agg and NOOP\n", config->timeline_shards);
+	if ((config->max_idle_files >= 0) || (config->idle_file_timeout >= 0)) {
+		agios_just_print("Files without requests will be evicted after %ld ns, keeping at most %d of them (-1 means no limit)\n", config->idle_file_timeout, config->max_idle_files);
+		config_print_flag(config->keep_evicted_file_stats, "\tWill the statistics of evicted files be kept? ");
+	}
+	config_print_flag(config->deferred_add, "Will requests be added by the AGIOS thread? ");
+	config_print_flag(config->deferred_release, "Will requests be released by the AGIOS thread? ");
+	config_print_flag(config->trace, "Will AGIOS generate trace files? ");
+	if (config->trace) {
+		agios_just_print("\tTrace files are named %s.*.%s\n", config->trace_file_prefix, config->trace_file_sufix);
+		agios_just_print("\tTrace file buffer has size %d bytes\n", config->max_trace_buffer_size);
 	} //end if tracing
 }
 /**
  * function used to read the configuration parameters from a configuration file. It uses libconfig to do so. 
+ * @param ctx the AGIOS instance, its configuration must have been filled with the default values by set_default_config_parameters.
  * @param config_file the name (with path) of the configuration file. If NULL is provided, then the function will read from DEFAULT_CONFIGFILE instead. If the default file does not exist, the default values will be used.
  * @return true or false for success.
  */
-bool read_configuration_file(char *config_file)
+bool read_configuration_file(struct agios_ctx_t *ctx, char *config_file)
 {
+	struct agios_config_t *config = &ctx->config; /**< where the parameters will be stored */
 	int32_t ret; /**< used to capture return values from libconfig */
 	const char *ret_str; /**< used to capture return values from libconfig */
 	config_t agios_config; /**< used to interact with libconfig */
@@ -99,60 +128,82 @@ bool read_configuration_file(char *config_file)
 	} //end if reading from input file failed
 	//if we are here we successfully read configuration parameters from the file, so we have to obtain then from libconfig and store in out variables
 	/*1. library options*/
+	//a parameter that is not in the file keeps its current (default) value, so ret is filled with it before each lookup
+	ret = config->trace;
 	config_lookup_bool(&agios_config, "library_options.trace", &ret);
-	config_trace_agios = convert_inttobool(ret);
-	config_lookup_string(&agios_config, "library_options.trace_file_prefix", &ret_str);
-	config_trace_agios_file_prefix = malloc(sizeof(char)*(strlen(ret_str)+1));
-	if (!config_trace_agios_file_prefix) return false;
-	strcpy(config_trace_agios_file_prefix, ret_str);
-	config_lookup_string(&agios_config, "library_options.trace_file_sufix", &ret_str);
-	config_trace_agios_file_sufix = malloc(sizeof(char)*(strlen(ret_str)+1));
-	if (!config_trace_agios_file_sufix) return false;
-	strcpy(config_trace_agios_file_sufix, ret_str);
-	config_lookup_string(&agios_config, "library_options.default_algorithm", &ret_str);
-	if (false == get_algorithm_from_string(ret_str, &config_agios_default_algorithm)) return false;
-	config_lookup_int(&agios_config, "library_options.waiting_time", &ret);
-	config_waiting_time = ret;
-	config_lookup_int(&agios_config, "library_options.aioli_quantum", &ret);
-	config_aioli_quantum = ret;
-	config_lookup_int(&agios_config, "library_options.mlf_quantum", &ret);
-	config_mlf_quantum = ret;
+	config->trace = convert_inttobool(ret);
+	if (config_lookup_string(&agios_config, "library_options.trace_file_prefix", &ret_str)) {
+		config->trace_file_prefix = malloc(sizeof(char)*(strlen(ret_str)+1));
+		if (!config->trace_file_prefix) return false;
+		strcpy(config->trace_file_prefix, ret_str);
+	}
+	if (config_lookup_string(&agios_config, "library_options.trace_file_sufix", &ret_str)) {
+		config->trace_file_sufix = malloc(sizeof(char)*(strlen(ret_str)+1));
+		if (!config->trace_file_sufix) return false;
+		strcpy(config->trace_file_sufix, ret_str);
+	}
+	if ((config_lookup_string(&agios_config, "library_options.default_algorithm", &ret_str)) &&
+	    (false == get_algorithm_from_string(ret_str, &config->default_algorithm))) return false;
+	config_lookup_int(&agios_config, "library_options.waiting_time", &config->waiting_time);
+	config_lookup_int(&agios_config, "library_options.aioli_quantum", &config->aioli_quantum);
+	config_lookup_int(&agios_config, "library_options.mlf_quantum", &config->mlf_quantum);
+	ret = (config->select_algorithm_period < 0) ? -1 : config->select_algorithm_period/1000000L;
 	config_lookup_int(&agios_config, "library_options.select_algorithm_period", &ret);
-	config_agios_select_algorithm_period = ret*1000000L; //convert it to ns
-	config_lookup_int(&agios_config, "library_options.select_algorithm_min_reqnumber", &config_agios_select_algorithm_min_reqnumber);
-	config_lookup_string(&agios_config, "library_options.starting_algorithm", &ret_str);
-	if (false == get_algorithm_from_string(ret_str, &config_agios_starting_algorithm)) return false;
+	config->select_algorithm_period = (ret < 0) ? -1 : ret*1000000L; //convert it to ns
+	config_lookup_int(&agios_config, "library_options.select_algorithm_min_reqnumber", &config->select_algorithm_min_reqnumber);
+	if ((config_lookup_string(&agios_config, "library_options.starting_algorithm", &ret_str)) &&
+	    (false == get_algorithm_from_string(ret_str, &config->starting_algorithm))) return false;
 
-    // if the default algorithm is WFQ we need to read the full path of the wfq conf file.
-    if(config_agios_default_algorithm == WFQ_SCHEDULER) {
-        config_lookup_string(&agios_config, "library_options.wfq_conf", &ret_str);
-        config_wfq_conf_file = malloc(sizeof(char) * (strlen(ret_str) + 1));
-        strcpy(config_wfq_conf_file, ret_str);
-        if (!config_wfq_conf_file) return false;
+    // if WFQ may be used (as the default algorithm or selected by a dynamic one) we need to read the full path of the wfq conf file.
+    if(config_lookup_string(&agios_config, "library_options.wfq_conf", &ret_str)) {
+        config->wfq_conf_file = malloc(sizeof(char) * (strlen(ret_str) + 1));
+        if (!config->wfq_conf_file) return false;
+        strcpy(config->wfq_conf_file, ret_str);
     }
 
 
 #if 0 //test if the starting algorithm is a dynamic one
-	if((config_agios_starting_algorithm == DYN_TREE_SCHEDULER) || (config_agios_starting_algorithm == ARMED_BANDIT_SCHEDULER))
+	if((config->starting_algorithm == DYN_TREE_SCHEDULER) || (config->starting_algorithm == ARMED_BANDIT_SCHEDULER))
 	{
-		config_agios_starting_algorithm = SJF_SCHEDULER;
+		config->starting_algorithm = SJF_SCHEDULER;
 		agios_print("Configuration error! Starting algorithm cannot be a dynamic one. Using SJF instead");
 	}
 #endif
-	config_lookup_int(&agios_config, "library_options.performance_values", &config_agios_performance_values);
+	config_lookup_int(&agios_config, "library_options.performance_values", &config->performance_values);
+	ret = false;
 	config_lookup_bool(&agios_config, "library_options.enable_SW", &ret);
-	if (ret) enable_SW();
+	if (ret) enable_SW(ctx);
+	ret = config->sw_size/1000000L;
 	config_lookup_int(&agios_config, "library_options.SW_window", &ret);
-	config_sw_size = ret*1000000L; //convert to ns
-	assert(config_sw_size >= 0);
+	config->sw_size = ret*1000000L; //convert to ns
+	assert(config->sw_size >= 0);
+	ret = config->twins_window/1000L;
 	config_lookup_int(&agios_config, "library_options.twins_window", &ret);
-	config_twins_window = ret*1000L; //convert us to ns
-	assert(config_twins_window >= 0);
+	config->twins_window = ret*1000L; //convert us to ns
+	assert(config->twins_window >= 0);
+	config_lookup_int(&agios_config, "library_options.preallocated_requests", &config->preallocated_requests);
+	config_lookup_int(&agios_config, "library_options.expected_files", &config->expected_files);
+	config_lookup_int(&agios_config, "library_options.timeline_shards", &config->timeline_shards);
+	config_lookup_int(&agios_config, "library_options.max_idle_files", &config->max_idle_files);
+	ret = -1;
+	config_lookup_int(&agios_config, "library_options.idle_file_timeout", &ret);
+	if (ret >= 0) config->idle_file_timeout = ret*1000000L; //convert ms to ns
+	ret = config->keep_evicted_file_stats;
+	config_lookup_bool(&agios_config, "library_options.keep_evicted_file_stats", &ret);
+	config->keep_evicted_file_stats = convert_inttobool(ret);
+	config_lookup_int(&agios_config, "library_options.pull_ring_size", &config->pull_ring_size);
+	ret = config->deferred_add;
+	config_lookup_bool(&agios_config, "library_options.deferred_add", &ret);
+	config->deferred_add = convert_inttobool(ret);
+	ret = config->deferred_release;
+	config_lookup_bool(&agios_config, "library_options.deferred_release", &ret);
+	config->deferred_release = convert_inttobool(ret);
+	ret = config->max_trace_buffer_size/1024;
 	config_lookup_int(&agios_config, "library_options.max_trace_buffer_size", &ret);
-	config_agios_max_trace_buffer_size = ret*1024; //it comes in KB, we store in bytes
+	config->max_trace_buffer_size = ret*1024; //it comes in KB, we store in bytes
 	//cleanup the libconfig structure
 	config_destroy(&agios_config);
-	config_print();
+	config_print(config);
 	return true;
 } 
 /**
@@ -1,5 +1,5 @@
 /*! \file agios_config.h
-    \brief Headers (and extern declarations) of AGIOS configuration parameters.
+    \brief Headers of AGIOS configuration parameters.
 
     Configuration parameters are provided in a configuration file (its name is given by the user in the agios_init function), and read using the libconfig library.
 */
@@ -10,24 +10,49 @@
 
 #define DEFAULT_CONFIGFILE	"/etc/agios.conf" /**< If a filename is not provided in agios_init, we'll try to read from this one */
 
-bool read_configuration_file(char *config_file);
-void cleanup_config_parameters(void);
-//about tracing
-extern bool config_trace_agios;
-extern char *config_trace_agios_file_prefix;
-extern char *config_trace_agios_file_sufix;
-extern int32_t config_agios_max_trace_buffer_size;
-//about scheduling
-extern int32_t config_agios_default_algorithm;
-extern int64_t config_agios_select_algorithm_period;
-extern int32_t config_agios_select_algorithm_min_reqnumber;
-extern int32_t config_agios_starting_algorithm;
-extern int32_t config_waiting_time;
-extern int32_t config_aioli_quantum;
-extern int32_t config_mlf_quantum;
-extern int64_t config_sw_size;
-extern int64_t config_twins_window;
-//performance module 
-extern int32_t config_agios_performance_values;
-//about wfq
-extern char *config_wfq_conf_file;
\ No newline at end of file
+/** \struct agios_config_t
+ *  \brief The configuration parameters of an AGIOS instance, with their default values set by set_default_config_parameters.
+ */
+struct agios_config_t {
+	//about tracing
+	bool trace; /**< will agios create a trace file will all requests arrivals? */
+	char *trace_file_prefix; /**< if creating trace files, they will be named trace_file_prefix.*.trace_file_sufix. The value in the middle of prefix and sufix is a counter, the library will check for existing files so they are not overwritten. */
+	char *trace_file_sufix; /**< @see trace_file_prefix */
+	int32_t max_trace_buffer_size; /**< in bytes. A buffer is used to keep trace messages before going to the file, to avoid small writes to the disk and decrease tracing overhead. This parameter gives the size allocated for the buffer. */
+	//about scheduling
+	int32_t default_algorithm; /**< scheduling algorithm to be used (the identifier of the scheduling algorithm) */
+	int64_t select_algorithm_period; /**< if the scheduling algorithm is dynamic (meaning it will actually select other scheduling algorithms during the execution, this parameter defines the periodicity to change the scheduling algorithm during the execution. */
+	int32_t select_algorithm_min_reqnumber; /**< if the scheduling algorithm is dynamic (meaning it will actually select other scheduling algorithms during the execution, this parameter defines how many requests have to be treated during a period before a new scheduling algorithm can be selected. */
+	int32_t starting_algorithm; /**< if the scheduling algorithm is dynamic (meaning it will actually select other scheduling algorithms during the execution, this is the scheduling algorithm that will be used whenever a decision cannot be made (possibly because there is not enough information */
+	int32_t waiting_time; /**< when there are no requests, the scheduler sleep using this as a timeout. It is also used by aIOLi to wait if it thinks better aggregations are possible */
+	int32_t aioli_quantum; /**< in bytes, how much of a queue can be processed before going to the next one (used by aIOLi) */
+	int32_t mlf_quantum; /**< similar to aioli_quantum */
+	int64_t sw_size; /**< the window size used for the SW scheduling algorithm */
+	int64_t twins_window; /**< The amount of time TWINS will stay in one queue before moving on to the next one (in nanoseconds). The default is 1ms */
+	//memory pools
+	int32_t preallocated_requests; /**< how many requests (and the structures used to give them back to the user) are allocated at initialization, so that we don't have to allocate memory while requests arrive. More are allocated as needed. */
+	//the hashtable
+	int32_t expected_files; /**< how many files are expected to be accessed, used to choose the size of the hashtable. If more files are accessed, the hashtable grows. */
+	//the timeline
+	int32_t timeline_shards; /**< in how many shards (each with its own lock) the timeline is split for TO, TO-agg and NOOP. It is rounded down to a power of 2, and there are at most AGIOS_TIMELINE_MAX_SHARDS. */
+	//eviction of idle files
+	int32_t max_idle_files; /**< how many files without requests are kept, the least recently used ones are evicted. -1 for no limit. */
+	int64_t idle_file_timeout; /**< in ns, files without requests for longer than this are evicted. -1 to keep them. */
+	bool keep_evicted_file_stats; /**< should the statistics of evicted files be added to ctx->evicted_read_stats and ctx->evicted_write_stats? */
+	//pull mode
+	int32_t pull_ring_size; /**< in pull mode, how many groups of requests can wait for the workers (it will be rounded up to a power of 2). */
+	//adding requests
+	bool deferred_add; /**< if true, the add functions only build the requests and push them to a lock-free queue, and they are added to the data structures later by the AGIOS thread. */
+	//releasing requests
+	bool deferred_release; /**< if true, the release functions only add a record to a lock-free queue, and requests are released later by the AGIOS thread. */
+	//performance module 
+	int32_t performance_values; /**< for how many of the last scheduling algorithm selections should we keep performance metrics. */
+	//about wfq
+	char *wfq_conf_file; /**< full path to the wfq conf file*/
+};
+
+struct agios_ctx_t;
+
+void set_default_config_parameters(struct agios_config_t *config);
+bool read_configuration_file(struct agios_ctx_t *ctx, char *config_file);
+void cleanup_config_parameters(struct agios_config_t *config);
@@ -1,74 +1,74 @@
 /*! \file agios_counters.c
     \brief Provides functions to manipulate the request and file counters.
 
-    These counters are kept updated during the execution, and protected with a mutex.
+    These counters are kept updated during the execution with atomic operations, so they are never protected by a lock and can be read at any time (although the value may be outdated by the time it is used, so scheduling algorithms only use them as hints and check their queues while holding the locks). The counter of requests in each line of the hashtable (hashlist_reqcounter) is protected by the lock of that line (or of its shard of the timeline).
 */
+#include <stdatomic.h>
+
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "req_hashtable.h"
 
-int32_t current_reqnb; /**< Number of queued requests */
-int32_t current_filenb; /**< Number of files with queued requests */
-static pthread_mutex_t current_reqnb_lock = PTHREAD_MUTEX_INITIALIZER; /**< Used to protect the request and file counters current_reqnb and current_filenb */
-
 /**
- * function used to safely read the content of current_reqnb (using the mutex).
+ * function used to read the content of current_reqnb.
+ * @param ctx the AGIOS instance.
+ */
+int32_t get_current_reqnb(struct agios_ctx_t *ctx)
+{
+	return atomic_load_explicit(&ctx->current_reqnb, memory_order_acquire);
+}
+/**
+ * function used to increment the current_reqnb counter.
+ * @param ctx the AGIOS instance.
  */
-int32_t get_current_reqnb(void)
+void inc_current_reqnb(struct agios_ctx_t *ctx)
 {
-	int32_t ret;
-	pthread_mutex_lock(&current_reqnb_lock);
-	ret = current_reqnb;
-	pthread_mutex_unlock(&current_reqnb_lock);
-	return ret;
+	atomic_fetch_add_explicit(&ctx->current_reqnb, 1, memory_order_release);
 }
 /**
- * function used to safely increment the current_reqnb counter (using the mutex).
+ * function used to increment the current_reqnb counter by a certain value. It is to be used instead of many calls to inc_current_reqnb().
+ * @param ctx the AGIOS instance.
+ * @param value by how much we want to increment the current_reqnb counter.
  */
-void inc_current_reqnb()
+void inc_many_current_reqnb(struct agios_ctx_t *ctx, int32_t value)
 {
-	pthread_mutex_lock(&current_reqnb_lock);
-	current_reqnb++;
-	pthread_mutex_unlock(&current_reqnb_lock);
+	atomic_fetch_add_explicit(&ctx->current_reqnb, value, memory_order_release);
 }
 /** 
- * function used to safely decrement the current_reqnb counter (using the mutex). It also updates the hashtlist_reqcounter, so caller must hold mutex to the hashtable line.
+ * function used to decrement the current_reqnb counter. It also updates the hashtlist_reqcounter, so caller must hold mutex to the hashtable line.
+ * @param ctx the AGIOS instance.
  * @param hash the line of the hashtable that contains the file this request is accessing.
  */
-void dec_current_reqnb(int32_t hash)
+void dec_current_reqnb(struct agios_ctx_t *ctx, int32_t hash)
 {
-	pthread_mutex_lock(&current_reqnb_lock);
-	current_reqnb--;
-	hashlist_reqcounter[hash]--;
-	pthread_mutex_unlock(&current_reqnb_lock);
+	atomic_fetch_sub_explicit(&ctx->current_reqnb, 1, memory_order_relaxed);
+	ctx->hashlist_reqcounter[hash]--;
 }
 /** 
- * function used to safely decrement the current_reqnb counter by a certain value (using the mutex). It is tu be used instead of many calls to dec_current_reqnb(hash). It also updates the hashlist_reqcounter, so caller must hold mutex to the hashtable line.
+ * function used to decrement the current_reqnb counter by a certain value. It is tu be used instead of many calls to dec_current_reqnb(hash). It also updates the hashlist_reqcounter, so caller must hold mutex to the hashtable line.
+ * @param ctx the AGIOS instance.
  * @param hash the line of the hashtable that contains the file this request is accessing.
  * @param value by how much we want to decrement the current_reqnb counter.
  */
-void dec_many_current_reqnb(int32_t hash, int32_t value)
+void dec_many_current_reqnb(struct agios_ctx_t *ctx, int32_t hash, int32_t value)
 {
-	pthread_mutex_lock(&current_reqnb_lock);
-	current_reqnb-= value;
-	hashlist_reqcounter[hash]-= value;
-	pthread_mutex_unlock(&current_reqnb_lock);
+	atomic_fetch_sub_explicit(&ctx->current_reqnb, value, memory_order_relaxed);
+	ctx->hashlist_reqcounter[hash]-= value;
 }
 /**
- * function used to safely increment the current_filenb counter (using the mutex).
+ * function used to increment the current_filenb counter.
+ * @param ctx the AGIOS instance.
  */
-void inc_current_filenb(void)
+void inc_current_filenb(struct agios_ctx_t *ctx)
 {
-	pthread_mutex_lock(&current_reqnb_lock);
-	current_filenb++;
-	pthread_mutex_unlock(&current_reqnb_lock);
+	atomic_fetch_add_explicit(&ctx->current_filenb, 1, memory_order_relaxed);
 }
 /**
- * function used to safely decrement the current_filenb counter (using the mutex).
+ * function used to decrement the current_filenb counter.
+ * @param ctx the AGIOS instance.
  */
-void dec_current_filenb(void)
+void dec_current_filenb(struct agios_ctx_t *ctx)
 {
-	pthread_mutex_lock(&current_reqnb_lock);
-	current_filenb--;
-	pthread_mutex_unlock(&current_reqnb_lock);
+	atomic_fetch_sub_explicit(&ctx->current_filenb, 1, memory_order_relaxed);
 }
 
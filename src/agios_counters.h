@@ -6,15 +6,14 @@
 
 #pragma once
 
-#include <pthread.h>
 #include <stdint.h>
 
-extern int current_reqnb;
-extern int current_filenb;
+struct agios_ctx_t;
 
-int32_t get_current_reqnb(void); 
-void inc_current_reqnb(void);
-void dec_current_reqnb(int32_t hash);
-void dec_many_current_reqnb(int32_t hash, int32_t value);
-void inc_current_filenb(void);
-void dec_current_filenb(void);
+int32_t get_current_reqnb(struct agios_ctx_t *ctx); 
+void inc_current_reqnb(struct agios_ctx_t *ctx);
+void inc_many_current_reqnb(struct agios_ctx_t *ctx, int32_t value);
+void dec_current_reqnb(struct agios_ctx_t *ctx, int32_t hash);
+void dec_many_current_reqnb(struct agios_ctx_t *ctx, int32_t hash, int32_t value);
+void inc_current_filenb(struct agios_ctx_t *ctx);
+void dec_current_filenb(struct agios_ctx_t *ctx);
@@ -0,0 +1,148 @@
+/*! \file agios_ctx.h
+    \brief Definition of the AGIOS context, which holds all the state of one AGIOS instance.
+
+    Each call to agios_init_ctx (or agios_init_pull_mode_ctx) creates a new context, with its own configuration, data structures, scheduling algorithm and AGIOS thread, so many independent instances can run in the same process. The functions of the original API (agios_init, agios_add_request, ...) use a default context, created by agios_init and destroyed by agios_exit.
+    The only state shared by all instances is the memory pools (@see mem_pool.c) and the counter used to give requests their timestamps.
+    @see agios.c
+*/
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "agios_config.h"
+#include "agios_request.h"
+#include "file_registry.h"
+#include "mylist.h"
+#include "process_request.h"
+#include "scheduling_algorithms.h"
+#include "statistics.h"
+
+struct completion_t;
+struct deferred_add_t;
+struct hashtable_index_t;
+struct performance_entry_t;
+struct pull_slot_t;
+struct structure_readers_t;
+struct timeline_shard_t;
+struct wfq_weights_t;
+
+/** \struct agios_ctx_t
+ *  \brief The state of one AGIOS instance. Fields are grouped by the module that uses them.
+ */
+struct agios_ctx_t {
+	struct agios_config_t config; /**< configuration parameters, read by read_configuration_file. */
+	struct agios_client user_callbacks; /**< the callbacks given to agios_init_ctx, used to process requests. */
+	bool using_mem_pools; /**< did this instance successfully call init_mem_pools? */
+	//the hashtable (req_hashtable.c)
+	struct agios_list_head *hashlist; /**< the hashtable. */
+	int32_t hashtable_shift; /**< the hashtable has 1 << hashtable_shift lines, chosen by hashtable_init from the expected_files configuration parameter. */
+	int32_t hashtable_size; /**< the number of lines of the hashtable. */
+	struct hashtable_index_t *hashlist_index; /**< the index of each line of the hashtable, used to find files in it. */
+	struct agios_list_head *hashlist_active; /**< for each line of the hashtable, the files that have requests in their queues. Scheduling algorithms go through these lists instead of all files. */
+	_Atomic uint64_t *active_lines; /**< one bit per line of the hashtable, set while its list of active files is not empty, so lines without requests are skipped without taking their locks. */
+	struct agios_list_head *hashlist_idle; /**< for each line of the hashtable, its idle files (without queued or dispatched requests), in the order they became idle. Only used if files are evicted (@see file_eviction.c). */
+	int32_t *hashlist_idlenb; /**< how many files are in each list of hashlist_idle. */
+	int32_t *hashlist_reqcounter; /**< how many requests are present in each position from the hashtable (used to speed the search for requests in the scheduling algorithms). */
+	pthread_mutex_t *hashlist_locks; /**< one mutex per line of the hashtable. */
+	//the timeline (req_timeline.c)
+	struct timeline_shard_t *timeline_shards; /**< the request queue, split in shards with their own locks (@see req_timeline.c). Scheduling algorithms that do not shard the timeline only use the first one. */
+	int32_t timeline_shardnb; /**< the number of shards, a power of 2 chosen from the timeline_shards configuration parameter. */
+	int32_t timeline_shard_shift; /**< the shard of a line of the hashtable is the line >> timeline_shard_shift. */
+	struct agios_list_head *multi_timeline; /**< multiple request queues, indexed by the queue_id provided by the user with each request to agios_add_request. This structure is used by TWINS and WFQ. */
+	int32_t multi_timeline_size; /**< number of queues in multi_timeline. */
+	struct agios_list_head SW_windows; /**< the calendar used by SW to find the place of new requests in the timeline, a list of time windows (@see SW.c). */
+	//request and file counters (agios_counters.c)
+	_Atomic int32_t current_reqnb; /**< Number of queued requests, updated with atomic operations (no lock protects it) */
+	_Atomic int32_t current_filenb; /**< Number of files with queued requests, also updated with atomic operations */
+	//scheduling algorithms (scheduling_algorithms.c)
+	struct io_scheduler_instance_t io_schedulers[IO_SCHEDULER_COUNT]; /**< this instance's copy of the list of all scheduling algorithms, so their parameters can be changed (by enable_SW) without affecting other instances. */
+	int32_t current_alg; /**< the identifier of the scheduling algorithm being currently used. */
+	struct io_scheduler_instance_t *current_scheduler; /**< a pointer to the structure describing the scheduling algorithm being currently used. */
+	struct io_scheduler_instance_t *dynamic_scheduler; /**< The scheduling algorithm chosen in the configuration parameters. */
+	struct structure_readers_t *structure_readers; /**< for each shard of the timeline, how many threads are using the data structures for its lines (@see acquire_adequate_lock). The scheduling algorithm only changes when they are all zero. */
+	atomic_bool switching_scheduler; /**< set while the AGIOS thread changes the scheduling algorithm (or before it selects the first one), so threads wait in acquire_adequate_lock. */
+	pthread_mutex_t scheduler_switch_mutex; /**< used with scheduler_switch_cond. */
+	pthread_cond_t scheduler_switch_cond; /**< used to wake up the threads waiting for the end of a change of scheduling algorithm. */
+	atomic_bool migrating; /**< set while requests are still being moved from the data structure of the previous scheduling algorithm to the one of the current algorithm (@see migrate_slice). */
+	bool migrating_to_timeline; /**< the direction of that migration (from the hashtable to the timeline, or the other way). Only changes during a switch. */
+	bool migration_sharded_timeline; /**< when migrating to the hashtable, did the previous scheduling algorithm split the timeline in shards? It tells in which shard the requests of a line still are. */
+	bool migration_multi_timeline; /**< when migrating to the hashtable, did the previous scheduling algorithm keep the requests in the multi_timeline (@see req_timeline.c)? */
+	int32_t migration_position; /**< the next line of the hashtable (when migrating to the timeline) or shard of the timeline or queue of the multi_timeline (to the hashtable) to be moved by migrate_slice. Only used by the AGIOS thread. */
+	int32_t migration_slices; /**< how many times migrate_slice was called for the current migration. Only used by the AGIOS thread. */
+	_Atomic int64_t migrated_reqnb; /**< how many requests were moved in the current migration (by the AGIOS thread or by the threads touching their files). */
+	_Atomic int64_t switch_max_wait; /**< the longest time (in ns) a thread waited for the data structures since the last change of scheduling algorithm, or spent moving the requests of a file to the new one, reported when the migration ends. */
+	//the AGIOS thread (agios_thread.c)
+	pthread_t agios_thread; /**< AGIOS thread that will run the agios_thread function. */
+	pthread_cond_t request_added_cond; /**< Used to let the agios thread know that we have new requests. */
+	pthread_mutex_t request_added_mutex; /**< Used to protect the request_added_cond. */
+	bool agios_thread_stop; /**< Set to true when agios_exit_ctx calls stop_the_agios_thread. */
+	struct timespec last_algorithm_update; /**< the time at the last time we've selected an algorithm */
+	//the performance module (performance.c)
+	int64_t processed_reqnb; /**< processed (and released) requests counter (relative to the most recently selected scheduling algorithm only). Not protected by a mutex, @see performance.c */
+	struct agios_list_head performance_info; /**< the list with all information we are holding about performance measurements (each element will be a struct performance_entry_t). */
+	int32_t performance_info_len; /**< how many entries in performance_info. */
+	struct performance_entry_t *current_performance_entry; /**< the latest entry to performance_info. */
+	pthread_mutex_t performance_mutex; /**< to protect the performance_info structure. */
+	//eviction of idle files (file_eviction.c)
+	bool evicting_files; /**< are idle files evicted? True if library_options.max_idle_files or library_options.idle_file_timeout were given. */
+	struct timespec last_eviction; /**< the last time the AGIOS thread looked for files to evict. */
+	int64_t evicted_filenb; /**< how many file structures were evicted. */
+	struct queue_statistics_t evicted_read_stats; /**< the statistics of the read queues of all evicted files, added together (if library_options.keep_evicted_file_stats is set). Only accessed by the AGIOS thread. */
+	struct queue_statistics_t evicted_write_stats; /**< the same for the write queues. */
+	//global statistics (statistics.c)
+	struct line_statistics_t *hashlist_stats; /**< for each line of the hashtable, the global statistics of the requests to its files, merged by get_global_stats. */
+	//the trace module (trace.c)
+	FILE *tracefile_fd; /**< the current trace file*/
+	pthread_mutex_t trace_mutex; /**< makes sure only one thread tries to access the trace file at a time. */
+	struct timespec trace_t0; /**< time measured at initialization (all traced times are relative to this one). */
+	char *tracefile_buffer; /**< a buffer to avoid generating many I/O operations to the trace file. */
+	int32_t tracefile_buffer_size; /**< occupancy of the buffer. Used to control when to flush it. */
+	char *trace_aux_buf; /**< this smaller buffer is used to write a line at a time to the main buffer. */
+	//the file registry (file_registry.c)
+	struct file_t **registered_files[AGIOS_FILE_KEY_MAX_CHUNKS]; /**< the registry, each position points to a chunk of AGIOS_FILE_KEY_CHUNK_SIZE file structures. */
+	_Atomic int32_t registered_filenb; /**< how many files were registered, which is also the next key to be given. It is written with a release store after the new slot (and its chunk) are filled, so lookups read it with an acquire load and without the lock. */
+	pthread_mutex_t registry_mutex; /**< used to protect registered_filenb and the allocation of chunks. */
+	//the pull mode (pull_mode.c)
+	bool pull_mode; /**< are we in pull mode? Set by agios_init_pull_mode_ctx. */
+	struct pull_slot_t *pull_ring; /**< the ring of groups of requests waiting for a worker. */
+	size_t pull_ring_mask; /**< the size of the ring minus 1 (the size is a power of 2). */
+	atomic_size_t pull_put_position; /**< the next position of the ring to be written. */
+	atomic_size_t pull_take_position; /**< the next position of the ring to be read. */
+	atomic_bool pull_stopping; /**< set by stop_pull_mode when agios_exit_ctx is called, so sleeping threads will give up. */
+	atomic_int pull_waiting_workers; /**< how many workers are sleeping because the ring is empty. */
+	atomic_int pull_waiting_producers; /**< how many threads are sleeping because the ring is full. */
+	atomic_int pull_active_workers; /**< how many workers are inside agios_next_requests. */
+	pthread_mutex_t pull_mutex; /**< used with the condition variables. */
+	pthread_cond_t pull_not_empty_cond; /**< used to wake up workers when something is put in the ring. */
+	pthread_cond_t pull_not_full_cond; /**< used to wake up producers when something is taken from the ring. */
+	struct agios_list_head pull_partial_list; /**< groups of requests that did not fit in the buffer given to agios_next_requests. */
+	atomic_int pull_partial_nb; /**< the number of elements in pull_partial_list, so we don't take the lock when it is empty. */
+	pthread_mutex_t pull_partial_mutex; /**< protects pull_partial_list. */
+	//deferred additions (agios_add_request.c)
+	_Atomic(struct deferred_add_t *) add_queue; /**< the queue of new requests waiting to be added by the AGIOS thread, a stack where any thread can push without locks. */
+	struct agios_list_head failed_adds; /**< deferred additions the AGIOS thread could not add, kept (because the user has their handles) until agios_exit_ctx. Only accessed by the AGIOS thread. */
+	//deferred releases (agios_release_request.c)
+	_Atomic(struct completion_t *) completion_queue; /**< the queue of deferred releases, a stack where any thread can push without locks. */
+	//MLF
+	int32_t MLF_current_hash; /**< position of the hashtable we are accessing. Used so we do a round robin on the hashtable even across different calls to MLF(). */
+	int32_t *MLF_lock_tries; /**< counter of how many times we tried without success to acquire the lock of a hashtable line. */
+	//SJF-heap
+	struct queue_t **sjf_heap; /**< min-heap of the queues that have requests, keyed on their current_size. Only allocated while SJF-heap is the current scheduler. */
+	int32_t sjf_heap_len; /**< number of queues in sjf_heap. */
+	int32_t sjf_heap_size; /**< number of positions allocated for sjf_heap. */
+	pthread_mutex_t sjf_heap_mutex; /**< protects sjf_heap. It is taken while holding the lock of the line of the hashtable of the queue being updated, never the other way around. */
+	//TWINS
+	bool twins_first_req; /**< used to know when twins is being used for the first time (so we'll reset it) */
+	int32_t current_twins_server; /**< the current queue from where we are taking requests */
+	struct timespec twins_window_start; /**< the timestamp for the start of the current window */
+	//WFQ
+	int32_t wfq_current_queue; /**< the current queue from where we are taking requests */
+	struct wfq_weights_t *wfq_weights; /**< An array that keeps the weight and the credit of each queue */
+};
+
+extern struct agios_ctx_t *default_ctx;
@@ -1,13 +1,23 @@
 /*! \file agios_release_request.c
     \brief Implementation of the agios_release_request function, called by the user after processing a request.
+
+    If library_options.deferred_release is set, the release functions do not acquire any data structure lock. They only add a completion record to a lock-free queue and return, and the AGIOS thread later releases all the requests from the queue at once (with process_deferred_releases).
  */
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "agios.h"
+#include "agios_add_request.h"
+#include "agios_config.h"
+#include "agios_ctx.h"
+#include "agios_release_request.h"
 #include "agios_request.h"
 #include "common_functions.h"
 #include "data_structures.h"
+#include "file_registry.h"
 #include "hash.h"
+#include "mem_pool.h"
 #include "mylist.h"
 #include "performance.h"
 #include "req_hashtable.h"
@@ -25,96 +35,574 @@ void generic_cleanup(struct request_t *req)
 	req->globalinfo->stats.processed_req_size += req->len;
 	request_cleanup(req); //remove from the list and free the memory
 }
+/**
+ * updates statistics and performance information after requests have been processed by the user, and then frees them. The performance mutex is acquired only once for all of them. The caller must hold the relevant data structure lock (for all requests).
+ * @param ctx the AGIOS instance.
+ * @param reqs the requests that have been released by the user (they must be in the dispatch queues).
+ * @param reqnb the number of requests in reqs.
+ */
+static void release_these_requests(struct agios_ctx_t *ctx, struct request_t **reqs, int32_t reqnb)
+{
+	int64_t elapsed_time; /**< how long has it been since this request was issued? */
+	struct performance_entry_t *entry = NULL; /**< used to access performance information about the right scheduling algorithm */
+	int64_t entry_dispatch_timestamp = -1; /**< the dispatch timestamp of the request for which we looked for entry (requests dispatched together will have the same) */
+	int64_t this_bandwidth; /**< the bandwidth measured in the access by this request */
+	struct file_t *req_file; /**< the file accessed by a request, which may become idle when the request is freed */
+
+	pthread_mutex_lock(&ctx->performance_mutex);
+	for (int32_t i = 0; i < reqnb; i++) {
+		//let's see how long it took to process this request
+		elapsed_time = get_nanoelapsed_long(reqs[i]->arrival_time);
+		//update local performance information (we don't update processed_req_size here because it is updated in the generic_cleanup function)
+		reqs[i]->globalinfo->stats.releasedreq_nb++;
+		/*! \todo do we need a different precision for bandwidth??? */
+		this_bandwidth = reqs[i]->len/elapsed_time;  //in bytes per nanosecond
+		reqs[i]->globalinfo->stats.processed_bandwidth = update_iterative_average(reqs[i]->globalinfo->stats.processed_bandwidth, this_bandwidth, reqs[i]->globalinfo->stats.releasedreq_nb);
+		//update global performance information. We need to figure out to each time slice this request belongs
+		if (reqs[i]->dispatch_timestamp != entry_dispatch_timestamp) {
+			entry = get_request_entry(ctx, reqs[i]); //we use the timestamp from when the request was sent for processing, because we want to relate its performance to the scheduling algorithm who choose to process the request
+			entry_dispatch_timestamp = reqs[i]->dispatch_timestamp;
+		}
+		if (entry) { //we need to check because maybe the request took so long to process we don't even have a record for the scheduling algorithm that issued it
+			entry->reqnb++;
+			entry->size += reqs[i]->len;
+			entry->bandwidth = update_iterative_average(entry->bandwidth,this_bandwidth, entry->reqnb);
+			if (entry == ctx->current_performance_entry) { //if this request was issued by the current scheduling algorithm
+				ctx->processed_reqnb++; //we only count it as a new processed request if it was issued by the current scheduling algorithm
+				debug("a request issued by the current scheduling algorithm is back! processed_reqnb is %ld", ctx->processed_reqnb);
+			}
+		} //end if found a performance entry
+	}
+	pthread_mutex_unlock(&ctx->performance_mutex);
+	//now we can completely free these requests
+	for (int32_t i = 0; i < reqnb; i++) {
+		req_file = reqs[i]->globalinfo->req_file;
+		generic_cleanup(reqs[i]);
+		hashtable_update_idle(ctx, req_file); //in case it was the last request to this file
+	}
+}
+/**
+ * looks for a request in the dispatch queue of a file. Requests already claimed by process_deferred_releases are skipped, so when several dispatched requests have the same type, size and offset, each completion record finds a different one. The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param req_file the file accessed by the request.
+ * @param type if RT_READ or RT_WRITE
+ * @param len the size of the request
+ * @param offset the position of the file
+ * @return the request, or NULL if it could not be found.
+ */
+static struct request_t *find_dispatched_request(struct agios_ctx_t *ctx,
+					struct file_t *req_file, 
+					int32_t type, 
+					int64_t len, 
+					int64_t offset)
+{
+	struct queue_t *related; /**< used to point to the queue where we should look (read or write). */
+	struct request_t *req; /**< used to iterate through all requests to the file. */
+
+#ifdef AGIOS_DEBUG
+	debug("Releasing a request from file %s:", req_file->file_id );
+	print_hashtable_line(ctx, req_file->hash);
+#endif
+	//get the relevant list 
+	if (type == RT_WRITE) related = &req_file->write_queue;
+	else related = &req_file->read_queue;
+	//find the request in the dispatch queue
+	agios_list_for_each_entry (req, &related->dispatch, related) {
+		if ((req->len == len) && (req->offset == offset) && (!req->release_claimed)) return req;
+	}
+	debug("PANIC! Could not find the request %ld %ld to file %s\n", offset, len, req_file->file_id);
+	return NULL;
+}
+/**
+ * looks for the structure of a file in a line of the hashtable. Different from find_req_file, it does not create the structure if it does not exist. The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable where we will look.
+ * @param file_hash the hash of file_id, given by get_file_hash.
+ * @param file_id the file handle.
+ * @return the structure of the file, or NULL if it could not be found.
+ */
+static struct file_t *find_released_file(struct agios_ctx_t *ctx, int32_t hash, uint64_t file_hash, char *file_id)
+{
+	struct file_t *req_file = hashtable_find_file(ctx, hash, file_hash, file_id); /**< the return value */
+
+	if (req_file) return req_file;
+	//that makes no sense, we are trying to release a request which was never added!!!
+	debug("PANIC! We cannot find the file structure for this request %s", file_id);
+	return NULL;
+}
+/**
+ * finds the first of the requests that were dispatched together with a request (in the same call to the callback, or taken together by a worker in pull mode). The caller must hold the relevant data structure lock.
+ * @param req one of the requests of the batch (it must be in the dispatch queue).
+ * @param reqnb will receive the number of requests of the batch.
+ * @return the first request of the batch. The others follow it in the dispatch queue.
+ */
+static struct request_t *find_dispatch_batch(struct request_t *req, int32_t *reqnb)
+{
+	struct agios_list_head *dispatch = &req->globalinfo->dispatch; /**< the dispatch queue where all requests of the batch are */
+	int64_t batch = req->dispatch_batch; /**< the identifier of the batch */
+
+	//the requests of a batch were added to the dispatch queue one after the other, so we go back to find the first of them
+	while ((req->related.prev != dispatch) && 
+		(agios_list_entry(req->related.prev, struct request_t, related)->dispatch_batch == batch)) 
+		req = agios_list_entry(req->related.prev, struct request_t, related);
+	//count them, so we know how much space we need
+	*reqnb = 0;
+	for (struct request_t *tmp = req; (&tmp->related != dispatch) && (tmp->dispatch_batch == batch); tmp = agios_list_entry(tmp->related.next, struct request_t, related)) (*reqnb)++;
+	return req;
+}
+/**
+ * copies the requests of a batch found by find_dispatch_batch to an array, and marks them as claimed so they are not released twice by process_deferred_releases. Requests that were already claimed are not copied.
+ * @param req the first request of the batch.
+ * @param reqnb the number of requests of the batch.
+ * @param group the array that will receive the requests (with space for at least reqnb more requests).
+ * @param groupnb the number of requests already in group.
+ * @return the number of requests in group after the copy.
+ */
+static int32_t claim_dispatch_batch(struct request_t *req, int32_t reqnb, struct request_t **group, int32_t groupnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) {
+		if (!req->release_claimed) {
+			req->release_claimed = true;
+			group[groupnb++] = req;
+		}
+		req = agios_list_entry(req->related.next, struct request_t, related);
+	}
+	return groupnb;
+}
+/**
+ * adds a completion record to the queue of deferred releases. Any thread can do that at any time, it takes no lock.
+ * @param ctx the AGIOS instance.
+ * @param completion the record, allocated from the COMPLETION_POOL.
+ */
+static void defer_release(struct agios_ctx_t *ctx, struct completion_t *completion)
+{
+	struct completion_t *head = atomic_load_explicit(&ctx->completion_queue, memory_order_relaxed); /**< the last record that was added to the queue */
+
+	do {
+		completion->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&ctx->completion_queue, &head, completion, memory_order_release, memory_order_relaxed));
+}
+/**
+ * makes a completion record and adds it to the queue of deferred releases. Used by the release functions when library_options.deferred_release is set.
+ * @param ctx the AGIOS instance.
+ * @param req the released request (or one request of the batch), NULL if the request is described by the other arguments.
+ * @param whole_batch true if all requests dispatched together with req are being released.
+ * @param req_file the file accessed by the request, if req is NULL. If also NULL, file_id is used.
+ * @param file_id the file handle, used if req and req_file are NULL.
+ * @param type if RT_READ or RT_WRITE (if req is NULL)
+ * @param len the size of the request (if req is NULL)
+ * @param offset the position of the file (if req is NULL)
+ * @return true or false for success.
+ */
+static bool make_completion(struct agios_ctx_t *ctx,
+				struct request_t *req, 
+				bool whole_batch, 
+				struct file_t *req_file, 
+				char *file_id, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset)
+{
+	struct completion_t *completion = mem_pool_alloc(COMPLETION_POOL); /**< the new record */
+
+	if (!completion) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		return false;
+	}
+	completion->req = req;
+	completion->whole_batch = whole_batch;
+	completion->req_file = req_file;
+	completion->file_id = NULL;
+	if (req) completion->hash = req->globalinfo->req_file->hash;
+	else if (req_file) completion->hash = req_file->hash;
+	else { 
+		//we cannot look for the structure of the file without holding the lock, so we keep a copy of the handle for the AGIOS thread to do it
+		completion->file_id = strdup(file_id);
+		if (!completion->file_id) {
+			agios_print("PANIC! AGIOS could not allocate memory!\n");
+			mem_pool_free(COMPLETION_POOL, completion);
+			return false;
+		}
+		completion->file_hash = get_file_hash(file_id);
+		completion->hash = get_hashtable_position(ctx, completion->file_hash);
+	}
+	completion->type = type;
+	completion->len = len;
+	completion->offset = offset;
+	defer_release(ctx, completion);
+	return true;
+}
+/**
+ * used to check, without taking them, if there are records in the queue of deferred releases.
+ * @param ctx the AGIOS instance.
+ * @return true if there are deferred releases to be processed.
+ */
+bool has_deferred_releases(struct agios_ctx_t *ctx)
+{
+	return (atomic_load_explicit(&ctx->completion_queue, memory_order_relaxed) != NULL);
+}
+/**
+ * used to sort completion records by line of the hashtable with qsort.
+ */
+static int compare_completions_by_hash(const void *a, const void *b)
+{
+	int32_t hash_a = (*(struct completion_t **)a)->hash; /**< the line of the first record */
+	int32_t hash_b = (*(struct completion_t **)b)->hash; /**< the line of the second record */
+
+	return (hash_a > hash_b) - (hash_a < hash_b);
+}
+/**
+ * finds the requests described by a completion record given by its handle and stores them in its req and reqnb fields (reqnb is 0 if they could not be found). Records without the handle are looked for later by lookup_completion, here reqnb is set to 1, the most they can release. The caller must hold the relevant data structure lock.
+ * @param completion the record.
+ */
+static void resolve_completion(struct completion_t *completion)
+{
+	completion->reqnb = 0;
+	if (!completion->req) completion->reqnb = 1;
+	else if (completion->req->dispatch_timestamp == 0) { //the request is still in the scheduling queues, it makes no sense to release it
+		debug("PANIC! Trying to release the request %ld %ld to file %s, which was not processed yet\n", completion->req->offset, completion->req->len, completion->req->file_id);
+	} else if (completion->whole_batch) completion->req = find_dispatch_batch(completion->req, &completion->reqnb);
+	else completion->reqnb = 1;
+}
+/**
+ * looks for the request described by a completion record that was not given by its handle, and stores it in its req and reqnb fields (reqnb is 0 if it could not be found). The caller must hold the relevant data structure lock.
+ * @param ctx the AGIOS instance.
+ * @param completion the record.
+ */
+static void lookup_completion(struct agios_ctx_t *ctx, struct completion_t *completion)
+{
+	completion->reqnb = 0;
+	if (!completion->req_file) completion->req_file = find_released_file(ctx, completion->hash, completion->file_hash, completion->file_id);
+	if (completion->req_file) completion->req = find_dispatched_request(ctx, completion->req_file, completion->type, completion->len, completion->offset);
+	if (completion->req) completion->reqnb = 1;
+}
+/**
+ * releases the requests of all completion records that were added to the queue of deferred releases until now. It is called by the AGIOS thread (and by agios_exit_ctx), so the cost of releasing requests is not paid by the threads that call the release functions. Records are grouped by line of the hashtable, so each lock is acquired only once for all records in a line (or in a shard of the timeline, when it is being used), and performance information is updated once for each of these groups. Each request is released at most once per call: the requests of a group are marked as claimed, first the ones given by their handles and then the ones found by lookup, which skips claimed requests (so two completions of dispatched requests with the same file, type, size and offset release both requests). The caller must not hold any data structure lock.
+ * @param ctx the AGIOS instance.
+ */
+void process_deferred_releases(struct agios_ctx_t *ctx)
+{
+	struct completion_t *completion; /**< used to go over the records */
+	struct completion_t **completions; /**< the records, sorted by line of the hashtable */
+	int32_t completionnb = 0; /**< the number of records */
+	struct request_t **group; /**< the requests from the same line being released together */
+	int32_t groupnb; /**< the number of requests in group */
+	int32_t first = 0; /**< the first record of the group being released. */
+	int32_t last; /**< one after the last record of the group being released. */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
+
+	//take all records at once, new ones will be added to an empty queue
+	completion = atomic_exchange_explicit(&ctx->completion_queue, NULL, memory_order_acquire);
+	if (!completion) return;
+	for (struct completion_t *tmp = completion; tmp; tmp = tmp->next) completionnb++;
+	completions = malloc(sizeof(struct completion_t *)*completionnb);
+	if (!completions) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		//give them back so we can try again later
+		while (completion) {
+			struct completion_t *next = completion->next; /**< the next record */
+			defer_release(ctx, completion);
+			completion = next;
+		}
+		return;
+	}
+	//the queue gives them from the most recent one, but we want to release them in the order they arrived
+	for (int32_t i = completionnb-1; i >= 0; i--) {
+		completions[i] = completion;
+		completion = completion->next;
+	}
+	qsort(completions, completionnb, sizeof(struct completion_t *), compare_completions_by_hash);
+	while (first < completionnb) {
+		using_hashtable = acquire_adequate_lock(ctx, completions[first]->hash);
+		if (using_hashtable) {
+			for (last = first+1; (last < completionnb) && (completions[last]->hash == completions[first]->hash); last++);
+		} else { //the lock of a shard of the timeline protects all its lines of the hashtable (@see timeline_shard), and they are contiguous, so we release all the following requests in that shard together
+			for (last = first+1; (last < completionnb) && (timeline_shard(ctx, completions[last]->hash) == timeline_shard(ctx, completions[first]->hash)); last++);
+		}
+		groupnb = 0;
+		for (int32_t i = first; i < last; i++) {
+			resolve_completion(completions[i]);
+			groupnb += completions[i]->reqnb;
+		}
+		group = malloc(sizeof(struct request_t *)*groupnb);
+		if (!group) {
+			agios_print("PANIC! AGIOS could not allocate memory!\n");
+			//give them back so we can try again later (their requests are still in the dispatch queue)
+			for (int32_t i = first; i < last; i++) {
+				defer_release(ctx, completions[i]);
+				completions[i] = NULL;
+			}
+		} else {
+			groupnb = 0;
+			for (int32_t i = first; i < last; i++) {
+				if (completions[i]->req) groupnb = claim_dispatch_batch(completions[i]->req, completions[i]->reqnb, group, groupnb);
+			}
+			//only now the requests without handles are looked for, so they cannot take a request given by its handle in another record
+			for (int32_t i = first; i < last; i++) {
+				if (completions[i]->req) continue;
+				lookup_completion(ctx, completions[i]);
+				groupnb = claim_dispatch_batch(completions[i]->req, completions[i]->reqnb, group, groupnb);
+			}
+			release_these_requests(ctx, group, groupnb);
+			free(group);
+		}
+		release_adequate_lock(ctx, completions[first]->hash, using_hashtable);
+		first = last;
+	}
+	for (int32_t i = 0; i < completionnb; i++) {
+		if (!completions[i]) continue; //it was given back to the queue
+		if (completions[i]->file_id) free(completions[i]->file_id);
+		mem_pool_free(COMPLETION_POOL, completions[i]);
+	}
+	free(completions);
+}
 /** 
  * function called by the user after processing a request. Releases the data structures and keeps track of performance.
+ @param ctx the AGIOS instance, given by agios_init_ctx.
  @param file_id the file handle
  @param type if RT_READ or RT_WRITE
  @param len the size of the request
  @param offset the position of the file
  @return true or false for success.
  */
+bool agios_release_request_ctx(agios_ctx_t *ctx,
+			char *file_id, 
+				int32_t type, 
+				int64_t len, int64_t offset)
+{
+	int32_t hash; /**< the position of the hashtable where we have to look for this request. */
+	uint64_t file_hash; /**< the hash of the file handle. */
+	struct file_t *req_file; /**< the file accessed by the request */
+	struct request_t *req = NULL; /**< the request being released */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
+
+	PRINT_FUNCTION_NAME;
+	if (ctx->config.deferred_release) return make_completion(ctx, NULL, false, NULL, file_id, type, len, offset);
+	file_hash = get_file_hash(file_id);
+	hash = get_hashtable_position(ctx, file_hash);
+	//first acquire the lock of the data structure being used (it cannot be migrated while we hold it)
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	//now we are sure to have the lock
+	req_file = find_released_file(ctx, hash, file_hash, file_id);
+	if (req_file) req = find_dispatched_request(ctx, req_file, type, len, offset);
+	if (req) release_these_requests(ctx, &req, 1);
+	//release data structure lock
+	release_adequate_lock(ctx, hash, using_hashtable);
+
+	return (req != NULL);
+}
+/** 
+ * function called by the user after processing a request given by the default AGIOS instance (the one started by agios_init).
+ * @see agios_release_request_ctx
+ * @return true or false for success.
+ */
 bool agios_release_request(char *file_id, 
 				int32_t type, 
 				int64_t len, int64_t offset)
 {
-	int32_t hash = get_hashtable_position(file_id); /**< the position of the hashtable where we have to look for this request. */
+	return agios_release_request_ctx(default_ctx, file_id, type, len, offset);
+}
+/** 
+ * function called by the user after processing a request to a file registered with agios_register_file. It does the same as agios_release_request, but the file structure is found directly from the key.
+ @param ctx the AGIOS instance, given by agios_init_ctx.
+ @param key the key given by agios_register_file
+ @param type if RT_READ or RT_WRITE
+ @param len the size of the request
+ @param offset the position of the file
+ @return true or false for success.
+ */
+bool agios_release_request_by_key_ctx(agios_ctx_t *ctx,
+			int32_t key, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset)
+{
+	struct file_t *req_file = get_registered_file(ctx, key); /**< the file accessed by the request. */
+	struct request_t *req; /**< the request being released */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
+
+	PRINT_FUNCTION_NAME;
+	if (!req_file) {
+		debug("PANIC! There is no file registered with the key %d", key);
+		return false;
+	}
+	if (ctx->config.deferred_release) return make_completion(ctx, NULL, false, req_file, NULL, type, len, offset);
+	using_hashtable = acquire_adequate_lock(ctx, req_file->hash);
+	req = find_dispatched_request(ctx, req_file, type, len, offset);
+	if (req) release_these_requests(ctx, &req, 1);
+	//release data structure lock
+	release_adequate_lock(ctx, req_file->hash, using_hashtable);
+	return (req != NULL);
+}
+/** 
+ * function called by the user after processing a request to a file registered with agios_register_file, in the default AGIOS instance.
+ * @see agios_release_request_by_key_ctx
+ * @return true or false for success.
+ */
+bool agios_release_request_by_key(int32_t key, 
+				int32_t type, 
+				int64_t len, 
+				int64_t offset)
+{
+	return agios_release_request_by_key_ctx(default_ctx, key, type, len, offset);
+}
+/** 
+ * function called by the user after processing a request that was added with agios_add_request_with_handle. It does the same as agios_release_request, but since we have a pointer to the request, we don't have to look for it.
+ @param ctx the AGIOS instance, given by agios_init_ctx.
+ @param handle the handle obtained when adding the request. It is no longer valid after this call.
+ @return true or false for success.
+ */
+bool agios_release_request_by_handle_ctx(agios_ctx_t *ctx, agios_request_handle_t handle)
+{
+	struct request_t *req = handle; /**< the request being released. */
+	int32_t hash; /**< the position of the hashtable where information about the file is. */
 	bool ret = true; /**< return of the function */
-	struct file_t *req_file; /**< used to iterate through the files in a line of the hashtable */
-	struct agios_list_head *list; /**< used to access a line of the hashtable */
-	struct queue_t *related; /**< used to point to the queue where we should look (read or write). */
-	struct request_t *req; /**< used to iterate through all requests to the file. */
-	bool found=false; /**< did we find this request in the dispatch queues? */ 
-	int64_t elapsed_time; /**< how long has it been since this request was issued? */
 	bool using_hashtable; /**< used to ensure we acquire the right lock. */
-	struct performance_entry_t *entry; /**< used to access performance information about the right scheduling algorithm */
-	int64_t this_bandwidth; /**< the bandwidth measured in the access by this request */
 
 	PRINT_FUNCTION_NAME;
+	if ((!req) || (!request_is_added(req))) return false; //a deferred addition that was not added yet cannot have been processed
+	if (ctx->config.deferred_release) return make_completion(ctx, req, false, NULL, NULL, 0, 0, 0);
+	hash = req->globalinfo->req_file->hash;
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	if (req->dispatch_timestamp == 0) { //the request is still in the scheduling queues, it makes no sense to release it
+		debug("PANIC! Trying to release the request %ld %ld to file %s, which was not processed yet\n", req->offset, req->len, req->file_id);
+		ret = false;
+	} else release_these_requests(ctx, &req, 1);
+	//release data structure lock
+	release_adequate_lock(ctx, hash, using_hashtable);
+	return ret;
+}
+/** 
+ * function called by the user after processing a request that was added to the default AGIOS instance with agios_add_request_with_handle.
+ * @see agios_release_request_by_handle_ctx
+ * @return true or false for success.
+ */
+bool agios_release_request_by_handle(agios_request_handle_t handle)
+{
+	return agios_release_request_by_handle_ctx(default_ctx, handle);
+}
+/** 
+ * function called by the user after processing many requests that were added with handles. It does the same as calling agios_release_request_by_handle for each one of them, but it is cheaper: each lock is acquired only once for all requests to files in the same line of the hashtable (or in the same shard when a timeline is being used), and performance information is updated once for each of these groups.
+ @param ctx the AGIOS instance, given by agios_init_ctx.
+ @param handles the handles obtained when adding the requests. They are no longer valid after this call.
+ @param reqnb the number of handles.
+ @return true or false for success. If some of the requests were not processed yet (or some handles are NULL, or they are deferred additions that were not added), they are not released and false is returned, but the others are still released. 
+ */
+bool agios_release_requests_ctx(agios_ctx_t *ctx, agios_request_handle_t *handles, int32_t reqnb)
+{
+	struct batch_entry_t *entries; /**< the requests, sorted by line of the hashtable. */
+	struct request_t **group; /**< the requests from the same line being released together */
+	int32_t groupnb; /**< the number of requests in group */
+	int32_t first = 0; /**< the first entry of the group being released. */
+	int32_t last; /**< one after the last entry of the group being released. */
+	int32_t entrynb = 0; /**< the number of entries (the handles that are not NULL). */
+	bool ret = true; /**< return of the function */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
 
-	//first acquire lock. That is a bit complicated because the other thread might be migrating scheduling algorithms (and consequently data structures) while we are doing this. 
-	using_hashtable = acquire_adequate_lock(hash);
-	//now we are sure to have the lock
-	list = &hashlist[hash];
-	//find the structure for this file 
-	agios_list_for_each_entry (req_file, list, hashlist) {
-		if (strcmp(req_file->file_id, file_id) == 0) {
-			found = true;
-			break;
+	PRINT_FUNCTION_NAME;
+	if (reqnb <= 0) return (reqnb == 0);
+	if (ctx->config.deferred_release) {
+		for (int32_t i = 0; i < reqnb; i++) {
+			if ((!handles[i]) || (!request_is_added(handles[i])) || (!make_completion(ctx, handles[i], false, NULL, NULL, 0, 0, 0))) ret = false;
 		}
+		return ret;
 	}
-	if (!found) {
-		//that makes no sense, we are trying to release a request which was never added!!!
-		debug("PANIC! We cannot find the file structure for this request %s", file_id);
-		ret = false; //we cannot simply return here because we are holding the mutex, we have tofree it!
-	} else {
-		found = false;
-#ifdef AGIOS_DEBUG
-		debug("Releasing a request from file %s:", req_file->file_id );
-		print_hashtable_line(hash);
-#endif
-		//get the relevant list 
-		if (type == RT_WRITE) related = &req_file->write_queue;
-		else related = &req_file->read_queue;
-		//find the request in the dispatch queue
-		agios_list_for_each_entry (req, &related->dispatch, related) {
-			if ((req->len == len) && (req->offset == offset)) {
-				found =true;
-				break;
-			}
+	entries = malloc(sizeof(struct batch_entry_t)*reqnb);
+	group = malloc(sizeof(struct request_t *)*reqnb);
+	if ((!entries) || (!group)) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		free(entries);
+		free(group);
+		return false;
+	}
+	for (int32_t i = 0; i < reqnb; i++) {
+		if ((!handles[i]) || (!request_is_added(handles[i]))) { //as for agios_release_request_by_handle, there is nothing to release
+			ret = false;
+			continue;
+		}
+		entries[entrynb].req = handles[i];
+		entries[entrynb].hash = handles[i]->globalinfo->req_file->hash;
+		entries[entrynb].req_file = handles[i]->globalinfo->req_file;
+		entries[entrynb].index = i;
+		entrynb++;
+	}
+	qsort(entries, entrynb, sizeof(struct batch_entry_t), compare_batch_entries_by_hash);
+	while (first < entrynb) {
+		using_hashtable = acquire_adequate_lock(ctx, entries[first].hash);
+		if (using_hashtable) {
+			for (last = first+1; (last < entrynb) && (entries[last].hash == entries[first].hash); last++);
+		} else { //the lock of a shard of the timeline protects all its lines of the hashtable (@see timeline_shard), and they are contiguous, so we release all the following requests in that shard together
+			for (last = first+1; (last < entrynb) && (timeline_shard(ctx, entries[last].hash) == timeline_shard(ctx, entries[first].hash)); last++);
 		}
-		if (found) {
-			//let's see how long it took to process this request
-			elapsed_time = get_nanoelapsed_long(req->arrival_time);
-			//update local performance information (we don't update processed_req_size here because it is updated in the generic_cleanup function)
-			req->globalinfo->stats.releasedreq_nb++;
-			/*! \todo do we need a different precision for bandwidth??? */
-			this_bandwidth = req->len/elapsed_time;  //in bytes per nanosecond
-			req->globalinfo->stats.processed_bandwidth = update_iterative_average(req->globalinfo->stats.processed_bandwidth, this_bandwidth, req->globalinfo->stats.releasedreq_nb);
-			
-			//update global performance information
-			pthread_mutex_lock(&performance_mutex);
-			//we need to figure out to each time slice this request belongs
-			entry = get_request_entry(req); //we use the timestamp from when the request was sent for processing, because we want to relate its performance to the scheduling algorithm who choose to process the request
-			if (entry) { //we need to check because maybe the request took so long to process we don't even have a record for the scheduling algorithm that issued it
-				entry->reqnb++;
-				entry->size += req->len;
-				entry->bandwidth = update_iterative_average(entry->bandwidth,this_bandwidth, entry->reqnb);
-				if (entry == current_performance_entry) { //if this request was issued by the current scheduling algorithm
-					agios_processed_reqnb++; //we only count it as a new processed request if it was issued by the current scheduling algorithm
-					debug("a request issued by the current scheduling algorithm is back! processed_reqnb is %ld", agios_processed_reqnb);
-				}
-			} //end if found a performance entry
-			pthread_mutex_unlock(&performance_mutex);
-			//now we can completely free this request
-			generic_cleanup(req);
+		groupnb = 0;
+		for (int32_t i = first; i < last; i++) {
+			if (entries[i].req->dispatch_timestamp == 0) { //the request is still in the scheduling queues, it makes no sense to release it
+				debug("PANIC! Trying to release the request %ld %ld to file %s, which was not processed yet\n", entries[i].req->offset, entries[i].req->len, entries[i].req->file_id);
+				ret = false;
+			} else group[groupnb++] = entries[i].req;
+		}
+		release_these_requests(ctx, group, groupnb);
+		release_adequate_lock(ctx, entries[first].hash, using_hashtable);
+		first = last;
+	}
+	free(entries);
+	free(group);
+	return ret;
+}
+/** 
+ * function called by the user after processing many requests that were added to the default AGIOS instance with handles.
+ * @see agios_release_requests_ctx
+ * @return true or false for success. If some of the requests were not processed yet, they are not released and false is returned, but the others are still released. 
+ */
+bool agios_release_requests(agios_request_handle_t *handles, int32_t reqnb)
+{
+	return agios_release_requests_ctx(default_ctx, handles, reqnb);
+}
+/** 
+ * function called by the user after processing a group of requests that were given to it together (in the same call to the callback, for instance an aggregated request). The requests must have been added with handles, and the handle of any one of them identifies the whole group. It does the same as calling agios_release_requests for all of them, without having to provide all the handles.
+ @param ctx the AGIOS instance, given by agios_init_ctx.
+ @param handle the handle of one of the requests of the group. The handles of all requests of the group are no longer valid after this call.
+ @return true or false for success.
+ */
+bool agios_release_request_batch_ctx(agios_ctx_t *ctx, agios_request_handle_t handle)
+{
+	struct request_t *req = handle; /**< the first request of the batch */
+	struct request_t **group; /**< the requests being released */
+	int32_t groupnb; /**< the number of requests in group */
+	int32_t hash; /**< the position of the hashtable where information about the file is. */
+	bool ret = true; /**< return of the function */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
+
+	PRINT_FUNCTION_NAME;
+	if ((!req) || (!request_is_added(req))) return false; //a deferred addition that was not added yet cannot have been processed
+	if (ctx->config.deferred_release) return make_completion(ctx, req, true, NULL, NULL, 0, 0, 0);
+	hash = req->globalinfo->req_file->hash;
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	if (req->dispatch_timestamp == 0) { //the request is still in the scheduling queues, it makes no sense to release it
+		debug("PANIC! Trying to release the request %ld %ld to file %s, which was not processed yet\n", req->offset, req->len, req->file_id);
+		ret = false;
+	} else {
+		req = find_dispatch_batch(req, &groupnb);
+		group = malloc(sizeof(struct request_t *)*groupnb);
+		if (!group) {
+			agios_print("PANIC! AGIOS could not allocate memory!\n");
+			ret = false;
 		} else {
-			debug("PANIC! Could not find the request %ld %ld to file %s\n", offset, len, file_id);
-			ret = false; // we cannot simply return here because we are holding the mutex, needs to free it!
+			groupnb = claim_dispatch_batch(req, groupnb, group, 0);
+			release_these_requests(ctx, group, groupnb);
+			free(group);
 		}
-	} //end if we found the req_file
+	}
 	//release data structure lock
-	if (using_hashtable) hashtable_unlock(hash);
-	else timeline_unlock();
-
+	release_adequate_lock(ctx, hash, using_hashtable);
 	return ret;
 }
+/** 
+ * function called by the user after processing a group of requests given to it together by the default AGIOS instance.
+ * @see agios_release_request_batch_ctx
+ * @return true or false for success.
+ */
+bool agios_release_request_batch(agios_request_handle_t handle)
+{
+	return agios_release_request_batch_ctx(default_ctx, handle);
+}
@@ -0,0 +1,31 @@
+/*! \file agios_release_request.h
+    \brief Headers for the implementation of the agios_release_request function, called by the user after processing a request.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "agios_request.h"
+
+/** \struct completion_t
+ *  \brief A release that was deferred to the AGIOS thread (when library_options.deferred_release is set). The request is identified either by its handle or by its file, type, size and offset.
+ */
+struct completion_t {
+	struct completion_t *next; /**< the next record in the queue of deferred releases */
+	struct request_t *req; /**< the released request (or one of the batch), NULL until it is found if the request was not given by its handle */
+	bool whole_batch; /**< true if all requests dispatched together with req are being released (agios_release_request_batch) */
+	struct file_t *req_file; /**< the file accessed by the request, if not given by its handle */
+	char *file_id; /**< a copy of the file handle, if neither the request nor the file structure are known */
+	int32_t hash; /**< the line of the hashtable where information about the file is */
+	uint64_t file_hash; /**< the hash of file_id, if it is used */
+	int32_t type; /**< RT_READ or RT_WRITE */
+	int64_t len; /**< the size of the request */
+	int64_t offset; /**< the position of the file */
+	int32_t reqnb; /**< filled by the AGIOS thread: how many requests, starting at req, are to be released */
+};
+
+struct agios_ctx_t;
+
+bool has_deferred_releases(struct agios_ctx_t *ctx);
+void process_deferred_releases(struct agios_ctx_t *ctx);
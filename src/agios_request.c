@@ -5,6 +5,8 @@
 
 #include "agios_request.h"
 #include "common_functions.h"
+#include "mem_pool.h"
+#include "SW.h"
 
 /** 
  * prints information about a request, used for debug.
@@ -37,6 +39,16 @@ void list_of_requests_cleanup(struct agios_list_head *list)
 		if (aux_req) request_cleanup(aux_req);
 	} //end if the list was not empty
 }
+/**
+ * removes a request from the list where it is (a queue, the timeline, a dispatch queue or the list of a virtual request), and also from the index of its queue if it is in the hashtable.
+ * @param req the request.
+ */
+void request_del(struct request_t *req)
+{
+	if (req->sw_queue) SW_del_req(req);
+	if (!agios_rb_empty_node(&req->index_node)) agios_rb_erase(&req->globalinfo->index, &req->index_node);
+	agios_list_del(&req->related);
+}
 /**
  * free the space used by a struct request_t, which describes a request. If the request is aggregated (with multiple requests inside), it will recursively free these requests as well.
  * @param aux_req the request to be freed.
@@ -44,13 +56,12 @@ void list_of_requests_cleanup(struct agios_list_head *list)
 void request_cleanup(struct request_t *aux_req)
 {
 	//remove the request from its queue
-	agios_list_del(&aux_req->related);
+	request_del(aux_req);
 	//see if it is a virtual request
 	if (aux_req->reqnb > 1) {
 		//free all sub-requests
 		list_of_requests_cleanup(&aux_req->reqs_list);
 	}
-	//free the memory
-	if (aux_req->file_id) free(aux_req->file_id);
-	free(aux_req);
+	//free the memory (file_id belongs to the file structure, so it is not freed here)
+	mem_pool_free(REQUEST_POOL, aux_req);
 }
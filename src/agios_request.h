@@ -5,12 +5,24 @@
 #pragma once
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #include "mylist.h"
+#include "myrbtree.h"
+
+#define AGIOS_CACHE_LINE_SIZE 64 /**< the size of a cache line, used to align structures that are scanned often. */
 
 struct request_t;
+/** \enum 
+ *  \brief Where a new request is in its addition to the data structures (@see request_is_added).
+ */
+enum {
+	REQ_ADD_PENDING = 0, /**< it was not added yet (it may be waiting in the queue of deferred additions) */
+	REQ_ADDED = 1, /**< it was added to the data structures */
+	REQ_ADD_FAILED = 2, /**< the AGIOS thread could not add it (deferred additions only), it is kept until agios_exit_ctx because the user still holds its handle */
+};
 /*! \struct queue_statistics_t 
     \brief the statistics we keep for each queue (one for write and another for read) of each file in the system
  */
@@ -35,6 +47,8 @@ struct queue_statistics_t  {
  */	
 struct queue_t {
 	struct agios_list_head list ; /**< the queue of requests */
+	struct agios_rb_root index; /**< the requests of list, in the same order, so we can find where a new request goes without going through the list. When TO-agg is used, the requests of this queue that are in the timeline, ordered by end offset (offset+len), so we can find the ones a new request could be aggregated to (@see req_timeline.c) */
+	int64_t index_max_len; /**< when TO-agg is used, the largest len of the requests in index (it is not decreased when requests leave the index, only when it becomes empty) */
 	struct agios_list_head dispatch; /**< contains requests which were already scheduled, but not released yet */
 	struct file_t *req_file; /**< a pointer to the struct with information about this file */
 	//fields used by aIOLi (and also some of them are used by MLF)
@@ -42,15 +56,18 @@ struct queue_t {
 	int64_t lastfinaloff ; /**< used by aIOLi for shift phenomenon detection */
 	int64_t predictedoff ; /**< used by aIOLi for shift phenomenon detection */
 	int32_t nextquantum; /**< used by aIOLi to keep track of quanta */
+	uint32_t sched_epoch; /**< incremented every time MLF or aIOLi try to select a request from this queue, which doubles the sched_factor of all its requests (@see get_sched_factor) */
 	int64_t shift_phenomena; /**< counter used to make decisions regarding waiting times (for aIOLi) */
 	int64_t better_aggregation; /**< counter used to make decisions regarding waiting times (for aIOLi) */
 	//fields used to keep statistics
 	struct queue_statistics_t stats;  /**< statistics */
 	int64_t current_size; /**< sum of all its requests' sizes (even if they overlap). Used by SJF and some statistics */ 
+	int32_t heap_index; /**< position of the queue in the heap of SJF-heap, -1 if it is not there */
 	int32_t lastaggregation ;	/**< Number of request contained in the last processed virtual request. Used to help deciding on waiting times */ 
 	int32_t	best_agg; /**< best aggregation performed to this queue. Used to help deciding on waiting times */ 
 	struct timespec last_req_time; /**< timestamp of the last time we received a request for this one, used to keep statistics on time between requests */
 	int64_t last_received_finaloffset; /**< offset+len of the last request received to this queue, used to keep statistics on offset distance between consecutive requests */
+	int64_t dispatch_batchnb; /**< number of times requests from this queue were sent back to the user, used to identify requests that were sent together */
 };
 /*! \struct file_t
     \brief Holds information about one file that has received requests in this library
@@ -64,38 +81,51 @@ struct file_t {
 	struct queue_t write_queue; /**< write queue */
 	int64_t timeline_reqnb; /**< counter for knowing how many requests in the timeline are accessing this file */
 	struct agios_list_head hashlist; /**< to insert this structure in a list (hashtable position or timeline_files) */ 
+	struct agios_list_head activelist; /**< to insert this structure in the list of active files of its hashtable line (the ones with requests in their queues). It points to itself when the file is not active. */
+	struct agios_list_head idlelist; /**< to insert this structure in the list of idle files of its hashtable line (the ones that can be evicted, @see file_eviction.c). It points to itself when the file is not idle or files are not evicted. */
+	int64_t idle_since; /**< when the file became idle (only set if it is in the list of idle files) */
 	//used by aIOLi and SJF to handle waiting times (they apply to the whole file, not only the queue)
 	int32_t waiting_time; /**< for how long should we be waiting */
 	struct timespec waiting_start; /**< since when are we waiting */
 	int64_t first_request_time; /**< arrival time of the first request to this file, all requests' arrival times will be relative to this one */
+	int32_t hash; /**< the line of the hashtable where this structure is */
+	uint64_t file_hash; /**< the hash of file_id, given by get_file_hash. It is used to choose the line of the hashtable and the bucket of the line's index */
+	struct file_t *bucket_next; /**< the next file in the same bucket of the index of its hashtable line (@see req_hashtable.h) */
+	int32_t key; /**< the key given by agios_register_file, -1 if this file was not registered */
 };
 /*! \struct request_t
     \brief The structure holding information about one request in the system.
 
     It is created when a request is added and destroyed after release or cancel. It is added to queue_t of the appropriated file or to the timeline (depending on the scheduling algorithm being used). This structure might alternatively be a "virtual request", composed of a list of aggregated requests.
+    The fields are ordered by how often they are used. The first cache line holds everything scheduling algorithms read while going through queues (the list and index links, offset, len and sched_factor), so going from one request to the next touches a single line. The others are only used for the requests that are selected, dispatched or released. The memory pool gives each request its own cache lines, starting at the beginning of one (@see mem_pool.c). The type itself is not aligned, because list iterations compute the containing request of the list head of a queue and compare it with the current one, which is only valid for types whose alignment is not larger than that of the list head.
  */
-struct request_t { 
-	char *file_id;  /**< file handle */
-	int64_t arrival_time; /**< arrival time of the request to AGIOS */
-	int64_t dispatch_timestamp; /**< timestamp of when the request was given back to the user */ 
-	int32_t type; /**< RT_READ or RT_WRITE */
+struct request_t {
+	//hot part: read for every request while scanning queues and the timeline
+	struct agios_list_head related; /**< for including in hashtable or timeline */ 
+	struct agios_rb_node index_node; /**< for including in the index of its queue (only while it is in a queue of the hashtable) */
 	int64_t offset; /**< position of the file in bytes */
 	int64_t len; /**< request size in bytes */
-	int32_t queue_id; /**< an identifier of the queue to be used for this request, relevant for SW and TWINS only */
-	int64_t sw_priority; /**< value calculated by the SW algorithm to insert the request into the queue */
-	int64_t user_id;  /**< value passed by AGIOS' user (for knowing which request is this one)*/
-	int32_t sched_factor; /**< used by MLF and aIOLi */
-	int64_t timestamp; /**< the arrival order at the scheduler (a global value incremented each time a request arrives so the current value is given to that request as its timestamp)*/
-	/*request's position inside data structures*/
-	struct agios_list_head related; /**< for including in hashtable or timeline */ 
+	int32_t sched_factor; /**< used by MLF and aIOLi (requests in the hashtable). It doubles every time the scheduler looks at the queue, but that is not written here for every request, this is the value it had when the sched_epoch of its queue was sched_epoch. The current value is given by get_sched_factor (@see waiting_common.c) */
+	uint32_t sched_epoch; /**< the sched_epoch of its queue when sched_factor was last updated */
+	//cold part: read when the request is selected, dispatched or released
 	struct queue_t *globalinfo; /**< pointer for the related list inside the file (list of reads or  writes) */
-	/*for aggregations*/
 	int32_t reqnb; /**< for virtual requests (real requests), it is the number of requests aggregated into this one. */
+	int32_t type; /**< RT_READ or RT_WRITE */
+	int64_t arrival_time; /**< arrival time of the request to AGIOS */
+	int64_t user_id;  /**< value passed by AGIOS' user (for knowing which request is this one)*/
+	int64_t dispatch_timestamp; /**< timestamp of when the request was given back to the user */ 
+	int64_t dispatch_batch; /**< requests of the same queue with the same value were given back to the user together (in the same call to the callback) */
 	struct agios_list_head reqs_list; /**< list of requests inside this virtual request*/
 	struct request_t *agg_head; /**< pointer to the virtual request structure (if this one is part of an aggregation) */
-	struct agios_list_head list;  /**< to be inserted as part of a virtual request */
+	int64_t timestamp; /**< the arrival order at the scheduler (a global value incremented each time a request arrives so the current value is given to that request as its timestamp)*/
+	char *file_id;  /**< file handle (it points to the file_id of its struct file_t, it is not a copy) */
+	int32_t queue_id; /**< an identifier of the queue to be used for this request, relevant for SW and TWINS only */
+	atomic_int add_state; /**< REQ_ADD_PENDING, REQ_ADDED or REQ_ADD_FAILED, set while holding the lock of the data structure, so the functions that receive a handle can tell if the request is there (@see request_is_added) */
+	bool release_claimed; /**< set while process_deferred_releases releases the request, so no other completion record of the same drain can release it again (@see agios_release_request.c) */
+	struct SW_queue_t *sw_queue; /**< the queue of the calendar of SW where this request is, NULL if it is not there (@see SW.c) */
 };
 
+void request_del(struct request_t *req);
 void request_cleanup(struct request_t *aux_req);
 void list_of_requests_cleanup(struct agios_list_head *list);
 void print_request(struct request_t *req);
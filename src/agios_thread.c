@@ -6,53 +6,78 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
+#include "agios_add_request.h"
 #include "agios_config.h"
+#include "agios_ctx.h"
 #include "agios_counters.h"
+#include "agios_release_request.h"
 #include "agios_thread.h"
 #include "common_functions.h"
 #include "data_structures.h"
+#include "file_eviction.h"
 #include "performance.h"
 #include "scheduling_algorithms.h"
 #include "statistics.h"
 
-static pthread_cond_t g_request_added_cond = PTHREAD_COND_INITIALIZER;  /**< Used to let the agios thread know that we have new requests. */
-static pthread_mutex_t g_request_added_mutex = PTHREAD_MUTEX_INITIALIZER; /**< Used to protect the request_added_cond. */
-static bool g_agios_thread_stop = false; /**< Set to true when the agios_exit function calls stop_the_agios_thread. */
-static struct timespec g_last_algorithm_update; //the time at the last time we've selected an algorithm
-static struct io_scheduler_instance_t *g_dynamic_scheduler=NULL; /**< The scheduling algorithm chosen in the configuration parameters. */
+static __thread struct agios_ctx_t *g_agios_thread_ctx = NULL; /**< Only set for AGIOS threads, to the instance each one is running. */
 
 /**
  * function called when a new request is added to wake up the agios thread in case it is sleeping waiting for new requests.
+ * @param ctx the AGIOS instance.
  */
-void signal_new_req_to_agios_thread(void)
+void signal_new_req_to_agios_thread(struct agios_ctx_t *ctx)
 {
-	pthread_mutex_lock(&g_request_added_mutex);
-	pthread_cond_signal(&g_request_added_cond);
-	pthread_mutex_unlock(&g_request_added_mutex);
+	pthread_mutex_lock(&ctx->request_added_mutex);
+	pthread_cond_signal(&ctx->request_added_cond);
+	pthread_mutex_unlock(&ctx->request_added_mutex);
 }
 /**
- * function called by the agios_exit function to let the agios thread know we are finishing the execution.
+ * function called by agios_exit_ctx to let the agios thread know we are finishing the execution.
+ * @param ctx the AGIOS instance.
  */
-void stop_the_agios_thread(void)
+void stop_the_agios_thread(struct agios_ctx_t *ctx)
 {
-	g_agios_thread_stop = true; //we chose not to protect this variable with a mutex because there is a single thread writing to it and a single thread reading it, the worse it could happen is that the agios thread does not read it correctly, but then it will read it later. It is not a big deal if the agios_exit call waits a little longer.
+	ctx->agios_thread_stop = true; //we chose not to protect this variable with a mutex because there is a single thread writing to it and a single thread reading it, the worse it could happen is that the agios thread does not read it correctly, but then it will read it later. It is not a big deal if the agios_exit call waits a little longer.
 	//we signal the agios thread so it will wake up if it is sleeping
-	signal_new_req_to_agios_thread();
+	signal_new_req_to_agios_thread(ctx);
+}
+/**
+ * used to know if the calling thread is the agios thread of an instance (the scheduling algorithms may also be called by the user threads, for instance by NOOP when requests are added).
+ * @param ctx the AGIOS instance.
+ * @return true or false.
+ */
+bool running_on_agios_thread(struct agios_ctx_t *ctx)
+{
+	return g_agios_thread_ctx == ctx;
 }
 /**
  * used to test if it is time to update the scheduling algorithm.
+ * @param ctx the AGIOS instance.
  * @return true or false.
  */
-bool is_time_to_change_scheduler(void)
+bool is_time_to_change_scheduler(struct agios_ctx_t *ctx)
 {
-	if ((g_dynamic_scheduler->is_dynamic) &&
-		(config_agios_select_algorithm_period >= 0) &&
-		(agios_processed_reqnb >= config_agios_select_algorithm_min_reqnumber)) {
-		if (get_nanoelapsed(g_last_algorithm_update) >= config_agios_select_algorithm_period) return true;
+	if ((ctx->dynamic_scheduler->is_dynamic) &&
+		(!atomic_load_explicit(&ctx->migrating, memory_order_relaxed)) && //requests are still being moved after the last change (@see migrate_slice)
+		(ctx->config.select_algorithm_period >= 0) &&
+		(ctx->processed_reqnb >= ctx->config.select_algorithm_min_reqnumber)) {
+		if (get_nanoelapsed(ctx->last_algorithm_update) >= ctx->config.select_algorithm_period) return true;
 	}
 	return false;
 }
+/**
+ * reports how long threads had to wait for the data structures because of the last change of scheduling algorithm, once it is over (including the migration of requests to the other data structure, if there was one).
+ * @param ctx the AGIOS instance.
+ */
+static void report_switch_wait(struct agios_ctx_t *ctx)
+{
+	int64_t wait = atomic_load_explicit(&ctx->switch_max_wait, memory_order_relaxed); /**< the longest wait */
+
+	debug("the change to %s is over, %ld requests were migrated in %d slices, threads waited at most %ld ns", ctx->current_scheduler->name, atomic_load(&ctx->migrated_reqnb), ctx->migration_slices, wait);
+	performance_set_switch_wait(ctx, wait);
+}
 /**
  * Fills a struct timespec (used by sleeping functions) with a provided value in nanoseconds
  * @param value_ns the value in nanoseconds
@@ -65,70 +90,89 @@ void fill_struct_timespec(int32_t value_ns, struct timespec *str)
 }
 /**
  * the main function executed by the agios thread, which is responsible for processing requests that have been added to AGIOS.
+ * @param arg the AGIOS instance (struct agios_ctx_t) this thread runs.
  */
 void * agios_thread(void *arg)
 {
+	struct agios_ctx_t *ctx = arg; /**< the AGIOS instance. */
 	struct timespec timeout; /**< Used to set a timeout for pthread_cond_timedwait, so the thread periodically checks if it has to end. */
 	int32_t remaining_time = 1; /**< Used to calculate how long until we change the scheduling algorithm again */
 	int32_t scheduler_waiting_time = 0; /**< Used to receive instructions from the scheduling algorithms to sleep for some time before calling them again (even if we have queued requests to be processed) */
+	struct timespec switch_start; /**< when we started changing the scheduling algorithm */
+	bool report_switch = false; /**< did we change the scheduling algorithm and have not reported its cost yet? */
 
+	g_agios_thread_ctx = ctx;
 	//find out which I/O scheduling algorithm we need to use
-	g_dynamic_scheduler = initialize_scheduler(config_agios_default_algorithm); //if the scheduler has an init function, it will be called
+	ctx->dynamic_scheduler = initialize_scheduler(ctx, ctx->config.default_algorithm); //if the scheduler has an init function, it will be called
 	//a dynamic scheduling algorithm is a scheduling algorithm that periodically selects other scheduling algorithms to be used
-	if (!g_dynamic_scheduler->is_dynamic) { //we are NOT using a dynamic scheduling algorithm
-		current_alg = config_agios_default_algorithm;
-		current_scheduler = g_dynamic_scheduler;
+	if (!ctx->dynamic_scheduler->is_dynamic) { //we are NOT using a dynamic scheduling algorithm
+		ctx->current_alg = ctx->config.default_algorithm;
+		ctx->current_scheduler = ctx->dynamic_scheduler;
 	} else { //we ARE using a dynamic scheduler
 		//with which algorithm should we start?
-		current_alg = config_agios_starting_algorithm;
-		current_scheduler = initialize_scheduler(current_alg);
-		agios_gettime(&g_last_algorithm_update);	//we will change the algorithm periodically
+		ctx->current_alg = ctx->config.starting_algorithm;
+		ctx->current_scheduler = initialize_scheduler(ctx, ctx->current_alg);
+		agios_gettime(&ctx->last_algorithm_update);	//we will change the algorithm periodically
 	}
-	performance_set_new_algorithm(current_alg);
-	debug("selected algorithm: %s", current_scheduler->name);
+	performance_set_new_algorithm(ctx, ctx->current_alg);
+	debug("selected algorithm: %s", ctx->current_scheduler->name);
 	//since the current algorithm is decided, we can allow requests to be included
-	unlock_all_data_structures();
+	end_scheduler_switch(ctx);
 
 	//execution loop, it only stops when we close the library
 	do {
+		//release the requests the user released since the last iteration (if library_options.deferred_release is set), so the performance information used to select algorithms is up to date
+		process_deferred_releases(ctx);
+		//add the requests the user added since the last iteration (if library_options.deferred_add is set)
+		process_deferred_adds(ctx);
+		//free the structures of files that have been idle for too long (if library_options.max_idle_files or idle_file_timeout are set)
+		if (is_time_to_evict_files(ctx)) evict_idle_files(ctx);
+		//move some of the requests that are still in the data structure of the previous scheduling algorithm (if the last change was between one that uses the hashtable and one that uses the timeline)
+		if (atomic_load_explicit(&ctx->migrating, memory_order_relaxed)) migrate_slice(ctx);
+		if ((report_switch) && (!atomic_load_explicit(&ctx->migrating, memory_order_relaxed))) { //threads that were waiting for the change had one iteration to go on
+			report_switch_wait(ctx);
+			report_switch = false;
+		}
 		//check if it is time to change the scheduling algorithm
-		if (g_dynamic_scheduler->is_dynamic) {
-			if (is_time_to_change_scheduler()) { //it is time to select!
+		if (ctx->dynamic_scheduler->is_dynamic) {
+			if (is_time_to_change_scheduler(ctx)) { //it is time to select!
 				//make a decision on the next scheduling algorithm
-				int32_t next_alg = g_dynamic_scheduler->select_algorithm();
+				int32_t next_alg = ctx->dynamic_scheduler->select_algorithm(ctx);
 				//change it
 				debug("HEY IM CHANGING THE SCHEDULING ALGORITHM\n\n\n\n");
-				change_selected_alg(next_alg);
-				performance_set_new_algorithm(current_alg);
-				reset_all_statistics(); //reset all stats so they will not affect the next selection
-				unlock_all_data_structures(); //we can allow new requests to be added now
-				agios_gettime(&g_last_algorithm_update);
-				debug("We've changed the scheduling algorithm to %s", current_scheduler->name);
-				remaining_time = config_agios_select_algorithm_period;
+				agios_gettime(&switch_start);
+				change_selected_alg(ctx, next_alg);
+				performance_set_new_algorithm(ctx, ctx->current_alg);
+				reset_all_statistics(ctx); //reset all stats so they will not affect the next selection
+				end_scheduler_switch(ctx); //we can allow new requests to be added now
+				agios_gettime(&ctx->last_algorithm_update);
+				debug("We've changed the scheduling algorithm to %s, other threads could not use the data structures for %ld ns", ctx->current_scheduler->name, get_nanoelapsed(switch_start));
+				report_switch = true;
+				remaining_time = ctx->config.select_algorithm_period;
 			} else { //it is NOT time to select
-				remaining_time = config_agios_select_algorithm_period - get_nanoelapsed(g_last_algorithm_update);
+				remaining_time = ctx->config.select_algorithm_period - get_nanoelapsed(ctx->last_algorithm_update);
 				if (remaining_time < 0) remaining_time = 0;
 			}
 		} //end scheduler is dynamic
 		//if we have queued requests, try to process them
-		if (0 < get_current_reqnb()) { //here we use the mutex to access the variable current_reqnb because we don't want to risk getting an outdated value and then sleeping for nothing
-			scheduler_waiting_time = current_scheduler->schedule(); //the scheduler may have a reason to ask us for a sleeping time (for instance, TWINS keeps track of time windows)
-			if (scheduler_waiting_time > 0) { //the scheduling algorithm wants us to sleep for a while, so we'll respect that, and not with a cond_timedwait because this sleep is not to be interrupted by new request arrivals, and is not conditional to not having queued requests (we assume the scheduling algorithm knows what it is doing)
+		if (0 < get_current_reqnb(ctx)) { //here we use an acquire load to read current_reqnb because we don't want to risk getting an outdated value and then sleeping for nothing
+			scheduler_waiting_time = ctx->current_scheduler->schedule(ctx); //the scheduler may have a reason to ask us for a sleeping time (for instance, TWINS keeps track of time windows)
+			if ((scheduler_waiting_time > 0) && (!atomic_load_explicit(&ctx->migrating, memory_order_relaxed))) { //the scheduling algorithm wants us to sleep (but not while requests are being migrated, it may only be waiting for the ones it does not see yet) for a while, so we'll respect that, and not with a cond_timedwait because this sleep is not to be interrupted by new request arrivals, and is not conditional to not having queued requests (we assume the scheduling algorithm knows what it is doing)
                 if(remaining_time >= 0){
     				fill_struct_timespec(agios_min(scheduler_waiting_time, remaining_time), &timeout); //if we are supposed to change the scheduling algorithm before the end of the waiting time provided by the scheduler, we just wait until then
 				}else{
     				fill_struct_timespec(scheduler_waiting_time, &timeout);
 				}
-				if (TWINS_SCHEDULER != current_alg) {
+				if (TWINS_SCHEDULER != ctx->current_alg) {
 					nanosleep(&timeout, NULL);
 				} else {
                     /*unless of course we are using TWINS. In that case the sleeping time is NOT to be respected unconditionally,
                      * we are sleeping because there are no requests to the server being accessed, but if some new requests arrive
                      * they could be to that server, and then we should call TWINS again
                      */
-	 				pthread_mutex_lock(&g_request_added_mutex);
-					pthread_cond_timedwait(&g_request_added_cond, &g_request_added_mutex, &timeout);
-					pthread_mutex_unlock(&g_request_added_mutex);
+	 				pthread_mutex_lock(&ctx->request_added_mutex);
+					pthread_cond_timedwait(&ctx->request_added_cond, &ctx->request_added_mutex, &timeout);
+					pthread_mutex_unlock(&ctx->request_added_mutex);
 				} //end if using TWINS
 			} //end if scheduler_waiting_time > 0
 		} else { //we have no requests, so we sleep for a while (the default waiting time is provided in the configuration parameters), but this sleeping uses a conditional variable because we want to be called up if some new requests arrive (not having requests is the only reason why we are sleeping)
@@ -142,13 +186,14 @@ void * agios_thread(void *arg)
              * change). Second, if remaining time is greater than 0, that means we are using a dynamic scheduler AND we it is not yet time to
              * change the scheduling algorithm. If that is supposed to happen earlier than our usual waiting time,
              * we wake up earlier to respect that.*/
-			if (remaining_time > 0) fill_struct_timespec(agios_min(config_waiting_time, remaining_time), &timeout);
-			else fill_struct_timespec(config_waiting_time, &timeout);
-	 		pthread_mutex_lock(&g_request_added_mutex);
-			pthread_cond_timedwait(&g_request_added_cond, &g_request_added_mutex, &timeout);
-			pthread_mutex_unlock(&g_request_added_mutex);
+			if (remaining_time > 0) fill_struct_timespec(agios_min(ctx->config.waiting_time, remaining_time), &timeout);
+			else fill_struct_timespec(ctx->config.waiting_time, &timeout);
+	 		pthread_mutex_lock(&ctx->request_added_mutex);
+			//deferred additions signal us only when they find their queue empty, so we check it while holding the mutex to be sure we will not miss that signal
+			if (!has_deferred_adds(ctx)) pthread_cond_timedwait(&ctx->request_added_cond, &ctx->request_added_mutex, &timeout);
+			pthread_mutex_unlock(&ctx->request_added_mutex);
 		}
-        } while (!g_agios_thread_stop);
+        } while (!ctx->agios_thread_stop);
 
 	return 0;
 }
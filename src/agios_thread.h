@@ -5,8 +5,12 @@
 */
 #pragma once
 
+#include <stdbool.h>
+
+struct agios_ctx_t;
 
 void * agios_thread(void *arg);
-void stop_the_agios_thread(void);
-void signal_new_req_to_agios_thread(void);
-bool is_time_to_change_scheduler(void);
+void stop_the_agios_thread(struct agios_ctx_t *ctx);
+void signal_new_req_to_agios_thread(struct agios_ctx_t *ctx);
+bool is_time_to_change_scheduler(struct agios_ctx_t *ctx);
+bool running_on_agios_thread(struct agios_ctx_t *ctx);
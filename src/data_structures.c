@@ -5,10 +5,12 @@
     @see req_hashtable.c
     @see req_timeline.c
     @see agios_add_request.c
-    Depending on the scheduling algorithm being used, requests will be organized in different data structures. For instance, aIOLi and SJF use a hashtable, TO and TO-agg use a timeline, and TWINS uses multiple timelines. No matter the data structure used to hold the requests, AGIOS will always maintain the hashtable, because it is used for the statistics.
+    Depending on the scheduling algorithm being used, requests will be organized in different data structures. For instance, aIOLi and SJF use a hashtable, TO and TO-agg use a timeline, and TWINS and WFQ use multiple timelines (the multi_timeline). No matter the data structure used to hold the requests, AGIOS will always maintain the hashtable, because it is used for the statistics.
 */
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <semaphore.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -17,48 +19,56 @@
 #include <limits.h>
 
 #include "agios_counters.h"
+#include "agios_ctx.h"
 #include "agios_request.h"
 #include "common_functions.h"
+#include "data_structures.h"
 #include "hash.h"
+#include "mem_pool.h"
 #include "mylist.h"
 #include "req_hashtable.h"
 #include "req_timeline.h"
 #include "scheduling_algorithms.h"
+#include "SJF.h"
 #include "statistics.h"
 
-void put_all_requests_in_timeline(struct agios_list_head *queue, struct file_t *req_file, int32_t hash);
-void put_all_requests_in_hashtable(struct agios_list_head *list);
+void put_all_requests_in_timeline(struct agios_ctx_t *ctx, struct agios_list_head *queue, struct file_t *req_file, int32_t hash);
+void put_all_requests_in_hashtable(struct agios_ctx_t *ctx, struct agios_list_head *list);
 
 /**
  * function called to move a request from the hashtable to the timeline. If the request is a virtual one (composed of multiple actual requests) and the new scheduling algorithm does not allow aggregations, the request will be separated and all its parts will be added to the timeline.
+ * @param ctx the AGIOS instance.
  * @param req the request to be moved.
  * @param hash the line of the hashtable from where this request came.
  * @param req_file the file accessed by this request.
  */
-void put_this_request_in_timeline(struct request_t *req,
+void put_this_request_in_timeline(struct agios_ctx_t *ctx,
+					struct request_t *req,
 					int32_t hash,
 					struct file_t *req_file)
 {
 	//remove from queue
-	agios_list_del(&req->related);
-	if ((req->reqnb > 1) && (current_scheduler->max_aggreg_size <= 1)) {
+	request_del(req);
+	req->agg_head = NULL; //if it was part of a virtual request, it is not anymore (it could be aggregated again when added to the timeline)
+	if ((req->reqnb > 1) && (ctx->current_scheduler->max_aggreg_size <= 1)) {
 		//this is a virtual request, we need to break it into parts
-		put_all_requests_in_timeline(&req->reqs_list, req_file, hash);
+		put_all_requests_in_timeline(ctx, &req->reqs_list, req_file, hash);
 		//the parts were added to the timeline, the "super-request" has to be freed
-		if (req->file_id) free(req->file_id);
-		free(req);
+		mem_pool_free(REQUEST_POOL, req);
 	}
-	else timeline_add_req(req, hash, req_file); //put in timeline
+	else timeline_add_req(ctx, req, hash, req_file); //put in timeline
 
 }
 /**
  * function called to move all requests from a list of requests (either a queue from the hashtable or an aggregated request) to the timeline.
+ * @param ctx the AGIOS instance.
  * @see put_this_request_in_timeline
  * @param queue the list of requests.
  * @param req_file the file from which this list came from.
  * @param hash the line of the hashtable from which this list came from.
  */
-void put_all_requests_in_timeline(struct agios_list_head *queue,
+void put_all_requests_in_timeline(struct agios_ctx_t *ctx,
+					struct agios_list_head *queue,
 					struct file_t *req_file,
 					int32_t hash)
 {
@@ -66,142 +76,515 @@ void put_all_requests_in_timeline(struct agios_list_head *queue,
 	struct request_t *aux_req=NULL; /**< used so we don't move and free the request before moving the iterator to the next one, otherwise the loop breaks. */
 
 	agios_list_for_each_entry (req, queue, related) { //go through all requests
-		if (aux_req) put_this_request_in_timeline(aux_req, hash, req_file);
+		if (aux_req) put_this_request_in_timeline(ctx, aux_req, hash, req_file);
 		aux_req = req;
 	}
-	if (aux_req) put_this_request_in_timeline(aux_req, hash, req_file);
+	if (aux_req) put_this_request_in_timeline(ctx, aux_req, hash, req_file);
 }
 /**
  * function used to move a request from the timeline to the hashtable. If this request is a virtual one (composed of multiple actual requests) and the new scheduling algorithm does not allow aggregations, the request will be separated and all its sub-requests will be added to the hashtable separately.
+ * @param ctx the AGIOS instance.
  * @param req the request.
  */
-void put_req_in_hashtable(struct request_t *req)
+void put_req_in_hashtable(struct agios_ctx_t *ctx, struct request_t *req)
 {
-	int32_t hash = get_hashtable_position(req->file_id); /**< the line of the hashtable corresponding to this request's file */
+	int32_t hash = req->globalinfo->req_file->hash; /**< the line of the hashtable corresponding to this request's file */
 
 	//remove the request from the timeline
-	agios_list_del(&req->related);
-	if ((req->reqnb > 1) && (current_scheduler->max_aggreg_size <= 1)) {
-		put_all_requests_in_hashtable(&req->reqs_list);
+	request_del(req);
+	req->agg_head = NULL; //if it was part of a virtual request, it is not anymore (it could be aggregated again when added to the hashtable)
+	if ((req->reqnb > 1) && (ctx->current_scheduler->max_aggreg_size <= 1)) {
+		put_all_requests_in_hashtable(ctx, &req->reqs_list);
 		//free the virtual request (which used to have many sub-requests but that is now empty)
-		if (req->file_id) free(req->file_id);
-		free(req);
-	} else hashtable_add_req(req, hash, req->globalinfo->req_file);
+		mem_pool_free(REQUEST_POOL, req);
+	} else {
+		hashtable_add_req(ctx, req, hash, req->globalinfo->req_file);
+		SJF_heap_update(ctx, req->globalinfo);
+	}
 }
 /**
  * function used to move a list of requests from the timeline to the hashtable.
+ * @param ctx the AGIOS instance.
  * @see put_req_in_hashtable
  * @param list the list of requests.
  */
-void put_all_requests_in_hashtable(struct agios_list_head *list)
+void put_all_requests_in_hashtable(struct agios_ctx_t *ctx, struct agios_list_head *list)
 {
 	struct request_t *req; /**< used to iterate over all requests in the list */
 	struct request_t *aux_req=NULL; /**< used to avoid moving and freeing the request before moving the iterator to the next one, otherwise the loop breaks. */
 
 	agios_list_for_each_entry (req, list, related) { //go over all requests
-		if (aux_req) put_req_in_hashtable(aux_req);
+		if (aux_req) put_req_in_hashtable(ctx, aux_req);
 		aux_req = req;
 	}
-	if (aux_req) put_req_in_hashtable(aux_req);
+	if (aux_req) put_req_in_hashtable(ctx, aux_req);
+}
+/**
+ * gives how many requests will be moved to the timeline from a queue of the hashtable (the virtual requests count as their parts if the current scheduling algorithm does not aggregate requests).
+ * @param ctx the AGIOS instance.
+ * @param queue the queue.
+ * @return the number of requests.
+ */
+static int32_t count_requests_to_timeline(struct agios_ctx_t *ctx, struct queue_t *queue)
+{
+	struct request_t *req; /**< used to iterate over the queue */
+	int32_t ret = 0; /**< the return of the function */
+
+	agios_list_for_each_entry (req, &queue->list, related) ret += (ctx->current_scheduler->max_aggreg_size <= 1) ? req->reqnb : 1;
+	return ret;
+}
+/**
+ * takes all requests from a queue of the hashtable and puts them in an array, splitting virtual requests if the current scheduling algorithm does not aggregate requests (@see put_this_request_in_timeline).
+ * @param ctx the AGIOS instance.
+ * @param queue the queue.
+ * @param reqs the array, with room for count_requests_to_timeline requests after the ones already there.
+ * @param reqnb how many requests are already in reqs.
+ * @return how many requests are in reqs now.
+ */
+static int32_t take_requests_from_queue(struct agios_ctx_t *ctx, struct queue_t *queue, struct request_t **reqs, int32_t reqnb)
+{
+	struct request_t *req; /**< used to iterate over the queue */
+	struct request_t *next_req; /**< the one after req */
+	struct request_t *part; /**< used to iterate over the parts of a virtual request */
+	struct request_t *next_part; /**< the one after part */
+
+	agios_list_for_each_entry_safe (req, next_req, &queue->list, related) {
+		request_del(req);
+		req->agg_head = NULL;
+		if ((req->reqnb > 1) && (ctx->current_scheduler->max_aggreg_size <= 1)) {
+			agios_list_for_each_entry_safe (part, next_part, &req->reqs_list, related) {
+				request_del(part);
+				part->agg_head = NULL;
+				reqs[reqnb++] = part;
+			}
+			mem_pool_free(REQUEST_POOL, req);
+		} else reqs[reqnb++] = req;
+	}
+	return reqnb;
+}
+/**
+ * moves all requests of a file from the hashtable to the timeline. Its requests in the timeline arrived after the change of scheduling algorithm, so these ones go to the beginning of its shard, sorted by arrival (@see __timeline_add_req). For TWINS and WFQ, they are merged with the ones already in the queues of the multi_timeline, so each queue stays in arrival order (@see multi_timeline_merge). The caller must hold the lock of the shard of the timeline of the file.
+ * @param ctx the AGIOS instance.
+ * @param req_file the file.
+ * @return the number of requests moved.
+ */
+static int32_t move_file_to_timeline(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	struct request_t **reqs; /**< the requests being moved */
+	int32_t reqnb; /**< how many */
+
+	reqnb = count_requests_to_timeline(ctx, &req_file->read_queue) + count_requests_to_timeline(ctx, &req_file->write_queue);
+	if (reqnb == 0) return 0;
+	reqs = malloc(sizeof(struct request_t *)*reqnb);
+	if (!reqs) { //we cannot sort them, so they go in the order of the queues
+		agios_print("PANIC! Could not allocate memory to sort requests, they are moved to the timeline out of order");
+		put_all_requests_in_timeline(ctx, &req_file->read_queue.list, req_file, req_file->hash);
+		put_all_requests_in_timeline(ctx, &req_file->write_queue.list, req_file, req_file->hash);
+	} else {
+		reqnb = take_requests_from_queue(ctx, &req_file->read_queue, reqs, 0);
+		reqnb = take_requests_from_queue(ctx, &req_file->write_queue, reqs, reqnb);
+		qsort(reqs, reqnb, sizeof(struct request_t *), timeline_compare_newest_first);
+		if (ctx->current_scheduler->multi_timeline) multi_timeline_merge(ctx, reqs, reqnb);
+		else {
+			for (int32_t i = 0; i < reqnb; i++) timeline_add_req(ctx, reqs[i], req_file->hash, req_file);
+		}
+		free(reqs);
+	}
+	hashtable_update_active(ctx, req_file);
+	return reqnb;
+}
+/**
+ * used to know if a queue of the hashtable has requests still in the timeline in its index. TO-agg indexes the requests of each queue that are in the timeline (@see add_to_index), while in the hashtable the index has the requests of the list of the queue, so an index without a list means the first case.
+ * @param queue the queue.
+ * @return true or false.
+ */
+static inline bool has_timeline_index(struct queue_t *queue)
+{
+	return (queue->index.node) && (agios_list_empty(&queue->list));
+}
+/**
+ * moves to the hashtable the requests of a queue that are still in the timeline and in its index (@see has_timeline_index). That must be done before any request is added to the queue in the hashtable, otherwise the two kinds of requests would be mixed in the index. The caller must hold the lock of the line of the hashtable of the file and the one of the shard of the timeline where the requests are.
+ * @param ctx the AGIOS instance.
+ * @param queue the queue.
+ * @return the number of requests moved.
+ */
+static int32_t move_indexed_requests_to_hashtable(struct agios_ctx_t *ctx, struct queue_t *queue)
+{
+	AGIOS_LIST_HEAD(reqs); /**< the requests taken from the index */
+	struct request_t *req; /**< a request in the index */
+	int32_t reqnb = 0; /**< how many */
+
+	if (!has_timeline_index(queue)) return 0;
+	//the index is emptied first, so the requests are added to the hashtable as to an empty queue
+	while (queue->index.node) {
+		req = agios_rb_entry(queue->index.node, struct request_t, index_node);
+		request_del(req);
+		agios_list_add_tail(&req->related, &reqs);
+		reqnb++;
+	}
+	put_all_requests_in_hashtable(ctx, &reqs);
+	return reqnb;
+}
+/**
+ * gives the shard of the timeline where the requests to the files of a line of the hashtable were before a change to a scheduling algorithm that uses the hashtable. Its lock also protects the multi_timeline, if they were there.
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable.
+ * @return the shard.
+ */
+static inline int32_t migration_shard(struct agios_ctx_t *ctx, int32_t hash)
+{
+	if (!ctx->migration_sharded_timeline) return 0;
+	return hash >> ctx->timeline_shard_shift;
+}
+/**
+ * gives how many lists of requests the previous scheduling algorithm used, when migrating to the hashtable: the shards of the timeline or the queues of the multi_timeline (@see migration_list).
+ * @param ctx the AGIOS instance.
+ * @return the number of lists.
+ */
+static inline int32_t migration_listnb(struct agios_ctx_t *ctx)
+{
+	if (ctx->migration_multi_timeline) return ctx->multi_timeline_size;
+	return ctx->timeline_shardnb;
+}
+/**
+ * gives one of the lists where the requests were before a change to a scheduling algorithm that uses the hashtable. The previous algorithm used either the shards of the timeline or the queues of the multi_timeline (TWINS and WFQ), which are protected by the lock of the first shard.
+ * @param ctx the AGIOS instance.
+ * @param index the list, smaller than migration_listnb.
+ * @param shard will receive the shard whose lock protects the list.
+ * @return the list.
+ */
+static inline struct agios_list_head *migration_list(struct agios_ctx_t *ctx, int32_t index, int32_t *shard)
+{
+	if (ctx->migration_multi_timeline) {
+		*shard = 0;
+		return &ctx->multi_timeline[index];
+	}
+	*shard = index;
+	return &ctx->timeline_shards[index].list;
+}
+/**
+ * moves requests of a file that are still in the timeline to the hashtable. The ones in the index of their queue are always moved (@see move_indexed_requests_to_hashtable), the others only if asked, because they are found by going through the requests of the shard. The caller must hold the lock of the line of the hashtable of the file, and this function takes the one of the shard where its requests were (always in this order, @see migrate_slice_to_hashtable).
+ * @param ctx the AGIOS instance.
+ * @param req_file the file.
+ * @param search_timeline should we look for all requests of the file in the timeline?
+ * @return the number of requests moved.
+ */
+static int32_t move_file_to_hashtable(struct agios_ctx_t *ctx, struct file_t *req_file, bool search_timeline)
+{
+	int32_t shard = migration_shard(ctx, req_file->hash); /**< where the requests of the file were */
+	struct request_t *req; /**< used to iterate over the requests of the shard or of the queues */
+	struct request_t *next_req; /**< the one after req */
+	int32_t in_hashtable = 0; /**< how many requests of the file are already in the hashtable */
+	int32_t ret = 0; /**< the return of the function */
+
+	if (search_timeline) {
+		agios_list_for_each_entry (req, &req_file->read_queue.list, related) in_hashtable += req->reqnb;
+		agios_list_for_each_entry (req, &req_file->write_queue.list, related) in_hashtable += req->reqnb;
+		search_timeline = in_hashtable < req_file->timeline_reqnb; //otherwise there are none in the timeline
+	}
+	if ((!search_timeline) && (!has_timeline_index(&req_file->read_queue)) && (!has_timeline_index(&req_file->write_queue))) return 0;
+	timeline_lock_shard(ctx, shard);
+	ret += move_indexed_requests_to_hashtable(ctx, &req_file->read_queue);
+	ret += move_indexed_requests_to_hashtable(ctx, &req_file->write_queue);
+	if ((search_timeline) && (ctx->migration_multi_timeline)) { //we do not know their queue_id, so we look in all queues
+		for (int32_t i = 0; i < ctx->multi_timeline_size; i++) {
+			agios_list_for_each_entry_safe (req, next_req, &ctx->multi_timeline[i], related) {
+				if (req->globalinfo->req_file != req_file) continue;
+				put_req_in_hashtable(ctx, req);
+				ret++;
+			}
+		}
+	} else if (search_timeline) {
+		agios_list_for_each_entry_safe (req, next_req, &ctx->timeline_shards[shard].list, related) {
+			if (req->globalinfo->req_file != req_file) continue;
+			put_req_in_hashtable(ctx, req);
+			ret++;
+		}
+	}
+	timeline_unlock_shard(ctx, shard);
+	return ret;
+}
+/**
+ * updates the longest time a thread waited for the data structures since the last change of scheduling algorithm (@see acquire_adequate_lock).
+ * @param ctx the AGIOS instance.
+ * @param wait the time this thread waited (in ns).
+ */
+static void record_switch_wait(struct agios_ctx_t *ctx, int64_t wait)
+{
+	int64_t max = atomic_load_explicit(&ctx->switch_max_wait, memory_order_relaxed); /**< the current value */
+
+	while ((wait > max) && (!atomic_compare_exchange_weak_explicit(&ctx->switch_max_wait, &max, wait, memory_order_relaxed, memory_order_relaxed)));
+}
+/**
+ * called while requests are being migrated after a change of scheduling algorithm (it does nothing otherwise), before adding a request to a file or looking for its requests, to move the requests of the file that are still in the data structure of the previous scheduling algorithm to the current one. That way the requests of a file are never split between them when they are used. The caller must hold the lock acquired by acquire_adequate_lock.
+ * @param ctx the AGIOS instance.
+ * @param req_file the file.
+ * @param search_timeline are we looking for a request of the file? When migrating to the hashtable, the requests of the file in the timeline do not get in the way of a new request (only the ones that TO-agg indexed do), so they are only moved when looking for a request, because that takes a time proportional to the number of requests in the shard. The same goes when migrating to the multi_timeline.
+ */
+void migrate_file(struct agios_ctx_t *ctx, struct file_t *req_file, bool search_timeline)
+{
+	struct timespec start; /**< the time spent here counts as waiting for the migration */
+	int32_t moved; /**< how many requests were moved */
+
+	if (!atomic_load_explicit(&ctx->migrating, memory_order_relaxed)) return;
+	if ((ctx->migrating_to_timeline) && (ctx->current_scheduler->multi_timeline) && (!search_timeline)) return; //TWINS and WFQ do not aggregate requests, so a new one does not need the old ones of its file, and merging them in the multi_timeline takes a time proportional to the number of requests there
+	agios_gettime(&start);
+	if (ctx->migrating_to_timeline) moved = move_file_to_timeline(ctx, req_file);
+	else moved = move_file_to_hashtable(ctx, req_file, search_timeline);
+	if (moved > 0) {
+		atomic_fetch_add_explicit(&ctx->migrated_reqnb, moved, memory_order_relaxed);
+		record_switch_wait(ctx, get_nanoelapsed(start));
+	}
+}
+/**
+ * moves the requests of some lines of the hashtable to the timeline (@see migrate_slice). Files are moved whole, so a slice may have more than MIGRATION_SLICE requests. New requests go to the timeline, so the lines that were left behind are not filled again.
+ * @param ctx the AGIOS instance.
+ * @return the number of requests moved.
+ */
+static int32_t migrate_slice_to_timeline(struct agios_ctx_t *ctx)
+{
+	struct file_t *req_file; /**< used to iterate over the active files of a line */
+	struct file_t *next_file; /**< the one after req_file, which leaves the list when its requests are moved */
+	int32_t line; /**< the line being moved */
+	int32_t ret = 0; /**< the return of the function */
+
+	for (line = hashtable_next_active_line(ctx, ctx->migration_position); (line >= 0) && (ret < MIGRATION_SLICE); line = hashtable_next_active_line(ctx, line + 1)) {
+		timeline_lock(ctx, line); //the lock that now protects this line
+		agios_list_for_each_entry_safe (req_file, next_file, &ctx->hashlist_active[line], activelist) ret += move_file_to_timeline(ctx, req_file);
+		timeline_unlock(ctx, line);
+		ctx->migration_position = line + 1;
+	}
+	if (line < 0) atomic_store(&ctx->migrating, false);
+	return ret;
+}
+/**
+ * moves the requests of some lines of the hashtable to the multi_timeline (@see migrate_slice), used instead of migrate_slice_to_timeline for TWINS and WFQ. The requests of all files of the slice are sorted together and merged with the ones already in the queues (@see multi_timeline_merge), so each queue ends in arrival order, and the merge goes through the queues once per slice instead of once per file.
+ * @param ctx the AGIOS instance.
+ * @return the number of requests moved.
+ */
+static int32_t migrate_slice_to_multi_timeline(struct agios_ctx_t *ctx)
+{
+	struct file_t *req_file; /**< used to iterate over the active files of a line */
+	struct file_t *next_file; /**< the one after req_file, which leaves the list when its requests are moved */
+	struct request_t **reqs; /**< the requests being moved */
+	int32_t reqnb = 0; /**< how many */
+	int32_t line; /**< used to iterate over the lines */
+	int32_t end = ctx->migration_position; /**< the lines of the slice are the ones before this */
+
+	timeline_lock_shard(ctx, 0); //TWINS and WFQ do not shard the timeline, so this protects the whole hashtable and the multi_timeline
+	for (line = hashtable_next_active_line(ctx, ctx->migration_position); (line >= 0) && (reqnb < MIGRATION_SLICE); line = hashtable_next_active_line(ctx, line + 1)) {
+		agios_list_for_each_entry (req_file, &ctx->hashlist_active[line], activelist) reqnb += count_requests_to_timeline(ctx, &req_file->read_queue) + count_requests_to_timeline(ctx, &req_file->write_queue);
+		end = line + 1;
+	}
+	if (reqnb == 0) {
+		timeline_unlock_shard(ctx, 0);
+		atomic_store(&ctx->migrating, false);
+		return 0;
+	}
+	reqs = malloc(sizeof(struct request_t *)*reqnb);
+	reqnb = 0;
+	for (line = hashtable_next_active_line(ctx, ctx->migration_position); (line >= 0) && (line < end); line = hashtable_next_active_line(ctx, line + 1)) {
+		agios_list_for_each_entry_safe (req_file, next_file, &ctx->hashlist_active[line], activelist) {
+			if (!reqs) reqnb += move_file_to_timeline(ctx, req_file); //we cannot sort them all, so we do it one file at a time
+			else {
+				reqnb = take_requests_from_queue(ctx, &req_file->read_queue, reqs, reqnb);
+				reqnb = take_requests_from_queue(ctx, &req_file->write_queue, reqs, reqnb);
+				hashtable_update_active(ctx, req_file);
+			}
+		}
+	}
+	if (reqs) {
+		qsort(reqs, reqnb, sizeof(struct request_t *), timeline_compare_newest_first);
+		multi_timeline_merge(ctx, reqs, reqnb);
+		free(reqs);
+	}
+	timeline_unlock_shard(ctx, 0);
+	ctx->migration_position = end;
+	if (line < 0) atomic_store(&ctx->migrating, false);
+	return reqnb;
 }
 /**
- * This function gets all requests from the hashtable and moves them to the timeline. NO OTHER THREAD may be using any of these data structures. This will be used while migrating between scheduling algorithms, so after calling lock_all_data_structures.
+ * moves up to MIGRATION_SLICE requests from the timeline to the hashtable (@see migrate_slice), going through the shards (or the queues of the multi_timeline, @see migration_list) in order.
+ * Other threads hold the lock of a line of the hashtable before taking the one of a shard (@see move_file_to_hashtable), so here we only try to lock the line of each request, and skip the ones we could not lock (the next slice will find them).
+ * @param ctx the AGIOS instance.
+ * @return the number of requests moved.
  */
-void migrate_from_hashtable_to_timeline()
+static int32_t migrate_slice_to_hashtable(struct agios_ctx_t *ctx)
 {
-	struct agios_list_head *hash_list; /**< used to point to each line of the hashtable */
-	struct file_t *req_file; /**< used to iterate over each line of the hashtable */
+	struct agios_list_head *list; /**< the requests of the shard or queue being moved */
+	int32_t shard; /**< the shard whose lock protects it */
+	struct request_t *req; /**< used to iterate over them */
+	struct request_t *next_req; /**< the one after req */
+	int32_t hash; /**< the line of the hashtable of its file */
+	int32_t visited = 0; /**< how many requests we went through */
+	bool empty; /**< was the list emptied? */
+	int32_t ret = 0; /**< the return of the function */
 
-	//we will mess with the data structures and don't even use locks, since here we are certain no one else is messing with them
-	for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) { //go through the whole hashtable, one position at a time
-		hash_list = &hashlist[i];
-		agios_list_for_each_entry (req_file, hash_list, hashlist) { //go though all files in this line of the hashtable
-			//get all requests from it and put them in the timeline
-			put_all_requests_in_timeline(&req_file->read_queue.list, req_file, i);
-			put_all_requests_in_timeline(&req_file->write_queue.list, req_file, i);
+	while ((ctx->migration_position < migration_listnb(ctx)) && (visited < MIGRATION_SLICE)) {
+		list = migration_list(ctx, ctx->migration_position, &shard);
+		timeline_lock_shard(ctx, shard);
+restart:
+		agios_list_for_each_entry_safe (req, next_req, list, related) {
+			if (visited++ >= MIGRATION_SLICE) break;
+			hash = req->globalinfo->req_file->hash;
+			if (!hashtable_trylock(ctx, hash)) continue;
+			if (has_timeline_index(req->globalinfo)) { //the other requests of its queue in the index go with it, next_req may be one of them
+				ret += move_indexed_requests_to_hashtable(ctx, req->globalinfo);
+				hashtable_unlock(ctx, hash);
+				goto restart;
+			}
+			put_req_in_hashtable(ctx, req);
+			ret++;
+			hashtable_unlock(ctx, hash);
 		}
+		empty = agios_list_empty(list);
+		timeline_unlock_shard(ctx, shard);
+		if (empty) ctx->migration_position++;
 	}
+	if (ctx->migration_position >= migration_listnb(ctx)) atomic_store(&ctx->migrating, false);
+	return ret;
 }
 /**
- * This function gets all requests from the timeline and moves them to the hashtable. NO OTHER THREAD may be using any of these data structures. This will be used while migrating between scheduling algorithms, so after calling lock_all_data_structures.
+ * Called by the AGIOS thread at every iteration while a migration is in progress. When the scheduling algorithm changes between one that uses the hashtable and one that uses the timeline, new requests go directly to the data structure of the new one, and the requests already queued are moved by this function, a slice at a time, while requests keep being added and scheduled (they are also moved when their files are touched, @see migrate_file).
+ * @param ctx the AGIOS instance.
  */
-void migrate_from_timeline_to_hashtable()
+void migrate_slice(struct agios_ctx_t *ctx)
 {
-	/*! \todo make this TWINS-friendly if we ever want twins to be an option for dynamic algorithms */
-	put_all_requests_in_hashtable(&timeline);
+	int32_t moved; /**< how many requests were moved */
+
+	ctx->migration_slices++;
+	if ((ctx->migrating_to_timeline) && (ctx->current_scheduler->multi_timeline)) moved = migrate_slice_to_multi_timeline(ctx);
+	else if (ctx->migrating_to_timeline) moved = migrate_slice_to_timeline(ctx);
+	else moved = migrate_slice_to_hashtable(ctx);
+	atomic_fetch_add_explicit(&ctx->migrated_reqnb, moved, memory_order_relaxed);
 }
 /**
- * Locks all data structures used for requests and files. This is not supposed to be used for normal library functions. We only use it at initialization, to guarantee the user won't try to add new requests while we did not decide on the scheduling algorithm yet. Moreover, we use these functions while migrating between scheduling algorithms.
+ * Called by change_selected_alg (during a switch, @see begin_scheduler_switch) when the new scheduling algorithm does not use the same data structure as the previous one. Requests are not moved now, but by migrate_slice and migrate_file.
+ * @param ctx the AGIOS instance.
+ * @param to_timeline true if the new scheduling algorithm uses the timeline, false if it uses the hashtable.
+ * @param previous_scheduler the previous scheduling algorithm, if migrating to the hashtable we need to know where it kept the requests (in which shards of the timeline, or in the multi_timeline).
  */
-void lock_all_data_structures(void)
+void begin_migration(struct agios_ctx_t *ctx, bool to_timeline, struct io_scheduler_instance_t *previous_scheduler)
+{
+	ctx->migrating_to_timeline = to_timeline;
+	ctx->migration_sharded_timeline = previous_scheduler->sharded_timeline;
+	ctx->migration_multi_timeline = previous_scheduler->multi_timeline;
+	ctx->migration_position = 0;
+	ctx->migration_slices = 0;
+	atomic_store_explicit(&ctx->migrated_reqnb, 0, memory_order_relaxed);
+	atomic_store(&ctx->migrating, true); //the threads waiting for the switch will see it when they go on
+}
+/**
+ * Called by the AGIOS thread before changing the scheduling algorithm. From now on, threads calling acquire_adequate_lock will wait (for end_scheduler_switch), and we wait for the ones that are already holding a lock acquired by it to release it (a grace period). When this function returns, no other thread is using the data structures, so the AGIOS thread can change the scheduling algorithm (and reorder the timeline, or prepare the migration of requests to the other data structure, @see begin_migration) without taking any locks.
+ * @param ctx the AGIOS instance.
+ */
+void begin_scheduler_switch(struct agios_ctx_t *ctx)
 {
 	PRINT_FUNCTION_NAME;
-	timeline_lock();
-	for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) hashtable_lock(i);
+	atomic_store_explicit(&ctx->switch_max_wait, 0, memory_order_relaxed); //the waits caused by this switch (and the migration after it) are reported by the AGIOS thread
+	atomic_store(&ctx->switching_scheduler, true); //threads that enter the read side after this will see it and leave
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) {
+		while (atomic_load(&ctx->structure_readers[i].nb) > 0) sched_yield(); //they hold a lock for a short time, so it will not take long
+	}
 	PRINT_FUNCTION_EXIT;
 }
 /**
- * Unlocks all data structures used for requests and files. This is not supposed to be used for normal library functions. We only use it at initialization, to guarantee the user won't try to add new requests while we did not decide on the scheduling algorithm yet. Moreover, we use these functions while migrating between scheduling algorithms.
+ * Called by the AGIOS thread once the scheduling algorithm (and the data structure it uses) is ready, to let the threads waiting in acquire_adequate_lock go on. It is also used to publish the first scheduling algorithm, since data structures are allocated with a switch in progress (so requests cannot be added before we decide on the scheduling algorithm).
+ * @param ctx the AGIOS instance.
  */
-void unlock_all_data_structures(void)
+void end_scheduler_switch(struct agios_ctx_t *ctx)
 {
 	PRINT_FUNCTION_NAME;
-	for (int32_t i=0; i<AGIOS_HASH_ENTRIES; i++) hashtable_unlock(i);
-	timeline_unlock();
+	pthread_mutex_lock(&ctx->scheduler_switch_mutex);
+	atomic_store(&ctx->switching_scheduler, false);
+	pthread_cond_broadcast(&ctx->scheduler_switch_cond);
+	pthread_mutex_unlock(&ctx->scheduler_switch_mutex);
 	PRINT_FUNCTION_EXIT;
 }
 
 /**
  * This function allocates AGIOS data structures and initializes related locks.
+ * @param ctx the AGIOS instance.
  * @param max_queue_id is the value provided to agios_init to indicate what is the maximum identifier expected to be provided to agios_add_request.
  * @return true or false for success.
  */
-bool allocate_data_structures(int32_t max_queue_id)
+bool allocate_data_structures(struct agios_ctx_t *ctx, int32_t max_queue_id)
 {
-	reset_global_stats(); //puts all statistics to zero
-	if (!timeline_init(max_queue_id)) return false; //initializes the timeline
-	if (!hashtable_init()) return false;
+	if (!hashtable_init(ctx)) return false; //also puts all global statistics to zero
+	if (!timeline_init(ctx, max_queue_id)) return false; //initializes the timeline (after the hashtable, because its lines are split between the shards of the timeline)
+	//a counter of the threads using the data structures for each shard of the timeline (@see acquire_adequate_lock)
+	if (posix_memalign((void **) &ctx->structure_readers, AGIOS_CACHE_LINE_SIZE, sizeof(struct structure_readers_t)*ctx->timeline_shardnb) != 0) {
+		ctx->structure_readers = NULL;
+		agios_print("PANIC! Could not allocate memory for the data structures\n");
+		return false;
+	}
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) atomic_init(&ctx->structure_readers[i].nb, 0);
 	//put request and file counters to 0
-	current_reqnb = 0;
-	current_filenb=0;
-	//block all data structures so the user cannot start adding requests while we are not ready (we need to select a scheduling algorithm first)
-	lock_all_data_structures();
+	ctx->current_reqnb = 0;
+	ctx->current_filenb=0;
+	//the user cannot start adding requests while we are not ready (we need to select a scheduling algorithm first), so we start as if we were switching algorithms (@see end_scheduler_switch)
+	atomic_store(&ctx->switching_scheduler, true);
 	return true;
 }
 /**
- * function called to acquire the lock for the data structure currently in use. It is either the hashtable or the timeline depending on the scheduling algorithm being used. The catch is that we will call lock, but while we are waiting the scheduler in use may have changed, so we need to be sure we are holding the adequate lock before adding a request (or looking for it to cancel or release). If we don't, then the request is being added to a ghost data structure (they both exist even when not in use), from where it will never be recoved to be processed. The caller has to check the return value to be sure to unlock the right data structure after using it.
+ * function called to acquire the lock for the data structure currently in use. It is either the line of the hashtable or the shard of the timeline where the file is, depending on the scheduling algorithm being used. The scheduling algorithm (and the data structure) cannot change while we hold that lock: we are counted among the readers of the data structures for that shard, and the AGIOS thread waits for all readers to leave before changing it (@see begin_scheduler_switch). If a change is in progress, or the first scheduling algorithm was not selected yet, we wait for it to end. The lock must be released with release_adequate_lock.
+ * @param ctx the AGIOS instance.
  * @param hash the line of the hashtable containing information about the file being accessed.
  * @return true if the request is to be added to the hashtable, false for the timeline.
  */
-bool acquire_adequate_lock(int32_t hash)
+bool acquire_adequate_lock(struct agios_ctx_t *ctx, int32_t hash)
 {
-	bool previous_needs_hashtable;  /**< Used to control the used data structure in the case it is being changed while this function is running */
-
-    while(!current_scheduler){}// this is maybe not ideal, but it's needed here because sometimes the initialization function of the scheduler may be too long (it is the case of WFQ), and then the agios thread may not be done initializing the scheduler and setting this variable by the time the first request arrives. We have decided to busy wait because this is a rare occurrence, rather than adding a mutex that will have to be locked and unlocked every time a new request is added, released, or canceled.
-
+	_Atomic int32_t *readers = &ctx->structure_readers[hash >> ctx->timeline_shard_shift].nb; /**< the counter where we are going to be counted. */
+	bool using_hashtable; /**< the return of the function. */
+	struct timespec start; /**< when we started waiting because of a change of scheduling algorithm. */
+	bool measuring = false; /**< are we measuring that time? */
 
-	while(true)
-    { //we'll break out of this loop when we are sure to have acquired the lock for the right data structure
-		//check if the current scheduler uses the hashtable or not and then acquire the right lock
-		previous_needs_hashtable = current_scheduler->needs_hashtable;
-		if (previous_needs_hashtable) hashtable_lock(hash);
-		else timeline_lock();
-		//the problem is that the scheduling algorithm could have changed while we were waiting to acquire the lock, and then it is possible we have the wrong lock.
-		if (previous_needs_hashtable != current_scheduler->needs_hashtable) {
-			//the other thread has migrated scheduling algorithms (and data structure) while we were waiting for the lock (so the lock is no longer the adequate one)
-			if (previous_needs_hashtable) hashtable_unlock(hash);
-			else timeline_unlock();
+	while (true) {
+		//the two operations are sequentially consistent, so either we see switching_scheduler set or begin_scheduler_switch sees us counted
+		atomic_fetch_add(readers, 1);
+		if (!atomic_load(&ctx->switching_scheduler)) break;
+		//the AGIOS thread is changing the scheduling algorithm, we leave and wait until it is done
+		atomic_fetch_sub(readers, 1);
+		if (!measuring) {
+			agios_gettime(&start);
+			measuring = true;
 		}
-		else break; //everything is fine, we got the right lock (and now that we have it, other threads cannot change the scheduling algorithm
+		pthread_mutex_lock(&ctx->scheduler_switch_mutex);
+		while (atomic_load(&ctx->switching_scheduler)) pthread_cond_wait(&ctx->scheduler_switch_cond, &ctx->scheduler_switch_mutex);
+		pthread_mutex_unlock(&ctx->scheduler_switch_mutex);
 	}
-	return previous_needs_hashtable;
+	//while requests are being migrated, the AGIOS thread may hold the lock for a while (@see migrate_slice), that is also measured
+	if ((!measuring) && (atomic_load_explicit(&ctx->migrating, memory_order_relaxed))) {
+		agios_gettime(&start);
+		measuring = true;
+	}
+	using_hashtable = ctx->current_scheduler->needs_hashtable;
+	if (using_hashtable) hashtable_lock(ctx, hash);
+	else timeline_lock(ctx, hash);
+	if (measuring) record_switch_wait(ctx, get_nanoelapsed(start));
+	return using_hashtable;
+}
+/**
+ * function called to release the lock acquired by acquire_adequate_lock, after which the scheduling algorithm may change.
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable given to acquire_adequate_lock.
+ * @param using_hashtable the value returned by acquire_adequate_lock.
+ */
+void release_adequate_lock(struct agios_ctx_t *ctx, int32_t hash, bool using_hashtable)
+{
+	if (using_hashtable) hashtable_unlock(ctx, hash);
+	else timeline_unlock(ctx, hash);
+	atomic_fetch_sub_explicit(&ctx->structure_readers[hash >> ctx->timeline_shard_shift].nb, 1, memory_order_release); //the AGIOS thread must see what we did while holding the lock before changing the scheduling algorithm
 }
 /**
  * Function called to cleanup data structures used by AGIOS to keep requests (at the end of its execution).
+ * @param ctx the AGIOS instance.
  */
-void cleanup_data_structures(void)
+void cleanup_data_structures(struct agios_ctx_t *ctx)
 {
-	hashtable_cleanup();
-	timeline_cleanup();
+	hashtable_cleanup(ctx);
+	timeline_cleanup(ctx);
+	free(ctx->structure_readers);
+	ctx->structure_readers = NULL;
 }
 
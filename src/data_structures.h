@@ -3,12 +3,30 @@
  */
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-void migrate_from_hashtable_to_timeline();
-void migrate_from_timeline_to_hashtable();
-void lock_all_data_structures();
-void unlock_all_data_structures();
-bool allocate_data_structures(int32_t max_app_id);
-void cleanup_data_structures(void);
-bool acquire_adequate_lock(int32_t hash);
+#include "agios_request.h"
+
+#define MIGRATION_SLICE 1024 /**< how many requests (approximately) are moved by each call to migrate_slice after a change between a scheduling algorithm that uses the hashtable and one that uses the timeline. */
+
+/** \struct structure_readers_t
+ *  \brief How many threads are using the data structures for the lines of a shard of the timeline (@see acquire_adequate_lock). Aligned to cache lines so threads counted in different ones do not slow each other down.
+ */
+struct structure_readers_t {
+	_Atomic int32_t nb; /**< the number of threads holding a lock acquired with acquire_adequate_lock for these lines. */
+} __attribute__((aligned(AGIOS_CACHE_LINE_SIZE)));
+
+struct agios_ctx_t;
+struct io_scheduler_instance_t;
+
+void begin_migration(struct agios_ctx_t *ctx, bool to_timeline, struct io_scheduler_instance_t *previous_scheduler);
+void migrate_slice(struct agios_ctx_t *ctx);
+void migrate_file(struct agios_ctx_t *ctx, struct file_t *req_file, bool search_timeline);
+void begin_scheduler_switch(struct agios_ctx_t *ctx);
+void end_scheduler_switch(struct agios_ctx_t *ctx);
+bool allocate_data_structures(struct agios_ctx_t *ctx, int32_t max_app_id);
+void cleanup_data_structures(struct agios_ctx_t *ctx);
+bool acquire_adequate_lock(struct agios_ctx_t *ctx, int32_t hash);
+void release_adequate_lock(struct agios_ctx_t *ctx, int32_t hash, bool using_hashtable);
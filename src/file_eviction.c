@@ -0,0 +1,93 @@
+/*! \file file_eviction.c
+    \brief Implementation of the eviction of idle file structures.
+
+    A file structure is created for every file that receives requests, and without eviction it stays in the hashtable until agios_exit_ctx, so memory grows with the number of distinct files ever accessed. When library_options.max_idle_files or library_options.idle_file_timeout are given, files that are idle (with no queued or dispatched requests, and not registered with agios_register_file) are kept in a list per line of the hashtable, in the order they became idle (@see hashtable_update_idle). The AGIOS thread periodically goes through these lists and frees the files that have been idle for too long, and the least recently used ones when there are too many of them. If the same file receives requests again later, a new structure is created for it. The statistics of evicted files may be added to ctx->evicted_read_stats and ctx->evicted_write_stats, so they are not lost.
+    Only the AGIOS thread evicts files, between calls to the scheduling algorithm, so schedulers that keep pointers to queues while they do not hold locks are not affected (these queues have requests, so their files are not idle).
+    @see req_hashtable.c
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "agios.h"
+#include "agios_add_request.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "common_functions.h"
+#include "data_structures.h"
+#include "file_eviction.h"
+#include "mem_pool.h"
+#include "mylist.h"
+#include "req_hashtable.h"
+#include "req_timeline.h"
+#include "statistics.h"
+
+/**
+ * initializes the counters and statistics of evicted files. Called by hashtable_init.
+ * @param ctx the AGIOS instance.
+ */
+void file_eviction_init(struct agios_ctx_t *ctx)
+{
+	ctx->evicting_files = (ctx->config.max_idle_files >= 0) || (ctx->config.idle_file_timeout >= 0);
+	ctx->evicted_filenb = 0;
+	init_queue_statistics(&ctx->evicted_read_stats);
+	init_queue_statistics(&ctx->evicted_write_stats);
+	agios_gettime(&ctx->last_eviction);
+}
+/**
+ * used to test if it is time for the AGIOS thread to look for files to evict.
+ * @param ctx the AGIOS instance.
+ * @return true or false.
+ */
+bool is_time_to_evict_files(struct agios_ctx_t *ctx)
+{
+	if (!ctx->evicting_files) return false;
+	return get_nanoelapsed(ctx->last_eviction) >= AGIOS_FILE_EVICTION_PERIOD;
+}
+/**
+ * frees the structure of an idle file, after removing it from the hashtable. The caller must hold the relevant data structure lock (timeline or hashtable line).
+ * @param ctx the AGIOS instance.
+ * @param req_file the file, which must be in the list of idle files.
+ */
+static void evict_this_file(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	debug("evicting the structure of file %s", req_file->file_id);
+	if (ctx->config.keep_evicted_file_stats) {
+		fold_queue_statistics(&ctx->evicted_read_stats, &req_file->read_queue.stats);
+		fold_queue_statistics(&ctx->evicted_write_stats, &req_file->write_queue.stats);
+	}
+	hashtable_del_file(ctx, req_file);
+	free(req_file->file_id);
+	mem_pool_free(FILE_POOL, req_file);
+	ctx->evicted_filenb++;
+}
+/**
+ * goes through the lists of idle files of all lines of the hashtable, evicting the ones that have been idle for longer than library_options.idle_file_timeout, and the ones that have been idle the longest in lines with more than their share of library_options.max_idle_files. Called by the AGIOS thread, which must not hold any locks.
+ * @param ctx the AGIOS instance.
+ */
+void evict_idle_files(struct agios_ctx_t *ctx)
+{
+	int32_t line_limit = -1; /**< how many idle files each line can keep, -1 for no limit. */
+	int64_t oldest_allowed = -1; /**< files idle since before this time are evicted, -1 if there is no timeout. */
+	struct timespec now; /**< the current time. */
+	struct file_t *req_file; /**< the file that has been idle the longest in a line. */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
+
+	agios_gettime(&now);
+	if (ctx->config.max_idle_files >= 0) line_limit = (ctx->config.max_idle_files + ctx->hashtable_size - 1) / ctx->hashtable_size; //each line can keep its share (rounded up)
+	if (ctx->config.idle_file_timeout >= 0) oldest_allowed = get_timespec2long(now) - ctx->config.idle_file_timeout;
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		if (ctx->hashlist_idlenb[i] == 0) continue; //we read it without the lock, if we miss a file we will get it next time
+		using_hashtable = acquire_adequate_lock(ctx, i);
+		while (!agios_list_empty(&ctx->hashlist_idle[i])) {
+			req_file = agios_list_entry(ctx->hashlist_idle[i].next, struct file_t, idlelist);
+			if (((line_limit < 0) || (ctx->hashlist_idlenb[i] <= line_limit)) &&
+			    ((oldest_allowed < 0) || (req_file->idle_since > oldest_allowed))) break; //the other ones became idle after this one
+			evict_this_file(ctx, req_file);
+		}
+		release_adequate_lock(ctx, i, using_hashtable);
+	}
+	debug("%ld file structures were evicted so far", ctx->evicted_filenb);
+	agios_gettime(&ctx->last_eviction);
+}
@@ -0,0 +1,16 @@
+/*! \file file_eviction.h
+    \brief Headers of the eviction of idle file structures.
+
+    @see file_eviction.c
+*/
+#pragma once
+
+#include <stdbool.h>
+
+#define AGIOS_FILE_EVICTION_PERIOD 100000000L /**< in ns, how often the AGIOS thread looks for idle files to evict. */
+
+struct agios_ctx_t;
+
+void file_eviction_init(struct agios_ctx_t *ctx);
+bool is_time_to_evict_files(struct agios_ctx_t *ctx);
+void evict_idle_files(struct agios_ctx_t *ctx);
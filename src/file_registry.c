@@ -0,0 +1,118 @@
+/*! \file file_registry.c
+    \brief Implementation of agios_register_file, and of the registry that maps file keys to file structures.
+
+    Registering a file gives the user a small integer key that can be used instead of the file handle to add, release and cancel requests. With the key we can find the file structure directly, without calculating the hash of the file handle or comparing it to other handles. The file structure of a registered file stays in the hashtable as usual (it is never freed before agios_exit_ctx, even if idle files are being evicted, so the registry can keep a pointer to it).
+    Each AGIOS instance has its own registry, which is a table of chunks, and chunks are never moved or freed while AGIOS is running, so looking up a key does not need a lock. Only registering a new file uses the registry mutex.
+    @see agios_add_request.c
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "agios.h"
+#include "agios_add_request.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "common_functions.h"
+#include "data_structures.h"
+#include "file_registry.h"
+#include "hash.h"
+#include "req_hashtable.h"
+#include "req_timeline.h"
+
+/**
+ * gives a key to a file structure. The caller must hold the lock for the line of the hashtable where the file is (or the timeline lock), so it cannot be registered twice at the same time.
+ * @param ctx the AGIOS instance.
+ * @param req_file the file structure.
+ * @return the new key of the file, -1 if the registry is full or we could not allocate memory.
+ */
+static int32_t register_this_file(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	int32_t key; /**< the key given to the file. */
+	int32_t chunk; /**< the chunk of the registry where the file will be. */
+
+	pthread_mutex_lock(&ctx->registry_mutex);
+	key = atomic_load_explicit(&ctx->registered_filenb, memory_order_relaxed); //only changed while holding registry_mutex
+	chunk = key >> AGIOS_FILE_KEY_CHUNK_SHIFT;
+	if (chunk >= AGIOS_FILE_KEY_MAX_CHUNKS) {
+		pthread_mutex_unlock(&ctx->registry_mutex);
+		agios_print("PANIC! Too many files were registered, we cannot register %s\n", req_file->file_id);
+		return -1;
+	}
+	if (!ctx->registered_files[chunk]) { //first file in this chunk
+		ctx->registered_files[chunk] = malloc(sizeof(struct file_t *)*AGIOS_FILE_KEY_CHUNK_SIZE);
+		if (!ctx->registered_files[chunk]) {
+			pthread_mutex_unlock(&ctx->registry_mutex);
+			agios_print("PANIC! AGIOS could not allocate memory!\n");
+			return -1;
+		}
+	}
+	ctx->registered_files[chunk][key & (AGIOS_FILE_KEY_CHUNK_SIZE - 1)] = req_file;
+	atomic_store_explicit(&ctx->registered_filenb, key + 1, memory_order_release); //publishes the slot and the chunk pointer to get_registered_file
+	pthread_mutex_unlock(&ctx->registry_mutex);
+	req_file->key = key;
+	return key;
+}
+/**
+ * function called by the user to register a file. The returned key can then be used to add requests to this file with agios_add_request_by_key (and then release or cancel them with agios_release_request_by_key and agios_cancel_request_by_key), which are cheaper than the functions that receive the file handle. Registering the same file more than once gives the same key. Keys are valid until agios_exit_ctx.
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param file_id the file handle.
+ * @return the key of the file, or -1 in case of error.
+ */
+int32_t agios_register_file_ctx(agios_ctx_t *ctx, char *file_id)
+{
+	uint64_t file_hash = get_file_hash(file_id); /**< the hash of the file handle. */
+	int32_t hash = get_hashtable_position(ctx, file_hash); /**< the line of the hashtable where the file is. */
+	struct file_t *req_file; /**< the structure of the file being registered. */
+	int32_t key = -1; /**< the key that will be returned. */
+	bool using_hashtable; /**< used to ensure we acquire the right lock. */
+
+	PRINT_FUNCTION_NAME;
+	using_hashtable = acquire_adequate_lock(ctx, hash);
+	req_file = find_req_file(ctx, hash, file_hash, file_id);
+	if (req_file) {
+		if (req_file->key >= 0) key = req_file->key; //it was already registered
+		else key = register_this_file(ctx, req_file);
+		hashtable_update_idle(ctx, req_file); //registered files are never evicted
+	}
+	release_adequate_lock(ctx, hash, using_hashtable);
+	return key;
+}
+/** 
+ * function called by the user to register a file in the default AGIOS instance (the one started by agios_init).
+ * @see agios_register_file_ctx
+ * @return the key of the file, or -1 in case of error.
+ */
+int32_t agios_register_file(char *file_id)
+{
+	return agios_register_file_ctx(default_ctx, file_id);
+}
+/**
+ * looks for the file structure of a registered file. No lock is needed: the acquire load of the number of registered files pairs with the release store in register_this_file, so the chunk and the slot of any key below it are visible.
+ * @param ctx the AGIOS instance.
+ * @param key the key given by agios_register_file.
+ * @return the file structure, or NULL if no file was registered with this key.
+ */
+struct file_t *get_registered_file(struct agios_ctx_t *ctx, int32_t key)
+{
+	if ((key < 0) || (key >= atomic_load_explicit(&ctx->registered_filenb, memory_order_acquire))) return NULL;
+	return ctx->registered_files[key >> AGIOS_FILE_KEY_CHUNK_SHIFT][key & (AGIOS_FILE_KEY_CHUNK_SIZE - 1)];
+}
+/**
+ * called at the end of the execution to free the registry (the file structures are freed with the hashtable). All keys are invalid after that.
+ * @param ctx the AGIOS instance.
+ */
+void cleanup_file_registry(struct agios_ctx_t *ctx)
+{
+	pthread_mutex_lock(&ctx->registry_mutex);
+	for (int32_t i = 0; i < AGIOS_FILE_KEY_MAX_CHUNKS; i++) {
+		if (ctx->registered_files[i]) {
+			free(ctx->registered_files[i]);
+			ctx->registered_files[i] = NULL;
+		}
+	}
+	atomic_store_explicit(&ctx->registered_filenb, 0, memory_order_release);
+	pthread_mutex_unlock(&ctx->registry_mutex);
+}
@@ -0,0 +1,19 @@
+/*! \file file_registry.h
+    \brief Headers of the file registry, which maps keys given by agios_register_file to file structures.
+
+    @see file_registry.c
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "agios_request.h"
+
+#define AGIOS_FILE_KEY_CHUNK_SHIFT 10
+#define AGIOS_FILE_KEY_CHUNK_SIZE (1 << AGIOS_FILE_KEY_CHUNK_SHIFT) /**< how many keys fit in each chunk of the registry */
+#define AGIOS_FILE_KEY_MAX_CHUNKS 1024 /**< maximum number of chunks, so up to AGIOS_FILE_KEY_CHUNK_SIZE*AGIOS_FILE_KEY_MAX_CHUNKS files can be registered */
+
+struct agios_ctx_t;
+
+struct file_t *get_registered_file(struct agios_ctx_t *ctx, int32_t key);
+void cleanup_file_registry(struct agios_ctx_t *ctx);
@@ -1,48 +1,99 @@
 /*! \file hash.c
-    \brief Implementation of the get_hashtable_position function, used to select a line of the hashtable according to a file handle.
+    \brief Implementation of the hash of file handles, used to select a line of the hashtable and to compare handles quickly.
+
+    The hash is computed once for each file handle given by the user (get_file_hash) and stored in the struct file_t, so lines of the hashtable are chosen (get_hashtable_position) and files are compared without going through the string again. It reads the handle 8 bytes at a time and mixes them with 64x64->128-bit multiplications, in the same way as wyhash.
 */
 #include <string.h>
 
+#include "agios_ctx.h"
 #include "hash.h"
-#include "req_hashtable.h"
+
+#define HASH_SECRET0 0xa0761d6478bd642fULL /**< constants used to mix the input, taken from wyhash. */
+#define HASH_SECRET1 0xe7037ed1a0b428dbULL
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ULL
 
 /**
- * function used by get_hashtable_position to calculate a hash according to a number.
- * @param val a 64-bit value.
- * @return a 64-bit hash value.
+ * multiplies two 64-bit values and folds the 128-bit result into 64 bits.
+ * @param a the first value.
+ * @param b the second value.
+ * @return the folded product.
  */
-int64_t calculate_hash(int64_t val)
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
 {
-        int64_t hash = val;
-        int64_t n = hash;
-        n <<= 18;
-        hash -= n;
-        n <<= 33;
-        hash -= n;
-        n <<= 3;
-        hash += n;
-        n <<= 3;
-        hash -= n;
-        n <<= 4;
-        hash += n;
-        n <<= 2;
-        hash += n;
-        /* High bits are more random, so use them. */
-        return hash >> (64 - AGIOS_HASH_SHIFT);
+#ifdef __SIZEOF_INT128__
+	__uint128_t product = (__uint128_t) a * b; /**< the full product. */
+
+	return ((uint64_t) product) ^ ((uint64_t) (product >> 64));
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t) a, lb = (uint32_t) b; /**< the halves of a and b. */
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb; /**< the partial products. */
+	uint64_t t = rl + (rm0 << 32); /**< used to compute the carry. */
+	uint64_t lo = t + (rm1 << 32); /**< the low half of the product. */
+	uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t); /**< the high half of the product. */
+
+	return lo ^ hi;
+#endif
 }
 /**
- * function that returns a line of the hashtable where to put information about a file handle.
+ * reads 8 bytes of the handle (which do not have to be aligned).
+ * @param p the position of the handle.
+ * @return the 8 bytes as a number.
+ */
+static inline uint64_t read_word(const uint8_t *p)
+{
+	uint64_t value; /**< the return value. */
+
+	memcpy(&value, p, sizeof(uint64_t));
+	return value;
+}
+/**
+ * reads the last bytes of the handle (at most 8).
+ * @param p the position of the handle.
+ * @param len how many bytes to read.
+ * @return the bytes as a number (missing bytes are 0).
+ */
+static inline uint64_t read_tail(const uint8_t *p, size_t len)
+{
+	uint64_t value = 0; /**< the return value. */
+
+	memcpy(&value, p, len);
+	return value;
+}
+/**
+ * calculates the 64-bit hash of a file handle. It is computed once for each handle given by the user and kept in its struct file_t.
  * @param file_handle a string handle for the file.
- * @return an index between 0 and AGIOS_HASH_ENTRIES.
+ * @return the hash.
+ */
+uint64_t get_file_hash(const char *file_handle)
+{
+	const uint8_t *p = (const uint8_t *) file_handle; /**< the part of the handle we are reading. */
+	size_t total_len = strlen(file_handle); /**< the size of the handle. */
+	size_t len = total_len; /**< how many bytes are left to read. */
+	uint64_t seed = HASH_SECRET0 ^ hash_mix(total_len ^ HASH_SECRET2, HASH_SECRET1); /**< the state of the hash. */
+	uint64_t a; /**< the last bytes of the handle. */
+	uint64_t b;
+
+	while (len > 16) { //16 bytes at a time
+		seed = hash_mix(read_word(p) ^ HASH_SECRET1, read_word(p + 8) ^ seed);
+		p += 16;
+		len -= 16;
+	}
+	if (len > 8) {
+		a = read_word(p);
+		b = read_tail(p + 8, len - 8);
+	} else {
+		a = read_tail(p, len);
+		b = 0;
+	}
+	return hash_mix(HASH_SECRET1 ^ total_len, hash_mix(a ^ HASH_SECRET1, b ^ seed));
+}
+/**
+ * function that returns a line of the hashtable where to put information about a file handle.
+ * @param ctx the AGIOS instance.
+ * @param file_hash the hash of the file handle, given by get_file_hash.
+ * @return an index between 0 and ctx->hashtable_size.
  */
-int32_t get_hashtable_position(const char *file_handle)
+int32_t get_hashtable_position(struct agios_ctx_t *ctx, uint64_t file_hash)
 {
-	//makes a number using the sum of all characters of the name of the file
-	int64_t sum=0;	
-	for(int32_t i=0; i< strlen(file_handle); i++)
-		sum += file_handle[i];
-	//calculates the hash and transforms it into a position of the hashtable
-	sum = calculate_hash(sum);
-	if (sum < 0) sum = -sum;
-	return sum % AGIOS_HASH_ENTRIES;
+	return (int32_t) (file_hash >> (64 - ctx->hashtable_shift)); //high bits are the best mixed ones (the next ones are used by the index of the line)
 }
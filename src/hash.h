@@ -1,9 +1,12 @@
 /*! \file hash.h
-    \brief Header of the get_hashtable_position function.
+    \brief Headers of the functions used to hash file handles and to select a line of the hashtable.
 */
 #pragma once
 
 #include <stdint.h>
 
-int32_t get_hashtable_position(const char *file_handle);
+struct agios_ctx_t;
+
+uint64_t get_file_hash(const char *file_handle);
+int32_t get_hashtable_position(struct agios_ctx_t *ctx, uint64_t file_hash);
 
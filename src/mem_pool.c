@@ -0,0 +1,265 @@
+/*! \file mem_pool.c
+    \brief Implementation of the memory pools used for the fixed-size structures allocated in the path of every request (requests, files and processing information).
+
+    Each pool gets memory from malloc in slabs of many objects, which are only given back at the end of the execution (by cleanup_mem_pools). Free objects are kept in linked lists (the link is stored in the object itself). To avoid a lock for every allocation, each thread keeps a cache of free objects for each pool, and only goes to the shared pool (and its lock) to get or give back MEM_POOL_CACHE_BATCH objects at once. Objects may be freed by a thread other than the one that allocated them (requests are added by the user threads and virtual requests are freed by the AGIOS thread, for instance), in that case they simply go to the cache of the thread that freed them. When a thread ends, its caches are given back to the shared pools.
+    @see mem_pool.h
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "agios_add_request.h"
+#include "agios_release_request.h"
+#include "agios_request.h"
+#include "common_functions.h"
+#include "mem_pool.h"
+#include "process_request.h"
+
+/** \struct mem_slab_t
+ *  \brief A chunk of memory allocated for a pool, kept so it can be freed at the end.
+ */
+struct mem_slab_t {
+	void *objects; /**< the memory of the objects. */
+	struct mem_slab_t *next; /**< the next slab of the same pool. */
+};
+/** \struct mem_pool_t
+ *  \brief A shared pool of objects of the same size.
+ */
+struct mem_pool_t {
+	size_t object_size; /**< the size of each object of this pool. */
+	void *free_list; /**< the free objects, each one has a pointer to the next one at its beginning. */
+	struct mem_slab_t *slabs; /**< all memory allocated for this pool. */
+	pthread_mutex_t lock; /**< protects free_list and slabs. */
+};
+/** \struct mem_pool_cache_t
+ *  \brief The free objects of a pool kept by a thread.
+ */
+struct mem_pool_cache_t {
+	void *free_list; /**< the free objects, linked as in the shared pool. */
+	int32_t free_nb; /**< the number of objects in free_list. */
+};
+
+static struct mem_pool_t pools[MEM_POOL_NB]; /**< the shared pools. */
+static int32_t pools_users = 0; /**< how many AGIOS instances are using the pools. They are created by the first one and freed by the last one. */
+static pthread_mutex_t pools_users_mutex = PTHREAD_MUTEX_INITIALIZER; /**< protects pools_users and the creation and destruction of the pools. */
+static _Atomic int64_t pools_generation = 0; /**< incremented (with pools_users_mutex held) every time the pools are created or freed, so a thread will not use a cache filled before the pools were last created. Read without the lock in the fast path, with acquire loads that pair with the release increments. */
+static pthread_key_t caches_key; /**< used only to have flush_thread_caches called when a thread ends. */
+static __thread struct mem_pool_cache_t thread_caches[MEM_POOL_NB]; /**< the caches of this thread. */
+static __thread int64_t thread_caches_generation = -1; /**< the value of pools_generation when the caches of this thread were started. */
+
+/**
+ * allocates a new slab for a pool and adds all its objects to the free list of the pool. The caller must hold the lock of the pool (or be the only thread using it).
+ * @param pool the identifier of the pool.
+ * @param nb how many objects.
+ * @return true or false for success.
+ */
+static bool add_slab(int32_t pool, int32_t nb)
+{
+	struct mem_slab_t *slab; /**< the new slab. */
+	char *object; /**< used to iterate over the objects of the slab. */
+
+	slab = malloc(sizeof(struct mem_slab_t));
+	if (!slab) return false;
+	//slabs start at a cache line, so each request (whose object size is a multiple of the line, @see init_mem_pools) has its hot part in a single line
+	if (posix_memalign(&slab->objects, AGIOS_CACHE_LINE_SIZE, pools[pool].object_size*nb) != 0) {
+		free(slab);
+		return false;
+	}
+	slab->next = pools[pool].slabs;
+	pools[pool].slabs = slab;
+	//link all objects in the free list
+	object = slab->objects;
+	for (int32_t i = 0; i < nb; i++) {
+		*((void **) object) = pools[pool].free_list;
+		pools[pool].free_list = object;
+		object += pools[pool].object_size;
+	}
+	return true;
+}
+/**
+ * gives back free objects from the cache of a thread to the shared pool.
+ * @param pool the identifier of the pool.
+ * @param cache the cache of the thread for this pool.
+ * @param nb how many objects (at most cache->free_nb).
+ */
+static void give_back_to_pool(int32_t pool, struct mem_pool_cache_t *cache, int32_t nb)
+{
+	void *first = cache->free_list; /**< the first object being given back. */
+	void *last = first; /**< the last object being given back. */
+
+	if (nb <= 0) return;
+	for (int32_t i = 1; i < nb; i++) last = *((void **) last);
+	cache->free_list = *((void **) last);
+	cache->free_nb -= nb;
+	pthread_mutex_lock(&pools[pool].lock);
+	*((void **) last) = pools[pool].free_list;
+	pools[pool].free_list = first;
+	pthread_mutex_unlock(&pools[pool].lock);
+}
+/**
+ * gets free objects from the shared pool to the (empty) cache of a thread. If the pool is empty, a new slab is allocated.
+ * @param pool the identifier of the pool.
+ * @param cache the cache of the thread for this pool.
+ * @return true or false for success.
+ */
+static bool refill_cache(int32_t pool, struct mem_pool_cache_t *cache)
+{
+	void *object; /**< used to take objects from the pool. */
+
+	pthread_mutex_lock(&pools[pool].lock);
+	if ((!pools[pool].free_list) && (!add_slab(pool, MEM_POOL_SLAB_SIZE))) {
+		pthread_mutex_unlock(&pools[pool].lock);
+		return false;
+	}
+	while ((pools[pool].free_list) && (cache->free_nb < MEM_POOL_CACHE_BATCH)) {
+		object = pools[pool].free_list;
+		pools[pool].free_list = *((void **) object);
+		*((void **) object) = cache->free_list;
+		cache->free_list = object;
+		cache->free_nb++;
+	}
+	pthread_mutex_unlock(&pools[pool].lock);
+	return true;
+}
+/**
+ * called when a thread ends to give its cached objects back to the shared pools. It holds pools_users_mutex, so the pools cannot be freed by the last instance while the objects are given back.
+ * @param arg the caches of the thread (not used, we access them directly).
+ */
+static void flush_thread_caches(void *arg)
+{
+	if (thread_caches_generation != atomic_load_explicit(&pools_generation, memory_order_acquire)) return; //these caches are from a previous execution, their memory was already freed
+	pthread_mutex_lock(&pools_users_mutex);
+	//check again, the pools may have been freed (and created again) since the first check
+	if (thread_caches_generation == atomic_load_explicit(&pools_generation, memory_order_relaxed)) {
+		for (int32_t i = 0; i < MEM_POOL_NB; i++) give_back_to_pool(i, &thread_caches[i], thread_caches[i].free_nb);
+	}
+	pthread_mutex_unlock(&pools_users_mutex);
+}
+/**
+ * gives the caches of this thread for all pools, starting them if this is the first time this thread uses the pools since agios_init.
+ * @return the caches of this thread.
+ */
+static struct mem_pool_cache_t *get_thread_caches(void)
+{
+	int64_t generation = atomic_load_explicit(&pools_generation, memory_order_acquire); /**< the current generation of the pools. */
+
+	if (thread_caches_generation != generation) {
+		for (int32_t i = 0; i < MEM_POOL_NB; i++) {
+			thread_caches[i].free_list = NULL;
+			thread_caches[i].free_nb = 0;
+		}
+		thread_caches_generation = generation;
+		pthread_setspecific(caches_key, thread_caches);
+	}
+	return thread_caches;
+}
+/**
+ * takes an object from a pool.
+ * @param pool the identifier of the pool (REQUEST_POOL, FILE_POOL, PROCESSING_INFO_POOL, COMPLETION_POOL or DEFERRED_ADD_POOL).
+ * @return the object, or NULL if we could not allocate memory.
+ */
+void *mem_pool_alloc(int32_t pool)
+{
+	struct mem_pool_cache_t *cache = &get_thread_caches()[pool]; /**< the cache of this thread for the pool. */
+	void *object; /**< the object that will be returned. */
+
+	if ((!cache->free_list) && (!refill_cache(pool, cache))) return NULL;
+	object = cache->free_list;
+	cache->free_list = *((void **) object);
+	cache->free_nb--;
+	return object;
+}
+/**
+ * gives an object back to its pool. 
+ * @param pool the identifier of the pool from where the object was taken.
+ * @param object the object, which must have been obtained from mem_pool_alloc with the same pool.
+ */
+void mem_pool_free(int32_t pool, void *object)
+{
+	struct mem_pool_cache_t *cache = &get_thread_caches()[pool]; /**< the cache of this thread for the pool. */
+
+	*((void **) object) = cache->free_list;
+	cache->free_list = object;
+	cache->free_nb++;
+	//we don't want to keep too many objects in a thread, as they may be needed by others
+	if (cache->free_nb >= 2*MEM_POOL_CACHE_BATCH) give_back_to_pool(pool, cache, MEM_POOL_CACHE_BATCH);
+}
+/**
+ * frees all memory allocated for the pools, used by cleanup_mem_pools when the last instance ends (or by init_mem_pools if the first one fails). The caller must hold pools_users_mutex.
+ */
+static void free_pools(void)
+{
+	struct mem_slab_t *slab; /**< used to iterate over the slabs of a pool. */
+
+	pthread_key_delete(caches_key);
+	for (int32_t i = 0; i < MEM_POOL_NB; i++) {
+		while (pools[i].slabs) {
+			slab = pools[i].slabs;
+			pools[i].slabs = slab->next;
+			free(slab->objects);
+			free(slab);
+		}
+		pools[i].free_list = NULL;
+		pthread_mutex_destroy(&pools[i].lock);
+	}
+	atomic_fetch_add_explicit(&pools_generation, 1, memory_order_release); //so caches of all threads are dropped
+}
+/**
+ * called by agios_init_ctx to start the pools. The pools are shared by all AGIOS instances, so only the first one to call this function creates them, the others only add their preallocated objects.
+ * @param preallocated_requests how many requests (and processing information structures) should be allocated already, so that allocation does not have to happen while the requests are arriving.
+ * @return true or false for success. If it fails, cleanup_mem_pools must not be called.
+ */
+bool init_mem_pools(int32_t preallocated_requests)
+{
+	const int32_t preallocated_pools[] = {REQUEST_POOL, PROCESSING_INFO_POOL}; /**< the pools that get preallocated_requests objects. */
+	bool ret = true; /**< the return value. */
+
+	pthread_mutex_lock(&pools_users_mutex);
+	if (pools_users == 0) {
+		//requests are rounded up to whole cache lines, so the hot part of each one is in a single line (@see agios_request.h)
+		pools[REQUEST_POOL].object_size = ((sizeof(struct request_t) + AGIOS_CACHE_LINE_SIZE - 1) / AGIOS_CACHE_LINE_SIZE) * AGIOS_CACHE_LINE_SIZE;
+		pools[FILE_POOL].object_size = sizeof(struct file_t);
+		pools[PROCESSING_INFO_POOL].object_size = sizeof(struct processing_info_t);
+		pools[COMPLETION_POOL].object_size = sizeof(struct completion_t);
+		pools[DEFERRED_ADD_POOL].object_size = sizeof(struct deferred_add_t);
+		for (int32_t i = 0; i < MEM_POOL_NB; i++) {
+			pools[i].free_list = NULL;
+			pools[i].slabs = NULL;
+			pthread_mutex_init(&pools[i].lock, NULL);
+		}
+		if (pthread_key_create(&caches_key, flush_thread_caches) != 0) {
+			pthread_mutex_unlock(&pools_users_mutex);
+			return false;
+		}
+		atomic_fetch_add_explicit(&pools_generation, 1, memory_order_release);
+	}
+	if (preallocated_requests > 0) {
+		for (int32_t i = 0; i < 2; i++) {
+			pthread_mutex_lock(&pools[preallocated_pools[i]].lock); //other instances may be using the pools already
+			ret = add_slab(preallocated_pools[i], preallocated_requests);
+			pthread_mutex_unlock(&pools[preallocated_pools[i]].lock);
+			if (!ret) break;
+		}
+	}
+	if (ret) pools_users++;
+	else {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		if (pools_users == 0) free_pools();
+	}
+	pthread_mutex_unlock(&pools_users_mutex);
+	return ret;
+}
+/**
+ * called by each AGIOS instance at the end of its execution. When the last instance calls it, all memory allocated for the pools is freed and all objects taken from them are no longer valid.
+ */
+void cleanup_mem_pools(void)
+{
+	pthread_mutex_lock(&pools_users_mutex);
+	if (pools_users > 0) {
+		pools_users--;
+		if (pools_users == 0) free_pools();
+	}
+	pthread_mutex_unlock(&pools_users_mutex);
+}
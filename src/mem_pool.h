@@ -0,0 +1,29 @@
+/*! \file mem_pool.h
+    \brief Headers of the memory pools used for the fixed-size structures allocated in the path of every request.
+
+    @see mem_pool.c
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MEM_POOL_SLAB_SIZE 256 /**< how many objects are allocated at once when a pool is empty. */
+#define MEM_POOL_CACHE_BATCH 32 /**< how many objects are moved at once between the cache of a thread and the shared pool. */
+
+/** \enum 
+ *  \brief The pools, one for each type of structure.
+ */
+enum {
+	REQUEST_POOL = 0, /**< struct request_t */
+	FILE_POOL = 1, /**< struct file_t */
+	PROCESSING_INFO_POOL = 2, /**< struct processing_info_t */
+	COMPLETION_POOL = 3, /**< struct completion_t */
+	DEFERRED_ADD_POOL = 4, /**< struct deferred_add_t */
+	MEM_POOL_NB = 5, /**< the number of pools */
+};
+
+bool init_mem_pools(int32_t preallocated_requests);
+void *mem_pool_alloc(int32_t pool);
+void mem_pool_free(int32_t pool, void *object);
+void cleanup_mem_pools(void);
@@ -29,6 +29,13 @@ struct agios_list_head
               &pos->member != (head);        \
               pos = agios_list_entry(pos->member.next, typeof(*pos), member))
 
+//same as agios_list_for_each_entry, but pos can be removed from the list inside the loop
+#define agios_list_for_each_entry_safe(pos, n, head, member)                  \
+         for (pos = agios_list_entry((head)->next, typeof(*pos), member),      \
+              n = agios_list_entry(pos->member.next, typeof(*pos), member);    \
+              &pos->member != (head);                                          \
+              pos = n, n = agios_list_entry(n->member.next, typeof(*n), member))
+
 void init_agios_list_head(struct agios_list_head *list);
 void __agios_list_add(struct agios_list_head *new, struct agios_list_head *prev, struct agios_list_head *next);
 void __agios_list_del(struct agios_list_head * prev, struct agios_list_head * next);
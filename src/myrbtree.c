@@ -0,0 +1,335 @@
+/*! \file myrbtree.c
+    \brief Implementation of the red-black tree used as an ordered index of the requests in a queue.
+
+    Nodes are not inserted by comparing keys, but at a given position (after a given node), because the tree mirrors a list that is already ordered (the queue). That way the in-order traversal of the tree is always the same as the list, and users search the tree with their own comparison by walking from the root.
+    @see myrbtree.h
+*/
+#include <stdlib.h>
+
+#include "myrbtree.h"
+
+/**
+ * gives the parent of a node.
+ * @param node the node.
+ * @return the parent, NULL for the root.
+ */
+static inline struct agios_rb_node *rb_parent(const struct agios_rb_node *node)
+{
+	return (struct agios_rb_node *) (node->parent_color & ~AGIOS_RB_RED);
+}
+/**
+ * used to know the color of a node.
+ * @param node the node.
+ * @return true if it is red.
+ */
+static inline bool rb_is_red(const struct agios_rb_node *node)
+{
+	return node->parent_color & AGIOS_RB_RED;
+}
+/**
+ * changes the parent of a node, keeping its color.
+ * @param node the node.
+ * @param parent the new parent (may be NULL).
+ */
+static inline void rb_set_parent(struct agios_rb_node *node, struct agios_rb_node *parent)
+{
+	node->parent_color = ((uintptr_t) parent) | (node->parent_color & AGIOS_RB_RED);
+}
+/**
+ * changes the color of a node, keeping its parent.
+ * @param node the node.
+ * @param red true for red, false for black.
+ */
+static inline void rb_set_red(struct agios_rb_node *node, bool red)
+{
+	node->parent_color = (node->parent_color & ~AGIOS_RB_RED) | (red ? AGIOS_RB_RED : 0);
+}
+/**
+ * initializes an empty tree.
+ * @param root the tree.
+ */
+void agios_rb_init_root(struct agios_rb_root *root)
+{
+	root->node = NULL;
+}
+/**
+ * marks a node as not being in any tree.
+ * @param node the node.
+ */
+void agios_rb_init_node(struct agios_rb_node *node)
+{
+	node->parent_color = (uintptr_t) node; //black
+	node->left = NULL;
+	node->right = NULL;
+}
+/**
+ * used to know if a node is in a tree.
+ * @param node the node.
+ * @return true if the node is NOT in a tree.
+ */
+bool agios_rb_empty_node(const struct agios_rb_node *node)
+{
+	return node->parent_color == (uintptr_t) node;
+}
+/**
+ * puts new in the place of old in the tree (or as the root), from the point of view of the parent of old.
+ * @param root the tree.
+ * @param old the node being replaced.
+ * @param new the node taking its place (may be NULL).
+ */
+static void change_child(struct agios_rb_root *root, struct agios_rb_node *old, struct agios_rb_node *new)
+{
+	if (!rb_parent(old)) root->node = new;
+	else if (old == rb_parent(old)->left) rb_parent(old)->left = new;
+	else rb_parent(old)->right = new;
+	if (new) rb_set_parent(new, rb_parent(old));
+}
+/**
+ * rotates a node to the left, so its right child takes its place.
+ * @param root the tree.
+ * @param node the node.
+ */
+static void rotate_left(struct agios_rb_root *root, struct agios_rb_node *node)
+{
+	struct agios_rb_node *child = node->right; /**< the node that takes the place of node. */
+
+	node->right = child->left;
+	if (child->left) rb_set_parent(child->left, node);
+	change_child(root, node, child);
+	child->left = node;
+	rb_set_parent(node, child);
+}
+/**
+ * rotates a node to the right, so its left child takes its place.
+ * @param root the tree.
+ * @param node the node.
+ */
+static void rotate_right(struct agios_rb_root *root, struct agios_rb_node *node)
+{
+	struct agios_rb_node *child = node->left; /**< the node that takes the place of node. */
+
+	node->left = child->right;
+	if (child->right) rb_set_parent(child->right, node);
+	change_child(root, node, child);
+	child->right = node;
+	rb_set_parent(node, child);
+}
+/**
+ * restores the properties of the tree after a (red) node was inserted.
+ * @param root the tree.
+ * @param node the inserted node.
+ */
+static void insert_fixup(struct agios_rb_root *root, struct agios_rb_node *node)
+{
+	struct agios_rb_node *parent; /**< the parent of node. */
+	struct agios_rb_node *gparent; /**< the parent of parent (it always exists when parent is red, because the root is black). */
+	struct agios_rb_node *uncle; /**< the other child of gparent. */
+
+	while ((parent = rb_parent(node)) && (rb_is_red(parent))) {
+		gparent = rb_parent(parent);
+		if (parent == gparent->left) {
+			uncle = gparent->right;
+			if ((uncle) && (rb_is_red(uncle))) { //just recolor and go up
+				rb_set_red(parent, false);
+				rb_set_red(uncle, false);
+				rb_set_red(gparent, true);
+				node = gparent;
+				continue;
+			}
+			if (node == parent->right) {
+				rotate_left(root, parent);
+				node = parent;
+				parent = rb_parent(node);
+			}
+			rb_set_red(parent, false);
+			rb_set_red(gparent, true);
+			rotate_right(root, gparent);
+		} else { //the same thing, but mirrored
+			uncle = gparent->left;
+			if ((uncle) && (rb_is_red(uncle))) {
+				rb_set_red(parent, false);
+				rb_set_red(uncle, false);
+				rb_set_red(gparent, true);
+				node = gparent;
+				continue;
+			}
+			if (node == parent->left) {
+				rotate_right(root, parent);
+				node = parent;
+				parent = rb_parent(node);
+			}
+			rb_set_red(parent, false);
+			rb_set_red(gparent, true);
+			rotate_left(root, gparent);
+		}
+	}
+	rb_set_red(root->node, false);
+}
+/**
+ * inserts a node in the tree, right after another one in the order of the tree.
+ * @param root the tree.
+ * @param node the node being inserted, which must not be in a tree.
+ * @param prev the node that will come just before the new one, or NULL to insert it as the first one.
+ */
+void agios_rb_insert_after(struct agios_rb_root *root, struct agios_rb_node *node, struct agios_rb_node *prev)
+{
+	struct agios_rb_node *parent; /**< the node that will be the parent of the new one. */
+
+	node->left = NULL;
+	node->right = NULL;
+	rb_set_red(node, true);
+	if ((prev) && (!prev->right)) { //the new node is the right child of prev
+		prev->right = node;
+		rb_set_parent(node, prev);
+	} else { //the new node is the left child of the first node after prev (or of the first node of the tree)
+		parent = prev ? prev->right : root->node;
+		if (!parent) { //the tree is empty
+			root->node = node;
+			rb_set_parent(node, NULL);
+		} else {
+			while (parent->left) parent = parent->left;
+			parent->left = node;
+			rb_set_parent(node, parent);
+		}
+	}
+	insert_fixup(root, node);
+}
+/**
+ * restores the properties of the tree after a black node was removed.
+ * @param root the tree.
+ * @param node the node that took the place of the removed one (may be NULL).
+ * @param parent the parent of node (given because node may be NULL).
+ */
+static void erase_fixup(struct agios_rb_root *root, struct agios_rb_node *node, struct agios_rb_node *parent)
+{
+	struct agios_rb_node *sibling; /**< the other child of parent (it always exists, since the subtree of node is missing a black node). */
+
+	while ((node != root->node) && ((!node) || (!rb_is_red(node)))) {
+		if (node == parent->left) {
+			sibling = parent->right;
+			if (rb_is_red(sibling)) {
+				rb_set_red(sibling, false);
+				rb_set_red(parent, true);
+				rotate_left(root, parent);
+				sibling = parent->right;
+			}
+			if (((!sibling->left) || (!rb_is_red(sibling->left))) && ((!sibling->right) || (!rb_is_red(sibling->right)))) {
+				rb_set_red(sibling, true);
+				node = parent;
+				parent = rb_parent(node);
+			} else {
+				if ((!sibling->right) || (!rb_is_red(sibling->right))) {
+					rb_set_red(sibling->left, false);
+					rb_set_red(sibling, true);
+					rotate_right(root, sibling);
+					sibling = parent->right;
+				}
+				rb_set_red(sibling, rb_is_red(parent));
+				rb_set_red(parent, false);
+				rb_set_red(sibling->right, false);
+				rotate_left(root, parent);
+				node = root->node;
+				break;
+			}
+		} else { //the same thing, but mirrored
+			sibling = parent->left;
+			if (rb_is_red(sibling)) {
+				rb_set_red(sibling, false);
+				rb_set_red(parent, true);
+				rotate_right(root, parent);
+				sibling = parent->left;
+			}
+			if (((!sibling->left) || (!rb_is_red(sibling->left))) && ((!sibling->right) || (!rb_is_red(sibling->right)))) {
+				rb_set_red(sibling, true);
+				node = parent;
+				parent = rb_parent(node);
+			} else {
+				if ((!sibling->left) || (!rb_is_red(sibling->left))) {
+					rb_set_red(sibling->right, false);
+					rb_set_red(sibling, true);
+					rotate_left(root, sibling);
+					sibling = parent->left;
+				}
+				rb_set_red(sibling, rb_is_red(parent));
+				rb_set_red(parent, false);
+				rb_set_red(sibling->left, false);
+				rotate_right(root, parent);
+				node = root->node;
+				break;
+			}
+		}
+	}
+	if (node) rb_set_red(node, false);
+}
+/**
+ * removes a node from the tree. Afterwards, the node is marked as not being in a tree.
+ * @param root the tree.
+ * @param node the node, which must be in this tree.
+ */
+void agios_rb_erase(struct agios_rb_root *root, struct agios_rb_node *node)
+{
+	struct agios_rb_node *child; /**< the node that takes the place of the one being moved or removed. */
+	struct agios_rb_node *parent; /**< the parent of child. */
+	struct agios_rb_node *next; /**< when node has two children, the node after it, which takes its place. */
+	bool removed_red = rb_is_red(node); /**< the color of the node that actually left its position. */
+
+	if (!node->left) {
+		child = node->right;
+		parent = rb_parent(node);
+		change_child(root, node, child);
+	} else if (!node->right) {
+		child = node->left;
+		parent = rb_parent(node);
+		change_child(root, node, child);
+	} else {
+		next = node->right;
+		while (next->left) next = next->left;
+		removed_red = rb_is_red(next);
+		child = next->right;
+		if (rb_parent(next) == node) parent = next;
+		else {
+			parent = rb_parent(next);
+			change_child(root, next, child);
+			next->right = node->right;
+			rb_set_parent(next->right, next);
+		}
+		change_child(root, node, next);
+		next->left = node->left;
+		rb_set_parent(next->left, next);
+		rb_set_red(next, rb_is_red(node));
+	}
+	if (!removed_red) erase_fixup(root, child, parent);
+	agios_rb_init_node(node);
+}
+/**
+ * puts a node in the place of another one in the tree, without changing the order. Afterwards, the old node is marked as not being in a tree.
+ * @param root the tree.
+ * @param old the node being replaced, which must be in this tree.
+ * @param new the node taking its place, which must not be in a tree.
+ */
+void agios_rb_replace(struct agios_rb_root *root, struct agios_rb_node *old, struct agios_rb_node *new)
+{
+	*new = *old;
+	change_child(root, old, new);
+	if (new->left) rb_set_parent(new->left, new);
+	if (new->right) rb_set_parent(new->right, new);
+	agios_rb_init_node(old);
+}
+/**
+ * gives the node that comes after a node in the tree (in the in-order traversal).
+ * @param node the node, which must be in a tree.
+ * @return the next node, NULL if node is the last one.
+ */
+struct agios_rb_node *agios_rb_next(const struct agios_rb_node *node)
+{
+	struct agios_rb_node *parent; /**< used to go up the tree. */
+
+	if (node->right) { //the first node of the right subtree
+		node = node->right;
+		while (node->left) node = node->left;
+		return (struct agios_rb_node *) node;
+	}
+	//otherwise, the first ancestor of which node is in the left subtree
+	while ((parent = rb_parent(node)) && (node == parent->right)) node = parent;
+	return parent;
+}
@@ -0,0 +1,42 @@
+/*! \file myrbtree.h
+    \brief Headers of the red-black tree used as an ordered index of the requests in a queue.
+
+    The tree is intrusive (like the lists in mylist.h): a struct agios_rb_node is embedded in the indexed structure, and agios_rb_entry gives back the structure from the node.
+    @see myrbtree.c
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mylist.h"
+
+#define AGIOS_RB_RED 1UL /**< the bit of parent_color that is set for red nodes (nodes are aligned, so the lowest bit of their addresses is free). */
+
+/** \struct agios_rb_node
+ *  \brief A node of the tree, embedded in the indexed structure.
+ *
+ *  The color is kept in the lowest bit of the pointer to the parent, so a node takes three pointers (it is embedded in every request, @see request_t).
+ */
+struct agios_rb_node {
+	uintptr_t parent_color; /**< the parent node (NULL for the root, or the node itself if it is not in a tree), with AGIOS_RB_RED set if the node is red. */
+	struct agios_rb_node *left; /**< the left child. */
+	struct agios_rb_node *right; /**< the right child. */
+};
+/** \struct agios_rb_root
+ *  \brief The tree.
+ */
+struct agios_rb_root {
+	struct agios_rb_node *node; /**< the root node, NULL if the tree is empty. */
+};
+
+#define agios_rb_entry(ptr, type, member) \
+	agios_container_of(ptr, type, member)
+
+void agios_rb_init_root(struct agios_rb_root *root);
+void agios_rb_init_node(struct agios_rb_node *node);
+bool agios_rb_empty_node(const struct agios_rb_node *node);
+void agios_rb_insert_after(struct agios_rb_root *root, struct agios_rb_node *node, struct agios_rb_node *prev);
+void agios_rb_erase(struct agios_rb_root *root, struct agios_rb_node *node);
+void agios_rb_replace(struct agios_rb_root *root, struct agios_rb_node *old, struct agios_rb_node *new);
+struct agios_rb_node *agios_rb_next(const struct agios_rb_node *node);
@@ -6,7 +6,7 @@
 #include "agios_request.h"
 #include "mylist.h"
 
-extern int64_t agios_processed_reqnb; 
+struct agios_ctx_t;
 
 struct performance_entry_t //information about one time period, corresponding to one scheduling algorithm selection
 {
@@ -15,14 +15,13 @@ struct performance_entry_t //information about one time period, corresponding to
 	int64_t bandwidth; /**< average bandwidth in this time period. */
 	int64_t size; /**< the sum of size of every request in this time period. */
 	int64_t reqnb; /**< the number of requests released from this time period. */
+	int64_t switch_max_wait; /**< the longest time (in ns) a thread waited for the data structures because of the change to this scheduling algorithm (including the migration of requests after it), -1 if not known yet. */
 	struct agios_list_head list; /**< to be inserted in a list. */
 };
 
-extern struct performance_entry_t *current_performance_entry; 
-extern pthread_mutex_t performance_mutex; 
-
-void cleanup_performance_module(void);
-int64_t get_current_performance_bandwidth(void);
-bool performance_set_new_algorithm(int32_t alg);
-struct performance_entry_t * get_request_entry(struct request_t *req);
-void print_all_performance_data(void);
+void cleanup_performance_module(struct agios_ctx_t *ctx);
+int64_t get_current_performance_bandwidth(struct agios_ctx_t *ctx);
+bool performance_set_new_algorithm(struct agios_ctx_t *ctx, int32_t alg);
+void performance_set_switch_wait(struct agios_ctx_t *ctx, int64_t wait);
+struct performance_entry_t * get_request_entry(struct agios_ctx_t *ctx, struct request_t *req);
+void print_all_performance_data(struct agios_ctx_t *ctx);
@@ -5,7 +5,9 @@
 
 #include "agios_request.h"
 
-/* \struct agios_client is a struct used for a single variable, user_callbacks, filled by the agios_init function to store the pointers to the user-provided callbacks, used to process requests. 
+#define PROCESSING_INFO_EMBEDDED_IDS 16 /**< up to how many requests can be described by a processing_info_t without allocating its user_ids list (enough for a virtual request of MAX_AGGREG_SIZE requests). */
+
+/* \struct agios_client is a struct used for the user_callbacks field of the AGIOS context, filled by the agios_init_ctx function to store the pointers to the user-provided callbacks, used to process requests. 
  */
 struct agios_client {
 	void * (* process_request_cb)(int64_t req_id); /**< a function to process a single request. */
@@ -14,12 +16,15 @@ struct agios_client {
 /* \struct processing_info_t is a struct to hold information about one or more requests that are to be processed. It is filled by the process_requests_step1 function and used in the process_requests_step2 to send requests back to the user through the provided callbacks. 
  */
 struct processing_info_t {
-	int64_t *user_ids; /**< a list of requests, each request is represented by the user_id field, provided to agios_add_request as a request identifier that makes sense to the user */
+	int64_t *user_ids; /**< a list of requests, each request is represented by the user_id field, provided to agios_add_request as a request identifier that makes sense to the user. It points to embedded_user_ids if it fits there. */
+	int64_t embedded_user_ids[PROCESSING_INFO_EMBEDDED_IDS]; /**< space for user_ids, so we don't have to allocate it for the common case of a few requests. */
 	int32_t reqnb; /**< the lenght of the user_ids list (number of requests) */
+	int32_t taken_reqnb; /**< in pull mode, how many of the requests were already taken by workers */
 	struct agios_list_head list; /**< used to be inserted in a list (for MLF and aIOLi only) */
 };
 
-extern struct agios_client user_callbacks;	
+struct agios_ctx_t;
 
-struct processing_info_t *process_requests_step1(struct request_t *head_req, int32_t hash);
-bool process_requests_step2(struct processing_info_t *info);
+struct processing_info_t *process_requests_step1(struct agios_ctx_t *ctx, struct request_t *head_req, int32_t hash);
+bool process_requests_step2(struct agios_ctx_t *ctx, struct processing_info_t *info);
+void processing_info_cleanup(struct processing_info_t *info);
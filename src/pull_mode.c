@@ -0,0 +1,278 @@
+/*! \file pull_mode.c
+    \brief Implementation of the pull mode, where worker threads take requests with agios_next_requests instead of receiving them through callbacks.
+
+    When AGIOS is started with agios_init_pull_mode (or agios_init_pull_mode_ctx), process_requests_step2 does not call the user callbacks. Instead, the processing_info_t structures (each one a group of requests to be processed together) are put in a bounded ring, from where worker threads take them by calling agios_next_requests. That way a slow worker does not keep the scheduler from working.
+    The ring is a lock-free multi-producer multi-consumer queue (requests are put by the agios thread, but also by the threads adding requests when the NOOP scheduler is used). Each slot has a sequence number that tells if it is ready to receive a new element or to have its element taken. The mutex and condition variables are only used by threads that have to sleep because the ring is empty (workers) or full (the scheduler, which gives us backpressure when workers cannot keep up).
+    @see process_request.c
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "agios.h"
+#include "agios_ctx.h"
+#include "common_functions.h"
+#include "mylist.h"
+#include "process_request.h"
+#include "pull_mode.h"
+
+/** \struct pull_slot_t
+ *  \brief A position of the ring.
+ */
+struct pull_slot_t {
+	atomic_size_t sequence; /**< if it is equal to the position of the ring being written, the slot is free. If it is equal to that position + 1, it holds an element to be taken. */
+	struct processing_info_t *info; /**< the element. */
+};
+
+/**
+ * tries to put an element in the ring, without waiting.
+ * @param ctx the AGIOS instance.
+ * @param info the element.
+ * @return true if it was put, false if the ring is full.
+ */
+static bool ring_try_put(struct agios_ctx_t *ctx, struct processing_info_t *info)
+{
+	size_t position = atomic_load_explicit(&ctx->pull_put_position, memory_order_relaxed); /**< the position we are trying to write. */
+	struct pull_slot_t *slot; /**< the slot of the ring for that position. */
+	intptr_t diff; /**< difference between the sequence of the slot and the position. */
+
+	while (true) {
+		slot = &ctx->pull_ring[position & ctx->pull_ring_mask];
+		diff = (intptr_t) atomic_load_explicit(&slot->sequence, memory_order_acquire) - (intptr_t) position;
+		if (diff == 0) { //the slot is free, try to get it
+			if (atomic_compare_exchange_weak_explicit(&ctx->pull_put_position, &position, position+1, memory_order_relaxed, memory_order_relaxed)) break;
+		} else if (diff < 0) return false; //the slot still has the element from the previous round, the ring is full
+		else position = atomic_load_explicit(&ctx->pull_put_position, memory_order_relaxed); //someone else got this position
+	}
+	slot->info = info;
+	atomic_store_explicit(&slot->sequence, position+1, memory_order_release);
+	return true;
+}
+/**
+ * tries to take an element from the ring, without waiting.
+ * @param ctx the AGIOS instance.
+ * @return the element, or NULL if the ring is empty.
+ */
+static struct processing_info_t *ring_try_take(struct agios_ctx_t *ctx)
+{
+	size_t position = atomic_load_explicit(&ctx->pull_take_position, memory_order_relaxed); /**< the position we are trying to read. */
+	struct pull_slot_t *slot; /**< the slot of the ring for that position. */
+	struct processing_info_t *info; /**< the element that will be returned. */
+	intptr_t diff; /**< difference between the sequence of the slot and the position + 1. */
+
+	while (true) {
+		slot = &ctx->pull_ring[position & ctx->pull_ring_mask];
+		diff = (intptr_t) atomic_load_explicit(&slot->sequence, memory_order_acquire) - (intptr_t) (position+1);
+		if (diff == 0) { //the slot has an element, try to get it
+			if (atomic_compare_exchange_weak_explicit(&ctx->pull_take_position, &position, position+1, memory_order_relaxed, memory_order_relaxed)) break;
+		} else if (diff < 0) return NULL; //nothing was written in this slot yet, the ring is empty
+		else position = atomic_load_explicit(&ctx->pull_take_position, memory_order_relaxed); //someone else took this position
+	}
+	info = slot->info;
+	atomic_store_explicit(&slot->sequence, position+ctx->pull_ring_mask+1, memory_order_release); //the slot is free for the next round
+	return info;
+}
+/**
+ * takes the next group of requests for a worker, first from the partially taken ones and then from the ring.
+ * @param ctx the AGIOS instance.
+ * @return the group of requests, or NULL if there is none.
+ */
+static struct processing_info_t *take_info(struct agios_ctx_t *ctx)
+{
+	struct processing_info_t *info = NULL; /**< the element that will be returned. */
+
+	if (atomic_load(&ctx->pull_partial_nb) > 0) {
+		pthread_mutex_lock(&ctx->pull_partial_mutex);
+		if (!agios_list_empty(&ctx->pull_partial_list)) {
+			info = agios_list_entry(ctx->pull_partial_list.next, struct processing_info_t, list);
+			agios_list_del(&info->list);
+			atomic_fetch_sub(&ctx->pull_partial_nb, 1);
+		}
+		pthread_mutex_unlock(&ctx->pull_partial_mutex);
+		if (info) return info;
+	}
+	return ring_try_take(ctx);
+}
+/**
+ * wakes up a thread waiting for space in the ring, if there is any. The caller must NOT hold pull_mutex.
+ * @param ctx the AGIOS instance.
+ */
+static void wake_up_a_producer(struct agios_ctx_t *ctx)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&ctx->pull_waiting_producers) > 0) {
+		pthread_mutex_lock(&ctx->pull_mutex);
+		pthread_cond_signal(&ctx->pull_not_full_cond);
+		pthread_mutex_unlock(&ctx->pull_mutex);
+	}
+}
+/**
+ * wakes up a worker that is waiting for requests, if there is any. The caller must NOT hold pull_mutex.
+ * @param ctx the AGIOS instance.
+ */
+static void wake_up_a_worker(struct agios_ctx_t *ctx)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&ctx->pull_waiting_workers) > 0) {
+		pthread_mutex_lock(&ctx->pull_mutex);
+		pthread_cond_signal(&ctx->pull_not_empty_cond);
+		pthread_mutex_unlock(&ctx->pull_mutex);
+	}
+}
+/**
+ * called by process_requests_step2 in pull mode to give a group of requests to the workers. If the ring is full, it waits until some worker takes something from it.
+ * @param ctx the AGIOS instance.
+ * @param info the group of requests, filled by process_requests_step1. It will be freed by the worker that takes it.
+ * @return true or false for success. It fails if AGIOS is being stopped while we wait, in that case info is freed here and the requests are never given to the workers.
+ */
+bool pull_mode_put(struct agios_ctx_t *ctx, struct processing_info_t *info)
+{
+	bool added = ring_try_put(ctx, info); /**< could we put it in the ring? */
+
+	if (!added) { //the ring is full, we have to wait for the workers
+		pthread_mutex_lock(&ctx->pull_mutex);
+		atomic_fetch_add(&ctx->pull_waiting_producers, 1);
+		while ((!(added = ring_try_put(ctx, info))) && (!atomic_load(&ctx->pull_stopping))) pthread_cond_wait(&ctx->pull_not_full_cond, &ctx->pull_mutex);
+		atomic_fetch_sub(&ctx->pull_waiting_producers, 1);
+		pthread_mutex_unlock(&ctx->pull_mutex);
+		if (!added) {
+			processing_info_cleanup(info);
+			return false;
+		}
+	}
+	wake_up_a_worker(ctx);
+	return true;
+}
+/**
+ * function called by worker threads in pull mode to get requests to process. They are the same requests that would be given to the callbacks, and they must be released (or cancelled) as usual after being processed. Requests that are given together (a virtual request, for instance) are given in the same call, unless they do not fit in reqs. In that case the remaining ones will be given to the next call (by any worker).
+ * @param ctx the AGIOS instance, given by agios_init_ctx.
+ * @param reqs a vector that will receive the identifiers of the requests (the identifier given to agios_add_request).
+ * @param max_reqnb the size of reqs. It should be at least MAX_AGGREG_SIZE (16) so a whole virtual request can be given at once.
+ * @param timeout_ns how long to wait (in nanoseconds) if there are no requests. If 0, it does not wait. If negative, it waits until there are requests (or until agios_exit_ctx is called).
+ * @return the number of requests put in reqs, 0 if there were none before the timeout, or -1 if AGIOS is not running in pull mode (or is being stopped).
+ */
+int32_t agios_next_requests_ctx(agios_ctx_t *ctx, int64_t *reqs, int32_t max_reqnb, int64_t timeout_ns)
+{
+	struct processing_info_t *info; /**< the group of requests being taken. */
+	struct timespec deadline; /**< until when we are going to wait (with a timeout) */
+	int32_t reqnb; /**< how many requests are being given. */
+
+	if ((!ctx->pull_mode) || (max_reqnb <= 0)) return -1;
+	atomic_fetch_add(&ctx->pull_active_workers, 1);
+	info = take_info(ctx);
+	if ((!info) && (timeout_ns != 0)) { //we have to wait for requests
+		if (timeout_ns > 0) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			get_long2timespec(get_timespec2long(deadline) + timeout_ns, &deadline);
+		}
+		pthread_mutex_lock(&ctx->pull_mutex);
+		atomic_fetch_add(&ctx->pull_waiting_workers, 1);
+		while ((!(info = take_info(ctx))) && (!atomic_load(&ctx->pull_stopping))) {
+			if (timeout_ns < 0) pthread_cond_wait(&ctx->pull_not_empty_cond, &ctx->pull_mutex);
+			else if (pthread_cond_timedwait(&ctx->pull_not_empty_cond, &ctx->pull_mutex, &deadline) == ETIMEDOUT) {
+				info = take_info(ctx);
+				break;
+			}
+		}
+		atomic_fetch_sub(&ctx->pull_waiting_workers, 1);
+		pthread_mutex_unlock(&ctx->pull_mutex);
+	}
+	if (!info) {
+		reqnb = atomic_load(&ctx->pull_stopping) ? -1 : 0;
+		atomic_fetch_sub(&ctx->pull_active_workers, 1);
+		return reqnb;
+	}
+	wake_up_a_producer(ctx); //if the scheduler is waiting because the ring was full, there may be space now
+	//give the requests to the worker
+	reqnb = info->reqnb - info->taken_reqnb;
+	if (reqnb > max_reqnb) reqnb = max_reqnb;
+	memcpy(reqs, info->user_ids + info->taken_reqnb, sizeof(int64_t)*reqnb);
+	info->taken_reqnb += reqnb;
+	if (info->taken_reqnb < info->reqnb) { //some requests did not fit, they will be given to the next call
+		pthread_mutex_lock(&ctx->pull_partial_mutex);
+		agios_list_add(&info->list, &ctx->pull_partial_list);
+		atomic_fetch_add(&ctx->pull_partial_nb, 1);
+		pthread_mutex_unlock(&ctx->pull_partial_mutex);
+		wake_up_a_worker(ctx);
+	} else processing_info_cleanup(info);
+	atomic_fetch_sub(&ctx->pull_active_workers, 1);
+	return reqnb;
+}
+/** 
+ * function called by worker threads to get requests from the default AGIOS instance (the one started by agios_init_pull_mode).
+ * @see agios_next_requests_ctx
+ * @return the number of requests put in reqs, 0 if there were none before the timeout, or -1 if AGIOS is not running in pull mode (or is being stopped).
+ */
+int32_t agios_next_requests(int64_t *reqs, int32_t max_reqnb, int64_t timeout_ns)
+{
+	return agios_next_requests_ctx(default_ctx, reqs, max_reqnb, timeout_ns);
+}
+/**
+ * called by agios_init_pull_mode_ctx to allocate the ring.
+ * @param ctx the AGIOS instance.
+ * @param ring_size the minimum number of groups of requests the ring can hold (it will be rounded up to a power of 2).
+ * @return true or false for success.
+ */
+bool init_pull_mode(struct agios_ctx_t *ctx, int32_t ring_size)
+{
+	size_t size = 2; /**< the actual size of the ring. */
+
+	while (size < (size_t) ring_size) size *= 2;
+	ctx->pull_ring = malloc(sizeof(struct pull_slot_t)*size);
+	if (!ctx->pull_ring) {
+		agios_print("PANIC! AGIOS could not allocate memory!\n");
+		return false;
+	}
+	for (size_t i = 0; i < size; i++) atomic_init(&ctx->pull_ring[i].sequence, i);
+	ctx->pull_ring_mask = size - 1;
+	atomic_init(&ctx->pull_put_position, 0);
+	atomic_init(&ctx->pull_take_position, 0);
+	atomic_init(&ctx->pull_stopping, false);
+	atomic_init(&ctx->pull_waiting_workers, 0);
+	atomic_init(&ctx->pull_waiting_producers, 0);
+	atomic_init(&ctx->pull_active_workers, 0);
+	atomic_init(&ctx->pull_partial_nb, 0);
+	init_agios_list_head(&ctx->pull_partial_list);
+	ctx->pull_mode = true;
+	return true;
+}
+/**
+ * called by agios_exit_ctx before stopping the agios thread, to wake up all threads sleeping because of the ring. Workers calling agios_next_requests will get -1 from now on (after the requests still in the ring are taken).
+ * @param ctx the AGIOS instance.
+ */
+void stop_pull_mode(struct agios_ctx_t *ctx)
+{
+	if (!ctx->pull_mode) return;
+	pthread_mutex_lock(&ctx->pull_mutex);
+	atomic_store(&ctx->pull_stopping, true);
+	pthread_cond_broadcast(&ctx->pull_not_empty_cond);
+	pthread_cond_broadcast(&ctx->pull_not_full_cond);
+	pthread_mutex_unlock(&ctx->pull_mutex);
+}
+/**
+ * called at the end of the execution to free the ring and the requests that were not taken by any worker. It waits for workers still inside agios_next_requests to leave.
+ * @param ctx the AGIOS instance.
+ */
+void cleanup_pull_mode(struct agios_ctx_t *ctx)
+{
+	struct processing_info_t *info; /**< used to free what is left in the ring. */
+
+	if (!ctx->pull_mode) return;
+	stop_pull_mode(ctx);
+	ctx->pull_mode = false; //new calls to agios_next_requests return immediately
+	while (atomic_load(&ctx->pull_active_workers) > 0) {
+		pthread_mutex_lock(&ctx->pull_mutex);
+		pthread_cond_broadcast(&ctx->pull_not_empty_cond);
+		pthread_mutex_unlock(&ctx->pull_mutex);
+		sched_yield();
+	}
+	while ((info = take_info(ctx))) processing_info_cleanup(info);
+	free(ctx->pull_ring);
+	ctx->pull_ring = NULL;
+}
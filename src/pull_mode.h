@@ -0,0 +1,18 @@
+/*! \file pull_mode.h
+    \brief Headers of the pull mode, where worker threads take requests with agios_next_requests instead of receiving them through callbacks.
+
+    @see pull_mode.c
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "process_request.h"
+
+struct agios_ctx_t;
+
+bool init_pull_mode(struct agios_ctx_t *ctx, int32_t ring_size);
+bool pull_mode_put(struct agios_ctx_t *ctx, struct processing_info_t *info);
+void stop_pull_mode(struct agios_ctx_t *ctx);
+void cleanup_pull_mode(struct agios_ctx_t *ctx);
@@ -1,60 +1,281 @@
 /*! \file req_hashtable.c
     \brief Implementation of the hashtable, used to store information about files and request queues for some scheduling algorithms.
 
-    The hashtable has AGIOS_HASH_ENTRIES lines. Files are positioned in the hashtable according to their handles, each line has a collision list ordered by file handle. File structures hold information and statistics about access separated in two queues (write and read). Requests may or may not be in these queues (depending on the scheduling algorithm being used requests may be adde to the timeline). However, requests that were sent back to the user will always be in the dispatch queues of their files (in the hashtable) so they can be easily found. When adding requests to the hashtable, each line uses its own mutex to favor parallelism. However, if requests are being added to the timeline, then a single mutex (the timeline mutex) is used to access the whole hashtable. That was done to prevent deadlocks.
+    The number of lines of the hashtable is chosen at initialization, according to how many files are expected to be accessed (the expected_files parameter), and it does not change afterwards, because the line is also the unit of locking. Files are positioned in the hashtable according to the hash of their handles, each line has a list of its files, a list of its active files (the ones with requests in their queues, used by the scheduling algorithms to go through them) and an index (struct hashtable_index_t) used to find a file by its handle. The index of a line grows as files are added to it, so finding a file does not get slower as more files are accessed. File structures hold information and statistics about access separated in two queues (write and read). Requests may or may not be in these queues (depending on the scheduling algorithm being used requests may be adde to the timeline). However, requests that were sent back to the user will always be in the dispatch queues of their files (in the hashtable) so they can be easily found. When adding requests to the hashtable, each line uses its own mutex to favor parallelism. However, if requests are being added to the timeline, then the mutex of the shard of the timeline that holds a line is used to access it instead (@see req_timeline.c). That was done to prevent deadlocks.
     @see hash.c
     @see req_timeline.c
  */
 #include <assert.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "agios.h"
 #include "agios_add_request.h"
+#include "agios_ctx.h"
 #include "agios_request.h"
 #include "common_functions.h"
+#include "file_eviction.h"
 #include "hash.h"
+#include "mem_pool.h"
 #include "mylist.h"
 #include "req_hashtable.h"
+#include "statistics.h"
 
-struct agios_list_head *hashlist;  /**< the hashtable. */
-int32_t *hashlist_reqcounter = NULL; /**< how many requests are present in each position from the hashtable (used to speed the search for requests in the scheduling algorithms). */
-static pthread_mutex_t *hashlist_locks; /**< one mutex per line of the hashtable. */
+/**
+ * gives the smallest shift so that 1 << shift is at least a given value.
+ * @param value the value.
+ * @return the shift.
+ */
+static int32_t shift_for(int64_t value)
+{
+	int32_t shift = 0; /**< the return value. */
 
+	while ((1L << shift) < value) shift++;
+	return shift;
+}
 /**
- * function called at the beginning of the execution. It initializes data structures and locks. 
+ * function called at the beginning of the execution. It chooses the number of lines from the expected_files configuration parameter, and initializes data structures and locks. 
+ * @param ctx the AGIOS instance.
  * @return true or false for success. 
  */
-bool hashtable_init(void)
+bool hashtable_init(struct agios_ctx_t *ctx)
 {
+	int32_t bucket_shift; /**< the initial number of buckets of the index of each line. */
+
+	//choose the size
+	ctx->hashtable_shift = shift_for(ctx->config.expected_files / AGIOS_HASH_FILES_PER_LINE);
+	if (ctx->hashtable_shift < AGIOS_HASH_MIN_SHIFT) ctx->hashtable_shift = AGIOS_HASH_MIN_SHIFT;
+	if (ctx->hashtable_shift > AGIOS_HASH_MAX_SHIFT) ctx->hashtable_shift = AGIOS_HASH_MAX_SHIFT;
+	ctx->hashtable_size = 1 << ctx->hashtable_shift;
+	bucket_shift = shift_for(ctx->config.expected_files / (ctx->hashtable_size * AGIOS_HASH_BUCKET_LOAD));
+	if (bucket_shift < 1) bucket_shift = 1;
 	//allocate memory
-	hashlist = (struct agios_list_head *) malloc(sizeof(struct agios_list_head) * AGIOS_HASH_ENTRIES);
-	if (!hashlist) {
-		agios_print("AGIOS: cannot allocate memory for req cache\n");
-		return false;
-	}
-	hashlist_locks = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t)*AGIOS_HASH_ENTRIES);
-	if (!hashlist_locks) {
-		agios_print("AGIOS: cannot allocate memory for req locks\n");
-		free(hashlist);
-		return false;
-	}
-	hashlist_reqcounter = (int32_t *)malloc(sizeof(int32_t)*AGIOS_HASH_ENTRIES);
-	if (!hashlist_reqcounter) {
-		agios_print("AGIOS: cannot allocate memory for req counters\n");
-		free(hashlist);
-		free(hashlist_locks);
-		return false;
+	ctx->hashlist = (struct agios_list_head *) malloc(sizeof(struct agios_list_head) * ctx->hashtable_size);
+	ctx->hashlist_locks = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t)*ctx->hashtable_size);
+	ctx->hashlist_reqcounter = (int32_t *)malloc(sizeof(int32_t)*ctx->hashtable_size);
+	ctx->hashlist_index = (struct hashtable_index_t *) calloc(ctx->hashtable_size, sizeof(struct hashtable_index_t));
+	ctx->hashlist_active = (struct agios_list_head *) malloc(sizeof(struct agios_list_head) * ctx->hashtable_size);
+	ctx->active_lines = calloc(ctx->hashtable_size / 64, sizeof(uint64_t)); //hashtable_size is a power of 2, at least 64
+	ctx->hashlist_idle = (struct agios_list_head *) malloc(sizeof(struct agios_list_head) * ctx->hashtable_size);
+	ctx->hashlist_idlenb = (int32_t *) calloc(ctx->hashtable_size, sizeof(int32_t));
+	ctx->hashlist_stats = (struct line_statistics_t *) malloc(sizeof(struct line_statistics_t) * ctx->hashtable_size);
+	if ((!ctx->hashlist) || (!ctx->hashlist_locks) || (!ctx->hashlist_reqcounter) || (!ctx->hashlist_index) || (!ctx->hashlist_active) || (!ctx->active_lines) || (!ctx->hashlist_idle) || (!ctx->hashlist_idlenb) || (!ctx->hashlist_stats)) {
+		agios_print("AGIOS: cannot allocate memory for the hashtable\n");
+		goto cleanup_on_error;
 	}
 	//initialize structures
-	for (int32_t i = 0; i < AGIOS_HASH_ENTRIES; i++) {
-		init_agios_list_head(&hashlist[i]);
-		pthread_mutex_init(&(hashlist_locks[i]), NULL);
-		hashlist_reqcounter[i]=0;
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		init_agios_list_head(&ctx->hashlist[i]);
+		init_agios_list_head(&ctx->hashlist_active[i]);
+		init_agios_list_head(&ctx->hashlist_idle[i]);
+		ctx->hashlist_reqcounter[i]=0;
+		ctx->hashlist_index[i].shift = bucket_shift;
+		ctx->hashlist_index[i].buckets = calloc(1 << bucket_shift, sizeof(struct file_t *));
+		if (!ctx->hashlist_index[i].buckets) {
+			agios_print("AGIOS: cannot allocate memory for the hashtable\n");
+			goto cleanup_on_error;
+		}
 	}
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) pthread_mutex_init(&(ctx->hashlist_locks[i]), NULL);
+	reset_global_stats(ctx);
+	file_eviction_init(ctx);
+	debug("the hashtable has %d lines, with %d buckets each", ctx->hashtable_size, 1 << bucket_shift);
 	return true;
+cleanup_on_error: //hashtable_cleanup will not be called
+	if (ctx->hashlist_index) {
+		for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+			if (ctx->hashlist_index[i].buckets) free(ctx->hashlist_index[i].buckets);
+		}
+		free(ctx->hashlist_index);
+	}
+	if (ctx->hashlist) free(ctx->hashlist);
+	if (ctx->hashlist_locks) free(ctx->hashlist_locks);
+	if (ctx->hashlist_reqcounter) free(ctx->hashlist_reqcounter);
+	if (ctx->hashlist_active) free(ctx->hashlist_active);
+	if (ctx->active_lines) free(ctx->active_lines);
+	if (ctx->hashlist_idle) free(ctx->hashlist_idle);
+	if (ctx->hashlist_idlenb) free(ctx->hashlist_idlenb);
+	if (ctx->hashlist_stats) free(ctx->hashlist_stats);
+	ctx->hashlist_active = NULL;
+	ctx->active_lines = NULL;
+	ctx->hashlist_idle = NULL;
+	ctx->hashlist_idlenb = NULL;
+	ctx->hashlist_stats = NULL;
+	ctx->hashlist = NULL;
+	ctx->hashlist_locks = NULL;
+	ctx->hashlist_reqcounter = NULL;
+	ctx->hashlist_index = NULL;
+	return false;
+}
+/**
+ * gives the bucket of the index of a line where a file is.
+ * @param ctx the AGIOS instance.
+ * @param file_hash the hash of the file handle.
+ * @param shift the index has 1 << shift buckets.
+ * @return the bucket.
+ */
+static inline int32_t bucket_position(struct agios_ctx_t *ctx, uint64_t file_hash, int32_t shift)
+{
+	//the highest bits were used to choose the line, so we use the ones right after them
+	return (int32_t) ((file_hash << ctx->hashtable_shift) >> (64 - shift));
+}
+/**
+ * moves some of the old buckets of the index of a line to the new ones, if it is growing. When all of them have been moved, the old buckets are freed. The caller must hold the lock to the line.
+ * @param ctx the AGIOS instance.
+ * @param index the index of the line.
+ */
+static void index_rehash_step(struct agios_ctx_t *ctx, struct hashtable_index_t *index)
+{
+	struct file_t *req_file; /**< the file being moved. */
+	int32_t position; /**< the new bucket of req_file. */
+
+	if (!index->old_buckets) return;
+	for (int32_t i = 0; (i < AGIOS_HASH_REHASH_STEP) && (index->moved < (1 << index->old_shift)); i++) {
+		while ((req_file = index->old_buckets[index->moved])) {
+			index->old_buckets[index->moved] = req_file->bucket_next;
+			position = bucket_position(ctx, req_file->file_hash, index->shift);
+			req_file->bucket_next = index->buckets[position];
+			index->buckets[position] = req_file;
+		}
+		index->moved++;
+	}
+	if (index->moved >= (1 << index->old_shift)) {
+		free(index->old_buckets);
+		index->old_buckets = NULL;
+	}
+}
+/**
+ * starts growing the index of a line, if it has too many files per bucket and it is not already growing. The files will be moved to the new buckets by index_rehash_step. The caller must hold the lock to the line.
+ * @param ctx the AGIOS instance.
+ * @param index the index of the line.
+ */
+static void index_grow(struct agios_ctx_t *ctx, struct hashtable_index_t *index)
+{
+	struct file_t **new_buckets; /**< the new buckets. */
+
+	if ((index->old_buckets) || 
+	    (index->filenb <= (AGIOS_HASH_BUCKET_LOAD << index->shift)) || 
+	    (ctx->hashtable_shift + index->shift >= 62)) return;
+	new_buckets = calloc(1L << (index->shift + 1), sizeof(struct file_t *));
+	if (!new_buckets) {
+		debug("could not allocate memory to grow a line of the hashtable, it will keep its size");
+		return;
+	}
+	index->old_buckets = index->buckets;
+	index->old_shift = index->shift;
+	index->moved = 0;
+	index->buckets = new_buckets;
+	index->shift++;
+}
+/**
+ * gives the bucket of the index of a line where a file is (or where it would be included), taking into account that the index may be growing.
+ * @param ctx the AGIOS instance.
+ * @param index the index of the line.
+ * @param file_hash the hash of the file handle.
+ * @return the bucket.
+ */
+static struct file_t **index_bucket(struct agios_ctx_t *ctx, struct hashtable_index_t *index, uint64_t file_hash)
+{
+	int32_t position; /**< a position of the old buckets. */
+
+	if (index->old_buckets) { //the file may not have been moved to the new buckets yet
+		position = bucket_position(ctx, file_hash, index->old_shift);
+		if (position >= index->moved) return &index->old_buckets[position]; //it will be moved with the others of this bucket
+	}
+	return &index->buckets[bucket_position(ctx, file_hash, index->shift)];
+}
+/**
+ * looks for the structure of a file in a line of the hashtable. It does not create the structure if it does not exist. The caller must hold the relevant data structure lock (timeline or hashtable line).
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable where we will look.
+ * @param file_hash the hash of file_id, given by get_file_hash.
+ * @param file_id the file handle.
+ * @return the structure of the file, or NULL if it is not in the hashtable.
+ */
+struct file_t *hashtable_find_file(struct agios_ctx_t *ctx, int32_t hash, uint64_t file_hash, const char *file_id)
+{
+	struct hashtable_index_t *index = &ctx->hashlist_index[hash]; /**< the index of the line. */
+	struct file_t *req_file; /**< used to go through a bucket. */
+
+	index_rehash_step(ctx, index);
+	for (req_file = *index_bucket(ctx, index, file_hash); req_file; req_file = req_file->bucket_next) {
+		//we only compare the handles when their hashes are the same
+		if ((req_file->file_hash == file_hash) && (strcmp(req_file->file_id, file_id) == 0)) return req_file;
+	}
+	return NULL;
+}
+/**
+ * includes a new file structure in its line of the hashtable (req_file->hash). The caller must hold the relevant data structure lock (timeline or hashtable line), and make sure the file is not already there (with hashtable_find_file).
+ * @param ctx the AGIOS instance.
+ * @param req_file the new file structure.
+ */
+void hashtable_add_file(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	struct hashtable_index_t *index = &ctx->hashlist_index[req_file->hash]; /**< the index of the line. */
+	struct file_t **bucket; /**< the bucket where the file will be included. */
+
+	agios_list_add_tail(&req_file->hashlist, &ctx->hashlist[req_file->hash]);
+	index_rehash_step(ctx, index);
+	bucket = index_bucket(ctx, index, req_file->file_hash);
+	req_file->bucket_next = *bucket;
+	*bucket = req_file;
+	index->filenb++;
+	index_grow(ctx, index);
+	hashtable_update_idle(ctx, req_file); //it has no requests yet
+}
+/**
+ * removes a file structure from its line of the hashtable (it does not free it). The caller must hold the relevant data structure lock (timeline or hashtable line), and make sure the file has no requests (queued or dispatched) and is not registered.
+ * @param ctx the AGIOS instance.
+ * @param req_file the file structure.
+ */
+void hashtable_del_file(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	struct hashtable_index_t *index = &ctx->hashlist_index[req_file->hash]; /**< the index of the line. */
+	struct file_t **bucket; /**< used to go through the bucket of the file. */
+
+	assert(req_file->key < 0);
+	assert(agios_list_empty(&req_file->activelist));
+	for (bucket = index_bucket(ctx, index, req_file->file_hash); *bucket; bucket = &(*bucket)->bucket_next) {
+		if (*bucket == req_file) {
+			*bucket = req_file->bucket_next;
+			break;
+		}
+	}
+	index->filenb--;
+	agios_list_del(&req_file->hashlist);
+	if (!agios_list_empty(&req_file->idlelist)) {
+		agios_list_del(&req_file->idlelist);
+		ctx->hashlist_idlenb[req_file->hash]--;
+	}
+}
+/**
+ * includes a file in the list of idle files of its line of the hashtable if it has no requests (queued, in the timeline or dispatched) and it is not registered, or removes it from the list otherwise. Files in that list may be evicted by the AGIOS thread (@see file_eviction.c), so it must be called every time requests are added to or released from a file. It does nothing if files are not evicted. The caller must hold the relevant data structure lock (timeline or hashtable line).
+ * @param ctx the AGIOS instance.
+ * @param req_file the file.
+ */
+void hashtable_update_idle(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	bool idle; /**< should the file be in the list of idle files? */
+	bool is_idle = !agios_list_empty(&req_file->idlelist); /**< is it in the list? */
+	struct timespec now; /**< used to mark when the file became idle. */
+
+	if (!ctx->evicting_files) return;
+	idle = (req_file->key < 0) && (req_file->timeline_reqnb == 0) &&
+	       agios_list_empty(&req_file->read_queue.dispatch) && agios_list_empty(&req_file->write_queue.dispatch);
+	if (idle == is_idle) return;
+	if (idle) {
+		agios_gettime(&now);
+		req_file->idle_since = get_timespec2long(now);
+		agios_list_add_tail(&req_file->idlelist, &ctx->hashlist_idle[req_file->hash]);
+		ctx->hashlist_idlenb[req_file->hash]++;
+	} else {
+		agios_list_del(&req_file->idlelist);
+		ctx->hashlist_idlenb[req_file->hash]--;
+	}
 }
 /**
  * funtion called while freeing structures from the hashtable. It cleans up a queue (queue_t) by freeing all requests in its regular and dispatch lists. It does NOT frees the queue_t itself.
@@ -67,147 +288,208 @@ void queue_cleanup(struct queue_t *queue)
 }
 /**
  * called at the end of the execution to clean up the hashtable structures.
+ * @param ctx the AGIOS instance.
  */
-void hashtable_cleanup(void)
+void hashtable_cleanup(struct agios_ctx_t *ctx)
 {
 	struct file_t *req_file; /**< used to iterate over all files in a hashtable line. */
 	struct file_t *aux_req_file=NULL; /**< used to avoid freeing a file structure before moving the iterator to the next one, otherwise the loop breaks. */
 
-	if (hashlist) {
-		for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) { //go through all lines of the hashtable
-			if (!agios_list_empty(&hashlist[i])) {
-				agios_list_for_each_entry (req_file, &hashlist[i], hashlist) { //go through all file structures
+	if (ctx->hashlist) {
+		for (int32_t i=0; i< ctx->hashtable_size; i++) { //go through all lines of the hashtable
+			if (!agios_list_empty(&ctx->hashlist[i])) {
+				agios_list_for_each_entry (req_file, &ctx->hashlist[i], hashlist) { //go through all file structures
 					//go through all requests in the related lists
 					queue_cleanup(&req_file->read_queue);
 					queue_cleanup(&req_file->write_queue);
 					if (req_file->file_id) free(req_file->file_id);
 					if (aux_req_file) {
 						agios_list_del(&aux_req_file->hashlist);
-						free(aux_req_file);
+						mem_pool_free(FILE_POOL, aux_req_file);
 					}
 					aux_req_file = req_file;
 				} 
 				if (aux_req_file) {
 					agios_list_del(&aux_req_file->hashlist);
-					free(aux_req_file);
+					mem_pool_free(FILE_POOL, aux_req_file);
 					aux_req_file = NULL;
 				}
 			}
 		}
-		free(hashlist);
+		free(ctx->hashlist);
+	}
+	if (ctx->hashlist_index) {
+		for (int32_t i=0; i< ctx->hashtable_size; i++) {
+			free(ctx->hashlist_index[i].buckets);
+			if (ctx->hashlist_index[i].old_buckets) free(ctx->hashlist_index[i].old_buckets);
+		}
+		free(ctx->hashlist_index);
 	}
-	if (hashlist_locks) free(hashlist_locks);
-	if (hashlist_reqcounter) free(hashlist_reqcounter);
+	if (ctx->hashlist_locks) free(ctx->hashlist_locks);
+	if (ctx->hashlist_reqcounter) free(ctx->hashlist_reqcounter);
+	if (ctx->hashlist_active) free(ctx->hashlist_active);
+	if (ctx->active_lines) free(ctx->active_lines);
+	if (ctx->hashlist_idle) free(ctx->hashlist_idle);
+	if (ctx->hashlist_idlenb) free(ctx->hashlist_idlenb);
+	if (ctx->hashlist_stats) free(ctx->hashlist_stats);
 }
 /**
  * called to add a request to the hashtable. The caller must hold the mutex for the relevant line of the hashtable.
+ * @param ctx the AGIOS instance.
  * @param req the newly arrived request.
  * @param hash_val the line of the hashtable where the file accessed by this request belongs.
- * @param given_req_file to be provided ONLY when using this function to migrate from timeline to hashtable. In that case, it is the file structure.
+ * @param given_req_file to be provided ONLY when using this function to migrate from timeline to hashtable. In that case, it is the file structure. For new requests, the file structure was already set in req->globalinfo.
  * @return true or false for success.
  */ 
-bool hashtable_add_req(struct request_t *req, 
+bool hashtable_add_req(struct agios_ctx_t *ctx,
+			struct request_t *req, 
 			int32_t hash_val, 
 			struct file_t *given_req_file)
 {
-	struct agios_list_head *queue; /**< will receive the queue where the request is to be added (read or write) */
+	struct queue_t *queue; /**< will receive the queue where the request is to be added (read or write) */
 	struct file_t *req_file = given_req_file; /**< the file that is being accessed by this request. */
 	struct request_t *tmp; /**< used to find the insertion place for this request. */
-	struct agios_list_head *insertion_place; /**< used to find the insertion place for this request. */
+	struct agios_rb_node *node; /**< used to walk down the index of the queue. */
+	struct agios_list_head *insertion_place; /**< the position of the queue after which the request is to be added. */
 
 	debug("adding request to file %s, offset %ld, size %ld", req->file_id, req->offset, req->len);
 	/*finds the file to add to*/
-	if (!req_file) { //a file structure was not provided, we have to find/create it and update statistics
-		req_file = find_req_file(&hashlist[hash_val], req->file_id);
-		if (!req_file) return false;
-		/*if it is the first request to this file, we have to store its arrival time. */ 
-		if (req_file->first_request_time == 0) req_file->first_request_time = req->arrival_time;
-	}
+	if (!req_file) req_file = req->globalinfo->req_file; //a new request, its file was already found (and statistics updated) by agios_add_request
 	//choose the appropriate list to add the request
-	if (req->type == RT_READ) {
-		queue = &req_file->read_queue.list;
-		req->globalinfo = &req_file->read_queue;
-	} else {
-		queue = &req_file->write_queue.list;
-		req->globalinfo = &req_file->write_queue;
-	}
-	/* search for the position in the offset-sorted list. */ 
-	insertion_place = queue;
-	if (!agios_list_empty(queue)) {
-		agios_list_for_each_entry (tmp, queue, related) {
-			if ((tmp->offset > req->offset) ||
-			    ((tmp->offset == req->offset) &&
-			    (tmp->len > req->len))) {
-				insertion_place = &(tmp->related);
-				break;
-			}
-		}
+	if (req->type == RT_READ) queue = &req_file->read_queue;
+	else queue = &req_file->write_queue;
+	req->globalinfo = queue;
+	/* search for the position in the offset-sorted list. We use its index to find the first request that should come after the new one, the new one goes right before it (or at the end of the list if there is no such request). */ 
+	insertion_place = queue->list.prev;
+	node = queue->index.node;
+	while (node) {
+		tmp = agios_rb_entry(node, struct request_t, index_node);
+		if ((tmp->offset > req->offset) ||
+		    ((tmp->offset == req->offset) &&
+		    (tmp->len > req->len))) {
+			insertion_place = tmp->related.prev;
+			node = node->left;
+		} else node = node->right;
+	}
+	//try to aggregate the request with the neighboors. If it is not possible, just add it in the place we found for it (in the list and in the index).
+	if (!insert_aggregations(ctx, req, insertion_place, &queue->list)) {
+		agios_list_add(&req->related, insertion_place);
+		req->sched_epoch = queue->sched_epoch; //its sched_factor only grows from now on
+		if (insertion_place == &queue->list) agios_rb_insert_after(&queue->index, &req->index_node, NULL);
+		else agios_rb_insert_after(&queue->index, &req->index_node, &agios_list_entry(insertion_place, struct request_t, related)->index_node);
 	}
-	//try to aggregate the request with the neighboors. If it is not possible, just add it in the place we found for it.
-	if(!insert_aggregations(req, insertion_place->prev, queue))
-		agios_list_add(&req->related, insertion_place->prev);
+	hashtable_update_active(ctx, req_file);
 	return true;
 }
+/**
+ * includes a file in the list of active files of its line of the hashtable if it has requests in its queues, or removes it from the list if it does not. It must be called after requests are added to or removed from the queues of the file. The caller must hold the relevant data structure lock (timeline or hashtable line).
+ * @param ctx the AGIOS instance.
+ * @param req_file the file.
+ */
+void hashtable_update_active(struct agios_ctx_t *ctx, struct file_t *req_file)
+{
+	bool has_requests = (!agios_list_empty(&req_file->read_queue.list)) || (!agios_list_empty(&req_file->write_queue.list)); /**< should the file be active? */
+	bool is_active = !agios_list_empty(&req_file->activelist); /**< is it in the list of active files? */
+	struct agios_list_head *active_list = &ctx->hashlist_active[req_file->hash]; /**< the list of active files of its line */
+	uint64_t line_bit = 1UL << (req_file->hash % 64); /**< the bit of the line in active_lines. */
+
+	if (has_requests == is_active) return;
+	if (has_requests) {
+		if (agios_list_empty(active_list)) atomic_fetch_or(&ctx->active_lines[req_file->hash / 64], line_bit);
+		agios_list_add_tail(&req_file->activelist, active_list);
+	} else {
+		agios_list_del(&req_file->activelist);
+		if (agios_list_empty(active_list)) atomic_fetch_and(&ctx->active_lines[req_file->hash / 64], ~line_bit);
+	}
+}
+/**
+ * finds the next line of the hashtable that has active files. The caller does not need to hold any lock, but the line could become empty (or another line could receive requests) before the caller takes its lock, so it must still check the list of active files of the line.
+ * @param ctx the AGIOS instance.
+ * @param line the first line to be checked.
+ * @return the first line, starting from line, that has active files, or -1 if there are none.
+ */
+int32_t hashtable_next_active_line(struct agios_ctx_t *ctx, int32_t line)
+{
+	uint64_t word; /**< the bits of 64 lines. */
+
+	if (line >= ctx->hashtable_size) return -1;
+	word = atomic_load_explicit(&ctx->active_lines[line / 64], memory_order_relaxed) & (~0UL << (line % 64)); //ignore the lines before line
+	for (int32_t i = line / 64; ; ) {
+		if (word) return i*64 + __builtin_ctzll(word);
+		i++;
+		if (i >= ctx->hashtable_size / 64) return -1;
+		word = atomic_load_explicit(&ctx->active_lines[i], memory_order_relaxed);
+	}
+}
 /**
  * function called to safely remove a request from the hashtable. The caller must NOT be holding the mutex for the line of the hashtable, as this function will lock and unlock it before touching the request.
+ * @param ctx the AGIOS instance.
  * @param req the request that is being removed.
  */ 
-void hashtable_safely_del_req(struct request_t *req)
+void hashtable_safely_del_req(struct agios_ctx_t *ctx, struct request_t *req)
 {
-	int32_t hash = get_hashtable_position(req->file_id);
-	pthread_mutex_lock(&hashlist_locks[hash]);
-	agios_list_del(&req->related);
-	pthread_mutex_unlock(&hashlist_locks[hash]);
+	int32_t hash = req->globalinfo->req_file->hash;
+	pthread_mutex_lock(&ctx->hashlist_locks[hash]);
+	hashtable_del_req(ctx, req);
+	pthread_mutex_unlock(&ctx->hashlist_locks[hash]);
 }
 /**
- * alternative to hastable_safely_del_req to remove a request from the hashtable when we ARE holding the mutex to the relevant line.
+ * alternative to hastable_safely_del_req to remove a request from the hashtable when we ARE holding the mutex to the relevant line. If it was the last request in the queues of its file, the file is no longer active.
+ * @param ctx the AGIOS instance.
  * @param req the request to the removed.
  */
-void hashtable_del_req(struct request_t *req)
+void hashtable_del_req(struct agios_ctx_t *ctx, struct request_t *req)
 {
-	agios_list_del(&req->related);
+	struct file_t *req_file = req->globalinfo->req_file; /**< the file accessed by the request. */
+
+	request_del(req);
+	hashtable_update_active(ctx, req_file);
 }
 /**
  * function used to acquire the lock to a line of the hashtable.
+ * @param ctx the AGIOS instance.
  * @param index the line of the hashtable we want to access.
  * @return a pointer to the line of the hashtable, which can now be safely accessed. 
  */
-struct agios_list_head *hashtable_lock(int32_t index)
+struct agios_list_head *hashtable_lock(struct agios_ctx_t *ctx, int32_t index)
 {
-	assert((index >= 0) && (index < AGIOS_HASH_ENTRIES));
-	pthread_mutex_lock(&hashlist_locks[index]);
-	return &hashlist[index];
+	assert((index >= 0) && (index < ctx->hashtable_size));
+	pthread_mutex_lock(&ctx->hashlist_locks[index]);
+	return &ctx->hashlist[index];
 }
 /**
  * function used to TRY to acquire the lock to a line of the hashtable. It is not going to wait. 
+ * @param ctx the AGIOS instance.
  * @param index the line of the hashtable we want to access.
  * @return the line of the hashtable if the lock was successfully acquired, NULL otherwise.
  */
-struct agios_list_head *hashtable_trylock(int32_t index)
+struct agios_list_head *hashtable_trylock(struct agios_ctx_t *ctx, int32_t index)
 {
-	if (0 == pthread_mutex_trylock(&hashlist_locks[index])) return &hashlist[index];
+	if (0 == pthread_mutex_trylock(&ctx->hashlist_locks[index])) return &ctx->hashlist[index];
 	else return NULL;
 }
 /**
  * function used to free the lock on a line of the hashtable.
+ * @param ctx the AGIOS instance.
  * @param index the line of the hashtable we want to access.
  */
-void hashtable_unlock(int32_t index)
+void hashtable_unlock(struct agios_ctx_t *ctx, int32_t index)
 {
-	pthread_mutex_unlock(&hashlist_locks[index]);
+	pthread_mutex_unlock(&ctx->hashlist_locks[index]);
 }
 /**
  * prints all contents of a line of the hashtable. Used for debug purposes. The caller must hold the mutex for this line.
+ * @param ctx the AGIOS instance.
  * @param i the line of the hashtable to be printed.
  */
-void print_hashtable_line(int32_t i)
+void print_hashtable_line(struct agios_ctx_t *ctx, int32_t i)
 {
 #if AGIOS_DEBUG
 	struct agios_list_head *hash_list; /**< to access the line of the hashtable. */
 	struct file_t *req_file; /**< to iterate over all files in the line of the hashtable. */
 	struct request_t *req; /**< to iterate over all requests to each file in the line of the hashtable. */
 
-	hash_list = &hashlist[i];
+	hash_list = &ctx->hashlist[i];
 	if (!agios_list_empty(hash_list)) debug("[%d]", i);
 	agios_list_for_each_entry (req_file, hash_list, hashlist) { //go over all files
 		debug("\t%s", req_file->file_id);
@@ -230,12 +512,13 @@ void print_hashtable_line(int32_t i)
 }
 /** 
  * prints all contents of the hashtable. Used for debug purposes. The user must hold relevant mutexes.
+ * @param ctx the AGIOS instance.
  */
-void print_hashtable(void)
+void print_hashtable(struct agios_ctx_t *ctx)
 {
 	debug("Current hashtable status:");
-	for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) { //go through the whole hashtable, one position at a time
-		print_hashtable_line(i);
+	for (int32_t i=0; i< ctx->hashtable_size; i++) { //go through the whole hashtable, one position at a time
+		print_hashtable_line(ctx, i);
 	}
 	PRINT_FUNCTION_EXIT;
 }
@@ -5,21 +5,44 @@
 
 #include "agios_request.h"
 
-#define AGIOS_HASH_SHIFT 6						
-#define AGIOS_HASH_ENTRIES		(1 << AGIOS_HASH_SHIFT) 		
+#define AGIOS_HASH_MIN_SHIFT 6 /**< the hashtable has at least 1 << AGIOS_HASH_MIN_SHIFT lines */
+#define AGIOS_HASH_MAX_SHIFT 16 /**< and at most 1 << AGIOS_HASH_MAX_SHIFT lines */
+#define AGIOS_HASH_FILES_PER_LINE 32 /**< the number of lines is chosen so each one will have (approximately) this many files, if as many files as given by the expected_files parameter are accessed. */
+#define AGIOS_HASH_BUCKET_LOAD 2 /**< the index of a line grows when it has more than this many files per bucket. */
+#define AGIOS_HASH_REHASH_STEP 4 /**< while the index of a line is growing, how many of its old buckets are moved to the new ones each time it is used. */
 
-extern struct agios_list_head *hashlist;
-extern int32_t *hashlist_reqcounter;
+struct agios_ctx_t;
 
-bool hashtable_init(void);
-void hashtable_cleanup(void);
-bool hashtable_add_req(struct request_t *req, 
+/** \struct hashtable_index_t
+ *  \brief The index of a line of the hashtable, used to find its files without going through the whole line. 
+ *
+ *  The files of the line are kept in buckets (chained by file_t->bucket_next), chosen by the bits of their file_hash that come right after the ones used to choose the line. When there are too many files per bucket, the number of buckets is doubled. To avoid a long pause, files are not all moved at once: the previous buckets are kept in old_buckets and moved a few at a time, every time the line is used.
+ */
+struct hashtable_index_t {
+	struct file_t **buckets; /**< the buckets. */
+	int32_t shift; /**< there are 1 << shift buckets. */
+	struct file_t **old_buckets; /**< while growing, the previous buckets (NULL otherwise). */
+	int32_t old_shift; /**< there are 1 << old_shift old buckets. */
+	int32_t moved; /**< old buckets before this one were already moved to the new ones. */
+	int32_t filenb; /**< how many files are in this line. */
+};
+
+bool hashtable_init(struct agios_ctx_t *ctx);
+void hashtable_cleanup(struct agios_ctx_t *ctx);
+struct file_t *hashtable_find_file(struct agios_ctx_t *ctx, int32_t hash, uint64_t file_hash, const char *file_id);
+void hashtable_add_file(struct agios_ctx_t *ctx, struct file_t *req_file);
+void hashtable_del_file(struct agios_ctx_t *ctx, struct file_t *req_file);
+void hashtable_update_idle(struct agios_ctx_t *ctx, struct file_t *req_file);
+bool hashtable_add_req(struct agios_ctx_t *ctx,
+			struct request_t *req, 
 			int32_t hash_val, 
 			struct file_t *given_req_file);
-void hashtable_safely_del_req(struct request_t *req);
-void hashtable_del_req(struct request_t *req);
-struct agios_list_head *hashtable_lock(int32_t index);
-struct agios_list_head *hashtable_trylock(int32_t index);
-void hashtable_unlock(int32_t index);
-void print_hashtable_line(int32_t i);
-void print_hashtable(void);
+void hashtable_safely_del_req(struct agios_ctx_t *ctx, struct request_t *req);
+void hashtable_del_req(struct agios_ctx_t *ctx, struct request_t *req);
+void hashtable_update_active(struct agios_ctx_t *ctx, struct file_t *req_file);
+int32_t hashtable_next_active_line(struct agios_ctx_t *ctx, int32_t line);
+struct agios_list_head *hashtable_lock(struct agios_ctx_t *ctx, int32_t index);
+struct agios_list_head *hashtable_trylock(struct agios_ctx_t *ctx, int32_t index);
+void hashtable_unlock(struct agios_ctx_t *ctx, int32_t index);
+void print_hashtable_line(struct agios_ctx_t *ctx, int32_t i);
+void print_hashtable(struct agios_ctx_t *ctx);
@@ -1,9 +1,12 @@
 /*! \file req_timeline.c
     \brief Implementation of the timeline, used as request queue to some scheduling algorithms.
 
-    There is a timeline (queue) of requests, protected with a single mutex. The insertion order in this queue is usually FIFO, but may differ depending on the used scheduling algorithm. If a max_queue_id was provided to agios_init, the initialization function will also allocate the multi_timeline, a list of max_queue_id+1 request queues, which is used by some scheduling algorithms (for now just TWINS) and is also protected by the same timeline_mutex.
+    The timeline (queue) of requests is split in shards, each with its own mutex (@see timeline_shard_t). The lines of the hashtable are split between the shards (the first lines go to the first shard, and so on), and the requests to the files of a line are kept in its shard. While the timeline is used, the lock of a shard also protects its lines of the hashtable (the file structures, their dispatch queues and statistics), so adding, releasing or cancelling a request only takes the lock of one shard. Requests are added at the end of their shard and their timestamps come from a global counter, so TO (and TO-agg, and NOOP) process them in arrival order by always taking the first request of the shard whose first request is the oldest one.
+    The other scheduling algorithms that use the timeline (SW, TWINS and WFQ) need all requests in a single queue, so they only use the first shard, whose lock then protects the whole hashtable (@see timeline_shard). If a max_queue_id was provided to agios_init, the initialization function will also allocate the multi_timeline, a list of max_queue_id+1 request queues, which is used instead of the shards by the scheduling algorithms that have multi_timeline set (TWINS and WFQ) and is also protected by the lock of the first shard. Each queue of the multi_timeline has the requests with that queue_id, in arrival order.
  */
+#include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -11,36 +14,138 @@
 #include "agios.h"
 #include "agios_add_request.h"
 #include "agios_config.h"
+#include "agios_ctx.h"
 #include "agios_request.h"
 #include "common_functions.h"
 #include "hash.h"
 #include "mylist.h"
 #include "req_hashtable.h"
+#include "req_timeline.h"
 #include "scheduling_algorithms.h"
+#include "SW.h"
 
-AGIOS_LIST_HEAD(timeline); /**< the request queue. */ 
-struct agios_list_head *multi_timeline; /**< multiple request queues, indexed by the queue_id provided by the user with each request to agios_add_request. This structure is used by TWINS. */
-int32_t multi_timeline_size=0; /**< number of queues in multi_timeline. */
-static pthread_mutex_t timeline_mutex = PTHREAD_MUTEX_INITIALIZER; /**< a lock to access all timeline structures. */
+/**
+ * gives the shard of the timeline where the requests to the files of a line of the hashtable are. It is always the first one if the current scheduling algorithm does not shard the timeline.
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable.
+ * @return the shard.
+ */
+int32_t timeline_shard(struct agios_ctx_t *ctx, int32_t hash)
+{
+	if (!ctx->current_scheduler->sharded_timeline) return 0;
+	return hash >> ctx->timeline_shard_shift;
+}
+/**
+ * called to acquire the lock of a shard of the timeline. It will wait for the lock.
+ * @param ctx the AGIOS instance.
+ * @param shard the shard.
+ * @return a pointer to the list of requests of the shard.
+ */
+struct agios_list_head *timeline_lock_shard(struct agios_ctx_t *ctx, int32_t shard)
+{
+	pthread_mutex_lock(&ctx->timeline_shards[shard].lock);
+	return &ctx->timeline_shards[shard].list;
+}
+/**
+ * called to unlock the mutex of a shard of the timeline. Before that, it updates the timestamp of the oldest request of the shard, which may have changed.
+ * @param ctx the AGIOS instance.
+ * @param shard the shard.
+ */
+void timeline_unlock_shard(struct agios_ctx_t *ctx, int32_t shard)
+{
+	struct timeline_shard_t *this_shard = &ctx->timeline_shards[shard]; /**< the shard being unlocked */
 
+	if (agios_list_empty(&this_shard->list)) atomic_store_explicit(&this_shard->oldest, INT64_MAX, memory_order_release);
+	else atomic_store_explicit(&this_shard->oldest, agios_list_entry(this_shard->list.next, struct request_t, related)->timestamp, memory_order_release);
+	pthread_mutex_unlock(&this_shard->lock);
+}
+/**
+ * called to acquire the lock that protects a line of the hashtable and the requests to its files while the timeline is used. It will wait for the lock.
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable.
+ * @return a pointer to the list of requests where they are.
+ */
+struct agios_list_head *timeline_lock(struct agios_ctx_t *ctx, int32_t hash)
+{
+	return timeline_lock_shard(ctx, timeline_shard(ctx, hash));
+}
 /**
- * called to acquire the timeline lock. It will wait for the lock.
- * @return a pointer to the timeline.
+ * called to unlock the mutex acquired with timeline_lock.
+ * @param ctx the AGIOS instance.
+ * @param hash the line of the hashtable.
  */
-struct agios_list_head *timeline_lock(void)
+void timeline_unlock(struct agios_ctx_t *ctx, int32_t hash)
 {
-	pthread_mutex_lock(&timeline_mutex);
-	return &timeline;
+	timeline_unlock_shard(ctx, timeline_shard(ctx, hash));
 }
 /**
- * called to unlock the timeline mutex. 
+ * adds a request that is in the timeline to the index of its queue, ordered by end offset (offset+len). It is used by TO-agg to find requests that could be aggregated to a new one without going through the timeline. The caller must hold the timeline lock.
+ * @param req the request.
  */
-void timeline_unlock(void)
+static void add_to_index(struct request_t *req)
 {
-	pthread_mutex_unlock(&timeline_mutex);
+	struct queue_t *queue = req->globalinfo; /**< the queue of the request */
+	struct agios_rb_node *node = queue->index.node; /**< used to walk down the index */
+	struct agios_rb_node *prev = NULL; /**< the node after which the request goes */
+	struct request_t *tmp; /**< the request at node */
+
+	if (!node) queue->index_max_len = 0; //the index is empty, we can forget about the requests that were there
+	while (node) {
+		tmp = agios_rb_entry(node, struct request_t, index_node);
+		if ((tmp->offset + tmp->len) > (req->offset + req->len)) node = node->left;
+		else {
+			prev = node;
+			node = node->right;
+		}
+	}
+	agios_rb_insert_after(&queue->index, &req->index_node, prev);
+	if (req->len > queue->index_max_len) queue->index_max_len = req->len;
+}
+/**
+ * moves a request to its new place in the index of its queue after its offset or len changed (@see add_to_index). It does nothing if the request is not in the index. The caller must hold the timeline lock.
+ * @param req the request.
+ */
+void timeline_update_index(struct request_t *req)
+{
+	if (agios_rb_empty_node(&req->index_node)) return;
+	agios_rb_erase(&req->globalinfo->index, &req->index_node);
+	add_to_index(req);
+}
+/**
+ * looks for a request in the timeline to which a new request can be aggregated (used by TO-agg). That is a request to the same file, with the same type, that is contiguous to (or overlaps) the new one and still has room for it. If there are many, we take the oldest one (the first in the timeline).
+ * Requests of the same queue are indexed by end offset (@see add_to_index), so we start by the first one that ends at or after the beginning of the new one. The ones that could be aggregated start before the end of the new one, so they cannot end after that plus the length of the largest request in the index.
+ * @param ctx the AGIOS instance.
+ * @param req the new request.
+ * @return the request to which req can be aggregated, NULL if there is none.
+ */
+static struct request_t *find_aggregation_partner(struct agios_ctx_t *ctx, struct request_t *req)
+{
+	struct queue_t *queue = req->globalinfo; /**< the queue of the new request */
+	struct agios_rb_node *node = queue->index.node; /**< used to go through the index */
+	struct agios_rb_node *first = NULL; /**< the first request in the index that ends at or after the beginning of req */
+	struct request_t *tmp; /**< the request at node */
+	struct request_t *selected = NULL; /**< the request we will return */
+	int64_t last_end = req->offset + req->len + queue->index_max_len; /**< requests that end after this cannot be contiguous to req */
+
+	while (node) {
+		tmp = agios_rb_entry(node, struct request_t, index_node);
+		if ((tmp->offset + tmp->len) >= req->offset) {
+			first = node;
+			node = node->left;
+		} else node = node->right;
+	}
+	for (node = first; node; node = agios_rb_next(node)) {
+		tmp = agios_rb_entry(node, struct request_t, index_node);
+		if ((tmp->offset + tmp->len) > last_end) break;
+		if ((CHECK_AGGREGATE(req, tmp) || CHECK_AGGREGATE(tmp, req)) && //they are contiguous
+		    ((tmp->reqnb + req->reqnb) <= ctx->current_scheduler->max_aggreg_size) && //and the virtual request can hold the new one (which may be a virtual request being migrated)
+		    ((!selected) || (tmp->timestamp < selected->timestamp))) selected = tmp;
+	}
+	return selected;
 }
 /**
  * function used by timeline_add_request to add a request to the timeline. This is a separated function because when migrating to or from SW or TWINS we need to completely reorder the timeline, so we'll add requests to a temporary timeline in the process. 
+ * @param ctx the AGIOS instance.
  * @see reorder_timeline
  * @param req @see timeline_add_req
  * @param hash @see timeline_add_req
@@ -48,183 +153,291 @@ void timeline_unlock(void)
  * @param this_timeline a link to the timeline where we should add the request.
  * @return true or false for success.
  */
-bool __timeline_add_req(struct request_t *req, 
+bool __timeline_add_req(struct agios_ctx_t *ctx,
+			struct request_t *req, 
 			int32_t hash, 
 			struct file_t *given_req_file, 
 			struct agios_list_head *this_timeline)
 {
 	struct file_t *req_file = given_req_file; /**< used to find the structure holding information about the file being accessed. */
-	struct request_t *tmp; /**< used to iterate over the timeline to find the insertion place for the request (depending on the scheduling algorithm being used). */
-	int32_t sw_priority; /**< a value that will define the position in the timeline when using the SW scheduling algorithm. */
-	struct agios_list_head *insertion_place; /**< the insertion place of the new request in the queue. */
+	struct request_t *tmp; /**< a request to which the new one can be aggregated (with TO-agg). */
 
 	if (!req_file) { //if a req_file structure has been given, we are actually migrating from hashtable to timeline and will copy the file_t structures, so no need to create new. Also the request pointers are already set, and we don't need to use locks here
 		debug("adding request %ld %ld to file %s, app_id %u", req->offset, req->len, req->file_id, req->queue_id);	
-		/*find the file and update its informations if needed*/
-		req_file = find_req_file(&hashlist[hash], req->file_id); //we store file information in the hashtable 
-		if (!req_file) return false;
-		if (req_file->first_request_time == 0) req_file->first_request_time = req->arrival_time;
-		if (req->type == RT_READ) req->globalinfo = &req_file->read_queue;
-		else req->globalinfo = &req_file->write_queue;
-		if (current_alg == NOOP_SCHEDULER) return true; //we don't really include requests when using the NOOP scheduler, we just go through this function because we want file_t  structures for statistics
+		req_file = req->globalinfo->req_file; //the file was already found (and its information updated) by agios_add_request
+		if (ctx->current_alg == NOOP_SCHEDULER) return true; //we don't really include requests when using the NOOP scheduler, we just go through this function because we want file_t  structures for statistics
 	}
 	//the SW scheduling algorithm separates requests into windows
-	if (current_alg == SW_SCHEDULER) {
-		// Calculate the request priority
-		sw_priority = ((req->arrival_time / config_sw_size) * 32768) + req->queue_id; //we assume 32768 here is the maximum value app_id could ever assume (not max_queue_id, but the maximum max_queue_id the user could ever give us). This is an ugly hardcoded value.
-		// Find the position to insert the request
-		agios_list_for_each_entry (tmp, this_timeline, related) { //go through all requests in the queue
-			if (tmp->sw_priority > sw_priority) {
-				agios_list_add(&req->related, tmp->related.prev);
-				return true;
-			}
-		}
-		// If it was not inserted in the middle of the queue, insert the request in the proper position (the end of the queue)
-		agios_list_add_tail(&req->related, this_timeline);
+	if (ctx->current_alg == SW_SCHEDULER) {
+		SW_add_req(ctx, req, this_timeline, given_req_file != NULL); //its calendar finds the place of the request in the timeline
 		return true;
 	} 
-	if (current_alg == TWINS_SCHEDULER || current_alg == WFQ_SCHEDULER) {
-		agios_list_add_tail(&req->related, &(multi_timeline[req->queue_id]));
+	//TWINS and WFQ keep a queue for each queue_id
+	if (ctx->current_scheduler->multi_timeline) {
+		if (!given_req_file) agios_list_add_tail(&req->related, &(ctx->multi_timeline[req->queue_id]));
+		else agios_list_add(&req->related, &(ctx->multi_timeline[req->queue_id])); //older than the ones already there, as below
 		return true;
 	}
 	//the TO-agg scheduling algorithm searches the queue for contiguous requests. If it finds any, then aggregate them.	
-	if ((current_alg == TOAGG_SCHEDULER) && (current_scheduler->max_aggreg_size > 1)) {	
-		agios_list_for_each_entry (tmp, this_timeline, related) { //go through all requests in the queue
-			if (tmp->globalinfo == req->globalinfo) { //same type and to the same file
-				if (tmp->reqnb < current_scheduler->max_aggreg_size) { //if the virtual request can hold another one
-					if (CHECK_AGGREGATE(req,tmp) || CHECK_AGGREGATE(tmp, req)) { //and they are contiguous
-						include_in_aggregation(req, &tmp);
-						return true;
-					}
-				} 
-			}
-		} //end loop going over all requests 
+	if ((ctx->current_alg == TOAGG_SCHEDULER) && (ctx->current_scheduler->max_aggreg_size > 1)) {	
+		tmp = find_aggregation_partner(ctx, req);
+		if (tmp) {
+			if (req->reqnb > 1) join_aggregations(&tmp, &req); //a virtual request being migrated from the hashtable, its requests go into the other one
+			else include_in_aggregation(req, &tmp);
+			timeline_update_index(tmp); //its offset and len changed
+			return true;
+		}
 	}
 	//if we are here it means the request still has to be inserted in the queue
-	if ((!given_req_file) || (current_alg == NOOP_SCHEDULER))  { //if no file_t structure was given, this is a regular new request, so we simply add it to the end of the timeline. If we are here and are using NOOP, it means we are migrating between data structures (because otherwise we would have left the function earlier), and in that case we don't do much regarding ordering because we are going to schedule these requests as soon as possible and we don't care (NOOP does not usually have a queue, this is a special case). */
+	if (!given_req_file) { //if no file_t structure was given, this is a regular new request, so we simply add it to the end of the timeline.
 		debug("request is not aggregated, inserting in the timeline");
 		agios_list_add_tail(&req->related, this_timeline); 
+	} else { //we are moving requests from the hashtable or reordering the timeline. These requests are older than the ones already in the timeline (which arrived after the change of scheduling algorithm), and the caller gives them from the newest to the oldest, so they go to the beginning (@see reorder_timeline, migrate_slice)
+		debug("request not aggregated and we are migrating, so adding it to the beginning of the timeline");
+		agios_list_add(&req->related, this_timeline);
 	}
-	else { //we are rebuilding this queue from the hashtable, so we need to make sure requests are ordered by time (and we are not using the time window algorithm, otherwise it would have called return already (see above)
-		debug("request not aggregated and we are reordering the timeline, so looking for its place");
-		insertion_place = this_timeline;
-		if (!agios_list_empty(this_timeline)) {
-			agios_list_for_each_entry (tmp, this_timeline, related) {
-				if (tmp->timestamp > req->timestamp) {
-					insertion_place = &(tmp->related);
-					break;	
-				}
-			}
-		}
-		agios_list_add(&req->related, insertion_place->prev);
-	}
+	if (ctx->current_alg == TOAGG_SCHEDULER) add_to_index(req);
 	return true;
 }
 /**
- * function called to add a request to the timeline. The caller must hold the timeline mutex before this call. 
+ * function called to add a request to the timeline. The caller must hold the lock of its shard (@see timeline_lock) before this call. 
+ * @param ctx the AGIOS instance.
  * @param req the new request being added.
  * @param hash the line of the hashtable containing information about the file being accessed.
- * @param given_req_file the information about the file being accessed or NULL if unknown. It is important to notice that: when called by agios_add_request, given_req_file will be NULL. It will only have a different value when this function is being used to migrate between data structures.
+ * @param given_req_file the information about the file being accessed or NULL if unknown. It is important to notice that: when called by agios_add_request, given_req_file will be NULL. It will only have a different value when this function is being used to migrate between data structures, and then the request goes to the beginning of its shard (instead of the end), so the caller must give requests from the newest to the oldest.
  * @return true or false for success.
  */
-bool timeline_add_req(struct request_t *req, int32_t hash, struct file_t *given_req_file)
+bool timeline_add_req(struct agios_ctx_t *ctx, struct request_t *req, int32_t hash, struct file_t *given_req_file)
+{
+	return __timeline_add_req(ctx, req, hash, given_req_file, &ctx->timeline_shards[timeline_shard(ctx, hash)].list);
+}
+/**
+ * compares two requests by timestamp, the newest first, used with qsort to give requests to timeline_add_req when migrating (@see given_req_file).
+ */
+int timeline_compare_newest_first(const void *a, const void *b)
+{
+	const struct request_t *first = *((struct request_t * const *) a);
+	const struct request_t *second = *((struct request_t * const *) b);
+
+	return (first->timestamp > second->timestamp) ? -1 : (first->timestamp < second->timestamp);
+}
+/**
+ * adds requests that were moved from the hashtable to the queues of the multi_timeline (used by TWINS and WFQ), keeping each queue in arrival order. The requests already in the queues are in arrival order, so we go through each queue once, and this takes a time proportional to the number of requests in them plus the number of new ones. The caller must hold the lock of the first shard.
+ * @param ctx the AGIOS instance.
+ * @param reqs the requests, sorted from the newest to the oldest (@see timeline_compare_newest_first).
+ * @param reqnb how many.
+ */
+void multi_timeline_merge(struct agios_ctx_t *ctx, struct request_t **reqs, int32_t reqnb)
+{
+	struct agios_list_head **positions; /**< for each queue, where we stopped, the next request goes after that */
+	struct agios_list_head *pos; /**< the first request in the queue that is newer than the one being added */
+	struct request_t *req; /**< the one being added */
+
+	positions = malloc(sizeof(struct agios_list_head *)*ctx->multi_timeline_size);
+	if (positions) {
+		for (int32_t i = 0; i < ctx->multi_timeline_size; i++) positions[i] = ctx->multi_timeline[i].next;
+	}
+	for (int32_t i = reqnb - 1; i >= 0; i--) { //the oldest first
+		req = reqs[i];
+		pos = positions ? positions[req->queue_id] : ctx->multi_timeline[req->queue_id].next; //without memory for the positions, we start from the beginning every time
+		while ((pos != &ctx->multi_timeline[req->queue_id]) && (agios_list_entry(pos, struct request_t, related)->timestamp < req->timestamp)) pos = pos->next;
+		__agios_list_add(&req->related, pos->prev, pos);
+		if (positions) positions[req->queue_id] = pos;
+	}
+	free(positions);
+}
+/**
+ * gives one of the lists of requests of the timeline, which are the shards followed by the queues of the multi_timeline.
+ * @param ctx the AGIOS instance.
+ * @param index the list, between 0 and timeline_shardnb + multi_timeline_size - 1.
+ * @return the list.
+ */
+static inline struct agios_list_head *timeline_list(struct agios_ctx_t *ctx, int32_t index)
+{
+	if (index < ctx->timeline_shardnb) return &ctx->timeline_shards[index].list;
+	return &ctx->multi_timeline[index - ctx->timeline_shardnb];
+}
+/**
+ * gives the newest request of the timeline, looking at the last request of each shard and of each queue of the multi_timeline. No other thread may be using the timeline (@see begin_scheduler_switch).
+ * @param ctx the AGIOS instance.
+ * @return the request, NULL if the timeline is empty.
+ */
+static struct request_t *newest_req_of_all_lists(struct agios_ctx_t *ctx)
 {
-	return __timeline_add_req(req, hash, given_req_file, &timeline);
+	struct request_t *ret = NULL; /**< the request that will be returned */
+	struct request_t *tmp; /**< the last request of a list */
+	struct agios_list_head *list; /**< a shard or a queue of the multi_timeline */
+
+	for (int32_t i = 0; i < ctx->timeline_shardnb + ctx->multi_timeline_size; i++) {
+		list = timeline_list(ctx, i);
+		if (agios_list_empty(list)) continue;
+		tmp = agios_list_entry(list->prev, struct request_t, related);
+		if ((!ret) || (tmp->timestamp > ret->timestamp)) ret = tmp;
+	}
+	return ret;
 }
 /** 
- * This function is called when migrating between two scheduling algorithms when both use timeline and one of them is the TIME_WINDOW or TWINS. In this case, it is necessary to redo the timeline so requests will be processed in the new relevant order.
+ * This function is called when migrating between two scheduling algorithms that use the timeline when one of them is SW, or when only one of them shards the timeline, or when only one of them uses the multi_timeline (TWINS and WFQ). In this case, it is necessary to redo the timeline so requests will be processed in the new relevant order (and be in the right shards or queues). No other thread may be using the timeline (@see begin_scheduler_switch), and the new scheduling algorithm must already be the current one.
+ * Requests are taken from all shards and queues and sorted by arrival, and each one is added to the beginning of its new shard or queue from the newest to the oldest (@see __timeline_add_req), so every shard and every queue of the multi_timeline ends in arrival order. If there is no memory to sort them, we take them from the end of the lists instead, which takes a time proportional to the number of requests times the number of lists.
+ * @param ctx the AGIOS instance.
  */
-void reorder_timeline(void)
+void reorder_timeline(struct agios_ctx_t *ctx)
 {
-	struct agios_list_head *new_timeline; /**< a temporary timeline used while we are migrating. */
-	struct request_t *req; /**< used to iterate over all requests of the queue. */
- 	struct request_t *aux_req=NULL;  /**< used to avoid moving a request before moving the iterator to the next one, otherwise the loop breaks. */
-	int32_t hash; /**< line of the hashtable where information about a file is. */
+	AGIOS_LIST_HEAD(old_timeline); /**< the requests taken from all lists, from the newest to the oldest, if we cannot sort them. */
+	struct request_t **reqs; /**< the requests taken from all lists. */
+	int32_t reqnb = 0; /**< how many */
+	struct request_t *req; /**< used to iterate over all requests of the timeline. */
+	struct request_t *next_req; /**< the one after req. */
 
-	//initialize new timeline structure
-	new_timeline = (struct agios_list_head *)malloc(sizeof(struct agios_list_head));
-	new_timeline->prev = new_timeline;
-	new_timeline->next = new_timeline;
-	//get all requests from the previous timeline and include in the new one
-	agios_list_for_each_entry (req, &timeline, related) {
-		if (aux_req) {
-			hash = get_hashtable_position(aux_req->file_id);
-			agios_list_del(&aux_req->related);
-			__timeline_add_req(aux_req, hash, aux_req->globalinfo->req_file, new_timeline);	
+	for (int32_t i = 0; i < ctx->timeline_shardnb + ctx->multi_timeline_size; i++) {
+		agios_list_for_each_entry (req, timeline_list(ctx, i), related) reqnb++;
+	}
+	if (reqnb == 0) return;
+	reqs = malloc(sizeof(struct request_t *)*reqnb);
+	if (!reqs) {
+		agios_print("PANIC! Could not allocate memory to sort requests, reordering the timeline will be slow");
+		while ((req = newest_req_of_all_lists(ctx))) {
+			request_del(req);
+			agios_list_add_tail(&req->related, &old_timeline);
 		}
-		aux_req = req;
-	}	
-	if (aux_req) {
-		hash = get_hashtable_position(aux_req->file_id);
-		agios_list_del(&aux_req->related);
-		__timeline_add_req(aux_req, hash, aux_req->globalinfo->req_file, new_timeline);	
-	}
-	//redefine the pointers and replace the old timeline by the new one
-	new_timeline->prev->next = &timeline;
-	new_timeline->next->prev = &timeline;
-	timeline.next = new_timeline->next;
-	timeline.prev = new_timeline->prev;
-	free(new_timeline);
-}
-/**
- * removes the first request from the queue and also calculates its hash. The caller must hold the timeline lock before calling this.
+		agios_list_for_each_entry_safe (req, next_req, &old_timeline, related) {
+			agios_list_del(&req->related);
+			timeline_add_req(ctx, req, req->globalinfo->req_file->hash, req->globalinfo->req_file);
+		}
+		return;
+	}
+	//take all requests from the lists
+	reqnb = 0;
+	for (int32_t i = 0; i < ctx->timeline_shardnb + ctx->multi_timeline_size; i++) {
+		agios_list_for_each_entry_safe (req, next_req, timeline_list(ctx, i), related) {
+			request_del(req);
+			reqs[reqnb++] = req;
+		}
+	}
+	//and include them in the timeline again, the newest first
+	qsort(reqs, reqnb, sizeof(struct request_t *), timeline_compare_newest_first);
+	for (int32_t i = 0; i < reqnb; i++) timeline_add_req(ctx, reqs[i], reqs[i]->globalinfo->req_file->hash, reqs[i]->globalinfo->req_file);
+	free(reqs);
+}
+/**
+ * gives the shard of the timeline whose first request is the oldest one, without taking any locks (so it may be outdated by the time the caller takes the lock of the shard).
+ * @param ctx the AGIOS instance.
+ * @return the shard, -1 if all shards seem to be empty.
+ */
+int32_t timeline_oldest_shard(struct agios_ctx_t *ctx)
+{
+	int32_t ret = -1; /**< the shard that will be returned */
+	int64_t oldest = INT64_MAX; /**< the timestamp of the first request of that shard */
+	int64_t this_oldest; /**< the timestamp of the first request of a shard */
+
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) {
+		this_oldest = atomic_load_explicit(&ctx->timeline_shards[i].oldest, memory_order_acquire);
+		if (this_oldest < oldest) {
+			oldest = this_oldest;
+			ret = i;
+		}
+	}
+	return ret;
+}
+/**
+ * removes the first request from a shard of the timeline and also calculates its hash. The caller must hold the lock of the shard before calling this.
+ * @param ctx the AGIOS instance.
+ * @param shard the shard.
  * @param hash the value that will be updated in this function to hold the line of the hashtable with information about the file that is accessed by the returned request.
- * @return the first request from the queue, removed from it, NULL if the queue is empty. 
+ * @return the first request from the shard, removed from it, NULL if the shard is empty. 
  */
-struct request_t *timeline_oldest_req(int32_t *hash)
+struct request_t *timeline_oldest_req(struct agios_ctx_t *ctx, int32_t shard, int32_t *hash)
 {
+	struct agios_list_head *list = &ctx->timeline_shards[shard].list; /**< the requests of the shard */
 	struct request_t *tmp; /**< the request that will be returned. */
 
-	if (agios_list_empty(&timeline)) return NULL;
-	tmp = agios_list_entry(timeline.next, struct request_t, related);
-	agios_list_del(&tmp->related);
-	*hash = get_hashtable_position(tmp->file_id);
+	if (agios_list_empty(list)) return NULL;
+	tmp = agios_list_entry(list->next, struct request_t, related);
+	request_del(tmp);
+	*hash = tmp->globalinfo->req_file->hash;
 	return tmp;
 }
 /**
- * Initializes data structures used for the timeline, the multi_timeline and the lock. 
+ * Initializes data structures used for the timeline, the multi_timeline and the locks. It must be called after hashtable_init, because the lines of the hashtable are split between the shards.
+ * @param ctx the AGIOS instance.
  * @param max_queue_id the number of queues in multi_timeline. It is only relevant for TWINS. Pass 0 otherwise to prevent unnecessary memory allocation.
  * @return true or false for success. 
  */
-bool timeline_init(int32_t max_queue_id)
+bool timeline_init(struct agios_ctx_t *ctx, int32_t max_queue_id)
 {
-	init_agios_list_head(&timeline);
+	int32_t shard_shift = 0; /**< there will be 1 << shard_shift shards */
+	void *shards; /**< the memory allocated for the shards */
+
+	//the number of shards is a power of 2 (rounded down), so each one has the same number of lines of the hashtable
+	while ((shard_shift < ctx->hashtable_shift) && ((2 << shard_shift) <= AGIOS_TIMELINE_MAX_SHARDS) && ((2 << shard_shift) <= ctx->config.timeline_shards)) shard_shift++;
+	ctx->timeline_shardnb = 1 << shard_shift;
+	ctx->timeline_shard_shift = ctx->hashtable_shift - shard_shift;
+	if (posix_memalign(&shards, AGIOS_CACHE_LINE_SIZE, sizeof(struct timeline_shard_t)*ctx->timeline_shardnb) != 0) {
+		agios_print("PANIC! No memory to allocate the timeline");
+		return false;
+	}
+	ctx->timeline_shards = shards;
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) {
+		pthread_mutex_init(&ctx->timeline_shards[i].lock, NULL);
+		init_agios_list_head(&ctx->timeline_shards[i].list);
+		atomic_init(&ctx->timeline_shards[i].oldest, INT64_MAX);
+	}
+	init_agios_list_head(&ctx->SW_windows);
 	if (max_queue_id > 0) {
-		multi_timeline = (struct agios_list_head *) malloc(sizeof(struct agios_list_head)*(max_queue_id+1));
-		multi_timeline_size = max_queue_id+1;
-		if (!multi_timeline) {
+		ctx->multi_timeline = (struct agios_list_head *) malloc(sizeof(struct agios_list_head)*(max_queue_id+1));
+		if (!ctx->multi_timeline) {
 			agios_print("PANIC! No memory to allocate the app timeline for TWINS");
 			return false;
 		}
-		for (int32_t i=0; i< multi_timeline_size; i++) {
-			init_agios_list_head(&(multi_timeline[i]));
+		ctx->multi_timeline_size = max_queue_id+1;
+		for (int32_t i=0; i< ctx->multi_timeline_size; i++) {
+			init_agios_list_head(&(ctx->multi_timeline[i]));
 		}
 	}
+	debug("the timeline has %d shards", ctx->timeline_shardnb);
 	return true;
 }
 /**
  * called at the end of the execution to free allocated data structures.
+ * @param ctx the AGIOS instance.
  */
-void timeline_cleanup(void)
+void timeline_cleanup(struct agios_ctx_t *ctx)
 {
-	list_of_requests_cleanup(&timeline);
-	if (multi_timeline_size > 0) {
-		for(int32_t i=0; i< multi_timeline_size; i++)
-			list_of_requests_cleanup(&multi_timeline[i]);
-		free(multi_timeline);
+	if (ctx->timeline_shards) {
+		for (int32_t i = 0; i < ctx->timeline_shardnb; i++) {
+			list_of_requests_cleanup(&ctx->timeline_shards[i].list);
+			pthread_mutex_destroy(&ctx->timeline_shards[i].lock);
+		}
+		free(ctx->timeline_shards);
+		ctx->timeline_shards = NULL;
+	}
+	if (ctx->multi_timeline_size > 0) {
+		for(int32_t i=0; i< ctx->multi_timeline_size; i++)
+			list_of_requests_cleanup(&ctx->multi_timeline[i]);
+		free(ctx->multi_timeline);
 	}
 }
 /**
  * prints all requests in the timeline, used for debug.
+ * @param ctx the AGIOS instance.
  */
-void print_timeline(void)
+void print_timeline(struct agios_ctx_t *ctx)
 {
 #if AGIOS_DEBUG
 	struct request_t *req;
 	debug("Current timeline status:");
-	debug("Requests:");
-	agios_list_for_each_entry (req, &timeline, related) {
-		print_request(req);
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) {
+		debug("Requests of shard %d:", i);
+		agios_list_for_each_entry (req, &ctx->timeline_shards[i].list, related) {
+			print_request(req);
+		}
+	}
+	for (int32_t i = 0; i < ctx->multi_timeline_size; i++) {
+		if (agios_list_empty(&ctx->multi_timeline[i])) continue;
+		debug("Requests of queue %d:", i);
+		agios_list_for_each_entry (req, &ctx->multi_timeline[i], related) {
+			print_request(req);
+		}
 	}
 #endif
 }
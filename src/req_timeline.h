@@ -3,17 +3,36 @@
  */
 #pragma once
 
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "agios_request.h"
 
-extern struct agios_list_head timeline;
-extern struct agios_list_head *multi_timeline;
-extern int32_t multi_timeline_size;
+#define AGIOS_TIMELINE_MAX_SHARDS 64 /**< the timeline has at most this many shards (the smallest number of lines of the hashtable, @see req_hashtable.h) */
+
+/** \struct timeline_shard_t
+ *  \brief A part of the timeline with its own lock (@see timeline_shard). Shards are aligned to cache lines so threads using different ones do not slow each other down.
+ */
+struct timeline_shard_t {
+	pthread_mutex_t lock; /**< protects list and the lines of the hashtable that belong to this shard. */
+	struct agios_list_head list; /**< the requests to files of these lines. */
+	_Atomic int64_t oldest; /**< the timestamp of the first request in list, INT64_MAX if it is empty. It is updated when the lock is released, so TO can choose a shard without taking all locks. */
+} __attribute__((aligned(AGIOS_CACHE_LINE_SIZE)));
+
+struct agios_ctx_t;
 
-struct agios_list_head *timeline_lock(void);
-void timeline_unlock(void);
-bool timeline_add_req(struct request_t *req, int32_t hash, struct file_t *given_req_file);
-void reorder_timeline(void);
-struct request_t *timeline_oldest_req(int32_t *hash);
-bool timeline_init(int32_t max_queue_id);
-void timeline_cleanup(void);
-void print_timeline(void);
+int32_t timeline_shard(struct agios_ctx_t *ctx, int32_t hash);
+struct agios_list_head *timeline_lock_shard(struct agios_ctx_t *ctx, int32_t shard);
+void timeline_unlock_shard(struct agios_ctx_t *ctx, int32_t shard);
+struct agios_list_head *timeline_lock(struct agios_ctx_t *ctx, int32_t hash);
+void timeline_unlock(struct agios_ctx_t *ctx, int32_t hash);
+bool timeline_add_req(struct agios_ctx_t *ctx, struct request_t *req, int32_t hash, struct file_t *given_req_file);
+void timeline_update_index(struct request_t *req);
+int timeline_compare_newest_first(const void *a, const void *b);
+void multi_timeline_merge(struct agios_ctx_t *ctx, struct request_t **reqs, int32_t reqnb);
+void reorder_timeline(struct agios_ctx_t *ctx);
+int32_t timeline_oldest_shard(struct agios_ctx_t *ctx);
+struct request_t *timeline_oldest_req(struct agios_ctx_t *ctx, int32_t shard, int32_t *hash);
+bool timeline_init(struct agios_ctx_t *ctx, int32_t max_queue_id);
+void timeline_cleanup(struct agios_ctx_t *ctx);
+void print_timeline(struct agios_ctx_t *ctx);
@@ -7,7 +7,9 @@
 #include <limits.h>
 #include <string.h>
 
+#include "agios_ctx.h"
 #include "aIOLi.h"
+#include "common_functions.h"
 #include "data_structures.h"
 #include "MLF.h"
 #include "NOOP.h"
@@ -21,12 +23,10 @@
 #include "TWINS.h"
 #include "WFQ.h"
 
-int32_t current_alg = 0; /**< the identifier of the scheduling algorithm being currently used. @see scheduling_algorithms.h */
-struct io_scheduler_instance_t *current_scheduler=NULL; /**< a pointer to the structure describing the scheduling algorithm being currently used. */
 /** 
- * the list of all scheduling algorithms and their parameters.
+ * the list of all scheduling algorithms and their parameters. Each AGIOS instance works on its own copy of it (@see init_scheduling_algorithms).
  */
-static struct io_scheduler_instance_t io_schedulers[] = { 
+static const struct io_scheduler_instance_t io_schedulers[] = { 
 		{
 			.name = "MLF",
 			.index = MLF_SCHEDULER,
@@ -36,6 +36,8 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.select_algorithm = NULL,
 			.max_aggreg_size = MAX_AGGREG_SIZE,
 			.needs_hashtable=true,
+			.sharded_timeline=false,
+			.multi_timeline=false,
 			.can_be_dynamically_selected=true,
 			.is_dynamic=false,
 		},
@@ -48,6 +50,8 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.select_algorithm = NULL,
 			.max_aggreg_size = MAX_AGGREG_SIZE,
 			.needs_hashtable=false,
+			.sharded_timeline=true,
+			.multi_timeline=false,
 			.can_be_dynamically_selected=true,
 			.is_dynamic=false,
 		},
@@ -60,6 +64,8 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.select_algorithm = NULL,
 			.max_aggreg_size = MAX_AGGREG_SIZE,
 			.needs_hashtable=true,
+			.sharded_timeline=false,
+			.multi_timeline=false,
 			.can_be_dynamically_selected=true,
 			.is_dynamic=false,
 		},
@@ -72,6 +78,8 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.select_algorithm = NULL,
 			.max_aggreg_size = MAX_AGGREG_SIZE,
 			.needs_hashtable=true,
+			.sharded_timeline=false,
+			.multi_timeline=false,
 			.can_be_dynamically_selected=false,
 			.is_dynamic=false,
 		},
@@ -84,6 +92,8 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.select_algorithm = NULL,
 			.max_aggreg_size = 1,
 			.needs_hashtable=false,
+			.sharded_timeline=true,
+			.multi_timeline=false,
 			.can_be_dynamically_selected=true,
 			.is_dynamic=false,
 		},
@@ -95,7 +105,9 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.exit = NULL,
 			.select_algorithm = NULL,
 			.max_aggreg_size = 1,
-			.needs_hashtable=false, 
+			.needs_hashtable=false,
+			.sharded_timeline=false, 
+			.multi_timeline=false,
 			.can_be_dynamically_selected=false,
 			.is_dynamic=false,
 		},
@@ -108,6 +120,8 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.select_algorithm = NULL,
 			.max_aggreg_size = 1,
 			.needs_hashtable= false,
+			.sharded_timeline=true,
+			.multi_timeline=false,
 			.can_be_dynamically_selected=true,
 			.is_dynamic=false,
 		},
@@ -119,8 +133,10 @@ static struct io_scheduler_instance_t io_schedulers[] = {
 			.exit = &TWINS_exit,
 			.select_algorithm = NULL,
 			.max_aggreg_size = 1,
-			.needs_hashtable = false, 
-			.can_be_dynamically_selected = false, //The functions that implement the migration between different scheduling algorithms were not adapted for this algorithm, so it should never be used with a dynamic algorithm until we fix that.  
+			.needs_hashtable = false,
+			.sharded_timeline=false, 
+			.multi_timeline=true,
+			.can_be_dynamically_selected = true, //unless the multi_timeline was not allocated (@see disable_unavailable_schedulers)
 			.is_dynamic=false,
 		},
         {
@@ -132,79 +148,101 @@ static struct io_scheduler_instance_t io_schedulers[] = {
             .select_algorithm = NULL,
             .max_aggreg_size = 1, //??
             .needs_hashtable = false,
-            .can_be_dynamically_selected = false, //The functions that implement the migration between different scheduling algorithms were not adapted for this algorithm
+            .sharded_timeline=false,
+            .multi_timeline=true,
+            .can_be_dynamically_selected = true, //unless the multi_timeline was not allocated or the weights could not be read (@see disable_unavailable_schedulers)
             .is_dynamic = false,
-        }
+        },
+		{
+			.name = "SJF-heap",
+			.index = SJF_HEAP_SCHEDULER,
+			.init = &SJF_heap_init,
+			.schedule = &SJF_heap,
+			.exit = &SJF_heap_exit,
+			.select_algorithm = NULL,
+			.max_aggreg_size = MAX_AGGREG_SIZE,
+			.needs_hashtable=true,
+			.sharded_timeline=false,
+			.multi_timeline=false,
+			.can_be_dynamically_selected=true,
+			.is_dynamic=false,
+		}
 	};
 /**
- * Called to change the current scheduling algorithm and update local parameters. Here we assume the scheduling thread is NOT running, so it won't mess with the structures. This function will acquire the lock to all data structures, must call unlock afterwards 
+ * Called to change the current scheduling algorithm and update local parameters. It is called by the AGIOS thread, so the scheduling algorithm is not running. This function begins a switch of scheduling algorithm (@see begin_scheduler_switch), so no other thread is using the data structures until the caller calls end_scheduler_switch. If the new algorithm uses the other data structure, requests are not moved here but after the switch, a slice at a time (@see migrate_slice), and the AGIOS thread must not change the scheduling algorithm again until that is over.
+ * @param ctx the AGIOS instance.
  * @param new_alg identifier of the new scheduling algorithm.
  */
-void change_selected_alg(int32_t new_alg)
+void change_selected_alg(struct agios_ctx_t *ctx, int32_t new_alg)
 {
 	int32_t previous_alg; /**< will receive the current_alg while we are changing it to new_alg. */
 	struct io_scheduler_instance_t *previous_scheduler; /**< will receive current_scheduler while we are changing it to the new one. */
 
-	//lock all data structures so no one is adding or releasing requests while we migrate
-	lock_all_data_structures();
-	if (current_alg != new_alg) { //if we are indeed changing something
+	//wait until no one is adding or releasing requests, and make sure no one will until we are done changing the algorithm
+	begin_scheduler_switch(ctx);
+	if (ctx->current_alg != new_alg) { //if we are indeed changing something
 		//change scheduling algorithm
-		previous_scheduler = current_scheduler;
-		previous_alg = current_alg;
-		current_scheduler = initialize_scheduler(new_alg);
-		current_alg = new_alg;
+		previous_scheduler = ctx->current_scheduler;
+		previous_alg = ctx->current_alg;
+		if (previous_scheduler->exit) previous_scheduler->exit(ctx); //so it does not keep (and update) structures it will not use
+		ctx->current_scheduler = initialize_scheduler(ctx, new_alg);
+		ctx->current_alg = new_alg;
 		//do we need to migrate data structure?
 		//first situation: both use hashtable
-		if (current_scheduler->needs_hashtable && previous_scheduler->needs_hashtable) {
+		if (ctx->current_scheduler->needs_hashtable && previous_scheduler->needs_hashtable) {
 			//the only problem here is if we decreased the maximum aggregation
 			//For now we chose to do nothing. If we no longer tolerate aggregations of a certain size, we are not spliting already performed aggregations since this would not benefit us at all. We could rethink that at some point
 		}
-		//second situation: from hashtable to timeline
-		else if (previous_scheduler->needs_hashtable && (!current_scheduler->needs_hashtable)) {
-			print_hashtable();
-			migrate_from_hashtable_to_timeline();
-			print_timeline();
+		//second situation: from hashtable to timeline. New requests go to the timeline from now on, and the queued ones are moved while the new algorithm runs (@see migrate_slice)
+		else if (previous_scheduler->needs_hashtable && (!ctx->current_scheduler->needs_hashtable)) {
+			print_hashtable(ctx);
+			begin_migration(ctx, true, previous_scheduler);
 		}
-		//third situation: from timeline to hashtable
-		else if ((!previous_scheduler->needs_hashtable) && current_scheduler->needs_hashtable) {
-			print_timeline();
-			migrate_from_timeline_to_hashtable();
-			print_hashtable();
+		//third situation: from timeline to hashtable, also moved while the new algorithm runs
+		else if ((!previous_scheduler->needs_hashtable) && ctx->current_scheduler->needs_hashtable) {
+			print_timeline(ctx);
+			begin_migration(ctx, false, previous_scheduler);
 		} else { //fourth situation: both algorithms use timeline
 			//now it depends on the algorithms. 
 			//if we are changing to NOOP, it does not matter because it does not really use the data structure
-			//if we are changing from or to SW or TWINS, we need to reorder the list
+			//if we are changing from or to SW, we need to reorder the list
 			//if we are changing to the timeorder with aggregation, we need to reorder the list
-			if ((current_alg != NOOP_SCHEDULER) && 
-			   ((previous_alg == SW_SCHEDULER) || (current_alg == SW_SCHEDULER) || (current_alg == TWINS_SCHEDULER) || (previous_alg == TWINS_SCHEDULER))) {
-				reorder_timeline(); 
+			//if only one of them shards the timeline, requests have to be moved between the shards (even for NOOP)
+			//if only one of them uses the multi_timeline (TWINS and WFQ), requests have to be moved between it and the shards (even for NOOP). Between TWINS and WFQ they stay in their queues, in the same order
+			if (((ctx->current_alg != NOOP_SCHEDULER) && 
+			    ((previous_alg == SW_SCHEDULER) || (ctx->current_alg == SW_SCHEDULER))) ||
+			    (previous_scheduler->sharded_timeline != ctx->current_scheduler->sharded_timeline) ||
+			    (previous_scheduler->multi_timeline != ctx->current_scheduler->multi_timeline)) {
+				reorder_timeline(ctx); 
 			}
 		} //end fourth situation 
 	} //end if changing the scheduler
 }
 /**
  * finds and returns the current scheduler indicated by index. If this scheduler needs an initialization function, calls it.
+ * @param ctx the AGIOS instance.
  * @param index the identifier of the scheduler.
  * @return a pointer to the initialized scheduler instance, NULL on error.
  */
-struct io_scheduler_instance_t *initialize_scheduler(int32_t index) 
+struct io_scheduler_instance_t *initialize_scheduler(struct agios_ctx_t *ctx, int32_t index) 
 {
 	//sanity check
 	if ((index >= IO_SCHEDULER_COUNT) || (index < 0)) return NULL;
-	if (io_schedulers[index].init) {
-		if (!io_schedulers[index].init()) return NULL;
+	if (ctx->io_schedulers[index].init) {
+		if (!ctx->io_schedulers[index].init(ctx)) return NULL;
 	}
-	return &(io_schedulers[index]);
+	return &(ctx->io_schedulers[index]);
 }
 /** 
  * finds an returns a scheduler indicated by index.
+ * @param ctx the AGIOS instance.
  * @param index the identifier of the scheduler.
  * @return a pointer to the scheduler instance, NULL on error.
  */
-struct io_scheduler_instance_t *find_io_scheduler(int32_t index)
+struct io_scheduler_instance_t *find_io_scheduler(struct agios_ctx_t *ctx, int32_t index)
 {
 	if ((index >= IO_SCHEDULER_COUNT) || (index < 0)) return NULL;
-	return &(io_schedulers[index]);
+	return &(ctx->io_schedulers[index]);
 }
 /** 
  * finds and returns a scheduler identified by its name
@@ -229,17 +267,41 @@ bool get_algorithm_from_string(const char *alg, int32_t *index)
  * @param index the scheduler identifier
  * @return the scheduler name (a pointer to it), NULL on error.
  */
-char * get_algorithm_name_from_index(int32_t index)
+const char *get_algorithm_name_from_index(int32_t index)
 {
 	if ((index >= IO_SCHEDULER_COUNT) || (index < 0)) return NULL;
 	return io_schedulers[index].name;
 }
+/**
+ * called when an AGIOS instance is created, to give it its own copy of the list of scheduling algorithms.
+ * @param ctx the AGIOS instance.
+ */
+void init_scheduling_algorithms(struct agios_ctx_t *ctx)
+{
+	memcpy(ctx->io_schedulers, io_schedulers, sizeof(io_schedulers));
+}
 /**
  * used to change the parameter of the SW scheduler to make it possible to be selected dynamically (by default it isn't).
+ * @param ctx the AGIOS instance.
  */
-void enable_SW(void)
+void enable_SW(struct agios_ctx_t *ctx)
 {
-	io_schedulers[SW_SCHEDULER].can_be_dynamically_selected = true;
+	ctx->io_schedulers[SW_SCHEDULER].can_be_dynamically_selected = true;
+}
+/**
+ * called once the configuration was read and the data structures were allocated, so a dynamic scheduling algorithm will not select TWINS or WFQ if the multi_timeline they need was not allocated (agios_init was given 0 as max_queue_id), nor WFQ if its weights could not be read (@see WFQ_init). The weights are read here (only if a dynamic scheduling algorithm is used), so that does not fail later, when the AGIOS thread changes the scheduling algorithm.
+ * @param ctx the AGIOS instance.
+ */
+void disable_unavailable_schedulers(struct agios_ctx_t *ctx)
+{
+	if (!ctx->io_schedulers[ctx->config.default_algorithm].is_dynamic) return;
+	for (int32_t i = 0; i < IO_SCHEDULER_COUNT; i++) {
+		if ((ctx->io_schedulers[i].multi_timeline) && (ctx->multi_timeline_size == 0)) ctx->io_schedulers[i].can_be_dynamically_selected = false;
+	}
+	if ((ctx->io_schedulers[WFQ_SCHEDULER].can_be_dynamically_selected) && ((!ctx->config.wfq_conf_file) || (!WFQ_init(ctx)))) {
+		debug("WFQ will not be selected, its weights were not provided");
+		ctx->io_schedulers[WFQ_SCHEDULER].can_be_dynamically_selected = false;
+	}
 }
 /**
  * Called after processing a request to update some statistics and possibly cleanup a virtual request structure. 
@@ -6,15 +6,13 @@
 #include <string.h>
 
 #include "agios.h"
+#include "agios_add_request.h"
+#include "agios_ctx.h"
 #include "common_functions.h"
 #include "mylist.h"
 #include "req_hashtable.h"
 #include "statistics.h"
 
-static struct timespec last_req; /**< time of the last request arrival. */
-static struct global_statistics_t global_stats; /**< global statistics. */
-static pthread_mutex_t global_statistics_mutex = PTHREAD_MUTEX_INITIALIZER; /**< to protectthe global statistics */
-
 /**
  * function called to update the local statistics to a queue after the arrival of a new request.
  * @param stats the statistics structure of the queue to be updated.
@@ -43,24 +41,20 @@ void update_local_stats(struct queue_statistics_t *stats, struct request_t *req)
 	stats->avg_req_size = update_iterative_average(stats->avg_req_size, req->len, stats->receivedreq_nb);
 }
 /**
- * function called when a new request is received, to update the global statistics.
- * @param stats the global statistics structure.
+ * function called when a new request is received, to update the global statistics. They are kept separately for each line of the hashtable, so threads adding requests to different lines do not have to wait for each other (@see get_global_stats). The caller must hold the lock of the line of the file accessed by the request (or of its shard of the timeline).
+ * @param ctx the AGIOS instance, whose global statistics will be updated.
  * @req the newly arrived request.
  */
-void update_global_stats_newreq(struct global_statistics_t *stats, 
+static void update_global_stats_newreq(struct agios_ctx_t *ctx, 
 				struct request_t *req)
 {
-	int64_t elapsedtime; /**< time since the previous request's arrival.*/
+	struct line_statistics_t *stats = &ctx->hashlist_stats[req->globalinfo->req_file->hash]; /**< the statistics of the line of the file. */
 
-	stats->total_reqnb++;
-	//update global statistics on time between requests 
-	if (stats->total_reqnb > 1) { //we can only measure time between requests starting from the second request
-		elapsedtime = (req->arrival_time - get_timespec2long(last_req)); 
-		stats->avg_time_between_requests = update_iterative_average(stats->avg_time_between_requests, elapsedtime, stats->total_reqnb-1);
-	}
-	get_long2timespec(req->arrival_time, &last_req);
-	//update global statistics on request size 
-	stats->avg_request_size = update_iterative_average(stats->avg_request_size, req->len, stats->total_reqnb);
+	stats->reqnb++;
+	stats->total_size += req->len;
+	//the time between consecutive requests is measured from the first and the last arrivals (@see get_global_stats)
+	if ((stats->first_arrival < 0) || (req->arrival_time < stats->first_arrival)) stats->first_arrival = req->arrival_time;
+	if (req->arrival_time > stats->last_arrival) stats->last_arrival = req->arrival_time;
 	//update global statistics on operation
 	if(req->type == RT_READ)
 		stats->reads++;
@@ -68,31 +62,80 @@ void update_global_stats_newreq(struct global_statistics_t *stats,
 		stats->writes++;
 }
 /**
- * function called to update the statists after the arrival of a new request. The caller  must hold the hashtable mutex. Must NOT hold the global statistics mutex.
+ * function called to update the statists after the arrival of a new request. The caller must hold the lock of the line of the hashtable of the file accessed by the request (or of its shard of the timeline).
+ * @param ctx the AGIOS instance.
  * @param req the newly arrived requests.
  */
-void statistics_newreq(struct request_t *req)
+void statistics_newreq(struct agios_ctx_t *ctx, struct request_t *req)
 {
 	req->globalinfo->stats.receivedreq_nb++;
 	//update global statistics
-	pthread_mutex_lock(&global_statistics_mutex);
-	update_global_stats_newreq(&global_stats, req);
-	pthread_mutex_unlock(&global_statistics_mutex);
+	update_global_stats_newreq(ctx, req);
 	//update local statistics
 	update_local_stats(&req->globalinfo->stats, req);
 }
 /**
- * resets all global statistics.
+ * function called to update the statistics after the arrival of a batch of new requests. It does the same as calling statistics_newreq for each one of them. The caller must hold the mutex of the hashtable line (or the shard of the timeline) where all these requests are.
+ * @param ctx the AGIOS instance.
+ * @param reqs the newly arrived requests.
+ * @param reqnb the number of requests in reqs.
+ */
+void statistics_newreqs(struct agios_ctx_t *ctx, struct request_t **reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) {
+		update_global_stats_newreq(ctx, reqs[i]);
+		reqs[i]->globalinfo->stats.receivedreq_nb++;
+		update_local_stats(&reqs[i]->globalinfo->stats, reqs[i]);
+	}
+}
+/**
+ * resets all global statistics. No other thread can be using the data structures (@see reset_all_statistics), or we are initializing the hashtable.
+ * @param ctx the AGIOS instance.
  */
-void reset_global_stats(void)
+void reset_global_stats(struct agios_ctx_t *ctx)
 {
-	pthread_mutex_lock(&global_statistics_mutex);
-	global_stats.total_reqnb =0;
-	global_stats.reads = 0;
-	global_stats.writes = 0;
-	global_stats.avg_time_between_requests = -1;
-	global_stats.avg_request_size = -1;
-	pthread_mutex_unlock(&global_statistics_mutex);
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		ctx->hashlist_stats[i].reqnb = 0;
+		ctx->hashlist_stats[i].reads = 0;
+		ctx->hashlist_stats[i].writes = 0;
+		ctx->hashlist_stats[i].total_size = 0;
+		ctx->hashlist_stats[i].first_arrival = -1;
+		ctx->hashlist_stats[i].last_arrival = -1;
+	}
+}
+/**
+ * merges the global statistics kept for each line of the hashtable. The counters are the same as before, but the averages are not calculated as they used to be:
+ * - the average request size is the sum of the sizes divided by the number of requests. It used to be an iterative average, truncated by an integer division at every request, so it was a little smaller.
+ * - the average time between requests is the time between the earliest and the latest arrivals divided by the number of requests minus one. It used to be the iterative average of the time between each request and the one counted before it (in the order threads acquired the global statistics mutex, which is not always the order of arrival when several threads add requests), also truncated at every request. With a single thread adding requests, the sum of these times was the same, so only the truncation differs.
+ * The statistics of each queue still use iterative averages. No other thread can be using the data structures, as when selecting a new scheduling algorithm (@see begin_scheduler_switch).
+ * @param ctx the AGIOS instance.
+ * @param stats the structure that receives the global statistics.
+ */
+void get_global_stats(struct agios_ctx_t *ctx, struct global_statistics_t *stats)
+{
+	int64_t total_size = 0; /**< the sum of the sizes of all requests. */
+	int64_t first_arrival = -1; /**< the earliest arrival among all lines. */
+	int64_t last_arrival = -1; /**< the latest one. */
+
+	stats->total_reqnb = 0;
+	stats->reads = 0;
+	stats->writes = 0;
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		struct line_statistics_t *line = &ctx->hashlist_stats[i]; /**< the statistics of this line. */
+
+		if (line->reqnb == 0) continue;
+		stats->total_reqnb += line->reqnb;
+		stats->reads += line->reads;
+		stats->writes += line->writes;
+		total_size += line->total_size;
+		if ((first_arrival < 0) || (line->first_arrival < first_arrival)) first_arrival = line->first_arrival;
+		if (line->last_arrival > last_arrival) last_arrival = line->last_arrival;
+	}
+	if (stats->total_reqnb > 0) stats->avg_request_size = total_size / stats->total_reqnb;
+	else stats->avg_request_size = -1;
+	//we can only measure time between requests starting from the second request
+	if (stats->total_reqnb > 1) stats->avg_time_between_requests = (last_arrival - first_arrival) / (stats->total_reqnb - 1);
+	else stats->avg_time_between_requests = -1;
 }
 /**
  * called by reset_all_statistics to reset all local statistics from a queue
@@ -111,22 +154,59 @@ void reset_stats_queue(struct queue_t *queue)
 	queue->stats.avg_agg_size = -1;
 }
 /**
- * function called once in a while to completely reset all statistics (local and global) we have been keeping about the access pattern. Must hold ALL mutexes (this function is called after lock_all_data_structures, so no other locks are necessary). 
+ * function called once in a while to completely reset all statistics (local and global) we have been keeping about the access pattern. No other thread can be using the data structures (this function is called after change_selected_alg, before end_scheduler_switch, so no locks are necessary). 
+ * @param ctx the AGIOS instance.
  */
-void reset_all_statistics(void)
+void reset_all_statistics(struct agios_ctx_t *ctx)
 {
 	struct agios_list_head *list; /**< used to access each line of the hashtable.*/
 	struct file_t *req_file; /**< used to iterate over all files in a line of the hashtable. */
 
-	for (int32_t i=0; i< AGIOS_HASH_ENTRIES; i++) {
-		list = &hashlist[i];
+	for (int32_t i=0; i< ctx->hashtable_size; i++) {
+		list = &ctx->hashlist[i];
 		agios_list_for_each_entry (req_file, list, hashlist) { //goes over all files of this line of the hashtable
 			reset_stats_queue(&req_file->read_queue);
 			reset_stats_queue(&req_file->write_queue);
 		}
 	}
+	//the statistics of evicted files are reset with the others
+	init_queue_statistics(&ctx->evicted_read_stats);
+	init_queue_statistics(&ctx->evicted_write_stats);
 	//reset global statistics as well
-	reset_global_stats();
+	reset_global_stats(ctx);
+}
+/**
+ * combines two averages into the average of all values they were calculated from.
+ * @param avg the first average, -1 if it has no values.
+ * @param nb how many values were used to calculate avg.
+ * @param other_avg the second average, -1 if it has no values.
+ * @param other_nb how many values were used to calculate other_avg.
+ * @return the combined average, -1 if neither has values.
+ */
+static int64_t combine_averages(int64_t avg, int64_t nb, int64_t other_avg, int64_t other_nb)
+{
+	if ((other_avg < 0) || (other_nb <= 0)) return avg;
+	if ((avg < 0) || (nb <= 0)) return other_avg;
+	return (int64_t) ((((double) avg)*nb + ((double) other_avg)*other_nb) / (nb + other_nb)); //we use double because the products may not fit in 64 bits
+}
+/**
+ * adds the statistics of a queue to a total (used to keep the statistics of files that were evicted). Counters are added and averages are weighted by the number of values they were calculated from.
+ * @param total the statistics being accumulated.
+ * @param stats the statistics of the queue.
+ */
+void fold_queue_statistics(struct queue_statistics_t *total, struct queue_statistics_t *stats)
+{
+	//the averages first, because they use the counters before they are added
+	total->avg_req_size = combine_averages(total->avg_req_size, total->receivedreq_nb, stats->avg_req_size, stats->receivedreq_nb);
+	total->avg_time_between_requests = combine_averages(total->avg_time_between_requests, total->receivedreq_nb - 1, stats->avg_time_between_requests, stats->receivedreq_nb - 1);
+	total->avg_distance = combine_averages(total->avg_distance, total->receivedreq_nb - 1, stats->avg_distance, stats->receivedreq_nb - 1);
+	total->processed_bandwidth = combine_averages(total->processed_bandwidth, total->releasedreq_nb, stats->processed_bandwidth, stats->releasedreq_nb);
+	total->avg_agg_size = combine_averages(total->avg_agg_size, total->aggs_no, stats->avg_agg_size, stats->aggs_no);
+	total->processedreq_nb += stats->processedreq_nb;
+	total->receivedreq_nb += stats->receivedreq_nb;
+	total->processed_req_size += stats->processed_req_size;
+	total->releasedreq_nb += stats->releasedreq_nb;
+	total->aggs_no += stats->aggs_no;
 }
 /**
  * updates the local statistics for a queue after an aggregation. The size of the aggregation is not provided because it is already in related->lastaggregation.
@@ -7,16 +7,37 @@
 
 #include "agios_request.h"
 
+/** \struct global_statistics_t
+ *  \brief Statistics about all requests received since the last reset, given by get_global_stats.
+ */
 struct global_statistics_t
 {
 	int64_t total_reqnb; /**< number of received requests. We have a similar counter in consumer.c, but this one can be reset, that one is fixed (never set to 0, counts through the whole execution). */
 	int64_t reads; /**< number of received read requests. */
 	int64_t writes; /**< number of received write requests. */
-	int64_t avg_time_between_requests; /**< iteratively calculated average time between consecutive requests. */
-	int64_t avg_request_size; /**< iteratively calculated average request size. */
+	int64_t avg_time_between_requests; /**< average time between consecutive requests. */
+	int64_t avg_request_size; /**< average request size. */
+};
+
+/** \struct line_statistics_t
+ *  \brief What is kept of the global statistics for the requests to the files of one line of the hashtable. It is protected by the lock of the line (or of its shard of the timeline), and the lines are merged by get_global_stats.
+ */
+struct line_statistics_t
+{
+	int64_t reqnb; /**< number of received requests. */
+	int64_t reads; /**< number of received read requests. */
+	int64_t writes; /**< number of received write requests. */
+	int64_t total_size; /**< sum of the sizes of the received requests. */
+	int64_t first_arrival; /**< the earliest arrival time among the received requests, -1 if there are none. */
+	int64_t last_arrival; /**< the latest arrival time among them. */
 };
 
-void statistics_newreq(struct request_t *req);
-void reset_global_stats(void);
-void reset_all_statistics(void);
+struct agios_ctx_t;
+
+void statistics_newreq(struct agios_ctx_t *ctx, struct request_t *req);
+void statistics_newreqs(struct agios_ctx_t *ctx, struct request_t **reqs, int32_t reqnb);
+void reset_global_stats(struct agios_ctx_t *ctx);
+void get_global_stats(struct agios_ctx_t *ctx, struct global_statistics_t *stats);
+void reset_all_statistics(struct agios_ctx_t *ctx);
 void stats_aggregation(struct queue_t *related);
+void fold_queue_statistics(struct queue_statistics_t *total, struct queue_statistics_t *stats);
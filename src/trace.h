@@ -5,8 +5,10 @@
 
 #include "agios_request.h"
 
-void agios_trace_add_request(struct request_t *req);
-bool init_trace_module(void);
-void cleanup_agios_trace(void);
-void close_agios_trace();
+struct agios_ctx_t;
+
+void agios_trace_add_request(struct agios_ctx_t *ctx, struct request_t *req);
+bool init_trace_module(struct agios_ctx_t *ctx);
+void cleanup_agios_trace(struct agios_ctx_t *ctx);
+void close_agios_trace(struct agios_ctx_t *ctx);
 
@@ -3,8 +3,10 @@
 
     aIOLi and MLF are the scheduling algorithms that try to predict shift phenomena and better aggregations, and then impose waiting times on files to improve the access pattern. Here we have some functions common to both.
  */
+#include <stdint.h>
 
 #include "agios_config.h"
+#include "agios_ctx.h"
 #include "common_functions.h"
 #include "process_request.h"
 #include "scheduling_algorithms.h"
@@ -25,25 +27,27 @@ void update_waiting_time_counters(struct file_t *req_file,
 }
 /**
  * function used to check if a selected request can proceed or if we should impose waiting time for its file.
+ * @param ctx the AGIOS instance.
  * @param req the selected request to be processed.
  * @param req_file the file for this request.
  * @return true or false to proceed with this request
  */ 
-bool check_selection(struct request_t *req, 
+bool check_selection(struct agios_ctx_t *ctx,
+			struct request_t *req, 
 			struct file_t *req_file)
 {
 	/*waiting times are cause by 2 phenomena:*/
 	/*1. shift phenomenon. One of the processes issuing requests to this queue is a little delayed, causing a contiguous request to arrive shortly after the other ones*/
 	if (req->globalinfo->predictedoff != 0) {
 		if (req->offset > req->globalinfo->predictedoff) { //we detected a shift, so we will impose a waiting time for this file
-			req_file->waiting_time = config_waiting_time;
+			req_file->waiting_time = ctx->config.waiting_time;
 		}
 		/*set to 0 to avoid starvation*/
 		req->globalinfo->predictedoff = 0;
 	} 
 	/*2. better aggregation. If we just performed a larger aggregation on this queue, we believe we could do it again*/
 	else if ((req->offset > req->globalinfo->lastfinaloff) && (req->globalinfo->lastaggregation > req->reqnb)) {
-		req_file->waiting_time = config_waiting_time;
+		req_file->waiting_time = ctx->config.waiting_time;
 		/*set to zero to avoid starvation*/
 		req->globalinfo->lastaggregation = 0;
 	}
@@ -54,13 +58,41 @@ bool check_selection(struct request_t *req,
 	return true;
 }
 /**
- * this function is used by MLF and by AIOLI. These two schedulers use a sched_factor that increases as request stays in the scheduler queues.
- * @param the request to be updated.
+ * this function is used by MLF and by AIOLI. These two schedulers use a sched_factor that increases as request stays in the scheduler queues: every time they try to select a request from a queue, the sched_factor of all its requests goes from 0 to 1 or is doubled. Instead of going through the queue to do that, we only count these steps in the queue, and get_sched_factor applies them when the value of a request is needed.
+ * @param queue the queue.
  */
-void increment_sched_factor(struct request_t *req)
+void increment_sched_factors(struct queue_t *queue)
 {
-	if(req->sched_factor == 0) req->sched_factor = 1;
-	else req->sched_factor = req->sched_factor << 1;
+	queue->sched_epoch++;
+}
+/**
+ * gives the current sched_factor of a request (used by MLF and aIOLi), by applying the steps counted by increment_sched_factors since the request's value was last updated. The value is limited to INT32_MAX (a request would need to wait about 30 steps to get there).
+ * @param queue the queue where the request is.
+ * @param req the request.
+ * @return the sched_factor.
+ */
+int32_t get_sched_factor(struct queue_t *queue, struct request_t *req)
+{
+	uint32_t steps = queue->sched_epoch - req->sched_epoch; /**< how many times it should have been incremented */
+	int32_t sched_factor = req->sched_factor;
+
+	if (steps == 0) return sched_factor;
+	if (sched_factor == 0) { //the first step takes it to 1, the other ones double it
+		sched_factor = 1;
+		steps--;
+	}
+	if ((steps >= 31) || (sched_factor > (INT32_MAX >> steps))) return INT32_MAX;
+	return sched_factor << steps;
+}
+/**
+ * stores the current sched_factor of a request in it (@see get_sched_factor). It is used before the value is changed by other means (for aggregations).
+ * @param queue the queue where the request is.
+ * @param req the request.
+ */
+void update_sched_factor(struct queue_t *queue, struct request_t *req)
+{
+	req->sched_factor = get_sched_factor(queue, req);
+	req->sched_epoch = queue->sched_epoch;
 }
 /**
  * post process function for scheduling algorithms which use waiting times (AIOLI and MLF).
@@ -78,10 +110,11 @@ void waiting_algorithms_postprocess(struct request_t *req)
 }
 /**
  * used by aIOLi and MLF to call step2 for a list of processing_info_t structures filled by multiple calls to process_requests_step1.
+ * @param ctx the AGIOS instance.
  * @param info_list a list of filled processing_info_t structs. It will be empty (and all elements freed) after the call.
  * @return true if any of the calls to process_requests_step2 returned true, false otherwise.
  */ 
-bool call_step2_for_info_list(struct agios_list_head *info_list)
+bool call_step2_for_info_list(struct agios_ctx_t *ctx, struct agios_list_head *info_list)
 {
 	struct processing_info_t *info; /**< used to iterate over the list */
 	struct processing_info_t *aux = NULL; /**< used to avoid freeing an info struct before iterating to the next element otherwise we will crash the loop. */
@@ -89,13 +122,13 @@ bool call_step2_for_info_list(struct agios_list_head *info_list)
 	agios_list_for_each_entry (info, info_list, list) {
 		if (aux) {
 			agios_list_del(&aux->list);
-			ret = ret || process_requests_step2(aux);
+			if (process_requests_step2(ctx, aux)) ret = true; //step2 must be called for all of them, even after one returned true, otherwise these requests are lost
 		}
 		aux = info;
 	}
 	if (aux) {
 		agios_list_del(&aux->list);
-		ret = ret || process_requests_step2(aux);
+		if (process_requests_step2(ctx, aux)) ret = true;
 	}
 	return ret; 
 }
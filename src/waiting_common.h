@@ -5,10 +5,15 @@
 #pragma once
 #include "agios_request.h"
 
+struct agios_ctx_t;
+
 void update_waiting_time_counters(struct file_t *req_file, 
 					int32_t *shortest_waiting_time);
-bool check_selection(struct request_t *req, 
+bool check_selection(struct agios_ctx_t *ctx,
+			struct request_t *req, 
 			struct file_t *req_file);
-void increment_sched_factor(struct request_t *req);
+void increment_sched_factors(struct queue_t *queue);
+int32_t get_sched_factor(struct queue_t *queue, struct request_t *req);
+void update_sched_factor(struct queue_t *queue, struct request_t *req);
 void waiting_algorithms_postprocess(struct request_t *req);
-bool call_step2_for_info_list(struct agios_list_head *info_list);
+bool call_step2_for_info_list(struct agios_ctx_t *ctx, struct agios_list_head *info_list);
@@ -0,0 +1,301 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <agios.h>
+
+/* Measures the cost of adding requests to AGIOS. Submitting threads give requests to AGIOS as fast as they can, and requests are released in the callback, so what is measured is the overhead of the library itself.
+ * Modes:
+ *  single - each request is added with agios_add_request_with_handle and released with agios_release_request_by_handle
+ *  batch - requests are added in vectors of <batch size> with agios_add_requests, and the ones given together to the callback are released with agios_release_requests
+ *  dispatch - as batch, but the ones given together to the callback are released with agios_release_request_batch
+ *  key - as single, but files are registered with agios_register_file before the measurement and requests are added with agios_add_request_by_key
+ *  pull - as single, but AGIOS is started with agios_init_pull_mode and <number of threads> worker threads take the requests with agios_next_requests (instead of callbacks) and release them with agios_release_requests
+ *  ctx - as single, but two AGIOS instances are started with agios_init_ctx, and each thread adds its requests to one of them with agios_add_request_with_handle_ctx
+ */
+
+enum {
+	MODE_SINGLE = 0,
+	MODE_BATCH = 1,
+	MODE_DISPATCH = 2,
+	MODE_KEY = 3,
+	MODE_PULL = 4,
+	MODE_CTX = 5,
+};
+
+int32_t g_mode; /**< which way of adding requests is being measured */
+int32_t g_thread_nb; /**< number of submitting threads */
+int32_t g_file_nb; /**< number of files accessed by the requests */
+int32_t g_reqnb_perthread; /**< number of requests generated by each thread */
+int32_t g_batch_size; /**< number of requests given at once to agios_add_requests */
+int32_t g_generated_reqnb; /**< the total number of generated requests */
+int32_t *g_file_keys; /**< the keys given by agios_register_file to each file, used in the key mode */
+agios_ctx_t *g_ctxs[2]; /**< the two AGIOS instances used in the ctx mode */
+
+struct agios_request_info_t *g_requests; /**< ALL requests generated in this benchmark */
+agios_request_handle_t *g_handles; /**< the handles of the requests, used to release them */
+
+int32_t g_processed_reqnb=0; /**< the number of requests already processed and released from agios */
+pthread_mutex_t g_processed_reqnb_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_processed_reqnb_cond=PTHREAD_COND_INITIALIZER;
+pthread_barrier_t g_start;
+
+int64_t get_elapsed(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_nsec - start->tv_nsec) + ((end->tv_sec - start->tv_sec)*1000000000L);
+}
+void inc_processed_reqnb(int32_t value)
+{
+	pthread_mutex_lock(&g_processed_reqnb_mutex);
+	g_processed_reqnb += value;
+	if (g_processed_reqnb >= g_generated_reqnb) pthread_cond_signal(&g_processed_reqnb_cond);
+	pthread_mutex_unlock(&g_processed_reqnb_mutex);
+}
+/**
+ * in the ctx mode, gives the AGIOS instance to which a request was added (threads with even indexes use the first one)
+ */
+agios_ctx_t *get_ctx_of_request(int64_t req_id)
+{
+	return g_ctxs[(req_id / g_reqnb_perthread) % 2];
+}
+void * bench_process(int64_t req_id)
+{
+	bool released;
+
+	if (g_mode == MODE_CTX) released = agios_release_request_by_handle_ctx(get_ctx_of_request(req_id), g_handles[req_id]);
+	else released = agios_release_request_by_handle(g_handles[req_id]);
+	if (!released) printf("PANIC! release request failed!\n");
+	inc_processed_reqnb(1);
+	return 0;
+}
+void * bench_process_list(int64_t *reqs, int32_t reqnb)
+{
+	if (g_mode == MODE_CTX) {
+		for (int32_t i = 0; i < reqnb; i++) {
+			if (!agios_release_request_by_handle_ctx(get_ctx_of_request(reqs[i]), g_handles[reqs[i]])) printf("PANIC! release request failed!\n");
+		}
+	} else if ((g_mode == MODE_SINGLE) || (g_mode == MODE_KEY)) {
+		for (int32_t i = 0; i < reqnb; i++) {
+			if (!agios_release_request_by_handle(g_handles[reqs[i]])) printf("PANIC! release request failed!\n");
+		}
+	} else if (g_mode == MODE_BATCH) {
+		agios_request_handle_t handles[reqnb];
+		for (int32_t i = 0; i < reqnb; i++) handles[i] = g_handles[reqs[i]];
+		if (!agios_release_requests(handles, reqnb)) printf("PANIC! release requests failed!\n");
+	} else {
+		if (!agios_release_request_batch(g_handles[reqs[0]])) printf("PANIC! release request batch failed!\n");
+	}
+	inc_processed_reqnb(reqnb);
+	return 0;
+}
+/**
+ * worker thread used in the pull mode, it takes requests from AGIOS and releases them until all requests were processed
+ */
+void *worker_thr(void *arg)
+{
+	int64_t reqs[64];
+	agios_request_handle_t handles[64];
+	int32_t reqnb;
+	bool done = false;
+
+	while (!done) {
+		reqnb = agios_next_requests(reqs, 64, 1000000);
+		if (reqnb < 0) break;
+		if (reqnb > 0) {
+			for (int32_t i = 0; i < reqnb; i++) handles[i] = g_handles[reqs[i]];
+			if (!agios_release_requests(handles, reqnb)) printf("PANIC! release requests failed!\n");
+			inc_processed_reqnb(reqnb);
+		}
+		pthread_mutex_lock(&g_processed_reqnb_mutex);
+		done = (g_processed_reqnb >= g_generated_reqnb);
+		pthread_mutex_unlock(&g_processed_reqnb_mutex);
+	}
+	return 0;
+}
+/**
+ * thread that submits its share of the requests to AGIOS
+ */
+void *bench_thr(void *arg)
+{
+	int32_t index = *((int32_t *) arg);
+	int32_t start_i = index * g_reqnb_perthread;
+	int32_t end_i = start_i + g_reqnb_perthread;
+
+	pthread_barrier_wait(&g_start);
+	if ((g_mode == MODE_SINGLE) || (g_mode == MODE_PULL)) {
+		for (int32_t i = start_i; i < end_i; i++) {
+			if (!agios_add_request_with_handle(g_requests[i].file_id, g_requests[i].type, g_requests[i].offset, g_requests[i].len, g_requests[i].identifier, g_requests[i].queue_id, &g_handles[i]))
+				printf("PANIC! agios_add_request failed!\n");
+		}
+	} else if (g_mode == MODE_CTX) {
+		for (int32_t i = start_i; i < end_i; i++) {
+			if (!agios_add_request_with_handle_ctx(g_ctxs[index % 2], g_requests[i].file_id, g_requests[i].type, g_requests[i].offset, g_requests[i].len, g_requests[i].identifier, g_requests[i].queue_id, &g_handles[i]))
+				printf("PANIC! agios_add_request_with_handle_ctx failed!\n");
+		}
+	} else if (g_mode == MODE_KEY) {
+		for (int32_t i = start_i; i < end_i; i++) {
+			if (!agios_add_request_by_key(g_requests[i].file_key, g_requests[i].type, g_requests[i].offset, g_requests[i].len, g_requests[i].identifier, g_requests[i].queue_id, &g_handles[i]))
+				printf("PANIC! agios_add_request_by_key failed!\n");
+		}
+	} else {
+		for (int32_t i = start_i; i < end_i; i += g_batch_size) {
+			int32_t this_batch = (end_i - i < g_batch_size) ? (end_i - i) : g_batch_size;
+			if (!agios_add_requests(&g_requests[i], this_batch, &g_handles[i])) printf("PANIC! agios_add_requests failed!\n");
+		}
+	}
+	return 0;
+}
+/**
+ * reads the arguments given to the program and generates the requests. Each thread accesses sequentially its own region of the files, changing files every 16 requests.
+ */
+void retrieve_arguments_and_generate_requests(int argc, char **argv)
+{
+	if (argc < 6) {
+		printf("Usage: %s <single|batch|dispatch|key|pull|ctx> <number of threads> <number of files> <number of requests per thread> <batch size>\n", argv[0]);
+		exit(1);
+	}
+	if (strcmp(argv[1], "single") == 0) g_mode = MODE_SINGLE;
+	else if (strcmp(argv[1], "batch") == 0) g_mode = MODE_BATCH;
+	else if (strcmp(argv[1], "dispatch") == 0) g_mode = MODE_DISPATCH;
+	else if (strcmp(argv[1], "key") == 0) g_mode = MODE_KEY;
+	else if (strcmp(argv[1], "pull") == 0) g_mode = MODE_PULL;
+	else if (strcmp(argv[1], "ctx") == 0) g_mode = MODE_CTX;
+	else {
+		printf("Unknown mode %s\n", argv[1]);
+		exit(1);
+	}
+	g_thread_nb = atoi(argv[2]);
+	assert(g_thread_nb > 0);
+	g_file_nb = atoi(argv[3]);
+	assert(g_file_nb > 0);
+	g_reqnb_perthread = atoi(argv[4]);
+	assert(g_reqnb_perthread > 0);
+	g_batch_size = atoi(argv[5]);
+	assert(g_batch_size > 0);
+	g_generated_reqnb = g_thread_nb * g_reqnb_perthread;
+	g_requests = malloc(sizeof(struct agios_request_info_t)*g_generated_reqnb);
+	g_handles = malloc(sizeof(agios_request_handle_t)*g_generated_reqnb);
+	if ((!g_requests) || (!g_handles)) {
+		printf("Could not allocate memory\n");
+		exit(1);
+	}
+	for (int32_t i = 0; i < g_generated_reqnb; i++) {
+		int32_t this_thread = i / g_reqnb_perthread;
+		g_requests[i].file_id = malloc(32);
+		sprintf(g_requests[i].file_id, "arquivo.%d.out", (this_thread + i/16) % g_file_nb);
+		g_requests[i].file_key = -1;
+		g_requests[i].type = i % 2;
+		g_requests[i].len = 4096;
+		g_requests[i].offset = (int64_t) i * 4096;
+		g_requests[i].identifier = i;
+		g_requests[i].queue_id = 0;
+	}
+}
+int main(int argc, char **argv)
+{
+	pthread_t *threads;
+	pthread_t *workers = NULL;
+	int32_t *thread_index;
+	struct timespec start_time, submitted_time, end_time;
+
+	if (!getenv("AGIOS_CONF")) {
+		fprintf(stderr, "The environment variable AGIOS_CONF was not found.\n");
+		exit(1);
+	}
+	retrieve_arguments_and_generate_requests(argc, argv);
+	if (g_mode == MODE_PULL) {
+		if (!agios_init_pull_mode(getenv("AGIOS_CONF"), 1)) {
+			printf("PANIC! Could not initialize AGIOS!\n");
+			exit(1);
+		}
+		workers = malloc(sizeof(pthread_t)*g_thread_nb);
+		if (!workers) {
+			printf("PANIC! Could not allocate memory\n");
+			exit(1);
+		}
+		for (int32_t i = 0; i < g_thread_nb; i++) {
+			if (pthread_create(&workers[i], NULL, worker_thr, NULL) != 0) {
+				printf("PANIC! Unable to create worker thread %d!\n", i);
+				exit(1);
+			}
+		}
+	} else if (g_mode == MODE_CTX) {
+		for (int32_t i = 0; i < 2; i++) {
+			g_ctxs[i] = agios_init_ctx(bench_process, bench_process_list, getenv("AGIOS_CONF"), 1);
+			if (!g_ctxs[i]) {
+				printf("PANIC! Could not initialize AGIOS instance %d!\n", i);
+				exit(1);
+			}
+		}
+	} else if (!agios_init(bench_process, bench_process_list, getenv("AGIOS_CONF"), 1)) {
+		printf("PANIC! Could not initialize AGIOS!\n");
+		exit(1);
+	}
+	if (g_mode == MODE_KEY) { //register all files, the requests will then use their keys
+		char file_id[32];
+		usleep(200000); //give the agios thread time to select the scheduling algorithm, calls made before that will wait for it
+		g_file_keys = malloc(sizeof(int32_t)*g_file_nb);
+		if (!g_file_keys) {
+			printf("PANIC! Could not allocate memory\n");
+			exit(1);
+		}
+		for (int32_t i = 0; i < g_file_nb; i++) {
+			sprintf(file_id, "arquivo.%d.out", i);
+			g_file_keys[i] = agios_register_file(file_id);
+			if (g_file_keys[i] < 0) {
+				printf("PANIC! Could not register file %s\n", file_id);
+				exit(1);
+			}
+		}
+		for (int32_t i = 0; i < g_generated_reqnb; i++) g_requests[i].file_key = g_file_keys[atoi(g_requests[i].file_id + strlen("arquivo."))];
+	}
+	threads = malloc(sizeof(pthread_t)*g_thread_nb);
+	thread_index = malloc(sizeof(int32_t)*g_thread_nb);
+	if ((!threads) || (!thread_index)) {
+		printf("PANIC! Could not allocate memory\n");
+		exit(1);
+	}
+	pthread_barrier_init(&g_start, NULL, g_thread_nb+1);
+	for (int32_t i = 0; i < g_thread_nb; i++) {
+		thread_index[i] = i;
+		if (pthread_create(&threads[i], NULL, bench_thr, &thread_index[i]) != 0) {
+			printf("PANIC! Unable to create thread %d!\n", i);
+			exit(1);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	pthread_barrier_wait(&g_start);
+	for (int32_t i = 0; i < g_thread_nb; i++) pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &submitted_time);
+	pthread_mutex_lock(&g_processed_reqnb_mutex);
+	while (g_processed_reqnb < g_generated_reqnb) pthread_cond_wait(&g_processed_reqnb_cond, &g_processed_reqnb_mutex);
+	pthread_mutex_unlock(&g_processed_reqnb_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	printf("%s: %d threads submitted %d requests in %ldns (%f requests/s), all of them were processed and released after %ldns\n",
+		argv[1],
+		g_thread_nb,
+		g_generated_reqnb,
+		get_elapsed(&start_time, &submitted_time),
+		((double) g_generated_reqnb / (double) get_elapsed(&start_time, &submitted_time))*1000000000L,
+		get_elapsed(&start_time, &end_time));
+	if (workers) {
+		for (int32_t i = 0; i < g_thread_nb; i++) pthread_join(workers[i], NULL);
+		free(workers);
+	}
+	if (g_mode == MODE_CTX) {
+		agios_exit_ctx(g_ctxs[0]);
+		agios_exit_ctx(g_ctxs[1]);
+	} else agios_exit();
+	for (int32_t i = 0; i < g_generated_reqnb; i++) free(g_requests[i].file_id);
+	free(g_requests);
+	free(g_handles);
+	if (g_file_keys) free(g_file_keys);
+	free(threads);
+	free(thread_index);
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agios.h"
+#include "agios_add_request.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "file_registry.h"
+#include "mem_pool.h"
+#include "mylist.h"
+#include "test_common.h"
+
+/* Checks that, with deferred_add, new requests are added by the AGIOS thread and their handles can be used safely, with a scheduling algorithm that uses the hashtable (SJF) and one that uses the timeline (TO).
+ * First a batch of requests, one for each file, is given to agios_add_requests_ctx, so the AGIOS thread adds them together (@see process_deferred_adds). While they are being processed, the callback adds more requests, which must be added between two steps of the scheduling algorithm (@see process_requests_step2) before the last request of the batch reaches the callback. Each request must be given to the callback once, and after all of them are released by their handles each file must have counted one release.
+ * Then the AGIOS thread is replaced by one that does nothing, and requests that are still waiting in the queue of deferred additions must be rejected by the functions that receive handles. Once they are added, one of them is cancelled by its handle. At last, requests left in the queue must be freed by discard_deferred_adds (they go back to the pool of requests), and agios_exit_ctx is called with one more request left there.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define BATCH_NB 64 /**< the requests of the first batch, one for each file */
+#define DRAIN_NB 4 /**< the requests added by the callback */
+#define PENDING_NB 4 /**< the requests added while the AGIOS thread does nothing */
+#define MAX_REQNB (BATCH_NB + DRAIN_NB) /**< the requests that are given to the callback */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+const char *g_algorithms[] = {"SJF", "TO"}; /**< the scheduling algorithms being tested */
+agios_ctx_t *g_ctx; /**< the AGIOS instance */
+agios_request_handle_t g_handles[MAX_REQNB]; /**< the handles of the requests given to the callback */
+int32_t g_keys[MAX_REQNB]; /**< the key of the file of each request given to the callback */
+atomic_int g_processed[MAX_REQNB]; /**< how many times each request was given to the callback */
+atomic_int g_processed_nb; /**< how many times the callback was called for a request */
+atomic_int g_batch_processed_nb; /**< how many requests of the first batch were given to the callback */
+atomic_bool g_drained; /**< were the requests added by the callback added before the last request of the first batch reached it? */
+int32_t g_errors; /**< how many errors were found */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+/**
+ * counts a request given to the callback. When the first request of the batch arrives, the DRAIN_NB requests are added (we are in the AGIOS thread, in the middle of the scheduling algorithm). When the last one arrives, these requests must have been added already.
+ * @param req_id the identifier of the request.
+ */
+void count_request(int64_t req_id)
+{
+	char file_id[64];
+
+	atomic_fetch_add(&g_processed[req_id], 1);
+	if (req_id < BATCH_NB) {
+		int32_t batch_processed_nb = atomic_fetch_add(&g_batch_processed_nb, 1) + 1;
+
+		if (batch_processed_nb == 1) {
+			for (int32_t i = BATCH_NB; i < MAX_REQNB; i++) {
+				sprintf(file_id, "file.%d", i);
+				if (!agios_add_request_with_handle_ctx(g_ctx, file_id, RT_READ, 0, REQ_SIZE, i, 0, &g_handles[i])) report_error("could not add request %d", i);
+			}
+		} else if (batch_processed_nb == BATCH_NB) {
+			bool drained = true;
+
+			for (int32_t i = BATCH_NB; i < MAX_REQNB; i++) drained = drained && request_is_added(g_handles[i]);
+			atomic_store(&g_drained, drained);
+		}
+	}
+	atomic_fetch_add(&g_processed_nb, 1);
+}
+void * test_process(int64_t req_id)
+{
+	count_request(req_id);
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) count_request(reqs[i]);
+	return 0;
+}
+/**
+ * waits until a number of requests were given to the callback, for at most 10 seconds.
+ * @param reqnb the number of requests.
+ * @return true if they were.
+ */
+bool wait_processed(int32_t reqnb)
+{
+	for (int32_t i = 0; i < 10000; i++) {
+		if (atomic_load(&g_processed_nb) >= reqnb) return true;
+		usleep(1000);
+	}
+	return false;
+}
+/**
+ * checks that the request to a file was released once: the dispatch queue is empty and the queue counted one release.
+ * @param key the key of the file.
+ */
+void check_released(int32_t key)
+{
+	struct file_t *req_file = get_registered_file(g_ctx, key);
+
+	if (!req_file) {
+		report_error("the file with key %d is not registered", key);
+		return;
+	}
+	if (!agios_list_empty(&req_file->read_queue.dispatch)) report_error("there are requests to %s left in the dispatch queue", req_file->file_id);
+	if (req_file->read_queue.stats.releasedreq_nb != 1) report_error("%ld requests to %s were released, but one was added", req_file->read_queue.stats.releasedreq_nb, req_file->file_id);
+}
+/**
+ * checks that requests went back to the pool of requests: they are the most recently freed objects, so mem_pool_alloc must give them back before the objects this thread gave to the shared pool since then (at most 2*MEM_POOL_CACHE_BATCH).
+ * @param reqs the requests.
+ * @param reqnb the number of requests.
+ * @return how many of them were found.
+ */
+int32_t count_freed_requests(agios_request_handle_t *reqs, int32_t reqnb)
+{
+	void *objects[2*MEM_POOL_CACHE_BATCH + PENDING_NB];
+	int32_t objectnb;
+	int32_t found = 0;
+
+	for (objectnb = 0; (objectnb < 2*MEM_POOL_CACHE_BATCH + reqnb) && (found < reqnb); objectnb++) {
+		objects[objectnb] = mem_pool_alloc(REQUEST_POOL);
+		for (int32_t i = 0; i < reqnb; i++) {
+			if (objects[objectnb] == reqs[i]) found++;
+		}
+	}
+	for (int32_t i = objectnb-1; i >= 0; i--) {
+		if (objects[i]) mem_pool_free(REQUEST_POOL, objects[i]);
+	}
+	return found;
+}
+/**
+ * runs the test for one scheduling algorithm.
+ * @param algorithm the scheduling algorithm.
+ * @return true if there were no errors.
+ */
+bool run(const char *algorithm)
+{
+	struct agios_request_info_t reqs[BATCH_NB];
+	agios_request_handle_t pending[PENDING_NB];
+	agios_request_handle_t last_pending;
+	char file_ids[BATCH_NB][64];
+	char file_id[64];
+	int32_t errors = g_errors;
+
+	for (int32_t i = 0; i < MAX_REQNB; i++) atomic_init(&g_processed[i], 0);
+	atomic_init(&g_processed_nb, 0);
+	atomic_init(&g_batch_processed_nb, 0);
+	atomic_init(&g_drained, false);
+	g_ctx = start_test_ctx(algorithm, test_process, test_process_list, 0, "deferred_add = true ;\n");
+	if (!g_ctx) return false;
+	//the files are registered only so we can find their structures to check them, the requests are added by file handle
+	for (int32_t i = 0; i < MAX_REQNB; i++) {
+		sprintf(file_id, "file.%d", i);
+		g_keys[i] = agios_register_file_ctx(g_ctx, file_id);
+		if (g_keys[i] < 0) {
+			printf("agios_register_file_ctx failed!\n");
+			return false;
+		}
+	}
+	//the first batch, all deferred together
+	for (int32_t i = 0; i < BATCH_NB; i++) {
+		sprintf(file_ids[i], "file.%d", i);
+		reqs[i].file_id = file_ids[i];
+		reqs[i].file_key = -1;
+		reqs[i].type = RT_READ;
+		reqs[i].offset = 0;
+		reqs[i].len = REQ_SIZE;
+		reqs[i].identifier = i;
+		reqs[i].queue_id = 0;
+	}
+	if (!agios_add_requests_ctx(g_ctx, reqs, BATCH_NB, g_handles)) report_error("could not add the first batch");
+	if (!wait_processed(MAX_REQNB)) report_error("only %d of %d requests were given to the callback", atomic_load(&g_processed_nb), MAX_REQNB);
+	if (!atomic_load(&g_drained)) report_error("the requests added by the callback were not added between two steps of %s", algorithm);
+	for (int32_t i = 0; i < MAX_REQNB; i++) {
+		if (atomic_load(&g_processed[i]) != 1) report_error("request %d was given to the callback %d times", i, atomic_load(&g_processed[i]));
+	}
+	if (!agios_release_requests_ctx(g_ctx, g_handles, MAX_REQNB)) report_error("agios_release_requests_ctx failed");
+	for (int32_t i = 0; i < MAX_REQNB; i++) check_released(g_keys[i]);
+	//from now on nothing is added unless we do it
+	if (!replace_agios_thread(g_ctx, NULL)) return false;
+	for (int32_t i = 0; i < PENDING_NB; i++) {
+		if (!agios_add_request_with_handle_ctx(g_ctx, "pending", RT_WRITE, i*2*REQ_SIZE, REQ_SIZE, i, 0, &pending[i])) report_error("could not add pending request %d", i);
+	}
+	if (!has_deferred_adds(g_ctx)) report_error("the pending requests are not in the queue of deferred additions");
+	if (get_current_reqnb(g_ctx) != 0) report_error("there are %d requests in the data structures, but all were released", get_current_reqnb(g_ctx));
+	if (agios_cancel_request_by_handle_ctx(g_ctx, pending[0])) report_error("a request waiting to be added was cancelled");
+	if (agios_release_request_by_handle_ctx(g_ctx, pending[1])) report_error("a request waiting to be added was released");
+	if (agios_release_requests_ctx(g_ctx, pending, PENDING_NB)) report_error("requests waiting to be added were released together");
+	if (agios_release_request_batch_ctx(g_ctx, pending[2])) report_error("a request waiting to be added was released with its batch");
+	process_deferred_adds(g_ctx);
+	for (int32_t i = 0; i < PENDING_NB; i++) {
+		if (!request_is_added(pending[i])) report_error("pending request %d was not added", i);
+	}
+	if (get_current_reqnb(g_ctx) != PENDING_NB) report_error("there are %d requests in the data structures, but %d were added", get_current_reqnb(g_ctx), PENDING_NB);
+	if (!agios_cancel_request_by_handle_ctx(g_ctx, pending[0])) report_error("could not cancel a request that was added");
+	if (get_current_reqnb(g_ctx) != PENDING_NB-1) report_error("there are %d requests in the data structures after cancelling one of %d", get_current_reqnb(g_ctx), PENDING_NB);
+	//requests left in the queue go back to the pool of requests, as agios_exit_ctx does after the AGIOS thread ends
+	for (int32_t i = 0; i < PENDING_NB; i++) {
+		if (!agios_add_request_with_handle_ctx(g_ctx, "pending", RT_READ, i*2*REQ_SIZE, REQ_SIZE, i, 0, &pending[i])) report_error("could not add pending request %d", i);
+	}
+	discard_deferred_adds(g_ctx);
+	if (has_deferred_adds(g_ctx)) report_error("requests were left in the queue of deferred additions");
+	if (count_freed_requests(pending, PENDING_NB) != PENDING_NB) report_error("the requests left in the queue of deferred additions were not freed");
+	//and agios_exit_ctx has to do it with one more
+	if (!agios_add_request_with_handle_ctx(g_ctx, "pending", RT_READ, 0, REQ_SIZE, 0, 0, &last_pending)) report_error("could not add the last pending request");
+	agios_exit_ctx(g_ctx);
+	if (g_errors > errors) return false;
+	printf("PASSED: with %s, %d deferred requests were added by the AGIOS thread (%d of them between two steps of the scheduling algorithm), given to the callback and released once, and requests waiting to be added were rejected by their handles and freed\n", algorithm, MAX_REQNB, DRAIN_NB);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	bool ret = true;
+
+	for (int32_t i = 0; i < 2; i++) ret = run(g_algorithms[i]) && ret;
+	return ret ? 0 : -1;
+}
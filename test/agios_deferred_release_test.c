@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "agios.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "agios_release_request.h"
+#include "agios_request.h"
+#include "file_registry.h"
+#include "mylist.h"
+#include "test_common.h"
+
+/* Checks that, with deferred_release, completions of dispatched requests that have the same file, type, size and offset release each of these requests once.
+ * AGIOS is started with NOOP, then its thread is replaced by one that does nothing, so this program decides when requests are dispatched and when deferred releases are processed. Pairs of identical requests are added and dispatched, then released by lookup (file handle and by key), and by lookup and handle mixed, and the completions of all of them are processed together by process_deferred_releases. Each request must have been released once, and no request may be left in the dispatch queues.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define MAX_REQNB 16 /**< the most requests this test adds */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance */
+int32_t g_processed[MAX_REQNB]; /**< how many times each request was given to the callback */
+int32_t g_errors; /**< how many errors were found */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+void * test_process(int64_t req_id)
+{
+	g_processed[req_id]++;
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) g_processed[reqs[i]]++;
+	return 0;
+}
+/**
+ * checks that all requests to a file were released once: the dispatch queue is empty and the queue counted one release for each request.
+ * @param key the key of the file.
+ * @param name the name of the file, for the messages.
+ * @param type RT_READ or RT_WRITE.
+ * @param reqnb how many requests were added to the file with that type.
+ */
+void check_released(int32_t key, const char *name, int32_t type, int64_t reqnb)
+{
+	struct file_t *req_file = get_registered_file(g_ctx, key);
+	struct queue_t *queue;
+
+	if (!req_file) {
+		report_error("the file %s is not registered", name);
+		return;
+	}
+	queue = (type == RT_READ) ? &req_file->read_queue : &req_file->write_queue;
+	if (!agios_list_empty(&queue->dispatch)) report_error("there are requests to %s left in the dispatch queue", name);
+	if (queue->stats.releasedreq_nb != reqnb) report_error("%ld requests to %s were released, but %ld were added", queue->stats.releasedreq_nb, name, reqnb);
+	if (queue->stats.processedreq_nb != reqnb) report_error("%ld requests to %s were cleaned up, but %ld were added", queue->stats.processedreq_nb, name, reqnb);
+}
+
+int main(int argc, char **argv)
+{
+	agios_request_handle_t handles[MAX_REQNB];
+	int32_t reqnb = 0;
+	int32_t lookup_key; /**< requests released with agios_release_request */
+	int32_t by_key_key; /**< requests released with agios_release_request_by_key */
+	int32_t mixed_key; /**< requests released by handle and by lookup */
+
+	g_ctx = start_test_ctx("NOOP", test_process, test_process_list, 0, "deferred_release = true ;\n");
+	if ((!g_ctx) || (!replace_agios_thread(g_ctx, NULL))) return -1;
+	if (g_ctx->current_alg != NOOP_SCHEDULER) {
+		printf("FAIL: AGIOS started with %s instead of NOOP\n", g_ctx->current_scheduler->name);
+		return -1;
+	}
+	//the files are registered only so we can find their structures to check them
+	lookup_key = agios_register_file_ctx(g_ctx, "lookup");
+	by_key_key = agios_register_file_ctx(g_ctx, "by_key");
+	mixed_key = agios_register_file_ctx(g_ctx, "mixed");
+	if ((lookup_key < 0) || (by_key_key < 0) || (mixed_key < 0)) {
+		printf("agios_register_file_ctx failed!\n");
+		return -1;
+	}
+	//two identical reads and a third one to "lookup", two identical writes to "by_key", two identical reads to "mixed"
+	for (int32_t i = 0; i < 3; i++, reqnb++) {
+		if (!agios_add_request_with_handle_ctx(g_ctx, "lookup", RT_READ, (i / 2)*REQ_SIZE, REQ_SIZE, reqnb, 0, &handles[reqnb])) report_error("could not add request %d", reqnb);
+	}
+	for (int32_t i = 0; i < 2; i++, reqnb++) {
+		if (!agios_add_request_by_key_ctx(g_ctx, by_key_key, RT_WRITE, 0, REQ_SIZE, reqnb, 0, &handles[reqnb])) report_error("could not add request %d", reqnb);
+	}
+	for (int32_t i = 0; i < 2; i++, reqnb++) {
+		if (!agios_add_request_with_handle_ctx(g_ctx, "mixed", RT_READ, 0, REQ_SIZE, reqnb, 0, &handles[reqnb])) report_error("could not add request %d", reqnb);
+	}
+	//dispatch them all
+	while (get_current_reqnb(g_ctx) > 0) g_ctx->current_scheduler->schedule(g_ctx);
+	for (int32_t i = 0; i < reqnb; i++) {
+		if (g_processed[i] != 1) report_error("request %d was given to the callback %d times", i, g_processed[i]);
+	}
+	//release them, the identical ones with the same arguments
+	agios_release_request_ctx(g_ctx, "lookup", RT_READ, REQ_SIZE, 0);
+	agios_release_request_ctx(g_ctx, "lookup", RT_READ, REQ_SIZE, 0);
+	agios_release_request_ctx(g_ctx, "lookup", RT_READ, REQ_SIZE, REQ_SIZE);
+	agios_release_request_ctx(g_ctx, "lookup", RT_READ, REQ_SIZE, 0); //there is no third one, nothing must happen
+	agios_release_request_by_key_ctx(g_ctx, by_key_key, RT_WRITE, REQ_SIZE, 0);
+	agios_release_request_by_key_ctx(g_ctx, by_key_key, RT_WRITE, REQ_SIZE, 0);
+	//the lookup comes first, but it must not take the request given by its handle
+	agios_release_request_ctx(g_ctx, "mixed", RT_READ, REQ_SIZE, 0);
+	agios_release_request_by_handle_ctx(g_ctx, handles[reqnb - 2]);
+	//all completions are processed together
+	process_deferred_releases(g_ctx);
+	if (has_deferred_releases(g_ctx)) report_error("completions were left in the queue of deferred releases");
+	check_released(lookup_key, "lookup", RT_READ, 3);
+	check_released(by_key_key, "by_key", RT_WRITE, 2);
+	check_released(mixed_key, "mixed", RT_READ, 2);
+	agios_exit_ctx(g_ctx);
+	if (g_errors) return -1;
+	printf("PASSED: %d dispatched requests, in pairs with the same file, type, size and offset, were each released once by deferred releases\n", reqnb);
+	return 0;
+}
@@ -0,0 +1,306 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "agios.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "file_eviction.h"
+#include "hash.h"
+#include "req_hashtable.h"
+#include "scheduling_algorithms.h"
+#include "test_common.h"
+
+/* Checks the eviction of idle file structures (see evict_idle_files in file_eviction.c).
+ * AGIOS is started, then its thread is replaced by one that does nothing, so this program decides when requests are processed and when evict_idle_files is called. Files are chosen so they all go to the same line of the hashtable. For each scheduling algorithm (one that uses the hashtable and one that uses the timeline):
+ * - LRU: with max_idle_files equal to the number of lines, a line keeps one idle file. Three files become idle one after the other, and only the last one must be kept. Files with queued requests, with dispatched requests (not released yet, even after another one to the same file was released) or registered with agios_register_file must not be evicted, until they become idle (then they are evicted in the order they became idle, except the registered one, never). The statistics of the evicted files must be added to evicted_read_stats and evicted_write_stats. An evicted file must be able to receive requests again, with a new structure.
+ * - TTL: with idle_file_timeout, an idle file must be kept until the timeout, and evicted after it. With keep_evicted_file_stats = false, its statistics must not be kept.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define TIMEOUT 100 /**< idle_file_timeout in the TTL test (in ms) */
+#define MAX_REQNB 64 /**< the most requests added by a test */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+//the files of the LRU test
+#define IDLE1 0 /**< the first to become idle */
+#define IDLE2 1 /**< the second to become idle */
+#define IDLE3 2 /**< the third to become idle */
+#define QUEUED 3 /**< it has a queued request */
+#define DISPATCHED 4 /**< it has a dispatched request */
+#define REGISTERED 5 /**< it was registered */
+#define LRU_FILE_NB 6 /**< how many */
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance */
+char g_file_ids[LRU_FILE_NB][64]; /**< the files, all in the same line of the hashtable */
+agios_request_handle_t g_handles[MAX_REQNB]; /**< the handles of the requests */
+int32_t g_reqnb; /**< how many requests were added */
+int32_t g_processed[MAX_REQNB]; /**< how many times each request was given to the callback */
+int32_t g_errors; /**< how many errors were found */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+void * test_process(int64_t req_id)
+{
+	g_processed[req_id]++;
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) g_processed[reqs[i]]++;
+	return 0;
+}
+/**
+ * starts AGIOS and replaces its thread.
+ * @param algorithm the scheduling algorithm.
+ * @param max_idle_files max_idle_files
+ * @param idle_file_timeout idle_file_timeout (in ms)
+ * @param keep_stats keep_evicted_file_stats
+ * @return true or false for success.
+ */
+bool start_agios(const char *algorithm, int32_t max_idle_files, int32_t idle_file_timeout, bool keep_stats)
+{
+	g_ctx = start_test_ctx(algorithm, test_process, test_process_list, 0, "max_idle_files = %d ;\nidle_file_timeout = %d ;\nkeep_evicted_file_stats = %s ;\n", max_idle_files, idle_file_timeout, keep_stats ? "true" : "false");
+	if ((!g_ctx) || (!replace_agios_thread(g_ctx, NULL))) return false;
+	if (strcmp(g_ctx->current_scheduler->name, algorithm) != 0) {
+		printf("FAIL: AGIOS started with %s instead of %s\n", g_ctx->current_scheduler->name, algorithm);
+		return false;
+	}
+	g_reqnb = 0;
+	memset(g_processed, 0, sizeof(g_processed));
+	return true;
+}
+/**
+ * chooses the names of the files of the LRU test, so they all go to the same line of the hashtable as the first one.
+ */
+void choose_files(void)
+{
+	int32_t line = -1;
+	int32_t filenb = 0;
+
+	for (int32_t i = 0; filenb < LRU_FILE_NB; i++) {
+		sprintf(g_file_ids[filenb], "file.%d", i);
+		if (line < 0) line = get_hashtable_position(g_ctx, get_file_hash(g_file_ids[filenb]));
+		else if (get_hashtable_position(g_ctx, get_file_hash(g_file_ids[filenb])) != line) continue;
+		filenb++;
+	}
+}
+/**
+ * gives the structure of a file, if it is in the hashtable.
+ * @param file_id the file.
+ * @return the structure, or NULL.
+ */
+struct file_t *find_file(const char *file_id)
+{
+	uint64_t file_hash = get_file_hash(file_id);
+
+	return hashtable_find_file(g_ctx, get_hashtable_position(g_ctx, file_hash), file_hash, file_id);
+}
+/**
+ * adds a request.
+ * @param file_id the file.
+ * @param type RT_READ or RT_WRITE.
+ * @return the identifier of the request.
+ */
+int32_t add_request(char *file_id, int32_t type)
+{
+	int32_t req_id = g_reqnb++;
+
+	if (!agios_add_request_with_handle_ctx(g_ctx, file_id, type, req_id*REQ_SIZE, REQ_SIZE, req_id, 0, &g_handles[req_id])) report_error("could not add request %d to %s", req_id, file_id);
+	return req_id;
+}
+/**
+ * gives all queued requests to the callback.
+ */
+void process_requests(void)
+{
+	while (get_current_reqnb(g_ctx) > 0) g_ctx->current_scheduler->schedule(g_ctx);
+}
+/**
+ * releases a request that was given to the callback.
+ * @param req_id the request.
+ */
+void release_request(int32_t req_id)
+{
+	if (g_processed[req_id] != 1) report_error("request %d was given to the callback %d times", req_id, g_processed[req_id]);
+	if (!agios_release_request_by_handle_ctx(g_ctx, g_handles[req_id])) report_error("could not release request %d", req_id);
+}
+/**
+ * adds a read and a write to a file, processes and releases them, so the file becomes idle (with statistics in both queues).
+ * @param file_id the file.
+ */
+void use_file(char *file_id)
+{
+	struct timespec pause = {0, 1000000}; /**< so files do not become idle at the same time */
+	int32_t read = add_request(file_id, RT_READ);
+	int32_t write = add_request(file_id, RT_WRITE);
+
+	process_requests();
+	release_request(read);
+	release_request(write);
+	nanosleep(&pause, NULL);
+}
+/**
+ * checks whether a file is in the hashtable.
+ * @param file the file of the LRU test.
+ * @param expected true if it must be there.
+ * @param when describes the moment of the check, for the messages.
+ */
+void check_file(int32_t file, bool expected, const char *when)
+{
+	bool found = (find_file(g_file_ids[file]) != NULL);
+
+	if (found != expected) report_error("%s with %s: %s %s, but it should%s be", when, g_ctx->current_scheduler->name, g_file_ids[file], found ? "is still in the hashtable" : "was evicted", expected ? "" : " not");
+}
+/**
+ * checks that the statistics of evicted files are the sum of the ones given.
+ * @param expected_read the read statistics of the files that were evicted, added together.
+ * @param expected_write the write ones.
+ */
+void check_evicted_stats(struct queue_statistics_t *expected_read, struct queue_statistics_t *expected_write)
+{
+	struct queue_statistics_t *stats[2][2] = {{&g_ctx->evicted_read_stats, expected_read}, {&g_ctx->evicted_write_stats, expected_write}};
+
+	for (int32_t i = 0; i < 2; i++) {
+		if ((stats[i][0]->receivedreq_nb != stats[i][1]->receivedreq_nb) ||
+		    (stats[i][0]->processedreq_nb != stats[i][1]->processedreq_nb) ||
+		    (stats[i][0]->releasedreq_nb != stats[i][1]->releasedreq_nb) ||
+		    (stats[i][0]->processed_req_size != stats[i][1]->processed_req_size))
+			report_error("with %s, the %s statistics of evicted files have %ld received, %ld processed and %ld released requests (%ld bytes), the evicted files had %ld, %ld and %ld (%ld bytes)", g_ctx->current_scheduler->name, i ? "write" : "read", stats[i][0]->receivedreq_nb, stats[i][0]->processedreq_nb, stats[i][0]->releasedreq_nb, stats[i][0]->processed_req_size, stats[i][1]->receivedreq_nb, stats[i][1]->processedreq_nb, stats[i][1]->releasedreq_nb, stats[i][1]->processed_req_size);
+	}
+}
+/**
+ * adds the counters of the statistics of a file to a total, before it is evicted.
+ * @param file the file of the LRU test.
+ * @param total_read the total of the read queues.
+ * @param total_write the total of the write queues.
+ */
+void add_file_stats(int32_t file, struct queue_statistics_t *total_read, struct queue_statistics_t *total_write)
+{
+	struct file_t *req_file = find_file(g_file_ids[file]);
+	struct queue_statistics_t *stats[2][2] = {{total_read, &req_file->read_queue.stats}, {total_write, &req_file->write_queue.stats}};
+
+	for (int32_t i = 0; i < 2; i++) {
+		stats[i][0]->receivedreq_nb += stats[i][1]->receivedreq_nb;
+		stats[i][0]->processedreq_nb += stats[i][1]->processedreq_nb;
+		stats[i][0]->releasedreq_nb += stats[i][1]->releasedreq_nb;
+		stats[i][0]->processed_req_size += stats[i][1]->processed_req_size;
+	}
+}
+/**
+ * the LRU test, @see the beginning of this file.
+ * @param algorithm the scheduling algorithm.
+ * @return true if no error was found.
+ */
+bool lru_test(const char *algorithm)
+{
+	struct queue_statistics_t expected_read = {0}; /**< the statistics of the files evicted so far */
+	struct queue_statistics_t expected_write = {0};
+	struct file_t *req_file;
+	int32_t dispatched_req;
+	int32_t first_dispatched_req;
+	int32_t queued_req;
+	int32_t again_req;
+
+	if (!start_agios(algorithm, 0, -1, true)) return false;
+	g_ctx->config.max_idle_files = g_ctx->hashtable_size; //each line keeps one idle file
+	g_errors = 0;
+	choose_files();
+	if (agios_register_file_ctx(g_ctx, g_file_ids[REGISTERED]) < 0) report_error("could not register %s", g_file_ids[REGISTERED]);
+	use_file(g_file_ids[REGISTERED]);
+	use_file(g_file_ids[IDLE1]);
+	use_file(g_file_ids[IDLE2]);
+	use_file(g_file_ids[IDLE3]);
+	first_dispatched_req = add_request(g_file_ids[DISPATCHED], RT_READ);
+	dispatched_req = add_request(g_file_ids[DISPATCHED], RT_READ);
+	process_requests();
+	release_request(first_dispatched_req); //it still has a dispatched request
+	queued_req = add_request(g_file_ids[QUEUED], RT_WRITE);
+	//only the last idle file is kept
+	add_file_stats(IDLE1, &expected_read, &expected_write);
+	add_file_stats(IDLE2, &expected_read, &expected_write);
+	evict_idle_files(g_ctx);
+	check_file(IDLE1, false, "first eviction");
+	check_file(IDLE2, false, "first eviction");
+	check_file(IDLE3, true, "first eviction");
+	check_file(QUEUED, true, "first eviction");
+	check_file(DISPATCHED, true, "first eviction");
+	check_file(REGISTERED, true, "first eviction");
+	check_evicted_stats(&expected_read, &expected_write);
+	//once its request is released, the file with a dispatched request is the most recently idle one
+	release_request(dispatched_req);
+	add_file_stats(IDLE3, &expected_read, &expected_write);
+	evict_idle_files(g_ctx);
+	check_file(IDLE3, false, "second eviction");
+	check_file(DISPATCHED, true, "second eviction");
+	check_file(QUEUED, true, "second eviction");
+	check_evicted_stats(&expected_read, &expected_write);
+	//and then the one with a queued request
+	process_requests();
+	release_request(queued_req);
+	add_file_stats(DISPATCHED, &expected_read, &expected_write);
+	evict_idle_files(g_ctx);
+	check_file(DISPATCHED, false, "third eviction");
+	check_file(QUEUED, true, "third eviction");
+	check_file(REGISTERED, true, "third eviction");
+	check_evicted_stats(&expected_read, &expected_write);
+	if (g_ctx->evicted_filenb != 4) report_error("with %s, %ld files were evicted instead of 4", algorithm, g_ctx->evicted_filenb);
+	//an evicted file receives requests again
+	again_req = add_request(g_file_ids[IDLE1], RT_READ);
+	req_file = find_file(g_file_ids[IDLE1]);
+	if (!req_file) report_error("with %s, %s has no structure after receiving a request again", algorithm, g_file_ids[IDLE1]);
+	else if (req_file->read_queue.stats.receivedreq_nb != 1) report_error("with %s, %s received %ld requests after it was evicted instead of 1", algorithm, g_file_ids[IDLE1], req_file->read_queue.stats.receivedreq_nb);
+	process_requests();
+	release_request(again_req);
+	agios_exit_ctx(g_ctx);
+	if (g_errors) return false;
+	printf("PASSED: with %s, the least recently idle files were evicted (and files with requests or registered were not), their statistics were kept, and an evicted file received requests again\n", algorithm);
+	return true;
+}
+/**
+ * the TTL test, @see the beginning of this file.
+ * @param algorithm the scheduling algorithm.
+ * @return true if no error was found.
+ */
+bool ttl_test(const char *algorithm)
+{
+	struct queue_statistics_t no_stats = {0};
+	struct timespec timeout = {0, 1500000L*TIMEOUT}; /**< longer than TIMEOUT */
+
+	if (!start_agios(algorithm, -1, TIMEOUT, false)) return false;
+	g_errors = 0;
+	choose_files();
+	use_file(g_file_ids[IDLE1]);
+	evict_idle_files(g_ctx);
+	check_file(IDLE1, true, "eviction before the timeout");
+	nanosleep(&timeout, NULL);
+	evict_idle_files(g_ctx);
+	check_file(IDLE1, false, "eviction after the timeout");
+	check_evicted_stats(&no_stats, &no_stats);
+	agios_exit_ctx(g_ctx);
+	if (g_errors) return false;
+	printf("PASSED: with %s, an idle file was kept until idle_file_timeout and evicted after it, without keeping its statistics\n", algorithm);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *algorithms[] = {"SJF", "TO"}; /**< one that uses the hashtable and one that uses the timeline */
+	bool ret = true;
+
+	for (int32_t i = 0; i < sizeof(algorithms)/sizeof(algorithms[0]); i++) {
+		ret = lru_test(algorithms[i]) && ret;
+		ret = ttl_test(algorithms[i]) && ret;
+	}
+	return ret ? 0 : -1;
+}
@@ -0,0 +1,220 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <hash.h>
+
+/* Measures how well file handles are spread over the lines of the hashtable by get_file_hash (and how long it takes to compute it), compared to the hash used before it (which summed the characters of the handle).
+ * The handles are read from a file (one path per line, "-" for the standard input), for instance the output of find over a real file system, or generated as one of the synthetic sets:
+ *  checkpoint - one file per rank and per step, as N-N checkpoints write (/scratch/job/step_0012/rank_00345.dat)
+ *  output - files with a single number in their names (output.1234.out), like the ones used by agios_bench
+ *  hdf5 - a few shared files per directory, with long paths (/lustre/project/run_07/fields/density_0042.h5)
+ * For each hashtable size between 2^min_shift and 2^max_shift lines, it prints how many lines are empty, the average and largest number of files in a line, and the standard deviation.
+ */
+
+/**
+ * the hash used by AGIOS before get_file_hash, kept here for comparison. It sums the characters of the handle and mixes the sum.
+ * @param file_handle the handle.
+ * @return the 64-bit mixed value, from which the position of the hashtable is taken.
+ */
+uint64_t old_file_hash(const char *file_handle)
+{
+	int64_t sum=0;
+	for(int32_t i=0; i< strlen(file_handle); i++)
+		sum += file_handle[i];
+	int64_t hash = sum;
+	int64_t n = hash;
+	n <<= 18;
+	hash -= n;
+	n <<= 33;
+	hash -= n;
+	n <<= 3;
+	hash += n;
+	n <<= 3;
+	hash -= n;
+	n <<= 4;
+	hash += n;
+	n <<= 2;
+	hash += n;
+	return (uint64_t) hash;
+}
+
+char **g_handles; /**< all file handles being tested */
+int32_t g_handle_nb; /**< number of handles */
+int32_t g_handle_max; /**< size of the g_handles array */
+
+/**
+ * adds a handle to the set being tested.
+ * @param handle the handle, which is copied.
+ * @return true or false for success.
+ */
+bool add_handle(const char *handle)
+{
+	if (g_handle_nb >= g_handle_max) {
+		g_handle_max = g_handle_max ? 2*g_handle_max : 1024;
+		g_handles = realloc(g_handles, sizeof(char *)*g_handle_max);
+		if (!g_handles) return false;
+	}
+	g_handles[g_handle_nb] = strdup(handle);
+	if (!g_handles[g_handle_nb]) return false;
+	g_handle_nb++;
+	return true;
+}
+/**
+ * reads handles from a file, one per line.
+ * @param path the path of the file, or "-" for the standard input.
+ * @return true or false for success.
+ */
+bool read_handles(const char *path)
+{
+	char line[4096];
+	FILE *fd = strcmp(path, "-") ? fopen(path, "r") : stdin;
+
+	if (!fd) {
+		printf("Could not open %s\n", path);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fd)) {
+		line[strcspn(line, "\n")] = '\0';
+		if ((strlen(line) > 0) && (!add_handle(line))) return false;
+	}
+	if (fd != stdin) fclose(fd);
+	return true;
+}
+/**
+ * generates one of the synthetic sets of handles.
+ * @param set the name of the set.
+ * @param file_nb (approximate) number of handles.
+ * @return true or false for success.
+ */
+bool generate_handles(const char *set, int32_t file_nb)
+{
+	char handle[256];
+
+	if (strcmp(set, "checkpoint") == 0) {
+		int32_t rank_nb = file_nb >= 4096 ? 4096 : file_nb;
+		for (int32_t step = 0; step*rank_nb < file_nb; step++) {
+			for (int32_t rank = 0; rank < rank_nb; rank++) {
+				sprintf(handle, "/scratch/job/step_%04d/rank_%05d.dat", step, rank);
+				if (!add_handle(handle)) return false;
+			}
+		}
+	} else if (strcmp(set, "output") == 0) {
+		for (int32_t i = 0; i < file_nb; i++) {
+			sprintf(handle, "output.%d.out", i);
+			if (!add_handle(handle)) return false;
+		}
+	} else if (strcmp(set, "hdf5") == 0) {
+		const char *fields[] = {"density", "pressure", "velocity_x", "velocity_y", "velocity_z", "temperature"};
+		for (int32_t i = 0; i < file_nb; i++) {
+			sprintf(handle, "/lustre/project/run_%02d/fields/%s_%04d.h5", i / 6000, fields[i % 6], (i / 6) % 1000);
+			if (!add_handle(handle)) return false;
+		}
+	} else {
+		printf("Unknown set %s\n", set);
+		return false;
+	}
+	return true;
+}
+/**
+ * compares two 64-bit values, used to sort hashes.
+ */
+int compare_hashes(const void *a, const void *b)
+{
+	uint64_t ha = *((const uint64_t *) a);
+	uint64_t hb = *((const uint64_t *) b);
+
+	if (ha == hb) return 0;
+	return (ha < hb) ? -1 : 1;
+}
+/**
+ * computes the hashes of all handles and prints the distribution over the lines of hashtables of multiple sizes.
+ * @param name the name of the hash function, to be printed.
+ * @param hash_function the hash function.
+ * @param min_shift the smallest hashtable has 2^min_shift lines.
+ * @param max_shift the largest hashtable has 2^max_shift lines.
+ */
+void evaluate(const char *name, uint64_t (*hash_function)(const char *), int32_t min_shift, int32_t max_shift)
+{
+	uint64_t *hashes = malloc(sizeof(uint64_t)*g_handle_nb);
+	int32_t *counters = malloc(sizeof(int32_t)*(1 << max_shift));
+	struct timespec start, end;
+	int64_t elapsed;
+	int32_t collisions = 0;
+
+	if ((!hashes) || (!counters)) {
+		printf("Could not allocate memory\n");
+		exit(-1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int32_t i = 0; i < g_handle_nb; i++) hashes[i] = hash_function(g_handles[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec)*1000000000L + (end.tv_nsec - start.tv_nsec);
+	for (int32_t shift = min_shift; shift <= max_shift; shift++) {
+		int32_t lines = 1 << shift;
+		int32_t empty = 0;
+		int32_t largest = 0;
+		double avg = ((double) g_handle_nb) / lines;
+		double variance = 0.0;
+
+		memset(counters, 0, sizeof(int32_t)*lines);
+		//the position is taken from the high bits, as get_hashtable_position does
+		for (int32_t i = 0; i < g_handle_nb; i++) counters[hashes[i] >> (64 - shift)]++;
+		for (int32_t i = 0; i < lines; i++) {
+			if (counters[i] == 0) empty++;
+			if (counters[i] > largest) largest = counters[i];
+			variance += (counters[i] - avg)*(counters[i] - avg);
+		}
+		printf("%s: %d lines, %d empty, %.2f files per line on average, %d at most, standard deviation %.2f\n", name, lines, empty, avg, largest, sqrt(variance / lines));
+	}
+	//handles that have exactly the same hash (they will be compared with strcmp)
+	qsort(hashes, g_handle_nb, sizeof(uint64_t), compare_hashes);
+	for (int32_t i = 1; i < g_handle_nb; i++) {
+		if (hashes[i] == hashes[i-1]) collisions++;
+	}
+	printf("%s: %d handles with the same 64-bit hash as another one, %fns per handle\n", name, collisions, ((double) elapsed) / g_handle_nb);
+	free(hashes);
+	free(counters);
+}
+
+int main(int argc, char **argv)
+{
+	int32_t min_shift = 6;
+	int32_t max_shift = 12;
+
+	if ((argc < 2) || (argc > 5)) {
+		printf("Usage: %s <checkpoint|output|hdf5> <number of files> [min shift] [max shift]\n", argv[0]);
+		printf("   or: %s <file with one path per line, or - for stdin> [min shift] [max shift]\n", argv[0]);
+		exit(-1);
+	}
+	if ((strcmp(argv[1], "checkpoint") == 0) || (strcmp(argv[1], "output") == 0) || (strcmp(argv[1], "hdf5") == 0)) {
+		if (argc < 3) {
+			printf("Missing the number of files\n");
+			exit(-1);
+		}
+		if (!generate_handles(argv[1], atoi(argv[2]))) exit(-1);
+		if (argc > 3) min_shift = atoi(argv[3]);
+		if (argc > 4) max_shift = atoi(argv[4]);
+	} else {
+		if (!read_handles(argv[1])) exit(-1);
+		if (argc > 2) min_shift = atoi(argv[2]);
+		if (argc > 3) max_shift = atoi(argv[3]);
+	}
+	if ((min_shift < 1) || (max_shift > 24) || (min_shift > max_shift)) {
+		printf("Shifts must be between 1 and 24\n");
+		exit(-1);
+	}
+	if (g_handle_nb == 0) {
+		printf("No file handles to test\n");
+		exit(-1);
+	}
+	printf("%d file handles\n", g_handle_nb);
+	evaluate("character sum", old_file_hash, min_shift, max_shift);
+	evaluate("get_file_hash", get_file_hash, min_shift, max_shift);
+	for (int32_t i = 0; i < g_handle_nb; i++) free(g_handles[i]);
+	free(g_handles);
+	return 0;
+}
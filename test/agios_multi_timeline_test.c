@@ -0,0 +1,288 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agios.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "common_functions.h"
+#include "data_structures.h"
+#include "req_timeline.h"
+#include "scheduling_algorithms.h"
+#include "test_common.h"
+#include "WFQ.h"
+
+/* Checks the changes between TWINS or WFQ, which keep a queue of requests for each queue_id (the multi_timeline), and the other scheduling algorithms.
+ * AGIOS is started with TWINS or WFQ, then its thread is replaced by one that does nothing, so this program does what the AGIOS thread would do: it changes the scheduling algorithm (calling change_selected_alg) to MLF, TO or TWINS and back, and moves the requests after each change (@see migrate_slice). Requests are added and cancelled while they are being moved, and every time we are back to TWINS or WFQ, we check that each queue of the multi_timeline has exactly the requests of its queue_id that were not cancelled, in the order they arrived.
+ * With WFQ, the weights and the credits of the queues are set before the first change, and must be the same every time WFQ is selected again (@see WFQ_exit).
+ * At the end, the scheduling algorithm is called until all requests are processed, and the requests of each queue_id must be given to the callback in the order they arrived.
+ * This program uses internal functions of AGIOS. The file with the weights of WFQ is written by this program (in /tmp).
+ */
+
+#define FILE_NB 64 /**< the number of files accessed by the requests */
+#define QUEUE_NB 4 /**< the number of queue ids given to the requests */
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define BATCH 3000 /**< how many requests are added at the beginning and while each migration is in progress (more than MIGRATION_SLICE, so a migration takes many slices) */
+#define CANCEL_NB 200 /**< how many requests are cancelled while each migration is in progress */
+#define ROUNDS 3 /**< how many times we change to the other scheduling algorithm and back */
+#define MAX_REQNB (BATCH*(2*ROUNDS + 1)) /**< the number of requests of a run */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+//the states of a request
+#define REQ_NEW 0 /**< it was not added yet */
+#define REQ_QUEUED 1 /**< it was added and not processed yet */
+#define REQ_CANCELLED 2 /**< it was cancelled */
+#define REQ_PROCESSED 3 /**< it was given to the callback, and it is waiting to be released */
+#define REQ_RELEASED 4 /**< it was released */
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance of the current run */
+agios_request_handle_t g_handles[MAX_REQNB]; /**< the handles of the requests */
+int32_t g_states[MAX_REQNB]; /**< the state of each request */
+int32_t g_queue_ids[MAX_REQNB]; /**< the queue_id of each request */
+uint8_t g_seen[MAX_REQNB]; /**< how many times each request was found in the multi_timeline by check_multi_timeline */
+int64_t g_last_processed[QUEUE_NB]; /**< the last request of each queue_id given to the callback */
+int32_t g_reqnb; /**< how many requests were added in the current run */
+int32_t g_cancelled; /**< how many were cancelled */
+int32_t g_checknb; /**< how many times the multi_timeline was checked */
+int32_t g_errors; /**< how many errors were found in the current run */
+unsigned int g_seed; /**< used to choose the queue_id of each request and the ones to be cancelled */
+struct wfq_weights_t g_wfq_weights[QUEUE_NB]; /**< the weights and credits of WFQ before the first change */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones of a run) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+/**
+ * called when a request is given to the callback. The requests of a queue_id must come in the order they were added.
+ * @param req_id the request.
+ */
+void request_processed(int64_t req_id)
+{
+	int32_t queue_id = g_queue_ids[req_id];
+
+	if (g_states[req_id] != REQ_QUEUED) report_error("request %ld was given to the callback in state %d", req_id, g_states[req_id]);
+	if (req_id <= g_last_processed[queue_id]) report_error("request %ld of queue_id %d was given to the callback after request %ld", req_id, queue_id, g_last_processed[queue_id]);
+	g_last_processed[queue_id] = req_id;
+	g_states[req_id] = REQ_PROCESSED;
+}
+void * test_process(int64_t req_id)
+{
+	request_processed(req_id);
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) request_processed(reqs[i]);
+	return 0;
+}
+/**
+ * adds requests with random queue_ids. Consecutive requests to the same file are not contiguous, so they are never aggregated (by MLF or TO-agg) and the order of each queue_id can be checked.
+ * @param reqnb how many.
+ */
+void add_requests(int32_t reqnb)
+{
+	char file_id[64];
+
+	for (int32_t i = 0; i < reqnb; i++) {
+		int64_t req_id = g_reqnb++;
+		int32_t file = req_id % FILE_NB;
+
+		sprintf(file_id, "file.%d", file);
+		g_queue_ids[req_id] = rand_r(&g_seed) % QUEUE_NB;
+		if (!agios_add_request_with_handle_ctx(g_ctx, file_id, file % 2 ? RT_WRITE : RT_READ, (req_id / FILE_NB)*2*REQ_SIZE, REQ_SIZE, req_id, g_queue_ids[req_id], &g_handles[req_id])) {
+			report_error("agios_add_request_with_handle_ctx failed for request %ld", req_id);
+			g_states[req_id] = REQ_CANCELLED;
+			continue;
+		}
+		g_states[req_id] = REQ_QUEUED;
+	}
+}
+/**
+ * cancels random requests that are queued. Nothing is processed while the scheduling algorithm is not called, so that must work.
+ * @param reqnb how many.
+ */
+void cancel_requests(int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) {
+		int64_t req_id = rand_r(&g_seed) % g_reqnb;
+
+		if (g_states[req_id] != REQ_QUEUED) continue;
+		if (!agios_cancel_request_by_handle_ctx(g_ctx, g_handles[req_id])) report_error("could not cancel request %ld", req_id);
+		else {
+			g_states[req_id] = REQ_CANCELLED;
+			g_cancelled++;
+		}
+	}
+}
+/**
+ * checks that each queue of the multi_timeline has the requests of its queue_id that are queued, in the order they were added, and that there are no requests anywhere else.
+ */
+void check_multi_timeline(void)
+{
+	struct request_t *req;
+	struct file_t *req_file;
+	int64_t last; /**< the last request found in the queue */
+	int32_t found = 0; /**< how many requests were found in the multi_timeline */
+	int32_t queued = 0; /**< how many should be there */
+
+	memset(g_seen, 0, sizeof(g_seen));
+	for (int32_t i = 0; i < g_ctx->multi_timeline_size; i++) {
+		last = -1;
+		agios_list_for_each_entry (req, &g_ctx->multi_timeline[i], related) {
+			if (req->reqnb != 1) {
+				report_error("there is a virtual request in queue %d of the multi_timeline", i);
+				continue;
+			}
+			if (g_seen[req->user_id]++) report_error("request %ld is in the multi_timeline more than once", req->user_id);
+			if (g_states[req->user_id] != REQ_QUEUED) report_error("request %ld is in the multi_timeline in state %d", req->user_id, g_states[req->user_id]);
+			if ((req->queue_id != i) || (g_queue_ids[req->user_id] != i)) report_error("request %ld of queue_id %d is in queue %d of the multi_timeline", req->user_id, g_queue_ids[req->user_id], i);
+			if (req->user_id <= last) report_error("request %ld is after request %ld in queue %d of the multi_timeline", req->user_id, last, i);
+			last = req->user_id;
+			found++;
+		}
+	}
+	for (int32_t i = 0; i < g_reqnb; i++) {
+		if (g_states[i] != REQ_QUEUED) continue;
+		queued++;
+		if (!g_seen[i]) report_error("request %d was added, but it is not in the multi_timeline", i);
+	}
+	if ((found != queued) || (get_current_reqnb(g_ctx) != queued)) report_error("%d requests are queued, %d are in the multi_timeline and current_reqnb is %d", queued, found, get_current_reqnb(g_ctx));
+	for (int32_t i = 0; i < g_ctx->timeline_shardnb; i++) {
+		if (!agios_list_empty(&g_ctx->timeline_shards[i].list)) report_error("shard %d of the timeline is not empty", i);
+	}
+	for (int32_t i = 0; i < g_ctx->hashtable_size; i++) {
+		agios_list_for_each_entry (req_file, &g_ctx->hashlist[i], hashlist) {
+			if ((!agios_list_empty(&req_file->read_queue.list)) || (!agios_list_empty(&req_file->write_queue.list))) report_error("file %s still has requests in the hashtable", req_file->file_id);
+		}
+	}
+	g_checknb++;
+}
+/**
+ * checks that the weights and the credits of WFQ are the ones it had before the first change.
+ */
+void check_wfq_weights(void)
+{
+	if (!g_ctx->wfq_weights) {
+		report_error("the weights of WFQ were freed");
+		return;
+	}
+	for (int32_t i = 0; i < QUEUE_NB; i++) {
+		if ((g_ctx->wfq_weights[i].weight != g_wfq_weights[i].weight) || (g_ctx->wfq_weights[i].credit != g_wfq_weights[i].credit)) report_error("queue %d of WFQ had weight %ld and credit %ld, now it has %ld and %ld", i, g_wfq_weights[i].weight, g_wfq_weights[i].credit, g_ctx->wfq_weights[i].weight, g_ctx->wfq_weights[i].credit);
+	}
+}
+/**
+ * changes the scheduling algorithm as the AGIOS thread does, and moves the requests to the data structure of the new one (if it is another), adding and cancelling requests while that is in progress.
+ * @param alg the new scheduling algorithm.
+ */
+void change_to(int32_t alg)
+{
+	change_selected_alg(g_ctx, alg); //it begins the switch
+	end_scheduler_switch(g_ctx);
+	if (atomic_load(&g_ctx->migrating)) migrate_slice(g_ctx);
+	add_requests(BATCH);
+	cancel_requests(CANCEL_NB);
+	while (atomic_load(&g_ctx->migrating)) migrate_slice(g_ctx);
+}
+/**
+ * calls the scheduling algorithm until all requests were processed, and releases them.
+ * @return true if it was done before a timeout.
+ */
+bool process_all_requests(void)
+{
+	struct timespec start;
+
+	agios_gettime(&start);
+	while (get_current_reqnb(g_ctx) > 0) {
+		g_ctx->current_scheduler->schedule(g_ctx);
+		if (get_nanoelapsed(start) > 60000000000L) return false;
+	}
+	for (int32_t i = 0; i < g_reqnb; i++) {
+		if (g_states[i] != REQ_PROCESSED) continue;
+		if (!agios_release_request_by_handle_ctx(g_ctx, g_handles[i])) report_error("could not release request %d", i);
+		g_states[i] = REQ_RELEASED;
+	}
+	return true;
+}
+/**
+ * writes the file with the weights of WFQ.
+ * @param wfq_path the path of the file.
+ * @return true or false for success.
+ */
+bool write_wfq_weights(const char *wfq_path)
+{
+	FILE *fd = fopen(wfq_path, "w");
+
+	if (!fd) {
+		printf("Could not create %s\n", wfq_path);
+		return false;
+	}
+	for (int32_t i = 0; i < QUEUE_NB; i++) fprintf(fd, "%d\n", (i+1)*REQ_SIZE + REQ_SIZE/2); //so the queues are left with credits
+	fclose(fd);
+	return true;
+}
+/**
+ * runs the test for TWINS or WFQ and another scheduling algorithm.
+ * @param wfq_path the path of the file with the weights of WFQ.
+ * @param algorithm TWINS or WFQ.
+ * @param other_algorithm the other one.
+ * @return true if no errors were found.
+ */
+bool run(char *wfq_path, const char *algorithm, const char *other_algorithm)
+{
+	int32_t alg;
+	int32_t other_alg;
+
+	g_reqnb = 0;
+	g_cancelled = 0;
+	g_checknb = 0;
+	g_errors = 0;
+	g_seed = 42;
+	memset(g_states, 0, sizeof(g_states));
+	for (int32_t i = 0; i < QUEUE_NB; i++) g_last_processed[i] = -1;
+	if ((!get_algorithm_from_string(algorithm, &alg)) || (!get_algorithm_from_string(other_algorithm, &other_alg))) {
+		printf("Unknown scheduling algorithm\n");
+		return false;
+	}
+	g_ctx = start_test_ctx(algorithm, test_process, test_process_list, QUEUE_NB, "expected_files = %d ;\nwfq_conf = \"%s\" ;\n", FILE_NB, wfq_path);
+	if ((!g_ctx) || (!replace_agios_thread(g_ctx, NULL))) return false;
+	if (g_ctx->current_alg != alg) report_error("AGIOS started with %s instead of %s", g_ctx->current_scheduler->name, algorithm);
+	if (alg == WFQ_SCHEDULER) { //we give credits to the queues, as if WFQ had been used for a while
+		for (int32_t i = 0; i < QUEUE_NB; i++) g_ctx->wfq_weights[i].credit = (i+1)*REQ_SIZE/4;
+		memcpy(g_wfq_weights, g_ctx->wfq_weights, sizeof(g_wfq_weights));
+	}
+	add_requests(BATCH);
+	for (int32_t i = 0; i < ROUNDS; i++) {
+		change_to(other_alg);
+		change_to(alg);
+		check_multi_timeline();
+		if (alg == WFQ_SCHEDULER) check_wfq_weights();
+	}
+	if (!process_all_requests()) report_error("the requests were not processed after 60s");
+	agios_exit_ctx(g_ctx);
+	for (int32_t i = 0; i < g_reqnb; i++) {
+		if ((g_states[i] != REQ_CANCELLED) && (g_states[i] != REQ_RELEASED)) report_error("request %d was neither cancelled nor released", i);
+	}
+	printf("%s\t%s<->%s\t%d\t%d\t%d\n", g_errors ? "FAIL" : "PASSED", algorithm, other_algorithm, g_reqnb, g_cancelled, g_checknb);
+	return g_errors == 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *algorithms[][2] = {{"TWINS", "MLF"}, {"TWINS", "TO"}, {"WFQ", "MLF"}, {"WFQ", "TO"}, {"WFQ", "TWINS"}}; /**< the runs of the test: TWINS or WFQ, and the scheduling algorithm we change to and back */
+	char wfq_path[64];
+	bool ret = true;
+
+	sprintf(wfq_path, "/tmp/agios_multi_timeline_test.%d.wfq", getpid());
+	if (!write_wfq_weights(wfq_path)) return 1;
+	printf("result\talgorithms\trequests\tcancelled\tchecks\n");
+	for (int32_t i = 0; i < sizeof(algorithms)/sizeof(algorithms[0]); i++) ret = run(wfq_path, algorithms[i][0], algorithms[i][1]) && ret;
+	unlink(wfq_path);
+	return ret ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agios.h"
+#include "agios_ctx.h"
+#include "scheduling_algorithms.h"
+#include "test_common.h"
+
+/* Checks the waits of the pull mode (@see pull_mode.c), with TO-agg and a ring of RING_SIZE groups of requests.
+ * Without requests, agios_next_requests_ctx must return 0 right away with a timeout of 0, and 0 after waiting with a positive timeout. A group of contiguous requests (aggregated by TO-agg) is then taken a few requests at a time, so the rest of the group goes to the list of partially taken groups and is given to the next calls, in order. Then more groups than the ring holds are added: the AGIOS thread must wait with the ring full until they are taken, and each request must be given once. At last, workers wait for requests (with and without a timeout) while agios_exit_ctx is called, and they must all be woken up and get -1.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define RING_SIZE 2 /**< pull_ring_size used in the configuration file (already a power of 2) */
+#define AGG_NB 4 /**< the requests of the group that is aggregated */
+#define FULL_NB 8 /**< the requests added to fill the ring, one group each */
+#define MAX_REQNB (AGG_NB + FULL_NB) /**< all requests given to the workers */
+#define WORKER_NB 3 /**< the workers waiting when agios_exit_ctx is called */
+#define TIMEOUT_NS 20000000L /**< the timeout used when there are no requests */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance */
+int32_t g_taken[MAX_REQNB]; /**< how many times each request was given by agios_next_requests_ctx */
+atomic_int g_exit_returns[WORKER_NB]; /**< what agios_next_requests_ctx returned to each worker while AGIOS was stopped (1 until it returns) */
+int32_t g_errors; /**< how many errors were found */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+int64_t get_elapsed(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_nsec - start->tv_nsec) + ((end->tv_sec - start->tv_sec)*1000000000L);
+}
+/**
+ * waits until a counter of the AGIOS instance reaches a value, for at most 10 seconds.
+ * @param counter the counter.
+ * @param value the value.
+ * @return true if it did.
+ */
+bool wait_counter(atomic_int *counter, int32_t value)
+{
+	for (int32_t i = 0; i < 10000; i++) {
+		if (atomic_load(counter) == value) return true;
+		usleep(1000);
+	}
+	return false;
+}
+/**
+ * a worker that waits for requests while agios_exit_ctx is called. Even workers wait without a timeout, odd ones with a long one.
+ * @param arg the index of the worker.
+ */
+void *waiting_worker(void *arg)
+{
+	int32_t worker = (int32_t) (intptr_t) arg;
+	int64_t reqs[MAX_AGGREG_SIZE];
+
+	atomic_store(&g_exit_returns[worker], agios_next_requests_ctx(g_ctx, reqs, MAX_AGGREG_SIZE, (worker % 2) ? 60000000000L : -1));
+	return 0;
+}
+/**
+ * adds requests together with agios_add_requests_ctx.
+ * @param first the identifier of the first request (the next ones are first+1, first+2, ...).
+ * @param reqnb how many requests.
+ * @param same_file if true, they are contiguous requests to the same file, otherwise each one is to its own file.
+ * @param handles receives their handles.
+ */
+void add_requests(int32_t first, int32_t reqnb, bool same_file, agios_request_handle_t *handles)
+{
+	struct agios_request_info_t reqs[MAX_REQNB];
+	char file_ids[MAX_REQNB][64];
+
+	for (int32_t i = 0; i < reqnb; i++) {
+		sprintf(file_ids[i], "file.%d", same_file ? first : first + i);
+		reqs[i].file_id = file_ids[i];
+		reqs[i].file_key = -1;
+		reqs[i].type = RT_READ;
+		reqs[i].offset = same_file ? i*REQ_SIZE : 0;
+		reqs[i].len = REQ_SIZE;
+		reqs[i].identifier = first + i;
+		reqs[i].queue_id = 0;
+	}
+	if (!agios_add_requests_ctx(g_ctx, reqs, reqnb, handles)) report_error("could not add requests %d to %d", first, first + reqnb - 1);
+}
+/**
+ * takes requests with agios_next_requests_ctx and counts them.
+ * @param max_reqnb the size of the vector given to agios_next_requests_ctx.
+ * @param reqs receives the identifiers of the requests.
+ * @return what agios_next_requests_ctx returned.
+ */
+int32_t take_requests(int32_t max_reqnb, int64_t *reqs)
+{
+	int32_t ret = agios_next_requests_ctx(g_ctx, reqs, max_reqnb, 10000000000L);
+
+	for (int32_t i = 0; i < ret; i++) {
+		if ((reqs[i] < 0) || (reqs[i] >= MAX_REQNB)) report_error("agios_next_requests_ctx gave an unknown request %ld", reqs[i]);
+		else g_taken[reqs[i]]++;
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	agios_request_handle_t handles[MAX_REQNB];
+	int64_t reqs[MAX_AGGREG_SIZE];
+	int32_t takennb = 0;
+	int32_t ret;
+	pthread_t workers[WORKER_NB];
+	struct timespec start, end;
+
+	g_ctx = start_test_pull_mode_ctx("TO-agg", 0, "pull_ring_size = %d ;\n", RING_SIZE);
+	if (!g_ctx) return -1;
+	//no requests: no wait with a timeout of 0, and 0 after the timeout
+	if ((ret = agios_next_requests_ctx(g_ctx, reqs, MAX_AGGREG_SIZE, 0)) != 0) report_error("agios_next_requests_ctx returned %d without requests and without a timeout", ret);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = agios_next_requests_ctx(g_ctx, reqs, MAX_AGGREG_SIZE, TIMEOUT_NS);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ret != 0) report_error("agios_next_requests_ctx returned %d without requests and with a timeout", ret);
+	if (get_elapsed(&start, &end) < TIMEOUT_NS - 1000000L) report_error("agios_next_requests_ctx returned after %ld ns, but its timeout was %ld ns", get_elapsed(&start, &end), TIMEOUT_NS);
+	//a group taken in parts: the first call gives one request, and the rest of the group waits in the list of partially taken groups
+	add_requests(0, AGG_NB, true, handles);
+	if ((ret = take_requests(1, reqs)) != 1) report_error("agios_next_requests_ctx gave %d requests instead of 1", ret);
+	else if (reqs[0] != 0) report_error("request %ld was given before request 0 of the group", reqs[0]);
+	if (atomic_load(&g_ctx->pull_partial_nb) != 1) report_error("%d groups are partially taken instead of 1", atomic_load(&g_ctx->pull_partial_nb));
+	for (int32_t i = 1; i < AGG_NB; i += ret) {
+		ret = take_requests(2, reqs);
+		if (ret <= 0) {
+			report_error("agios_next_requests_ctx returned %d while the group still had requests", ret);
+			break;
+		}
+		for (int32_t j = 0; j < ret; j++) {
+			if (reqs[j] != i + j) report_error("request %ld was given instead of request %d of the group", reqs[j], i + j);
+		}
+	}
+	if (atomic_load(&g_ctx->pull_partial_nb) != 0) report_error("a group is still partially taken after all its requests were given");
+	if (!agios_release_requests_ctx(g_ctx, handles, AGG_NB)) report_error("could not release the requests of the group");
+	//more groups than the ring holds: the AGIOS thread waits until they are taken
+	add_requests(AGG_NB, FULL_NB, false, &handles[AGG_NB]);
+	if (!wait_counter(&g_ctx->pull_waiting_producers, 1)) report_error("the AGIOS thread did not wait with the ring full");
+	if (atomic_load(&g_ctx->pull_put_position) - atomic_load(&g_ctx->pull_take_position) != RING_SIZE) report_error("the AGIOS thread waits, but the ring has %lu groups instead of %d", atomic_load(&g_ctx->pull_put_position) - atomic_load(&g_ctx->pull_take_position), RING_SIZE);
+	while (takennb < FULL_NB) {
+		ret = take_requests(MAX_AGGREG_SIZE, reqs);
+		if (ret <= 0) {
+			report_error("agios_next_requests_ctx returned %d after %d of %d requests", ret, takennb, FULL_NB);
+			break;
+		}
+		takennb += ret;
+	}
+	if (!agios_release_requests_ctx(g_ctx, &handles[AGG_NB], FULL_NB)) report_error("could not release the requests that filled the ring");
+	for (int32_t i = 0; i < MAX_REQNB; i++) {
+		if (g_taken[i] != 1) report_error("request %d was given %d times", i, g_taken[i]);
+	}
+	//workers waiting for requests when AGIOS is stopped
+	for (int32_t i = 0; i < WORKER_NB; i++) {
+		atomic_init(&g_exit_returns[i], 1);
+		if (pthread_create(&workers[i], NULL, waiting_worker, (void *) (intptr_t) i) != 0) {
+			printf("PANIC! Unable to create a worker!\n");
+			return -1;
+		}
+	}
+	if (!wait_counter(&g_ctx->pull_waiting_workers, WORKER_NB)) report_error("only %d of %d workers are waiting for requests", atomic_load(&g_ctx->pull_waiting_workers), WORKER_NB);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	agios_exit_ctx(g_ctx);
+	for (int32_t i = 0; i < WORKER_NB; i++) pthread_join(workers[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	for (int32_t i = 0; i < WORKER_NB; i++) {
+		if (atomic_load(&g_exit_returns[i]) != -1) report_error("a worker waiting when AGIOS was stopped got %d", atomic_load(&g_exit_returns[i]));
+	}
+	if (get_elapsed(&start, &end) > 5000000000L) report_error("the workers took %ld ns to leave after AGIOS was stopped", get_elapsed(&start, &end));
+	if (g_errors) return -1;
+	printf("PASSED: without requests agios_next_requests_ctx waited for its timeout, a group of %d requests was given in parts and in order, the AGIOS thread waited with %d groups in the ring, each of the %d requests was given once, and %d waiting workers got -1 when AGIOS was stopped\n", AGG_NB, RING_SIZE, MAX_REQNB, WORKER_NB);
+	return 0;
+}
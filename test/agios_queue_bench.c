@@ -0,0 +1,112 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_common.h"
+
+/* Measures the cost of the scheduling algorithms that go through whole queues (MLF and aIOLi, which look at every request of a queue when trying to select one, SW, which goes through the timeline to insert each new request, and TO-agg, which goes through it looking for a request to which the new one can be aggregated) as queues get longer.
+ * For each queue depth, <depth> requests are added to each one of <files> files (with gaps between them, so they are not aggregated) while AGIOS is started in pull mode with a tiny ring, so the AGIOS thread cannot schedule them before they are all there. Then the main thread takes requests with agios_next_requests (and releases them) and measures how long it takes to get <window> requests. The remaining requests are discarded by agios_exit_ctx.
+ * Only the scheduling algorithm and the number of requests change between the runs.
+ */
+
+#define RING_SIZE 4 /**< pull_ring_size used in the configuration file */
+#define REQ_SIZE 65536 /**< the size of all requests (MLF and aIOLi only select a request after a few steps, when its quantum grows to this) */
+
+const char *g_algorithms[] = {"MLF", "aIOLi", "SW", "TO-agg"}; /**< the scheduling algorithms being measured */
+
+int64_t get_elapsed(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_nsec - start->tv_nsec) + ((end->tv_sec - start->tv_sec)*1000000000L);
+}
+/**
+ * runs the test for one scheduling algorithm and one queue depth, and prints the results.
+ * @param algorithm the scheduling algorithm.
+ * @param file_nb the number of files.
+ * @param depth the number of requests to each file.
+ * @param window how many requests are taken while time is measured.
+ * @return true or false for success.
+ */
+bool run(const char *algorithm, int32_t file_nb, int32_t depth, int32_t window)
+{
+	agios_ctx_t *ctx;
+	int32_t req_nb = file_nb*depth;
+	agios_request_handle_t *handles = malloc(sizeof(agios_request_handle_t)*req_nb);
+	int64_t reqs[16];
+	char file_id[64];
+	struct timespec start, end;
+	int64_t add_time, take_time;
+	int32_t taken = 0;
+	int32_t ret;
+
+	if (!handles) {
+		printf("Could not allocate memory\n");
+		return false;
+	}
+	ctx = start_test_pull_mode_ctx(algorithm, 1, "preallocated_requests = %d ;\npull_ring_size = %d ;\n", req_nb, RING_SIZE);
+	if (!ctx) return false;
+	if (window > req_nb) window = req_nb;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int32_t i = 0; i < req_nb; i++) { //one request to each file, then the next one to each file, and so on
+		sprintf(file_id, "file.%d", i % file_nb);
+		if (!agios_add_request_with_handle_ctx(ctx, file_id, RT_READ, 2L*REQ_SIZE*(i / file_nb), REQ_SIZE, i, 0, &handles[i])) {
+			printf("PANIC! Could not add request\n");
+			return false;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	add_time = get_elapsed(&start, &end);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (taken < window) {
+		ret = agios_next_requests_ctx(ctx, reqs, 16, -1);
+		if (ret <= 0) {
+			printf("PANIC! agios_next_requests_ctx failed\n");
+			return false;
+		}
+		for (int32_t i = 0; i < ret; i++) {
+			if (!agios_release_request_by_handle_ctx(ctx, handles[reqs[i]])) printf("PANIC! release request failed!\n");
+		}
+		taken += ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	take_time = get_elapsed(&start, &end);
+	agios_exit_ctx(ctx);
+	printf("%s\t%d\t%d\t%d\t%.2f\t%.2f\n", algorithm, file_nb, depth, taken, ((double) add_time) / req_nb, ((double) take_time) / taken);
+	free(handles);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int32_t window = 1000;
+	int32_t file_nb = 16;
+	int32_t default_depths[] = {64, 256, 1024, 4096};
+	int32_t *depths = default_depths;
+	int32_t depth_nb = 4;
+
+	if ((argc == 2) && (strcmp(argv[1], "-h") == 0)) {
+		printf("Usage: %s [number of requests taken while measuring] [number of files] [queue depths]...\n", argv[0]);
+		exit(-1);
+	}
+	if (argc > 1) window = atoi(argv[1]);
+	if (argc > 2) file_nb = atoi(argv[2]);
+	if (argc > 3) {
+		depth_nb = argc - 3;
+		depths = malloc(sizeof(int32_t)*depth_nb);
+		if (!depths) exit(-1);
+		for (int32_t i = 0; i < depth_nb; i++) depths[i] = atoi(argv[i+3]);
+	}
+	if ((window <= 0) || (file_nb <= 0)) {
+		printf("The number of requests and of files must be positive\n");
+		exit(-1);
+	}
+	printf("algorithm\tfiles\tqueue depth\trequests taken\tadd (ns/request)\ttake (ns/request)\n");
+	for (int32_t i = 0; i < depth_nb; i++) {
+		for (int32_t j = 0; j < 4; j++) {
+			if (!run(g_algorithms[j], file_nb, depths[i], window)) exit(-1);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agios.h"
+#include "agios_add_request.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "aIOLi.h"
+#include "mem_pool.h"
+#include "MLF.h"
+#include "mylist.h"
+#include "req_hashtable.h"
+#include "scheduling_algorithms.h"
+#include "waiting_common.h"
+
+/* Checks that MLF and aIOLi make the same decisions now that the sched_factor of the requests is only counted in their queues (see get_sched_factor in waiting_common.c) as when the sched_factor of every request in a queue was incremented at every step.
+ * Two copies of a file receive the same random requests (some of them contiguous or overlapping, so they are aggregated). At each step, the reference copy has the sched_factor of all its requests incremented as MLF and aIOLi used to do, and the request is selected from that (the queue's sched_epoch never changes, so the values stored in the requests are the current ones). The other copy is given to applyMLFonlist or aIOLi_select_from_list. The selected requests and the sched_factor of all requests are compared after each step.
+ * This program uses internal functions of AGIOS on its own data structures, AGIOS is not started.
+ */
+
+#define MAX_QUEUE_LEN 8 /**< new requests are only added while the queue is shorter than this */
+#define ADD_STEPS 16 /**< new requests are added during this number of steps, then none is added during the same number of steps, and so on */
+#define QUANTUM 4096 /**< mlf_quantum and aioli_quantum */
+#define BLOCK 4096 /**< requests have 1 to 4 blocks, and start at a multiple of this */
+#define FILE_BLOCKS 256 /**< the size of the file, in blocks */
+
+struct agios_ctx_t g_ctx; /**< a context with just what is used by the tested functions */
+struct io_scheduler_instance_t g_scheduler; /**< the scheduler of g_ctx, only max_aggreg_size is used */
+struct agios_list_head g_active; /**< the list of active files of the only line of the hashtable */
+_Atomic uint64_t g_active_lines; /**< the active_lines of g_ctx */
+struct file_t g_reference_file; /**< sched_factors are incremented for every request here */
+struct file_t g_file; /**< sched_factors are counted in the queue here */
+int64_t g_steps_with_selection = 0; /**< how many steps selected a request */
+
+/**
+ * the function used by MLF and aIOLi to increment the sched_factor of each request in a queue before sched_factors were counted in the queues.
+ * @param req the request.
+ * @return false if the value would no longer fit an int32_t (the result was undefined).
+ */
+bool reference_increment(struct request_t *req)
+{
+	if (req->sched_factor == 0) req->sched_factor = 1;
+	else if (req->sched_factor > (INT32_MAX >> 1)) return false;
+	else req->sched_factor = req->sched_factor << 1;
+	return true;
+}
+/**
+ * increments the sched_factor of all requests in a queue of the reference file.
+ * @param queue the queue.
+ * @return false if some sched_factor overflowed.
+ */
+bool reference_increment_all(struct queue_t *queue)
+{
+	struct request_t *req;
+
+	agios_list_for_each_entry (req, &queue->list, related) {
+		if (!reference_increment(req)) {
+			printf("PANIC! the sched_factor of a request would overflow in the reference, the requests wait too long in this test\n");
+			return false;
+		}
+	}
+	return true;
+}
+/**
+ * MLF's selection from a queue, as it was when every request was incremented.
+ * @param queue a queue of the reference file.
+ * @param selected receives the selected request or NULL.
+ * @return false if some sched_factor overflowed.
+ */
+bool reference_MLF(struct queue_t *queue, struct request_t **selected)
+{
+	struct request_t *req;
+
+	*selected = NULL;
+	if (!reference_increment_all(queue)) return false;
+	agios_list_for_each_entry (req, &queue->list, related) {
+		if ((((int64_t) req->sched_factor)*QUANTUM) >= req->len) {
+			*selected = req;
+			break;
+		}
+	}
+	return true;
+}
+/**
+ * aIOLi's selection from a queue, as it was when every request was incremented.
+ * @param queue a queue of the reference file.
+ * @param selected receives the selected request or NULL.
+ * @return false if some sched_factor overflowed.
+ */
+bool reference_aIOLi(struct queue_t *queue, struct request_t **selected)
+{
+	struct request_t *req = agios_list_entry(queue->list.next, struct request_t, related);
+
+	*selected = NULL;
+	if (!reference_increment_all(queue)) return false;
+	if (req->len <= ((int64_t) req->sched_factor)*QUANTUM) *selected = req;
+	return true;
+}
+/**
+ * adds a request to the read queue of a file.
+ * @param req_file the file.
+ * @param offset and len describe the request.
+ * @return true or false for success.
+ */
+bool add_request(struct file_t *req_file, int64_t offset, int64_t len)
+{
+	struct request_t *req = request_constructor(RT_READ, offset, len, 0, 0, 0);
+
+	if (!req) {
+		printf("PANIC! Could not allocate a request\n");
+		return false;
+	}
+	req->file_id = req_file->file_id;
+	req->globalinfo = &req_file->read_queue;
+	return hashtable_add_req(&g_ctx, req, 0, NULL);
+}
+/**
+ * removes a selected request from its file and frees it.
+ * @param req the request.
+ */
+void remove_request(struct request_t *req)
+{
+	hashtable_del_req(&g_ctx, req);
+	request_cleanup(req);
+}
+/**
+ * compares the queues of the two files.
+ * @return true if they have the same requests (possibly virtual) with the same sched_factors.
+ */
+bool same_queues(void)
+{
+	struct agios_list_head *reference_pos = g_reference_file.read_queue.list.next;
+	struct agios_list_head *pos = g_file.read_queue.list.next;
+	struct request_t *reference_req;
+	struct request_t *req;
+
+	while ((reference_pos != &g_reference_file.read_queue.list) && (pos != &g_file.read_queue.list)) {
+		reference_req = agios_list_entry(reference_pos, struct request_t, related);
+		req = agios_list_entry(pos, struct request_t, related);
+		if ((reference_req->offset != req->offset) || (reference_req->len != req->len) || (reference_req->reqnb != req->reqnb)) {
+			printf("PANIC! the queues have different requests\n");
+			return false;
+		}
+		if (reference_req->sched_factor != get_sched_factor(&g_file.read_queue, req)) {
+			printf("PANIC! request %ld %ld has sched_factor %d, it should be %d\n", req->offset, req->len, get_sched_factor(&g_file.read_queue, req), reference_req->sched_factor);
+			return false;
+		}
+		reference_pos = reference_pos->next;
+		pos = pos->next;
+	}
+	if ((reference_pos != &g_reference_file.read_queue.list) || (pos != &g_file.read_queue.list)) {
+		printf("PANIC! the queues have different lengths\n");
+		return false;
+	}
+	return true;
+}
+/**
+ * runs the test for one scheduling algorithm.
+ * @param use_MLF true for MLF, false for aIOLi.
+ * @param steps how many steps.
+ * @return true if the decisions were always the same.
+ */
+bool run(bool use_MLF, int32_t steps)
+{
+	struct request_t *reference_selected;
+	struct request_t *selected;
+	struct queue_t *selected_queue;
+	int64_t selected_timestamp;
+	int32_t queue_len = 0;
+	int32_t new_reqnb;
+	int64_t offset, len;
+
+	if ((!file_init(&g_reference_file, "reference", 0, 0)) || (!file_init(&g_file, "file", 0, 1))) {
+		printf("PANIC! Could not initialize files\n");
+		return false;
+	}
+	for (int32_t step = 0; step < steps; step++) {
+		//new requests (the same to both files), only in half of the steps, otherwise the requests at the end of the queue could wait long enough for the reference sched_factor to overflow
+		if ((step / ADD_STEPS) % 2 == 0) new_reqnb = rand() % 3;
+		else new_reqnb = 0;
+		for (int32_t i = 0; (i < new_reqnb) && (queue_len < MAX_QUEUE_LEN); i++) {
+			offset = (rand() % FILE_BLOCKS)*BLOCK;
+			len = (1 + (rand() % 4))*BLOCK;
+			if ((!add_request(&g_reference_file, offset, len)) || (!add_request(&g_file, offset, len))) return false;
+			queue_len++;
+		}
+		if (agios_list_empty(&g_file.read_queue.list)) continue;
+		//a step of the scheduling algorithm
+		if (use_MLF) {
+			if (!reference_MLF(&g_reference_file.read_queue, &reference_selected)) return false;
+			selected = applyMLFonlist(&g_ctx, &g_file.read_queue);
+		} else {
+			if (!reference_aIOLi(&g_reference_file.read_queue, &reference_selected)) return false;
+			selected = NULL;
+			if (aIOLi_select_from_list(&g_ctx, &g_file.read_queue, &selected_queue, &selected_timestamp)) selected = agios_list_entry(selected_queue->list.next, struct request_t, related);
+		}
+		if ((!reference_selected) != (!selected)) {
+			printf("PANIC! at step %d, a request was selected from only one of the files\n", step);
+			return false;
+		}
+		if (!same_queues()) {
+			printf("at step %d\n", step);
+			return false;
+		}
+		if (selected) {
+			if ((reference_selected->offset != selected->offset) || (reference_selected->len != selected->len)) {
+				printf("PANIC! at step %d, different requests were selected\n", step);
+				return false;
+			}
+			remove_request(reference_selected);
+			remove_request(selected);
+			queue_len = 0;
+			agios_list_for_each_entry (selected, &g_file.read_queue.list, related) queue_len++;
+			g_steps_with_selection++;
+		}
+	}
+	list_of_requests_cleanup(&g_reference_file.read_queue.list);
+	list_of_requests_cleanup(&g_file.read_queue.list);
+	hashtable_update_active(&g_ctx, &g_reference_file);
+	hashtable_update_active(&g_ctx, &g_file);
+	free(g_reference_file.file_id);
+	free(g_file.file_id);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int32_t steps = 100000;
+	int32_t seed = 42;
+
+	if ((argc == 2) && (strcmp(argv[1], "-h") == 0)) {
+		printf("Usage: %s [number of steps] [random seed]\n", argv[0]);
+		exit(-1);
+	}
+	if (argc > 1) steps = atoi(argv[1]);
+	if (argc > 2) seed = atoi(argv[2]);
+	srand(seed);
+	if (!init_mem_pools(MAX_QUEUE_LEN*4)) {
+		printf("PANIC! Could not initialize memory pools\n");
+		exit(-1);
+	}
+	g_ctx.config.mlf_quantum = QUANTUM;
+	g_ctx.config.aioli_quantum = QUANTUM;
+	g_scheduler.max_aggreg_size = 4;
+	g_ctx.current_scheduler = &g_scheduler;
+	init_agios_list_head(&g_active);
+	g_ctx.hashlist_active = &g_active;
+	g_ctx.active_lines = &g_active_lines;
+	if (!run(true, steps)) exit(-1);
+	printf("MLF: same decisions in %d steps (%ld selected requests)\n", steps, g_steps_with_selection);
+	g_steps_with_selection = 0;
+	if (!run(false, steps)) exit(-1);
+	printf("aIOLi: same decisions in %d steps (%ld selected requests)\n", steps, g_steps_with_selection);
+	cleanup_mem_pools();
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_common.h"
+
+/* Compares SJF (which looks for the shortest queue among all files that have requests every time it selects a request) with SJF-heap (which keeps the queues in a heap).
+ * For each number of files, a request of a random size is added to each file while AGIOS is started in pull mode with a tiny ring, so the AGIOS thread cannot schedule them before they are all there. Then the main thread takes requests with agios_next_requests (and releases them) and measures how long it takes to get <window> requests, with all the other files still having requests. The remaining requests are discarded by agios_exit_ctx.
+ * Only the scheduling algorithm and the number of files change between the runs.
+ */
+
+#define RING_SIZE 4 /**< pull_ring_size used in the configuration file */
+
+const char *g_algorithms[] = {"SJF", "SJF-heap"}; /**< the scheduling algorithms being compared */
+
+int64_t get_elapsed(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_nsec - start->tv_nsec) + ((end->tv_sec - start->tv_sec)*1000000000L);
+}
+/**
+ * runs the test for one scheduling algorithm and one number of files, and prints the results.
+ * @param algorithm the scheduling algorithm.
+ * @param file_nb the number of files, each one with one request.
+ * @param window how many requests are taken while time is measured.
+ * @return true or false for success.
+ */
+bool run(const char *algorithm, int32_t file_nb, int32_t window)
+{
+	agios_ctx_t *ctx;
+	agios_request_handle_t *handles = malloc(sizeof(agios_request_handle_t)*file_nb);
+	int64_t reqs[RING_SIZE];
+	char file_id[64];
+	struct timespec start, end;
+	int64_t add_time, take_time;
+	int32_t taken = 0;
+	int32_t ret;
+	unsigned int seed = 42; //the same sizes for all algorithms
+
+	if (!handles) {
+		printf("Could not allocate memory\n");
+		return false;
+	}
+	ctx = start_test_pull_mode_ctx(algorithm, 1, "preallocated_requests = %d ;\nexpected_files = %d ;\npull_ring_size = %d ;\n", file_nb, file_nb, RING_SIZE);
+	if (!ctx) return false;
+	if (window > file_nb) window = file_nb;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int32_t i = 0; i < file_nb; i++) {
+		sprintf(file_id, "file.%d", i);
+		if (!agios_add_request_with_handle_ctx(ctx, file_id, RT_READ, 0, 4096*(1 + rand_r(&seed) % 256), i, 0, &handles[i])) {
+			printf("PANIC! Could not add request\n");
+			return false;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	add_time = get_elapsed(&start, &end);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (taken < window) {
+		ret = agios_next_requests_ctx(ctx, reqs, RING_SIZE, -1);
+		if (ret <= 0) {
+			printf("PANIC! agios_next_requests_ctx failed\n");
+			return false;
+		}
+		for (int32_t i = 0; i < ret; i++) {
+			if (!agios_release_request_by_handle_ctx(ctx, handles[reqs[i]])) printf("PANIC! release request failed!\n");
+		}
+		taken += ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	take_time = get_elapsed(&start, &end);
+	agios_exit_ctx(ctx);
+	printf("%s\t%d\t%d\t%.2f\t%.2f\n", algorithm, file_nb, taken, ((double) add_time) / file_nb, ((double) take_time) / taken);
+	free(handles);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int32_t window = 1000;
+	int32_t default_file_nbs[] = {100, 1000, 10000, 100000};
+	int32_t *file_nbs = default_file_nbs;
+	int32_t size_nb = 4;
+
+	if ((argc == 2) && (strcmp(argv[1], "-h") == 0)) {
+		printf("Usage: %s [number of requests taken while measuring] [numbers of files]...\n", argv[0]);
+		exit(-1);
+	}
+	if (argc > 1) window = atoi(argv[1]);
+	if (argc > 2) {
+		size_nb = argc - 2;
+		file_nbs = malloc(sizeof(int32_t)*size_nb);
+		if (!file_nbs) exit(-1);
+		for (int32_t i = 0; i < size_nb; i++) file_nbs[i] = atoi(argv[i+2]);
+	}
+	if (window <= 0) {
+		printf("The number of requests must be positive\n");
+		exit(-1);
+	}
+	printf("algorithm\tfiles\trequests taken\tadd (ns/request)\ttake (ns/request)\n");
+	for (int32_t i = 0; i < size_nb; i++) {
+		for (int32_t j = 0; j < 2; j++) {
+			if (!run(g_algorithms[j], file_nbs[i], window)) exit(-1);
+		}
+	}
+	return 0;
+}
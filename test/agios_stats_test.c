@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agios.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "common_functions.h"
+#include "statistics.h"
+
+/* Checks the global statistics kept separately for each line of the hashtable and merged by get_global_stats, against the ones calculated iteratively for every new request (as statistics.c used to do).
+ * Random requests (reads and writes of random sizes, to files in random lines) arrive with increasing arrival times, from a single thread. The merged counters must be equal to the reference ones. The merged averages are NOT the same values as the iterative ones: they must be the exact averages (total size / requests, and (last arrival - first arrival) / (requests - 1)), while the iterative averages were truncated by an integer division at every request, so they drift below them. We check the exact values, and that the iterative ones are within TOLERANCE of them, and print the largest difference.
+ * This program uses internal functions of AGIOS on its own data structures, AGIOS is not started.
+ */
+
+#define LINES 8 /**< the number of lines of the hashtable */
+#define FILES 32 /**< the number of files, each one in line (index % LINES) */
+#define REQNB 100000 /**< how many requests arrive */
+#define MAX_GAP 100000 /**< the time between consecutive arrivals (in ns) is up to this */
+#define TOLERANCE 0.01 /**< the iterative averages can be this far (relative) from the exact ones (they are always truncated, so they drift below them) */
+
+struct agios_ctx_t g_ctx; /**< a context with just what is used by the tested functions */
+struct file_t g_files[FILES]; /**< the files accessed by the requests */
+double g_max_difference = 0; /**< the largest relative difference between an iterative average and the merged one */
+
+/**
+ * the global statistics calculated as statistics.c used to do, updating iterative averages at every new request.
+ */
+struct reference_statistics_t {
+	int64_t total_reqnb;
+	int64_t reads;
+	int64_t writes;
+	int64_t avg_time_between_requests;
+	int64_t avg_request_size;
+	int64_t last_arrival;
+};
+
+/**
+ * updates the reference statistics with a new request.
+ */
+void reference_newreq(struct reference_statistics_t *stats, struct request_t *req)
+{
+	stats->total_reqnb++;
+	if (stats->total_reqnb > 1)
+		stats->avg_time_between_requests = update_iterative_average(stats->avg_time_between_requests, req->arrival_time - stats->last_arrival, stats->total_reqnb-1);
+	stats->last_arrival = req->arrival_time;
+	stats->avg_request_size = update_iterative_average(stats->avg_request_size, req->len, stats->total_reqnb);
+	if (req->type == RT_READ) stats->reads++;
+	else stats->writes++;
+}
+/**
+ * compares an iterative average with the exact one, and keeps the largest difference.
+ * @param name the name of the statistic, to be printed.
+ * @param iterative the iterative average.
+ * @param exact the exact average.
+ * @return true if they are close enough.
+ */
+bool close_enough(const char *name, int64_t iterative, int64_t exact)
+{
+	int64_t diff = iterative - exact;
+
+	if (diff < 0) diff = -diff;
+	if ((exact > 0) && (((double) diff) / exact > g_max_difference)) g_max_difference = ((double) diff) / exact;
+	if (diff > (exact*TOLERANCE) + 1) {
+		printf("FAIL: %s is %ld, the iterative average was %ld\n", name, exact, iterative);
+		return false;
+	}
+	return true;
+}
+/**
+ * generates the requests and checks the statistics after some of them.
+ * @return true if the merged statistics were always right.
+ */
+bool run(void)
+{
+	struct reference_statistics_t reference;
+	struct global_statistics_t stats;
+	struct request_t req;
+	int64_t total_size = 0;
+	int64_t first_arrival = 0;
+	int64_t arrival = 0;
+
+	memset(&reference, 0, sizeof(reference));
+	for (int32_t i = 0; i < REQNB; i++) {
+		struct file_t *file = &g_files[rand() % FILES];
+
+		memset(&req, 0, sizeof(req));
+		req.type = rand() % 2 ? RT_READ : RT_WRITE;
+		req.len = 1 + (rand() % (1024*1024));
+		req.offset = (int64_t) (rand() % 1024) * 4096;
+		arrival += rand() % MAX_GAP;
+		if (i == 0) first_arrival = arrival;
+		req.arrival_time = arrival;
+		req.globalinfo = req.type == RT_READ ? &file->read_queue : &file->write_queue;
+		total_size += req.len;
+		statistics_newreq(&g_ctx, &req);
+		reference_newreq(&reference, &req);
+		if ((i > 0) && (i % (REQNB / 10) != 0)) continue;
+		get_global_stats(&g_ctx, &stats);
+		if ((stats.total_reqnb != reference.total_reqnb) || (stats.reads != reference.reads) || (stats.writes != reference.writes)) {
+			printf("FAIL: after %d requests, got %ld requests (%ld reads, %ld writes), expected %ld (%ld, %ld)\n", i + 1, stats.total_reqnb, stats.reads, stats.writes, reference.total_reqnb, reference.reads, reference.writes);
+			return false;
+		}
+		if (stats.avg_request_size != total_size / (i + 1)) {
+			printf("FAIL: after %d requests, average request size is %ld, expected %ld\n", i + 1, stats.avg_request_size, total_size / (i + 1));
+			return false;
+		}
+		if (i == 0) {
+			if (stats.avg_time_between_requests != -1) {
+				printf("FAIL: after one request, average time between requests is %ld\n", stats.avg_time_between_requests);
+				return false;
+			}
+			continue;
+		}
+		if (stats.avg_time_between_requests != (arrival - first_arrival) / i) {
+			printf("FAIL: after %d requests, average time between requests is %ld, expected %ld\n", i + 1, stats.avg_time_between_requests, (arrival - first_arrival) / i);
+			return false;
+		}
+		if (!close_enough("average request size", reference.avg_request_size, stats.avg_request_size)) return false;
+		if (!close_enough("average time between requests", reference.avg_time_between_requests, stats.avg_time_between_requests)) return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	struct global_statistics_t stats;
+
+	srand(1234);
+	g_ctx.hashtable_size = LINES;
+	g_ctx.hashlist_stats = malloc(sizeof(struct line_statistics_t)*LINES);
+	if (!g_ctx.hashlist_stats) {
+		printf("Could not allocate memory\n");
+		return -1;
+	}
+	for (int32_t i = 0; i < FILES; i++) {
+		g_files[i].hash = i % LINES;
+		g_files[i].read_queue.req_file = &g_files[i];
+		g_files[i].write_queue.req_file = &g_files[i];
+	}
+	reset_global_stats(&g_ctx);
+	get_global_stats(&g_ctx, &stats);
+	if ((stats.total_reqnb != 0) || (stats.avg_request_size != -1) || (stats.avg_time_between_requests != -1)) {
+		printf("FAIL: statistics are not empty after reset_global_stats\n");
+		return -1;
+	}
+	if (!run()) return -1;
+	printf("PASSED: after %d requests, the merged counters are the same as the iterative ones and the merged averages are the exact ones (the iterative averages were up to %.4f%% away from them)\n", REQNB, g_max_difference*100);
+	free(g_ctx.hashlist_stats);
+	return 0;
+}
@@ -0,0 +1,226 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "agios.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "common_functions.h"
+#include "req_timeline.h"
+#include "SW.h"
+#include "test_common.h"
+
+/* Checks that SW, which finds the place of new requests with a calendar of time windows and queue_ids (see SW.c), keeps them in the same order as the linear insertion it replaced: going through the timeline and inserting the new request before the first one with a larger (window, queue_id), where the window is arrival_time / sw_size. The linear insertion packed them as window*32768 + queue_id, which misordered queue_ids of 32768 or more, so the reference here compares the pair instead.
+ * AGIOS is started with SW, then its thread is replaced by one that does nothing, so requests stay queued. Requests with random queue_ids (some of them larger than 32768) are added in bursts, waiting more than a window between bursts so they fall in several windows, and each one is also inserted linearly in a reference list. Some of them are then cancelled (from the timeline and from the reference). The timeline must be in the order of the reference, the calendar must describe the timeline, and the scheduling algorithm must give the requests to the callback in the same order.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define FILE_NB 16 /**< the number of files accessed by the requests */
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define BURSTS 6 /**< how many times requests are added */
+#define BURST 500 /**< how many requests are added each time */
+#define CANCEL_NB 300 /**< how many requests are cancelled at the end */
+#define SW_WINDOW 2 /**< the size of the windows of SW (in ms) */
+#define MAX_REQNB (BURSTS*BURST) /**< the number of requests */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+//the states of a request
+#define REQ_QUEUED 1 /**< it was added and not processed yet */
+#define REQ_CANCELLED 2 /**< it was cancelled */
+#define REQ_PROCESSED 3 /**< it was given to the callback */
+
+const int32_t g_queue_id_choices[] = {0, 1, 2, 3, 5, 8, 13, 40000, 40001}; /**< the queue_ids given to the requests (the larger ones were misordered when SW used window*32768 + queue_id as the priority of a request) */
+agios_ctx_t *g_ctx; /**< the AGIOS instance */
+agios_request_handle_t g_handles[MAX_REQNB]; /**< the handles of the requests */
+int32_t g_states[MAX_REQNB]; /**< the state of each request */
+int64_t g_expected[MAX_REQNB]; /**< the reference: the requests in the order given by the linear insertion */
+int32_t g_expectednb; /**< how many in g_expected */
+int32_t g_processednb; /**< how many were given to the callback */
+int32_t g_errors; /**< how many errors were found */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+/**
+ * called when a request is given to the callback. Requests must come in the order they were in the timeline.
+ * @param req_id the request.
+ */
+void request_processed(int64_t req_id)
+{
+	if (g_states[req_id] != REQ_QUEUED) report_error("request %ld was given to the callback in state %d", req_id, g_states[req_id]);
+	else if ((g_processednb >= g_expectednb) || (g_expected[g_processednb] != req_id)) report_error("request %ld was given to the callback in position %d, which had request %ld in the reference", req_id, g_processednb, g_processednb < g_expectednb ? g_expected[g_processednb] : -1);
+	g_states[req_id] = REQ_PROCESSED;
+	g_processednb++;
+}
+void * test_process(int64_t req_id)
+{
+	request_processed(req_id);
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) request_processed(reqs[i]);
+	return 0;
+}
+/**
+ * compares the places of two requests in the order of SW.
+ * @return true if a goes after b (its window is later, or it has the same window and a larger queue_id).
+ */
+bool sw_after(struct request_t *a, struct request_t *b)
+{
+	int64_t window_a = a->arrival_time / g_ctx->config.sw_size;
+	int64_t window_b = b->arrival_time / g_ctx->config.sw_size;
+
+	return (window_a > window_b) || ((window_a == window_b) && (a->queue_id > b->queue_id));
+}
+/**
+ * inserts a new request in the reference as SW did before the calendar: going from the first request until one that goes after the new one.
+ * @param req_id the new request.
+ */
+void reference_add(int32_t req_id)
+{
+	int32_t pos;
+
+	for (pos = 0; pos < g_expectednb; pos++) {
+		if (sw_after(g_handles[g_expected[pos]], g_handles[req_id])) break;
+	}
+	memmove(&g_expected[pos+1], &g_expected[pos], sizeof(int64_t)*(g_expectednb - pos));
+	g_expected[pos] = req_id;
+	g_expectednb++;
+}
+/**
+ * removes a cancelled request from the reference.
+ * @param req_id the request.
+ */
+void reference_del(int32_t req_id)
+{
+	for (int32_t pos = 0; pos < g_expectednb; pos++) {
+		if (g_expected[pos] != req_id) continue;
+		memmove(&g_expected[pos], &g_expected[pos+1], sizeof(int64_t)*(g_expectednb - pos - 1));
+		g_expectednb--;
+		return;
+	}
+}
+/**
+ * checks that the timeline has the requests of the reference, in the same order.
+ */
+void check_timeline(void)
+{
+	struct request_t *req;
+	int32_t pos = 0; /**< the place of req in the timeline */
+
+	agios_list_for_each_entry (req, &g_ctx->timeline_shards[0].list, related) {
+		if (g_states[req->user_id] != REQ_QUEUED) report_error("request %ld is in the timeline in state %d", req->user_id, g_states[req->user_id]);
+		if ((pos < g_expectednb) && (g_expected[pos] != req->user_id)) report_error("request %ld (window %ld, queue_id %d) is in position %d of the timeline, the linear insertion put request %ld there", req->user_id, req->arrival_time / g_ctx->config.sw_size, req->queue_id, pos, g_expected[pos]);
+		pos++;
+	}
+	if (pos != g_expectednb) report_error("there are %d requests in the timeline and %d in the reference", pos, g_expectednb);
+}
+/**
+ * checks that the calendar describes the timeline: its windows are ordered, the queue_ids of each window are ordered, and the requests from the first to the last of each queue_id, taken in the order of the calendar, are the whole timeline.
+ */
+void check_calendar(void)
+{
+	struct SW_window_t *window;
+	struct SW_queue_t *queue;
+	struct SW_window_t *prev_window = NULL;
+	struct SW_queue_t *prev_queue;
+	struct agios_list_head *pos = g_ctx->timeline_shards[0].list.next; /**< the next request of the timeline we expect */
+	struct request_t *req;
+	int32_t reqnb;
+
+	agios_list_for_each_entry (window, &g_ctx->SW_windows, list) {
+		if (prev_window && (prev_window->window >= window->window)) report_error("window %ld is after window %ld in the calendar", window->window, prev_window->window);
+		prev_window = window;
+		prev_queue = NULL;
+		agios_list_for_each_entry (queue, &window->queues, list) {
+			if (prev_queue && (prev_queue->queue_id >= queue->queue_id)) report_error("queue_id %d is after queue_id %d in window %ld of the calendar", queue->queue_id, prev_queue->queue_id, window->window);
+			prev_queue = queue;
+			if ((pos == &g_ctx->timeline_shards[0].list) || (agios_list_entry(pos, struct request_t, related) != queue->first)) {
+				report_error("the first request of queue_id %d in window %ld of the calendar is not the next one in the timeline", queue->queue_id, window->window);
+				return;
+			}
+			reqnb = 0;
+			do {
+				req = agios_list_entry(pos, struct request_t, related);
+				if (req->sw_queue != queue) report_error("request %ld is in the queue of queue_id %d of window %ld, but points to another one", req->user_id, queue->queue_id, window->window);
+				reqnb++;
+				pos = pos->next;
+			} while ((req != queue->last) && (pos != &g_ctx->timeline_shards[0].list));
+			if (req != queue->last) report_error("the last request of queue_id %d in window %ld of the calendar is not in the timeline", queue->queue_id, window->window);
+			if (reqnb != queue->reqnb) report_error("queue_id %d in window %ld of the calendar has %d requests in the timeline, but counts %d", queue->queue_id, window->window, reqnb, queue->reqnb);
+		}
+	}
+	if (pos != &g_ctx->timeline_shards[0].list) report_error("there are requests in the timeline after the last queue of the calendar");
+}
+
+int main(int argc, char **argv)
+{
+	char file_id[64];
+	unsigned int seed = 42; /**< used to choose the queue_ids and the requests to be cancelled */
+	struct timespec pause = {0, 3*SW_WINDOW*1000000L}; /**< between bursts, so the next one starts in another window */
+	int32_t reqnb = 0;
+	int32_t queued = 0;
+	int32_t windows = 0; /**< how many windows the requests fell in */
+	int64_t last_window = -1;
+	struct request_t *req;
+
+	g_ctx = start_test_ctx("SW", test_process, test_process_list, 0, "expected_files = %d ;\nSW_window = %d ;\nenable_SW = true ;\n", FILE_NB, SW_WINDOW);
+	if ((!g_ctx) || (!replace_agios_thread(g_ctx, NULL))) return -1;
+	if (g_ctx->current_alg != SW_SCHEDULER) {
+		printf("FAIL: AGIOS started with %s instead of SW\n", g_ctx->current_scheduler->name);
+		return -1;
+	}
+	//add the requests
+	for (int32_t burst = 0; burst < BURSTS; burst++) {
+		for (int32_t i = 0; i < BURST; i++, reqnb++) {
+			int32_t file = reqnb % FILE_NB;
+
+			sprintf(file_id, "file.%d", file);
+			if (!agios_add_request_with_handle_ctx(g_ctx, file_id, RT_READ, (reqnb / FILE_NB)*2*REQ_SIZE, REQ_SIZE, reqnb, g_queue_id_choices[rand_r(&seed) % (sizeof(g_queue_id_choices)/sizeof(g_queue_id_choices[0]))], &g_handles[reqnb])) {
+				report_error("agios_add_request_with_handle_ctx failed for request %d", reqnb);
+				g_states[reqnb] = REQ_CANCELLED;
+				continue;
+			}
+			g_states[reqnb] = REQ_QUEUED;
+			reference_add(reqnb);
+			queued++;
+		}
+		nanosleep(&pause, NULL);
+	}
+	//cancel some of them, from anywhere in the timeline
+	for (int32_t i = 0; i < CANCEL_NB; i++) {
+		int32_t req_id = rand_r(&seed) % reqnb;
+
+		if (g_states[req_id] != REQ_QUEUED) continue;
+		if (!agios_cancel_request_by_handle_ctx(g_ctx, g_handles[req_id])) report_error("could not cancel request %d", req_id);
+		g_states[req_id] = REQ_CANCELLED;
+		reference_del(req_id);
+		queued--;
+	}
+	if (g_expectednb != queued) report_error("%d requests are queued, but there are %d in the reference", queued, g_expectednb);
+	check_timeline();
+	check_calendar();
+	agios_list_for_each_entry (req, &g_ctx->timeline_shards[0].list, related) {
+		if (req->arrival_time / g_ctx->config.sw_size != last_window) windows++;
+		last_window = req->arrival_time / g_ctx->config.sw_size;
+	}
+	if (windows < 2) report_error("all requests fell in the same window, the test did not check the order between windows");
+	//SW must process them in the order of the reference
+	while (get_current_reqnb(g_ctx) > 0) g_ctx->current_scheduler->schedule(g_ctx);
+	if (g_processednb != g_expectednb) report_error("%d requests were given to the callback, %d were expected", g_processednb, g_expectednb);
+	for (int32_t i = 0; i < reqnb; i++) {
+		if ((g_states[i] == REQ_PROCESSED) && (!agios_release_request_by_handle_ctx(g_ctx, g_handles[i]))) report_error("could not release request %d", i);
+	}
+	agios_exit_ctx(g_ctx);
+	if (g_errors) return -1;
+	printf("PASSED: %d requests (%d cancelled) in %d windows were kept and processed in the order of the linear insertion\n", reqnb, reqnb - g_expectednb, windows);
+	return 0;
+}
@@ -0,0 +1,497 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agios.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "agios_thread.h"
+#include "common_functions.h"
+#include "data_structures.h"
+#include "performance.h"
+#include "req_timeline.h"
+#include "scheduling_algorithms.h"
+#include "statistics.h"
+#include "test_common.h"
+
+/* Checks the switches of scheduling algorithm (@see begin_scheduler_switch in data_structures.c) while other threads keep adding, cancelling and releasing requests.
+ * AGIOS is started as usual, then its thread is stopped and replaced by one of this program, which does what the AGIOS thread does (calls the scheduling algorithm and moves requests after a change of algorithm), and also begins and ends a switch every SWITCH_PERIOD ns. While a switch is in progress, it checks that no other thread holds the lock of a line of the hashtable or of a shard of the timeline, and goes through all data structures to check that every queued request is there exactly once, and that the number of requests in each line of the hashtable (hashlist_reqcounter) and in total (current_reqnb) agree with what was found.
+ * A switch may just begin and end (to check the handshake with the other threads), or change between two scheduling algorithms (calling change_selected_alg, as the AGIOS thread does). When they use different data structures, every other change the requests are also checked after each slice of the migration that follows (@see migrate_slice). The other changes are checked only once they are over (including the migration), and the longest time a thread waited because of them (switch_max_wait) is reported.
+ * Adding threads add requests with handles, cancelling threads cancel random requests that are queued, and releasing threads release the requests given to the callback. The state of each request is kept with atomic operations, so a request given to the callback twice, or after it was cancelled, is detected. At the end, every request must have been either cancelled or released.
+ * The arguments are the number of requests added by each adding thread (2000 by default) and the number of threads of each kind (4 by default). Each check goes through all requests of the run, and the number of checks grows with the duration of the run, so the time taken grows with the square of the number of requests: the defaults take about a second with one CPU.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define FILE_NB 64 /**< the number of files accessed by the requests */
+#define QUEUE_NB 4 /**< the number of queue ids given to the requests */
+#define REQ_SIZE 4096 /**< the size of all requests */
+#define SWITCH_PERIOD 200000L /**< a switch is started every this many ns */
+#define CANCEL_PAUSE 20000 /**< after each request it tries to cancel, a cancelling thread waits for this many ns */
+#define DRAIN_TIMEOUT 60 /**< after the last request is added, how long (in s) we wait for all of them to be cancelled or released */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+//the states of a request
+#define REQ_NEW 0 /**< it was not added yet */
+#define REQ_ADDING 1 /**< agios_add_request_with_handle_ctx was called */
+#define REQ_QUEUED 2 /**< it returned, and the request was not processed yet */
+#define REQ_CANCELLING 3 /**< a thread is trying to cancel it */
+#define REQ_CANCELLING_PROCESSED 4 /**< it was given to the callback while a thread was trying to cancel it */
+#define REQ_PROCESSED 5 /**< it was given to the callback, and it is waiting to be released */
+#define REQ_CANCELLED 6 /**< it was cancelled */
+#define REQ_RELEASED 7 /**< it was released */
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance of the current run */
+agios_request_handle_t *g_handles; /**< the handles of the requests */
+_Atomic int32_t *g_states; /**< the state of each request */
+int32_t g_reqnb_perthread; /**< number of requests added by each adding thread */
+int32_t g_thread_nb; /**< number of threads of each kind (adding, cancelling and releasing) */
+int32_t g_generated_reqnb; /**< the total number of requests of the current run */
+atomic_bool g_adding_done; /**< set when all adding threads are done */
+atomic_bool g_releasing_done; /**< set to stop the releasing threads */
+_Atomic int32_t g_errors; /**< how many errors were found in the current run */
+int64_t g_switchnb; /**< how many switches were made by our thread in the current run */
+int64_t g_checknb; /**< how many times the data structures were checked in the current run */
+int32_t g_algorithms[2]; /**< the scheduling algorithms used in the current run, the second one is -1 if the switches do not change it */
+bool g_checking_migration; /**< are the requests checked between slices of the current migration? */
+bool g_measuring; /**< is switch_max_wait going to be reported for the current change? */
+int64_t g_wait_max; /**< the largest switch_max_wait reported in the current run */
+int64_t g_wait_sum; /**< the sum of the ones reported */
+int32_t g_wait_nb; /**< how many */
+uint8_t *g_seen; /**< how many times each request was found in the data structures by check_requests */
+int32_t *g_line_reqnb; /**< how many requests check_requests found in each line of the hashtable */
+struct io_scheduler_instance_t g_switcher = {.name = "switch test", .is_dynamic = true}; /**< it takes the place of a dynamic scheduling algorithm, so the scheduling algorithms return to our thread when it is time for a switch (@see process_requests_step2) */
+
+int64_t *g_to_release; /**< the requests given to the callback, waiting to be released */
+int32_t g_to_release_nb; /**< how many */
+pthread_mutex_t g_to_release_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_to_release_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones of a run) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (atomic_fetch_add(&g_errors, 1) < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+/**
+ * gives a request to the releasing threads.
+ * @param req_id the request.
+ */
+void push_to_release(int64_t req_id)
+{
+	pthread_mutex_lock(&g_to_release_mutex);
+	g_to_release[g_to_release_nb++] = req_id;
+	pthread_cond_signal(&g_to_release_cond);
+	pthread_mutex_unlock(&g_to_release_mutex);
+}
+/**
+ * called for each request given to the callback, so it is released by one of the releasing threads (unless a thread is trying to cancel it, then that thread will do it).
+ * @param req_id the request.
+ */
+void request_processed(int64_t req_id)
+{
+	int32_t state = atomic_load(&g_states[req_id]);
+
+	while (true) {
+		if ((state == REQ_ADDING) || (state == REQ_QUEUED)) {
+			if (atomic_compare_exchange_weak(&g_states[req_id], &state, REQ_PROCESSED)) {
+				push_to_release(req_id);
+				return;
+			}
+		} else if (state == REQ_CANCELLING) {
+			if (atomic_compare_exchange_weak(&g_states[req_id], &state, REQ_CANCELLING_PROCESSED)) return;
+		} else {
+			report_error("request %ld was given to the callback in state %d", req_id, state);
+			return;
+		}
+	}
+}
+void * test_process(int64_t req_id)
+{
+	request_processed(req_id);
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) request_processed(reqs[i]);
+	return 0;
+}
+/**
+ * thread that adds its share of the requests. Consecutive requests to the same file are contiguous, so they may be aggregated.
+ */
+void *adding_thr(void *arg)
+{
+	int32_t index = *((int32_t *) arg);
+	char file_id[64];
+
+	for (int32_t i = 0; i < g_reqnb_perthread; i++) {
+		int64_t req_id = ((int64_t) index)*g_reqnb_perthread + i;
+		int32_t file = req_id % FILE_NB;
+		int32_t state = REQ_ADDING;
+
+		sprintf(file_id, "file.%d", file);
+		atomic_store(&g_states[req_id], REQ_ADDING);
+		if (!agios_add_request_with_handle_ctx(g_ctx, file_id, file % 2 ? RT_WRITE : RT_READ, (req_id / FILE_NB)*REQ_SIZE, REQ_SIZE, req_id, req_id % QUEUE_NB, &g_handles[req_id])) {
+			report_error("agios_add_request_with_handle_ctx failed for request %ld", req_id);
+			atomic_store(&g_states[req_id], REQ_CANCELLED); //so we do not wait for it
+			continue;
+		}
+		atomic_compare_exchange_strong(&g_states[req_id], &state, REQ_QUEUED); //it may have been processed already
+	}
+	return 0;
+}
+/**
+ * thread that cancels random requests that are queued, until all requests were added.
+ */
+void *cancelling_thr(void *arg)
+{
+	unsigned int seed = *((int32_t *) arg);
+	struct timespec pause = {0, CANCEL_PAUSE};
+
+	while (!atomic_load(&g_adding_done)) {
+		int64_t req_id = rand_r(&seed) % g_generated_reqnb;
+		int32_t state = REQ_QUEUED;
+
+		if (!atomic_compare_exchange_strong(&g_states[req_id], &state, REQ_CANCELLING)) continue;
+		if (agios_cancel_request_by_handle_ctx(g_ctx, g_handles[req_id])) {
+			state = REQ_CANCELLING;
+			if (!atomic_compare_exchange_strong(&g_states[req_id], &state, REQ_CANCELLED)) report_error("request %ld was cancelled, but it was also given to the callback", req_id);
+		} else { //it was processed before we could cancel it, so we release it once it is given to the callback (that happens after the scheduling algorithm releases its lock)
+			struct timespec start;
+
+			agios_gettime(&start);
+			while ((atomic_load(&g_states[req_id]) == REQ_CANCELLING) && (get_nanoelapsed(start) < DRAIN_TIMEOUT*1000000000L)) sched_yield();
+			state = REQ_CANCELLING_PROCESSED;
+			if (!atomic_compare_exchange_strong(&g_states[req_id], &state, REQ_PROCESSED)) report_error("request %ld could not be cancelled, but it was not given to the callback", req_id);
+			else push_to_release(req_id);
+		}
+		nanosleep(&pause, NULL); //so most requests are processed
+	}
+	return 0;
+}
+/**
+ * thread that releases the requests given to the callback.
+ */
+void *releasing_thr(void *arg)
+{
+	int64_t req_id;
+	int32_t state;
+
+	while (true) {
+		pthread_mutex_lock(&g_to_release_mutex);
+		while ((g_to_release_nb == 0) && (!atomic_load(&g_releasing_done))) pthread_cond_wait(&g_to_release_cond, &g_to_release_mutex);
+		if (g_to_release_nb == 0) {
+			pthread_mutex_unlock(&g_to_release_mutex);
+			return 0;
+		}
+		req_id = g_to_release[--g_to_release_nb];
+		pthread_mutex_unlock(&g_to_release_mutex);
+		state = REQ_PROCESSED;
+		if (!atomic_compare_exchange_strong(&g_states[req_id], &state, REQ_RELEASED)) report_error("request %ld was going to be released in state %d", req_id, state);
+		else if (!agios_release_request_by_handle_ctx(g_ctx, g_handles[req_id])) report_error("agios_release_request_by_handle_ctx failed for request %ld", req_id);
+	}
+}
+/**
+ * called while a switch is in progress to check that no other thread is using the data structures: all locks of the hashtable and of the timeline must be free, and all counters of readers must be zero.
+ * @param ctx the AGIOS instance.
+ */
+void check_no_lock_is_held(struct agios_ctx_t *ctx)
+{
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		if (pthread_mutex_trylock(&ctx->hashlist_locks[i]) != 0) report_error("the lock of line %d of the hashtable is held during a switch", i);
+		else pthread_mutex_unlock(&ctx->hashlist_locks[i]);
+	}
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) {
+		if (pthread_mutex_trylock(&ctx->timeline_shards[i].lock) != 0) report_error("the lock of shard %d of the timeline is held during a switch", i);
+		else pthread_mutex_unlock(&ctx->timeline_shards[i].lock);
+		if (atomic_load(&ctx->structure_readers[i].nb) != 0) report_error("%d threads are counted as readers of shard %d during a switch", atomic_load(&ctx->structure_readers[i].nb), i);
+	}
+}
+/**
+ * counts a request found in the data structures by check_requests.
+ * @param req the request (not a virtual one).
+ */
+void count_request(struct request_t *req)
+{
+	int32_t state = atomic_load(&g_states[req->user_id]);
+
+	g_line_reqnb[req->globalinfo->req_file->hash]++;
+	if (g_seen[req->user_id]++) report_error("request %ld is in the data structures more than once", req->user_id);
+	if ((state != REQ_ADDING) && (state != REQ_QUEUED) && (state != REQ_CANCELLING)) report_error("request %ld is in the data structures in state %d", req->user_id, state);
+}
+/**
+ * counts the requests of a queue of the hashtable, a shard of the timeline or a queue of the multi_timeline, including the ones inside virtual requests.
+ * @param list the requests.
+ */
+void count_list(struct agios_list_head *list)
+{
+	struct request_t *req;
+	struct request_t *aggregated;
+
+	int32_t partnb; /**< how many requests were found inside a virtual request */
+
+	agios_list_for_each_entry (req, list, related) {
+		if (req->reqnb > 1) {
+			partnb = 0;
+			agios_list_for_each_entry (aggregated, &req->reqs_list, related) {
+				if (aggregated->agg_head != req) report_error("request %ld is inside a virtual request, but its agg_head does not point to it", aggregated->user_id);
+				count_request(aggregated);
+				partnb++;
+			}
+			if (partnb != req->reqnb) report_error("a virtual request has %d requests inside, but its reqnb is %d", partnb, req->reqnb);
+		} else {
+			if (req->agg_head) report_error("request %ld is in the queues by itself, but its agg_head is set", req->user_id);
+			count_request(req);
+		}
+	}
+}
+/**
+ * called while a switch is in progress to check that every queued request is in the data structures (the hashtable, the timeline or the multi_timeline, during a migration some may be in each) exactly once, and that the counters of requests agree with them.
+ * @param ctx the AGIOS instance.
+ */
+void check_requests(struct agios_ctx_t *ctx)
+{
+	struct file_t *req_file;
+	int32_t total = 0;
+
+	memset(g_seen, 0, g_generated_reqnb);
+	memset(g_line_reqnb, 0, sizeof(int32_t)*ctx->hashtable_size);
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		agios_list_for_each_entry (req_file, &ctx->hashlist[i], hashlist) {
+			count_list(&req_file->read_queue.list);
+			count_list(&req_file->write_queue.list);
+		}
+	}
+	for (int32_t i = 0; i < ctx->timeline_shardnb; i++) count_list(&ctx->timeline_shards[i].list);
+	for (int32_t i = 0; i < ctx->multi_timeline_size; i++) count_list(&ctx->multi_timeline[i]);
+	for (int32_t i = 0; i < ctx->hashtable_size; i++) {
+		if (g_line_reqnb[i] != ctx->hashlist_reqcounter[i]) report_error("line %d of the hashtable has %d requests, but hashlist_reqcounter says %d", i, g_line_reqnb[i], ctx->hashlist_reqcounter[i]);
+		total += g_line_reqnb[i];
+	}
+	if (total != get_current_reqnb(ctx)) report_error("there are %d requests in the data structures, but current_reqnb is %d", total, get_current_reqnb(ctx));
+	for (int32_t i = 0; i < g_generated_reqnb; i++) { //a request being cancelled may have left already
+		if ((atomic_load(&g_states[i]) == REQ_QUEUED) && (!g_seen[i])) report_error("request %d was added, but it is not in the data structures", i);
+	}
+	g_checknb++;
+}
+/**
+ * checks the data structures while a switch is in progress.
+ * @param ctx the AGIOS instance.
+ */
+void check_switch(struct agios_ctx_t *ctx)
+{
+	if (!atomic_load(&ctx->switching_scheduler)) report_error("switching_scheduler is not set after begin_scheduler_switch");
+	check_no_lock_is_held(ctx);
+	check_requests(ctx);
+}
+/**
+ * makes a switch, changing the scheduling algorithm if two of them are being used, and checks the data structures while it is in progress.
+ * Threads wait while we check the requests, and that counts in switch_max_wait, so every other change the requests are checked only after it is over (@see switching_thr), and switch_max_wait is reported. For the other changes, they are checked during the switch and between the slices of the migration.
+ * @param ctx the AGIOS instance.
+ */
+void make_switch(struct agios_ctx_t *ctx)
+{
+	bool changing = (g_algorithms[1] >= 0); /**< are we changing the scheduling algorithm? */
+
+	g_measuring = changing && (g_switchnb % 2 == 1);
+	g_checking_migration = changing && (!g_measuring);
+	if (changing) change_selected_alg(ctx, (ctx->current_alg == g_algorithms[0]) ? g_algorithms[1] : g_algorithms[0]); //it begins the switch
+	else begin_scheduler_switch(ctx);
+	if (g_measuring) check_no_lock_is_held(ctx);
+	else check_switch(ctx);
+	if (changing) { //as the AGIOS thread does
+		performance_set_new_algorithm(ctx, ctx->current_alg);
+		reset_all_statistics(ctx);
+	}
+	end_scheduler_switch(ctx);
+	agios_gettime(&ctx->last_algorithm_update);
+	g_switchnb++;
+}
+/**
+ * called once a change of scheduling algorithm (and the migration after it) is over, to keep the longest time a thread waited because of it.
+ * @param ctx the AGIOS instance.
+ */
+void record_switch_wait(struct agios_ctx_t *ctx)
+{
+	int64_t wait = atomic_load(&ctx->switch_max_wait);
+
+	performance_set_switch_wait(ctx, wait);
+	if (wait > g_wait_max) g_wait_max = wait;
+	g_wait_sum += wait;
+	g_wait_nb++;
+}
+/**
+ * replaces the AGIOS thread: calls the scheduling algorithm while there are requests, and makes a switch every SWITCH_PERIOD ns, until agios_exit_ctx stops it.
+ * @param arg the AGIOS instance.
+ */
+void *switching_thr(void *arg)
+{
+	struct agios_ctx_t *ctx = arg;
+	struct timespec timeout = {0, 10000};
+	bool checking = false; /**< are the requests going to be checked in this iteration? */
+
+	ctx->dynamic_scheduler = &g_switcher; //the switches are made by this thread, every SWITCH_PERIOD ns
+	ctx->config.select_algorithm_period = SWITCH_PERIOD;
+	ctx->config.select_algorithm_min_reqnumber = 0;
+	agios_gettime(&ctx->last_algorithm_update);
+	while (!ctx->agios_thread_stop) {
+		if (atomic_load(&ctx->migrating)) {
+			migrate_slice(ctx);
+			checking = g_checking_migration;
+			//while migrating, the scheduling algorithm processes a request per slice, so the next change waits for SWITCH_PERIOD after the migration, otherwise requests could pile up
+			if (!atomic_load(&ctx->migrating)) agios_gettime(&ctx->last_algorithm_update);
+		} else if (g_measuring) { //the change is over
+			record_switch_wait(ctx);
+			g_measuring = false;
+			checking = true;
+		}
+		if (checking) {
+			begin_scheduler_switch(ctx);
+			check_switch(ctx);
+			end_scheduler_switch(ctx);
+			checking = false;
+			agios_gettime(&ctx->last_algorithm_update); //the time spent checking does not count
+		}
+		if (is_time_to_change_scheduler(ctx)) make_switch(ctx);
+		if ((get_current_reqnb(ctx) == 0) || (ctx->current_scheduler->schedule(ctx) > 0)) nanosleep(&timeout, NULL); //we do not wait for long, so switches keep happening
+	}
+	return 0;
+}
+/**
+ * starts AGIOS and replaces its thread by switching_thr.
+ * @param algorithm the first scheduling algorithm.
+ * @return true or false for success.
+ */
+bool start_agios(const char *algorithm)
+{
+	g_ctx = start_test_ctx(algorithm, test_process, test_process_list, QUEUE_NB, "expected_files = %d ;\n", FILE_NB);
+	return (g_ctx) && (replace_agios_thread(g_ctx, switching_thr));
+}
+/**
+ * waits until all requests were cancelled or released.
+ * @return the number of requests that were not.
+ */
+int32_t wait_for_all_requests(void)
+{
+	int32_t remaining = g_generated_reqnb;
+
+	for (int32_t t = 0; (t < DRAIN_TIMEOUT*1000) && (remaining > 0); t++) {
+		remaining = 0;
+		for (int32_t i = 0; i < g_generated_reqnb; i++) {
+			int32_t state = atomic_load(&g_states[i]);
+			if ((state != REQ_CANCELLED) && (state != REQ_RELEASED)) remaining++;
+		}
+		if (remaining > 0) usleep(1000);
+	}
+	return remaining;
+}
+/**
+ * runs the test for one scheduling algorithm, or for changes between two of them.
+ * @param algorithm the first scheduling algorithm.
+ * @param other_algorithm the other one, or NULL if the switches do not change the scheduling algorithm.
+ * @return true if no errors were found.
+ */
+bool run(const char *algorithm, const char *other_algorithm)
+{
+	pthread_t *threads = malloc(sizeof(pthread_t)*3*g_thread_nb);
+	int32_t *thread_index = malloc(sizeof(int32_t)*g_thread_nb);
+	int32_t lost;
+	int32_t cancelled = 0;
+
+	g_generated_reqnb = g_thread_nb*g_reqnb_perthread;
+	g_handles = malloc(sizeof(agios_request_handle_t)*g_generated_reqnb);
+	g_states = malloc(sizeof(_Atomic int32_t)*g_generated_reqnb);
+	g_to_release = malloc(sizeof(int64_t)*g_generated_reqnb);
+	g_seen = malloc(g_generated_reqnb);
+	if ((!threads) || (!thread_index) || (!g_handles) || (!g_states) || (!g_to_release) || (!g_seen)) {
+		printf("Could not allocate memory\n");
+		return false;
+	}
+	for (int32_t i = 0; i < g_generated_reqnb; i++) atomic_init(&g_states[i], REQ_NEW);
+	g_to_release_nb = 0;
+	g_switchnb = 0;
+	g_checknb = 0;
+	g_checking_migration = false;
+	g_measuring = false;
+	g_wait_max = 0;
+	g_wait_sum = 0;
+	g_wait_nb = 0;
+	g_algorithms[1] = -1;
+	if ((!get_algorithm_from_string(algorithm, &g_algorithms[0])) || ((other_algorithm) && (!get_algorithm_from_string(other_algorithm, &g_algorithms[1])))) {
+		printf("Unknown scheduling algorithm\n");
+		return false;
+	}
+	atomic_store(&g_errors, 0);
+	atomic_store(&g_adding_done, false);
+	atomic_store(&g_releasing_done, false);
+	if (!start_agios(algorithm)) return false;
+	g_line_reqnb = malloc(sizeof(int32_t)*g_ctx->hashtable_size);
+	if (!g_line_reqnb) {
+		printf("Could not allocate memory\n");
+		return false;
+	}
+	for (int32_t i = 0; i < g_thread_nb; i++) {
+		thread_index[i] = i;
+		if ((pthread_create(&threads[i], NULL, adding_thr, &thread_index[i]) != 0) ||
+		    (pthread_create(&threads[g_thread_nb + i], NULL, cancelling_thr, &thread_index[i]) != 0) ||
+		    (pthread_create(&threads[2*g_thread_nb + i], NULL, releasing_thr, &thread_index[i]) != 0)) {
+			printf("PANIC! Unable to create threads!\n");
+			return false;
+		}
+	}
+	for (int32_t i = 0; i < g_thread_nb; i++) pthread_join(threads[i], NULL);
+	atomic_store(&g_adding_done, true);
+	for (int32_t i = 0; i < g_thread_nb; i++) pthread_join(threads[g_thread_nb + i], NULL);
+	lost = wait_for_all_requests();
+	if (lost > 0) report_error("%d requests were neither cancelled nor released", lost);
+	pthread_mutex_lock(&g_to_release_mutex);
+	atomic_store(&g_releasing_done, true);
+	pthread_cond_broadcast(&g_to_release_cond);
+	pthread_mutex_unlock(&g_to_release_mutex);
+	for (int32_t i = 0; i < g_thread_nb; i++) pthread_join(threads[2*g_thread_nb + i], NULL);
+	agios_exit_ctx(g_ctx);
+	for (int32_t i = 0; i < g_generated_reqnb; i++) {
+		if (atomic_load(&g_states[i]) == REQ_CANCELLED) cancelled++;
+	}
+	printf("%s\t%s%s%s\t%d\t%d\t%ld\t%ld\t", atomic_load(&g_errors) ? "FAIL" : "PASSED", algorithm, other_algorithm ? "<->" : "", other_algorithm ? other_algorithm : "", g_generated_reqnb, cancelled, g_switchnb, g_checknb);
+	if (g_wait_nb > 0) printf("%.1f\t%.1f\n", g_wait_max / 1000.0, (g_wait_sum / g_wait_nb) / 1000.0);
+	else printf("-\t-\n");
+	free(g_handles);
+	free(g_states);
+	free(g_to_release);
+	free(g_seen);
+	free(g_line_reqnb);
+	free(threads);
+	free(thread_index);
+	return atomic_load(&g_errors) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *algorithms[][2] = {{"MLF", NULL}, {"SJF-heap", NULL}, {"TO-agg", NULL}, {"SW", NULL}, {"TWINS", NULL}, //only the handshake
+				{"MLF", "TO"}, {"SJF-heap", "TO-agg"}, {"SW", "MLF"}}; /**< the runs of the test: the algorithms used by the switches */
+	bool ret = true;
+
+	g_reqnb_perthread = 2000;
+	g_thread_nb = 4;
+	if ((argc == 2) && (strcmp(argv[1], "-h") == 0)) {
+		printf("Usage: %s [number of requests per adding thread] [number of threads of each kind]\n", argv[0]);
+		exit(-1);
+	}
+	if (argc > 1) g_reqnb_perthread = atoi(argv[1]);
+	if (argc > 2) g_thread_nb = atoi(argv[2]);
+	if ((g_reqnb_perthread <= 0) || (g_thread_nb <= 0)) {
+		printf("The number of requests and of threads must be positive\n");
+		exit(-1);
+	}
+	printf("result\talgorithms\trequests\tcancelled\tswitches\tchecks\tmax switch_max_wait (us)\taverage switch_max_wait (us)\n");
+	for (int32_t i = 0; i < sizeof(algorithms)/sizeof(algorithms[0]); i++) ret = run(algorithms[i][0], algorithms[i][1]) && ret;
+	return ret ? 0 : -1;
+}
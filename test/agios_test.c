@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <agios.h>
+#include <agios_ctx.h>
 #include <scheduling_algorithms.h>
 
 int32_t g_processed_reqnb=0; /**< the number of requests already processed and released rfom agios */
@@ -15,7 +16,6 @@ int32_t g_reqnb_perthread; /**< the number pf requests generated per thread */
 int32_t g_thread_nb; /**< number of thread */
 int32_t g_queue_ids; /**< number of possible ids provided with agios_add_request to identify different servers or applications to SW and TWINS */
 
-extern int32_t config_agios_default_algorithm;
 
 struct request_info_t {
 	char fileid[100];
@@ -320,7 +320,7 @@ int main (int argc, char **argv)
 	elapsed = ((end_time.tv_nsec - start_time.tv_nsec) + ((end_time.tv_sec - start_time.tv_sec)*1000000000L));
 	printf("It took %ldns to generate and schedule %d requests. The thoughput was of %f requests/s\n", elapsed, g_generated_reqnb, ((double) (g_generated_reqnb) / (double) elapsed)*1000000000L);	
 	//end agios, wait for the end of all threads, free stuff
-
+	int32_t used_algorithm = default_ctx->config.default_algorithm;
 
 	agios_exit();
 
@@ -331,7 +331,7 @@ int main (int argc, char **argv)
 
     // WFQ: gerenating a CSV file with the timestamps of the requests
     char buffer[1024];
-    sprintf(buffer, "output_%s_%d.csv", get_algorithm_name_from_index(config_agios_default_algorithm), (int)g_thread_nb);
+    sprintf(buffer, "output_%s_%d.csv", get_algorithm_name_from_index(used_algorithm), (int)g_thread_nb);
     FILE * output = fopen(buffer, "w");
     // us argv[1]
     fprintf(output, "request_id,queue_id,start_time,end_time,elapsed\n");
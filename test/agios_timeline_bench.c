@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_common.h"
+
+/* Measures how adding and releasing requests scales with the number of submitting threads when the timeline is used (by TO, TO-agg and NOOP), with the timeline in a single shard (a single lock) and split in many shards.
+ * For each number of threads, each thread adds <requests per thread> requests to its own files (with agios_add_request_with_handle_ctx), and they are released by the callback (with agios_release_request_by_handle_ctx). The time is measured from the moment all threads start until all requests were released.
+ * Only the scheduling algorithm, the number of shards and the number of files change between the runs.
+ */
+
+#define FILES_PER_THREAD 4 /**< how many files are accessed by each submitting thread */
+#define REQ_SIZE 4096 /**< the size of all requests */
+
+const char *g_algorithms[] = {"TO", "TO-agg", "NOOP"}; /**< the scheduling algorithms being measured */
+int32_t g_shards[] = {1, 16}; /**< the values of timeline_shards being compared */
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance of the current run */
+agios_request_handle_t *g_handles; /**< the handles of the requests, used to release them */
+int32_t g_reqnb_perthread; /**< number of requests generated by each thread */
+int32_t g_generated_reqnb; /**< the total number of requests of the current run */
+int32_t g_processed_reqnb; /**< the number of requests already released in the current run */
+pthread_mutex_t g_processed_reqnb_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_processed_reqnb_cond=PTHREAD_COND_INITIALIZER;
+pthread_barrier_t g_start;
+
+int64_t get_elapsed(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_nsec - start->tv_nsec) + ((end->tv_sec - start->tv_sec)*1000000000L);
+}
+void inc_processed_reqnb(int32_t value)
+{
+	pthread_mutex_lock(&g_processed_reqnb_mutex);
+	g_processed_reqnb += value;
+	if (g_processed_reqnb >= g_generated_reqnb) pthread_cond_signal(&g_processed_reqnb_cond);
+	pthread_mutex_unlock(&g_processed_reqnb_mutex);
+}
+void * bench_process(int64_t req_id)
+{
+	if (!agios_release_request_by_handle_ctx(g_ctx, g_handles[req_id])) printf("PANIC! release request failed!\n");
+	inc_processed_reqnb(1);
+	return 0;
+}
+void * bench_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) {
+		if (!agios_release_request_by_handle_ctx(g_ctx, g_handles[reqs[i]])) printf("PANIC! release request failed!\n");
+	}
+	inc_processed_reqnb(reqnb);
+	return 0;
+}
+/**
+ * thread that submits its share of the requests to AGIOS, going round robin over its files.
+ */
+void *bench_thr(void *arg)
+{
+	int32_t index = *((int32_t *) arg);
+	char file_id[64];
+
+	pthread_barrier_wait(&g_start);
+	for (int32_t i = 0; i < g_reqnb_perthread; i++) {
+		int32_t req_id = index*g_reqnb_perthread + i;
+		sprintf(file_id, "file.%d.%d", index, i % FILES_PER_THREAD);
+		if (!agios_add_request_with_handle_ctx(g_ctx, file_id, RT_READ, 2L*REQ_SIZE*(i / FILES_PER_THREAD), REQ_SIZE, req_id, 0, &g_handles[req_id]))
+			printf("PANIC! agios_add_request_with_handle_ctx failed!\n");
+	}
+	return 0;
+}
+/**
+ * runs the test for one scheduling algorithm, number of shards and number of threads, and prints the results.
+ * @param algorithm the scheduling algorithm.
+ * @param shards the number of shards of the timeline.
+ * @param thread_nb the number of submitting threads.
+ * @return true or false for success.
+ */
+bool run(const char *algorithm, int32_t shards, int32_t thread_nb)
+{
+	pthread_t *threads = malloc(sizeof(pthread_t)*thread_nb);
+	int32_t *thread_index = malloc(sizeof(int32_t)*thread_nb);
+	struct timespec start, end;
+	int64_t elapsed;
+
+	g_generated_reqnb = thread_nb*g_reqnb_perthread;
+	g_processed_reqnb = 0;
+	g_handles = malloc(sizeof(agios_request_handle_t)*g_generated_reqnb);
+	if ((!threads) || (!thread_index) || (!g_handles)) {
+		printf("Could not allocate memory\n");
+		return false;
+	}
+	g_ctx = start_test_ctx(algorithm, bench_process, bench_process_list, 1, "expected_files = %d ;\ntimeline_shards = %d ;\n", thread_nb*FILES_PER_THREAD, shards);
+	if (!g_ctx) return false;
+	pthread_barrier_init(&g_start, NULL, thread_nb + 1);
+	for (int32_t i = 0; i < thread_nb; i++) {
+		thread_index[i] = i;
+		if (pthread_create(&threads[i], NULL, bench_thr, &thread_index[i]) != 0) {
+			printf("PANIC! Unable to create thread %d!\n", i);
+			return false;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start); //before the barrier, otherwise the threads could be done before we get to run again
+	pthread_barrier_wait(&g_start);
+	for (int32_t i = 0; i < thread_nb; i++) pthread_join(threads[i], NULL);
+	pthread_mutex_lock(&g_processed_reqnb_mutex);
+	while (g_processed_reqnb < g_generated_reqnb) pthread_cond_wait(&g_processed_reqnb_cond, &g_processed_reqnb_mutex);
+	pthread_mutex_unlock(&g_processed_reqnb_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = get_elapsed(&start, &end);
+	agios_exit_ctx(g_ctx);
+	pthread_barrier_destroy(&g_start);
+	printf("%s\t%d\t%d\t%d\t%.2f\n", algorithm, shards, thread_nb, g_generated_reqnb, ((double) g_generated_reqnb) / (elapsed / 1000000000.0));
+	free(g_handles);
+	free(threads);
+	free(thread_index);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int32_t max_thread_nb = 64;
+
+	g_reqnb_perthread = 10000;
+	if ((argc == 2) && (strcmp(argv[1], "-h") == 0)) {
+		printf("Usage: %s [number of requests per thread] [maximum number of threads]\n", argv[0]);
+		exit(-1);
+	}
+	if (argc > 1) g_reqnb_perthread = atoi(argv[1]);
+	if (argc > 2) max_thread_nb = atoi(argv[2]);
+	if ((g_reqnb_perthread <= 0) || (max_thread_nb <= 0)) {
+		printf("The number of requests and of threads must be positive\n");
+		exit(-1);
+	}
+	printf("# %ld CPUs online, runs with more submitting threads than that cannot show how the shards scale\n", sysconf(_SC_NPROCESSORS_ONLN));
+	printf("algorithm\tshards\tthreads\trequests\tthroughput (requests/s)\n");
+	for (int32_t j = 0; j < 3; j++) {
+		for (int32_t thread_nb = 1; thread_nb <= max_thread_nb; thread_nb *= 2) {
+			for (int32_t k = 0; k < 2; k++) {
+				if (!run(g_algorithms[j], g_shards[k], thread_nb)) exit(-1);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,316 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agios.h"
+#include "agios_counters.h"
+#include "agios_ctx.h"
+#include "agios_request.h"
+#include "mylist.h"
+#include "req_timeline.h"
+#include "scheduling_algorithms.h"
+#include "test_common.h"
+
+/* Checks that TO-agg, which finds the request a new one is aggregated to with the index of its queue ordered by end offset (see find_aggregation_partner in req_timeline.c), makes the same decisions as when it went through the timeline: the new request is aggregated to the first request in the timeline to the same file, with the same type, that is contiguous to (or overlaps) it and has room for it, otherwise it goes to the end of the timeline.
+ * A reference copy of the timeline is kept by this program with that linear scan. AGIOS is started with TO-agg, then its thread is replaced by one that does nothing, so requests stay queued. In the first round, a virtual request loses its oldest request and a new request can then be aggregated to it or to a newer request (see cancelled_head_round). In each of the other rounds, random requests (often contiguous or overlapping) to a few files are added, then some of them are cancelled (also from inside virtual requests), and then all are processed and released. After each addition and each cancel, the timeline must have the same (virtual) requests as the reference, in the same order and with the same offset and len, and the requests must be given to the callback in the order of the reference (FIFO across files). This is done with a single shard of the timeline and with several.
+ * This program uses internal functions of AGIOS.
+ */
+
+#define FILE_NB 4 /**< the number of files accessed by the requests */
+#define BLOCK 4096 /**< requests have 1 to 4 blocks, and start at a multiple of this */
+#define FILE_BLOCKS 64 /**< the size of the files, in blocks */
+#define ROUNDS 50 /**< how many times requests are added, cancelled and processed */
+#define ROUND_REQNB 200 /**< how many requests are added in each round */
+#define ROUND_CANCELNB 40 /**< how many cancels are tried in each round */
+#define MAX_REQNB (ROUNDS*ROUND_REQNB) /**< the number of requests of a run */
+#define MAX_REPORTED_ERRORS 10 /**< we stop printing errors after this many */
+
+/**
+ * a (virtual) request in the reference timeline.
+ */
+struct reference_t {
+	int32_t file; /**< the file it accesses */
+	int32_t type; /**< RT_READ or RT_WRITE */
+	int64_t offset; /**< as the offset of the virtual request */
+	int64_t len; /**< as the len of the virtual request */
+	int32_t reqnb; /**< how many requests are in it */
+	int32_t reqs[MAX_AGGREG_SIZE]; /**< the requests, in the order of the list of the virtual request */
+};
+
+agios_ctx_t *g_ctx; /**< the AGIOS instance */
+agios_request_handle_t g_handles[MAX_REQNB]; /**< the handles of the requests */
+int64_t g_offsets[MAX_REQNB]; /**< the offset of each request */
+int64_t g_lens[MAX_REQNB]; /**< the len of each request */
+bool g_queued[MAX_REQNB]; /**< which requests are still queued */
+int32_t g_file_shards[FILE_NB]; /**< the shard of the timeline with the requests of each file */
+struct reference_t g_reference[ROUND_REQNB]; /**< the reference timeline */
+int32_t g_referencenb; /**< how many (virtual) requests in g_reference */
+int32_t g_processed[MAX_REQNB]; /**< the requests in the order they were given to the callback */
+int32_t g_processednb; /**< how many in g_processed */
+int64_t g_aggregated; /**< how many requests were aggregated to another one (to report the test was not trivial) */
+int32_t g_errors; /**< how many errors were found */
+
+/**
+ * prints an error (only the first MAX_REPORTED_ERRORS ones) and counts it.
+ */
+#define report_error(f, a...) do { \
+		if (g_errors++ < MAX_REPORTED_ERRORS) printf("FAIL: " f "\n", ## a); \
+	} while (0)
+
+void * test_process(int64_t req_id)
+{
+	if (g_processednb < MAX_REQNB) g_processed[g_processednb] = req_id;
+	g_processednb++;
+	return 0;
+}
+void * test_process_list(int64_t *reqs, int32_t reqnb)
+{
+	for (int32_t i = 0; i < reqnb; i++) test_process(reqs[i]);
+	return 0;
+}
+/**
+ * adds a new request to the reference as TO-agg did when it went through the timeline.
+ * @param req_id the new request.
+ * @param file the file it accesses.
+ * @param type RT_READ or RT_WRITE.
+ */
+void reference_add(int32_t req_id, int32_t file, int32_t type)
+{
+	int64_t offset = g_offsets[req_id];
+	int64_t len = g_lens[req_id];
+	struct reference_t *ref;
+
+	for (int32_t i = 0; i < g_referencenb; i++) {
+		ref = &g_reference[i];
+		if ((ref->file != file) || (ref->type != type) || (ref->reqnb >= g_ctx->current_scheduler->max_aggreg_size)) continue;
+		if (!(((offset <= ref->offset) && (offset + len >= ref->offset)) || ((ref->offset <= offset) && (ref->offset + ref->len >= offset)))) continue;
+		//aggregate it, as include_in_aggregation does
+		if (offset <= ref->offset) {
+			memmove(&ref->reqs[1], &ref->reqs[0], sizeof(int32_t)*ref->reqnb);
+			ref->reqs[0] = req_id;
+			ref->len += ref->offset - offset;
+			ref->offset = offset;
+		} else {
+			ref->reqs[ref->reqnb] = req_id;
+			ref->len = ref->len + ((offset + len) - (ref->offset + ref->len));
+		}
+		ref->reqnb++;
+		g_aggregated++;
+		return;
+	}
+	ref = &g_reference[g_referencenb++];
+	ref->file = file;
+	ref->type = type;
+	ref->offset = offset;
+	ref->len = len;
+	ref->reqnb = 1;
+	ref->reqs[0] = req_id;
+}
+/**
+ * removes a cancelled request from the reference, as cancel_from_virtual_request does if it is in a virtual request.
+ * @param req_id the request.
+ */
+void reference_cancel(int32_t req_id)
+{
+	struct reference_t *ref;
+
+	for (int32_t i = 0; i < g_referencenb; i++) {
+		ref = &g_reference[i];
+		for (int32_t j = 0; j < ref->reqnb; j++) {
+			if (ref->reqs[j] != req_id) continue;
+			if (ref->reqnb == 1) {
+				memmove(&g_reference[i], &g_reference[i+1], sizeof(struct reference_t)*(g_referencenb - i - 1));
+				g_referencenb--;
+				return;
+			}
+			memmove(&ref->reqs[j], &ref->reqs[j+1], sizeof(int32_t)*(ref->reqnb - j - 1));
+			ref->reqnb--;
+			ref->offset = g_offsets[ref->reqs[0]];
+			ref->len = g_lens[ref->reqs[0]];
+			for (int32_t k = 1; k < ref->reqnb; k++) {
+				if (g_offsets[ref->reqs[k]] < ref->offset) {
+					ref->len += ref->offset - g_offsets[ref->reqs[k]];
+					ref->offset = g_offsets[ref->reqs[k]];
+				}
+				if ((g_offsets[ref->reqs[k]] + g_lens[ref->reqs[k]]) > (ref->offset + ref->len)) ref->len += (g_offsets[ref->reqs[k]] + g_lens[ref->reqs[k]]) - (ref->offset + ref->len);
+			}
+			return;
+		}
+	}
+}
+/**
+ * checks that each shard of the timeline has the (virtual) requests of the reference to its files, in the same order.
+ * @param when describes the moment of the check, for the messages.
+ */
+void check_timeline(const char *when)
+{
+	struct request_t *req;
+	struct request_t *sub_req;
+	int32_t pos; /**< the next entry of the reference in this shard */
+	int32_t j;
+
+	for (int32_t shard = 0; shard < g_ctx->timeline_shardnb; shard++) {
+		pos = 0;
+		agios_list_for_each_entry (req, &g_ctx->timeline_shards[shard].list, related) {
+			while ((pos < g_referencenb) && (g_file_shards[g_reference[pos].file] != shard)) pos++;
+			if (pos >= g_referencenb) {
+				report_error("%s: request %ld is in shard %d of the timeline after all the requests of the reference", when, req->user_id, shard);
+				break;
+			}
+			if ((req->reqnb != g_reference[pos].reqnb) || (req->offset != g_reference[pos].offset) || (req->len != g_reference[pos].len)) report_error("%s: a request in shard %d of the timeline has %d requests, offset %ld and len %ld, the reference has %d, %ld and %ld", when, shard, req->reqnb, req->offset, req->len, g_reference[pos].reqnb, g_reference[pos].offset, g_reference[pos].len);
+			else if (req->reqnb == 1) {
+				if (req->user_id != g_reference[pos].reqs[0]) report_error("%s: request %ld is in shard %d of the timeline where the reference has request %d", when, req->user_id, shard, g_reference[pos].reqs[0]);
+			} else {
+				j = 0;
+				agios_list_for_each_entry (sub_req, &req->reqs_list, related) {
+					if (sub_req->user_id != g_reference[pos].reqs[j]) report_error("%s: request %ld is in position %d of a virtual request where the reference has request %d", when, sub_req->user_id, j, g_reference[pos].reqs[j]);
+					j++;
+				}
+			}
+			pos++;
+		}
+		while ((pos < g_referencenb) && (g_file_shards[g_reference[pos].file] != shard)) pos++;
+		if (pos < g_referencenb) report_error("%s: shard %d of the timeline has fewer requests than the reference", when, shard);
+	}
+}
+/**
+ * starts AGIOS with TO-agg and replaces its thread.
+ * @param shards the number of shards of the timeline.
+ * @return true or false for success.
+ */
+bool start_agios(int32_t shards)
+{
+	g_ctx = start_test_ctx("TO-agg", test_process, test_process_list, 0, "expected_files = %d ;\ntimeline_shards = %d ;\n", FILE_NB, shards);
+	if ((!g_ctx) || (!replace_agios_thread(g_ctx, NULL))) return false;
+	if (g_ctx->current_alg != TOAGG_SCHEDULER) {
+		printf("FAIL: AGIOS started with %s instead of TO-agg\n", g_ctx->current_scheduler->name);
+		return false;
+	}
+	return true;
+}
+/**
+ * adds a request to AGIOS and to the reference, and checks the timeline.
+ * @param req_id the new request.
+ * @param file the file it accesses.
+ * @param type RT_READ or RT_WRITE.
+ * @param offset its offset.
+ * @param len its len.
+ */
+void add_request(int32_t req_id, int32_t file, int32_t type, int64_t offset, int64_t len)
+{
+	char file_id[64];
+	char when[64];
+
+	g_offsets[req_id] = offset;
+	g_lens[req_id] = len;
+	sprintf(file_id, "file.%d", file);
+	if (!agios_add_request_with_handle_ctx(g_ctx, file_id, type, offset, len, req_id, 0, &g_handles[req_id])) {
+		report_error("agios_add_request_with_handle_ctx failed for request %d", req_id);
+		g_queued[req_id] = false;
+		return;
+	}
+	g_file_shards[file] = timeline_shard(g_ctx, ((struct request_t *)g_handles[req_id])->globalinfo->req_file->hash);
+	g_queued[req_id] = true;
+	reference_add(req_id, file, type);
+	sprintf(when, "after adding request %d", req_id);
+	check_timeline(when);
+}
+/**
+ * cancels a queued request in AGIOS and in the reference, and checks the timeline.
+ * @param req_id the request.
+ */
+void cancel_request(int32_t req_id)
+{
+	char when[64];
+
+	if (!agios_cancel_request_by_handle_ctx(g_ctx, g_handles[req_id])) report_error("could not cancel request %d", req_id);
+	g_queued[req_id] = false;
+	reference_cancel(req_id);
+	sprintf(when, "after cancelling request %d", req_id);
+	check_timeline(when);
+}
+/**
+ * processes all queued requests, checks they were given to the callback in the order of the reference, and releases them. The reference is emptied.
+ * @param round the round, for the messages.
+ * @param first the first request added in this round.
+ * @param last one after the last request added in this round.
+ */
+void process_requests(int32_t round, int32_t first, int32_t last)
+{
+	int32_t expected = 0; /**< the next place of the reference in g_processed */
+
+	g_processednb = 0;
+	while (get_current_reqnb(g_ctx) > 0) g_ctx->current_scheduler->schedule(g_ctx);
+	for (int32_t i = 0; i < g_referencenb; i++) {
+		for (int32_t j = 0; j < g_reference[i].reqnb; j++, expected++) {
+			if ((expected < g_processednb) && (g_processed[expected] != g_reference[i].reqs[j])) report_error("request %d was given to the callback in position %d of round %d, the reference has request %d there", g_processed[expected], expected, round, g_reference[i].reqs[j]);
+		}
+	}
+	if (expected != g_processednb) report_error("%d requests were given to the callback in round %d, the reference has %d", g_processednb, round, expected);
+	for (int32_t i = first; i < last; i++) {
+		if ((g_queued[i]) && (!agios_release_request_by_handle_ctx(g_ctx, g_handles[i]))) report_error("could not release request %d", i);
+	}
+	g_referencenb = 0;
+}
+/**
+ * first round: a virtual request loses its oldest request, so it is left with a newer one than the next request to the same file in the timeline, and a new request can be aggregated to both (it must go to the first in the timeline). Another file (in another shard, when there are many) has requests between them.
+ * @param reqnb the first free request identifier.
+ * @return one after the last request identifier used.
+ */
+int32_t cancelled_head_round(int32_t reqnb)
+{
+	int32_t first = reqnb;
+	int32_t other_file; /**< a file in another shard than file 0, if there is one */
+
+	for (other_file = 1; other_file < FILE_NB - 1; other_file++) {
+		add_request(reqnb++, other_file, RT_READ, 0, BLOCK);
+		if (g_file_shards[other_file] != g_file_shards[0]) break;
+	}
+	add_request(reqnb++, 0, RT_READ, 0, BLOCK); //A
+	add_request(reqnb++, 0, RT_READ, 8*BLOCK, BLOCK); //B, not contiguous to A
+	add_request(reqnb++, other_file, RT_READ, 16*BLOCK, BLOCK); //between B and the next ones
+	add_request(reqnb++, 0, RT_READ, BLOCK, BLOCK); //aggregated to A
+	cancel_request(reqnb - 4); //the oldest request of A
+	add_request(reqnb++, 0, RT_READ, 2*BLOCK, 6*BLOCK); //contiguous to A and to B
+	process_requests(0, first, reqnb);
+	return reqnb;
+}
+/**
+ * adds, cancels and processes requests for ROUNDS rounds, checking the timeline against the reference.
+ * @param shards the number of shards of the timeline.
+ * @return true if no error was found.
+ */
+bool run(int32_t shards)
+{
+	unsigned int seed = 42; /**< used to choose the requests and the ones to cancel */
+	int32_t reqnb = 0;
+	int32_t round_first; /**< the first request of the round */
+	int32_t req_id;
+
+	if (!start_agios(shards)) return false;
+	g_aggregated = 0;
+	reqnb = cancelled_head_round(reqnb);
+	for (int32_t round = 1; round < ROUNDS; round++) {
+		round_first = reqnb;
+		for (int32_t i = 0; i < ROUND_REQNB; i++, reqnb++) add_request(reqnb, rand_r(&seed) % FILE_NB, (rand_r(&seed) % 4 == 0) ? RT_WRITE : RT_READ, (rand_r(&seed) % FILE_BLOCKS)*BLOCK, (1 + rand_r(&seed) % 4)*BLOCK);
+		//cancel some of them, alone or from inside virtual requests
+		for (int32_t i = 0; i < ROUND_CANCELNB; i++) {
+			req_id = round_first + rand_r(&seed) % ROUND_REQNB;
+			if (g_queued[req_id]) cancel_request(req_id);
+		}
+		process_requests(round, round_first, reqnb);
+	}
+	agios_exit_ctx(g_ctx);
+	if (g_errors) return false;
+	printf("PASSED: with %d shards, %d requests (%ld of them aggregated to another one) were aggregated and processed as with the linear scan of the timeline\n", shards, reqnb, g_aggregated);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (!run(1)) return -1;
+	if (!run(16)) return -1;
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agios_ctx.h"
+#include "agios_thread.h"
+#include "test_common.h"
+
+/* @see test_common.h */
+
+void * noop_process(int64_t req_id)
+{
+	return 0;
+}
+void * noop_process_list(int64_t *reqs, int32_t reqnb)
+{
+	return 0;
+}
+/**
+ * replaces the AGIOS thread (@see replace_agios_thread), but does nothing until agios_exit_ctx stops it, so the program decides when requests are processed.
+ * @param arg the AGIOS instance.
+ */
+void *idle_agios_thread(void *arg)
+{
+	struct agios_ctx_t *ctx = arg;
+	struct timespec timeout = {0, 1000000};
+
+	while (!ctx->agios_thread_stop) nanosleep(&timeout, NULL);
+	return 0;
+}
+/**
+ * writes a configuration file for AGIOS.
+ * @param path the path of the file.
+ * @param algorithm the scheduling algorithm (also the starting one).
+ * @param options the other parameters, @see test_common.h.
+ * @param args the arguments of options.
+ * @return true or false for success.
+ */
+static bool write_test_config(const char *path, const char *algorithm, const char *options, va_list args)
+{
+	FILE *fd = fopen(path, "w");
+
+	if (!fd) {
+		printf("Could not create %s\n", path);
+		return false;
+	}
+	fprintf(fd, "library_options:\n{\n");
+	fprintf(fd, "default_algorithm = \"%s\" ;\n", algorithm);
+	fprintf(fd, "starting_algorithm = \"%s\" ;\n", algorithm);
+	vfprintf(fd, options, args);
+	fprintf(fd, "};\n");
+	fclose(fd);
+	return true;
+}
+/**
+ * starts an AGIOS instance with a configuration file written by write_test_config (in /tmp, and removed afterwards), and waits until its thread has selected the first scheduling algorithm.
+ * @param algorithm the scheduling algorithm.
+ * @param pull_mode if true, it is started with agios_init_pull_mode_ctx and the callbacks are ignored.
+ * @param process the callback for single requests (noop_process if NULL).
+ * @param process_list the callback for lists of requests (noop_process_list if NULL).
+ * @param max_queue_id the max_queue_id given to AGIOS.
+ * @param options the other parameters, @see test_common.h.
+ * @param args the arguments of options.
+ * @return the AGIOS instance, or NULL if it could not be started.
+ */
+static agios_ctx_t *start_ctx(const char *algorithm, bool pull_mode, void * process(int64_t req_id), void * process_list(int64_t *reqs, int32_t reqnb), int32_t max_queue_id, const char *options, va_list args)
+{
+	char config_path[64];
+	agios_ctx_t *ctx;
+
+	sprintf(config_path, "/tmp/agios_test.%d.conf", getpid());
+	if (!write_test_config(config_path, algorithm, options, args)) return NULL;
+	if (pull_mode) ctx = agios_init_pull_mode_ctx(config_path, max_queue_id);
+	else ctx = agios_init_ctx(process ? process : noop_process, process_list ? process_list : noop_process_list, config_path, max_queue_id);
+	unlink(config_path);
+	if (!ctx) {
+		printf("%s failed!\n", pull_mode ? "agios_init_pull_mode_ctx" : "agios_init_ctx");
+		return NULL;
+	}
+	while (atomic_load(&ctx->switching_scheduler)) usleep(1000); //the AGIOS thread selects the first scheduling algorithm
+	return ctx;
+}
+/**
+ * starts an AGIOS instance with callbacks, @see start_ctx.
+ */
+agios_ctx_t *start_test_ctx(const char *algorithm, void * process(int64_t req_id), void * process_list(int64_t *reqs, int32_t reqnb), int32_t max_queue_id, const char *options, ...)
+{
+	agios_ctx_t *ctx;
+	va_list args;
+
+	va_start(args, options);
+	ctx = start_ctx(algorithm, false, process, process_list, max_queue_id, options, args);
+	va_end(args);
+	return ctx;
+}
+/**
+ * starts an AGIOS instance in pull mode, @see start_ctx.
+ */
+agios_ctx_t *start_test_pull_mode_ctx(const char *algorithm, int32_t max_queue_id, const char *options, ...)
+{
+	agios_ctx_t *ctx;
+	va_list args;
+
+	va_start(args, options);
+	ctx = start_ctx(algorithm, true, NULL, NULL, max_queue_id, options, args);
+	va_end(args);
+	return ctx;
+}
+/**
+ * stops the AGIOS thread of an instance and runs another function in its place. agios_exit_ctx stops the new thread the same way (with ctx->agios_thread_stop).
+ * @param ctx the AGIOS instance.
+ * @param thread the function of the new thread (idle_agios_thread if NULL), it receives ctx.
+ * @return true or false for success.
+ */
+bool replace_agios_thread(agios_ctx_t *ctx, void *thread(void *arg))
+{
+	stop_the_agios_thread(ctx);
+	pthread_join(ctx->agios_thread, NULL);
+	ctx->agios_thread_stop = false;
+	if (pthread_create(&ctx->agios_thread, NULL, thread ? thread : idle_agios_thread, ctx) != 0) {
+		printf("PANIC! Unable to replace the AGIOS thread!\n");
+		return false;
+	}
+	return true;
+}
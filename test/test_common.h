@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "agios.h"
+
+/* Helpers shared by the tests and benchmarks: they write the configuration file, start an AGIOS instance with it and may replace its thread.
+ * The configuration file only has the parameters a program needs, the other ones keep their default values (@see set_default_config_parameters). Parameters are given as a printf format, one per line, for instance "expected_files = %d ;\n". Use "" for none.
+ */
+
+void *noop_process(int64_t req_id);
+void *noop_process_list(int64_t *reqs, int32_t reqnb);
+void *idle_agios_thread(void *arg);
+agios_ctx_t *start_test_ctx(const char *algorithm,
+			void * process(int64_t req_id),
+			void * process_list(int64_t *reqs, int32_t reqnb),
+			int32_t max_queue_id,
+			const char *options, ...) __attribute__((format(printf, 5, 6)));
+agios_ctx_t *start_test_pull_mode_ctx(const char *algorithm,
+			int32_t max_queue_id,
+			const char *options, ...) __attribute__((format(printf, 3, 4)));
+bool replace_agios_thread(agios_ctx_t *ctx, void *thread(void *arg));